@@ -0,0 +1,1817 @@
+/***************************************************************************
+ * Copyright (c) 2008-2009 University of Guelph.
+ *                         All rights reserved.
+ *
+ * This file is part of the Pilot software package.  For license
+ * information, see the LICENSE file in the top level directory of the
+ * Pilot source distribution.
+ **************************************************************************/
+
+/*!
+********************************************************************************
+\file mpi.c
+\brief Implementation of the single-node stand-in for MPI (see mpi.h)
+
+Before forking, MPI_Init maps one shared anonymous arena, so every address in
+it is the same in all the processes.  The arena holds a header with the one
+process-shared mutex that guards everything in it, a mailbox per rank, and a
+heap of power-of-two blocks for messages and windows.
+
+A send packs the data into a message block and appends it to the destination
+rank's mailbox, then wakes the rank.  Receives are matched within each process:
+a receive first looks through the messages already in its mailbox, oldest
+first, and otherwise is posted; each new message is offered to the posted
+receives in the order they were posted, and if none wants it, it stays in the
+mailbox.  This gives MPI's non-overtaking order.
+
+Collectives are made of the same messages, sent on a communicator's second
+context so they never match user receives.
+*******************************************************************************/
+
+#define _GNU_SOURCE
+#include "mpi.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#define NOMPI_ARENA	( (size_t)1 << 31 )	// virtual size of the arena
+#define NOMPI_ALIGN	64			// arena blocks start on cache lines
+#define NOMPI_CLASSES	48			// block sizes 2^0..2^47
+#define NOMPI_USEROP	100			// first MPI_Op id from MPI_Op_create
+
+/* tags used by collectives on a communicator's collective context */
+enum { TAG_BARRIER = 1, TAG_BCAST, TAG_GATHER, TAG_SCATTER, TAG_REDUCE,
+       TAG_SPLIT, TAG_CONTEXT, TAG_GROUP };
+
+/*** arena ***/
+
+typedef struct Block {
+    int cls;			// size is 1 << cls
+    struct Block *next;		// when on a free list
+} Block;
+
+typedef struct Message {
+    struct Message *prev, *next;
+    int context, source, tag;	// source is the sender's rank in the comm.
+    long len;			// packed bytes in data
+    char data[];
+} Message;
+
+typedef struct {
+    pthread_cond_t cond;	// signalled when a message arrives
+    Message *head, *tail;	// FIFO of messages not yet received
+    Message *scan;		// first message not yet offered to posted receives
+    pid_t pid;
+} Mailbox;
+
+typedef struct {
+    pthread_mutex_t lock;	// guards all of the arena
+    int size;			// no. of ranks
+    int next_context;		// next free communicator context (even)
+    volatile int abort_code;
+    char *top, *end;		// unallocated part of the heap
+    Block *free[NOMPI_CLASSES];
+    Mailbox box[];
+} Arena;
+
+/*** handles ***/
+
+enum { KIND_BUILTIN, KIND_PACKED, KIND_STRUCT };
+
+struct nompi_type {
+    int kind;
+    MPI_Aint size;		// bytes one element packs to
+    MPI_Aint lb, extent;
+    int (*op)( MPI_Op op, void *in, void *inout, int n );	// builtins
+    int count;			// KIND_STRUCT: blocks
+    int *blocklens;
+    MPI_Aint *displs;
+    MPI_Datatype *types;
+};
+
+struct nompi_comm {
+    int context;		// point-to-point; context+1 is for collectives
+    int rank, size;
+    int *ranks;			// world rank of each member
+    int inter;
+    int remote_size;
+    int *remote_ranks;
+    MPI_Errhandler errhandler;
+};
+
+struct nompi_group {
+    int size;
+    int ranks[];		// world ranks
+};
+
+enum { REQ_SEND, REQ_RECV };
+
+struct nompi_request {
+    int kind;
+    int persistent, active, done;
+    void *buf;
+    int count;
+    MPI_Datatype type;
+    int peer;			// send: dest. world rank; recv: source in comm
+    int label;			// send: our rank in comm
+    int context, tag;
+    MPI_Status status;
+    struct nompi_request *prev, *next;	// posted receives
+};
+
+struct nompi_win {
+    MPI_Comm comm;
+    void *mine;
+    void **bases;		// segment of each rank in comm
+    MPI_Aint *sizes;
+};
+
+struct nompi_errhandler {
+    MPI_Comm_errhandler_function *fn;
+};
+
+/*** process state ***/
+
+static Arena *Shared;		// NULL until MPI_Init
+static int Rank;		// world rank
+static int Finalized;
+static struct nompi_request *PostedHead, *PostedTail;	// guarded by arena lock
+static MPI_User_function **UserOps;
+static int NumUserOps;
+static int TagUB = INT_MAX;
+
+struct nompi_comm nompi_comm_world, nompi_comm_self;
+
+#define LOCK	pthread_mutex_lock( &Shared->lock );
+#define UNLOCK	pthread_mutex_unlock( &Shared->lock );
+
+/*** built-in datatypes ***/
+
+#define INT_OP( name, ctype ) \
+static int Op_##name( MPI_Op op, void *in, void *inout, int n ) \
+{ \
+    ctype *a = in, *b = inout; \
+    int i; \
+    for ( i = 0; i < n; i++ ) { \
+        switch ( op ) { \
+        case MPI_MAX:  if ( a[i] > b[i] ) b[i] = a[i]; break; \
+        case MPI_MIN:  if ( a[i] < b[i] ) b[i] = a[i]; break; \
+        case MPI_SUM:  b[i] = a[i] + b[i]; break; \
+        case MPI_PROD: b[i] = a[i] * b[i]; break; \
+        case MPI_LAND: b[i] = a[i] && b[i]; break; \
+        case MPI_BAND: b[i] = a[i] & b[i]; break; \
+        case MPI_LOR:  b[i] = a[i] || b[i]; break; \
+        case MPI_BOR:  b[i] = a[i] | b[i]; break; \
+        case MPI_LXOR: b[i] = !a[i] != !b[i]; break; \
+        case MPI_BXOR: b[i] = a[i] ^ b[i]; break; \
+        default: return MPI_ERR_OP; \
+        } \
+    } \
+    return MPI_SUCCESS; \
+}
+
+#define FLOAT_OP( name, ctype ) \
+static int Op_##name( MPI_Op op, void *in, void *inout, int n ) \
+{ \
+    ctype *a = in, *b = inout; \
+    int i; \
+    for ( i = 0; i < n; i++ ) { \
+        switch ( op ) { \
+        case MPI_MAX:  if ( a[i] > b[i] ) b[i] = a[i]; break; \
+        case MPI_MIN:  if ( a[i] < b[i] ) b[i] = a[i]; break; \
+        case MPI_SUM:  b[i] = a[i] + b[i]; break; \
+        case MPI_PROD: b[i] = a[i] * b[i]; break; \
+        default: return MPI_ERR_OP; \
+        } \
+    } \
+    return MPI_SUCCESS; \
+}
+
+#define DEFINE_TYPE( name, ctype ) \
+struct nompi_type nompi_##name = \
+    { KIND_BUILTIN, sizeof( ctype ), 0, sizeof( ctype ), Op_##name };
+
+NOMPI_INT_TYPES( INT_OP )
+NOMPI_INT_TYPES( DEFINE_TYPE )
+NOMPI_FLOAT_TYPES( FLOAT_OP )
+NOMPI_FLOAT_TYPES( DEFINE_TYPE )
+INT_OP( MPI_BYTE, unsigned char )
+DEFINE_TYPE( MPI_BYTE, unsigned char )
+struct nompi_type nompi_MPI_PACKED = { KIND_PACKED, 1, 0, 1, NULL };
+
+/*** errors ***/
+
+static const char *ErrorText( int code )
+{
+    switch ( code ) {
+    case MPI_SUCCESS:		return "no error";
+    case MPI_ERR_BUFFER:	return "invalid buffer pointer";
+    case MPI_ERR_COUNT:		return "invalid count argument";
+    case MPI_ERR_TYPE:		return "invalid datatype";
+    case MPI_ERR_TAG:		return "invalid tag";
+    case MPI_ERR_COMM:		return "invalid communicator";
+    case MPI_ERR_RANK:		return "invalid rank";
+    case MPI_ERR_REQUEST:	return "invalid request";
+    case MPI_ERR_ROOT:		return "invalid root";
+    case MPI_ERR_GROUP:		return "invalid group";
+    case MPI_ERR_OP:		return "invalid reduce operation";
+    case MPI_ERR_ARG:		return "invalid argument";
+    case MPI_ERR_TRUNCATE:	return "message truncated";
+    case MPI_ERR_INTERN:	return "internal error";
+    case MPI_ERR_NO_MEM:	return "out of shared memory (nompi arena is full)";
+    default:			return "unknown error";
+    }
+}
+
+/* Reports an error through the communicator's handler, or aborts. */
+static int Error( MPI_Comm comm, int code )
+{
+    if ( comm == MPI_COMM_NULL ) comm = MPI_COMM_WORLD;
+    if ( comm->errhandler ) {
+        comm->errhandler->fn( &comm, &code );
+        return code;
+    }
+    fprintf( stderr, "nompi: rank %d: %s\n", Rank, ErrorText( code ) );
+    MPI_Abort( MPI_COMM_WORLD, code );
+    return code;
+}
+
+#define CHECK( comm, cond, code ) if ( !( cond ) ) return Error( comm, code );
+
+/*** shared heap ***/
+
+/* Allocates n bytes from the arena; the lock must be held. */
+static void *Alloc( size_t n )
+{
+    int cls = 6;
+    Block *b;
+
+    n += sizeof( Block );
+    while ( ( (size_t)1 << cls ) < n ) cls++;
+    if ( ( b = Shared->free[cls] ) != NULL )
+        Shared->free[cls] = b->next;
+    else {
+        size_t size = (size_t)1 << cls;
+        if ( (size_t)( Shared->end - Shared->top ) < size ) return NULL;
+        b = (Block *)Shared->top;
+        Shared->top += size;
+        b->cls = cls;
+    }
+    return b + 1;
+}
+
+/* Returns a block to its free list; the lock must be held. */
+static void Free( void *p )
+{
+    Block *b = (Block *)p - 1;
+
+    b->next = Shared->free[b->cls];
+    Shared->free[b->cls] = b;
+}
+
+/*** datatypes ***/
+
+static MPI_Aint PackedLen( int count, MPI_Datatype t )
+{
+    return count * t->size;
+}
+
+/* Copies count elements of type t at in to out, packed; returns the end. */
+static char *PackData( char *out, const char *in, int count, MPI_Datatype t )
+{
+    int e, i;
+
+    if ( t->kind != KIND_STRUCT ) {
+        if ( count > 0 ) memcpy( out, in, count * t->size );
+        return out + count * t->size;
+    }
+    for ( e = 0; e < count; e++, in += t->extent )
+        for ( i = 0; i < t->count; i++ )
+            out = PackData( out, (const char *)( (uintptr_t)in + t->displs[i] ),
+                            t->blocklens[i], t->types[i] );
+    return out;
+}
+
+/* Copies packed data at in to count elements of type t at out; returns the
+   end of what was used. */
+static const char *UnpackData( const char *in, char *out, int count,
+                               MPI_Datatype t )
+{
+    int e, i;
+
+    if ( t->kind != KIND_STRUCT ) {
+        if ( count > 0 ) memcpy( out, in, count * t->size );
+        return in + count * t->size;
+    }
+    for ( e = 0; e < count; e++, out += t->extent )
+        for ( i = 0; i < t->count; i++ )
+            in = UnpackData( in, (char *)( (uintptr_t)out + t->displs[i] ),
+                             t->blocklens[i], t->types[i] );
+    return in;
+}
+
+int MPI_Type_create_struct( int count, const int blocklengths[],
+                            const MPI_Aint displacements[],
+                            const MPI_Datatype types[], MPI_Datatype *newtype )
+{
+    int i;
+    MPI_Aint lo = 0, hi = 0;
+    MPI_Datatype t = calloc( 1, sizeof( struct nompi_type ) );
+
+    CHECK( NULL, count >= 0, MPI_ERR_COUNT )
+    CHECK( NULL, t, MPI_ERR_NO_MEM )
+    t->kind = KIND_STRUCT;
+    t->count = count;
+    t->blocklens = malloc( ( count + 1 ) * sizeof( int ) );
+    t->displs = malloc( ( count + 1 ) * sizeof( MPI_Aint ) );
+    t->types = malloc( ( count + 1 ) * sizeof( MPI_Datatype ) );
+    CHECK( NULL, t->blocklens && t->displs && t->types, MPI_ERR_NO_MEM )
+
+    for ( i = 0; i < count; i++ ) {
+        MPI_Aint end = displacements[i] + types[i]->lb
+                       + blocklengths[i] * types[i]->extent;
+        t->blocklens[i] = blocklengths[i];
+        t->displs[i] = displacements[i];
+        t->types[i] = types[i];
+        t->size += PackedLen( blocklengths[i], types[i] );
+        if ( i == 0 || displacements[i] + types[i]->lb < lo )
+            lo = displacements[i] + types[i]->lb;
+        if ( i == 0 || end > hi ) hi = end;
+    }
+    t->lb = lo;
+    t->extent = hi - lo;
+    *newtype = t;
+    return MPI_SUCCESS;
+}
+
+int MPI_Type_commit( MPI_Datatype *datatype )
+{
+    return MPI_SUCCESS;
+}
+
+int MPI_Type_free( MPI_Datatype *datatype )
+{
+    MPI_Datatype t = *datatype;
+
+    if ( t && t->kind == KIND_STRUCT ) {
+        free( t->blocklens );
+        free( t->displs );
+        free( t->types );
+        free( t );
+    }
+    *datatype = MPI_DATATYPE_NULL;
+    return MPI_SUCCESS;
+}
+
+int MPI_Type_get_extent( MPI_Datatype datatype, MPI_Aint *lb, MPI_Aint *extent )
+{
+    *lb = datatype->lb;
+    *extent = datatype->extent;
+    return MPI_SUCCESS;
+}
+
+int MPI_Type_size( MPI_Datatype datatype, int *size )
+{
+    *size = datatype->size;
+    return MPI_SUCCESS;
+}
+
+int MPI_Get_address( const void *location, MPI_Aint *address )
+{
+    *address = (MPI_Aint)(uintptr_t)location;
+    return MPI_SUCCESS;
+}
+
+int MPI_Get_count( const MPI_Status *status, MPI_Datatype datatype, int *count )
+{
+    if ( datatype->size == 0 )
+        *count = 0;
+    else if ( status->nompi_bytes % datatype->size )
+        *count = MPI_UNDEFINED;
+    else
+        *count = status->nompi_bytes / datatype->size;
+    return MPI_SUCCESS;
+}
+
+int MPI_Pack( const void *inbuf, int incount, MPI_Datatype datatype,
+              void *outbuf, int outsize, int *position, MPI_Comm comm )
+{
+    CHECK( comm, *position + PackedLen( incount, datatype ) <= outsize,
+           MPI_ERR_TRUNCATE )
+    *position = PackData( (char *)outbuf + *position, inbuf, incount, datatype )
+                - (char *)outbuf;
+    return MPI_SUCCESS;
+}
+
+int MPI_Unpack( const void *inbuf, int insize, int *position, void *outbuf,
+                int outcount, MPI_Datatype datatype, MPI_Comm comm )
+{
+    CHECK( comm, *position + PackedLen( outcount, datatype ) <= insize,
+           MPI_ERR_TRUNCATE )
+    *position = UnpackData( (const char *)inbuf + *position, outbuf, outcount,
+                            datatype ) - (const char *)inbuf;
+    return MPI_SUCCESS;
+}
+
+int MPI_Pack_size( int incount, MPI_Datatype datatype, MPI_Comm comm, int *size )
+{
+    *size = PackedLen( incount, datatype );
+    return MPI_SUCCESS;
+}
+
+/*** point-to-point ***/
+
+/* World rank of rank r of the group we send to in comm. */
+static int WorldRank( MPI_Comm comm, int r )
+{
+    return comm->inter ? comm->remote_ranks[r] : comm->ranks[r];
+}
+
+/* Sends count elements of type t to world rank dest, labelled with our rank
+   label in the communicator whose context this is. */
+static int Post( const void *buf, int count, MPI_Datatype t, int dest,
+                 int context, int label, int tag )
+{
+    MPI_Aint len = PackedLen( count, t );
+    Mailbox *box = &Shared->box[dest];
+    Message *m;
+
+    LOCK
+    m = Alloc( sizeof( Message ) + len );
+    UNLOCK
+    if ( m == NULL ) return MPI_ERR_NO_MEM;
+
+    m->context = context;
+    m->source = label;
+    m->tag = tag;
+    m->len = len;
+    m->next = NULL;
+    PackData( m->data, buf, count, t );
+
+    LOCK
+    m->prev = box->tail;
+    if ( box->tail ) box->tail->next = m;
+    else box->head = m;
+    box->tail = m;
+    if ( box->scan == NULL ) box->scan = m;
+    pthread_cond_broadcast( &box->cond );
+    UNLOCK
+    return MPI_SUCCESS;
+}
+
+static int Matches( int context, int source, int tag, const Message *m )
+{
+    return m->context == context
+           && ( source == MPI_ANY_SOURCE || source == m->source )
+           && ( tag == MPI_ANY_TAG || tag == m->tag );
+}
+
+static void Unlink( Mailbox *box, Message *m )
+{
+    if ( m->prev ) m->prev->next = m->next;
+    else box->head = m->next;
+    if ( m->next ) m->next->prev = m->prev;
+    else box->tail = m->prev;
+}
+
+static void Unpost( struct nompi_request *r )
+{
+    if ( r->prev ) r->prev->next = r->next;
+    else PostedHead = r->next;
+    if ( r->next ) r->next->prev = r->prev;
+    else PostedTail = r->prev;
+    r->prev = r->next = NULL;
+}
+
+/* Completes receive r with message m, which is then freed; lock held. */
+static void Deliver( struct nompi_request *r, Message *m )
+{
+    MPI_Aint room = PackedLen( r->count, r->type );
+    int count = r->count;
+
+    r->status.MPI_SOURCE = m->source;
+    r->status.MPI_TAG = m->tag;
+    r->status.MPI_ERROR = MPI_SUCCESS;
+    r->status.nompi_bytes = m->len;
+    if ( m->len > room ) {
+        r->status.MPI_ERROR = MPI_ERR_TRUNCATE;
+        r->status.nompi_bytes = room;
+    }
+    else if ( r->type->size > 0 )
+        count = m->len / r->type->size;
+    UnpackData( m->data, r->buf, count, r->type );
+    r->done = 1;
+    Unlink( &Shared->box[Rank], m );
+    Free( m );
+}
+
+/* Offers each message that arrived since last time to the posted receives;
+   lock held. */
+static void Progress( void )
+{
+    Mailbox *box = &Shared->box[Rank];
+    Message *m, *next;
+    struct nompi_request *r;
+    int delivered = 0;
+
+    for ( m = box->scan, box->scan = NULL; m; m = next ) {
+        next = m->next;
+        for ( r = PostedHead; r; r = r->next )
+            if ( Matches( r->context, r->peer, r->tag, m ) ) break;
+        if ( r ) {
+            Unpost( r );
+            Deliver( r, m );
+            delivered = 1;
+        }
+    }
+    if ( delivered )	// other threads of this process may be waiting
+        pthread_cond_broadcast( &box->cond );
+}
+
+/* Waits for something to arrive; lock held. */
+static void Sleep( void )
+{
+    pthread_cond_wait( &Shared->box[Rank].cond, &Shared->lock );
+}
+
+/* Starts receive r: takes the oldest matching message already here, or
+   posts r; lock held. */
+static void StartRecv( struct nompi_request *r )
+{
+    Message *m;
+
+    r->done = 0;
+    r->status.nompi_cancelled = 0;
+    if ( r->peer == MPI_PROC_NULL ) {
+        r->status.MPI_SOURCE = MPI_PROC_NULL;
+        r->status.MPI_TAG = MPI_ANY_TAG;
+        r->status.MPI_ERROR = MPI_SUCCESS;
+        r->status.nompi_bytes = 0;
+        r->done = 1;
+        return;
+    }
+    Progress();
+    for ( m = Shared->box[Rank].head; m; m = m->next )
+        if ( Matches( r->context, r->peer, r->tag, m ) ) {
+            Deliver( r, m );
+            return;
+        }
+    r->prev = PostedTail;
+    r->next = NULL;
+    if ( PostedTail ) PostedTail->next = r;
+    else PostedHead = r;
+    PostedTail = r;
+}
+
+/* Blocking receive in a given context, used by MPI_Recv and collectives. */
+static int Receive( void *buf, int count, MPI_Datatype t, int source,
+                    int context, int tag, MPI_Status *status )
+{
+    struct nompi_request r;
+
+    memset( &r, 0, sizeof( r ) );
+    r.kind = REQ_RECV;
+    r.buf = buf;
+    r.count = count;
+    r.type = t;
+    r.peer = source;
+    r.context = context;
+    r.tag = tag;
+
+    LOCK
+    StartRecv( &r );
+    while ( !r.done ) {
+        Sleep();
+        Progress();
+    }
+    UNLOCK
+    if ( status ) *status = r.status;
+    return r.status.MPI_ERROR;
+}
+
+static struct nompi_request *NewRequest( int kind, void *buf, int count,
+                                         MPI_Datatype t, int peer, int tag,
+                                         MPI_Comm comm )
+{
+    struct nompi_request *r = calloc( 1, sizeof( struct nompi_request ) );
+
+    if ( r == NULL ) return NULL;
+    r->kind = kind;
+    r->buf = buf;
+    r->count = count;
+    r->type = t;
+    r->tag = tag;
+    r->context = comm->context;
+    r->done = 1;	// inactive
+    if ( kind == REQ_SEND ) {
+        r->peer = peer == MPI_PROC_NULL ? peer : WorldRank( comm, peer );
+        r->label = comm->rank;
+    }
+    else
+        r->peer = peer;
+    return r;
+}
+
+/* Starts request r, which is inactive. */
+static int StartRequest( struct nompi_request *r )
+{
+    int err = MPI_SUCCESS;
+
+    memset( &r->status, 0, sizeof( r->status ) );
+    r->active = 1;
+    if ( r->kind == REQ_SEND ) {
+        if ( r->peer != MPI_PROC_NULL )
+            err = Post( r->buf, r->count, r->type, r->peer, r->context,
+                        r->label, r->tag );
+        r->done = 1;
+        r->status.MPI_ERROR = err;
+    }
+    else {
+        LOCK
+        StartRecv( r );
+        UNLOCK
+    }
+    return err;
+}
+
+/* Finishes request *req, which is done: returns its status and frees it,
+   or makes it inactive if persistent. */
+static int Finish( MPI_Request *req, MPI_Status *status )
+{
+    struct nompi_request *r = *req;
+    int err = r->status.MPI_ERROR;
+
+    if ( status ) *status = r->status;
+    if ( !r->persistent ) {
+        free( r );
+        *req = MPI_REQUEST_NULL;
+    }
+    else {
+        r->active = 0;
+        memset( &r->status, 0, sizeof( r->status ) );
+    }
+    return err;
+}
+
+static void EmptyStatus( MPI_Status *status )
+{
+    if ( status ) {
+        memset( status, 0, sizeof( MPI_Status ) );
+        status->MPI_SOURCE = MPI_ANY_SOURCE;
+        status->MPI_TAG = MPI_ANY_TAG;
+    }
+}
+
+int MPI_Send( const void *buf, int count, MPI_Datatype datatype, int dest,
+              int tag, MPI_Comm comm )
+{
+    int err;
+
+    if ( dest == MPI_PROC_NULL ) return MPI_SUCCESS;
+    CHECK( comm, dest >= 0 && dest < ( comm->inter ? comm->remote_size
+                                                   : comm->size ), MPI_ERR_RANK )
+    err = Post( buf, count, datatype, WorldRank( comm, dest ), comm->context,
+                comm->rank, tag );
+    CHECK( comm, err == MPI_SUCCESS, err )
+    return MPI_SUCCESS;
+}
+
+int MPI_Recv( void *buf, int count, MPI_Datatype datatype, int source,
+              int tag, MPI_Comm comm, MPI_Status *status )
+{
+    int err = Receive( buf, count, datatype, source, comm->context, tag, status );
+
+    CHECK( comm, err == MPI_SUCCESS, err )
+    return MPI_SUCCESS;
+}
+
+int MPI_Isend( const void *buf, int count, MPI_Datatype datatype, int dest,
+               int tag, MPI_Comm comm, MPI_Request *request )
+{
+    int err = MPI_Send_init( buf, count, datatype, dest, tag, comm, request );
+
+    if ( err != MPI_SUCCESS ) return err;
+    ( *request )->persistent = 0;
+    err = StartRequest( *request );
+    CHECK( comm, err == MPI_SUCCESS, err )
+    return MPI_SUCCESS;
+}
+
+int MPI_Irecv( void *buf, int count, MPI_Datatype datatype, int source,
+               int tag, MPI_Comm comm, MPI_Request *request )
+{
+    int err = MPI_Recv_init( buf, count, datatype, source, tag, comm, request );
+
+    if ( err != MPI_SUCCESS ) return err;
+    ( *request )->persistent = 0;
+    return StartRequest( *request );
+}
+
+int MPI_Send_init( const void *buf, int count, MPI_Datatype datatype, int dest,
+                   int tag, MPI_Comm comm, MPI_Request *request )
+{
+    CHECK( comm, dest == MPI_PROC_NULL ||
+           ( dest >= 0 && dest < ( comm->inter ? comm->remote_size : comm->size ) ),
+           MPI_ERR_RANK )
+    *request = NewRequest( REQ_SEND, (void *)buf, count, datatype, dest, tag,
+                           comm );
+    CHECK( comm, *request, MPI_ERR_NO_MEM )
+    ( *request )->persistent = 1;
+    return MPI_SUCCESS;
+}
+
+int MPI_Recv_init( void *buf, int count, MPI_Datatype datatype, int source,
+                   int tag, MPI_Comm comm, MPI_Request *request )
+{
+    *request = NewRequest( REQ_RECV, buf, count, datatype, source, tag, comm );
+    CHECK( comm, *request, MPI_ERR_NO_MEM )
+    ( *request )->persistent = 1;
+    return MPI_SUCCESS;
+}
+
+int MPI_Start( MPI_Request *request )
+{
+    int err;
+
+    CHECK( NULL, *request && ( *request )->persistent, MPI_ERR_REQUEST )
+    err = StartRequest( *request );
+    CHECK( NULL, err == MPI_SUCCESS, err )
+    return MPI_SUCCESS;
+}
+
+/* Looks for a message matching source and tag in comm, waiting if block. */
+static int Probe( int source, int tag, MPI_Comm comm, int block, int *flag,
+                  MPI_Status *status )
+{
+    Message *m;
+
+    *flag = 0;
+    if ( source == MPI_PROC_NULL ) {
+        EmptyStatus( status );
+        if ( status ) status->MPI_SOURCE = MPI_PROC_NULL;
+        *flag = 1;
+        return MPI_SUCCESS;
+    }
+    LOCK
+    for ( ;; ) {
+        Progress();
+        for ( m = Shared->box[Rank].head; m; m = m->next )
+            if ( Matches( comm->context, source, tag, m ) ) break;
+        if ( m || !block ) break;
+        Sleep();
+    }
+    if ( m ) {
+        *flag = 1;
+        if ( status ) {
+            status->MPI_SOURCE = m->source;
+            status->MPI_TAG = m->tag;
+            status->MPI_ERROR = MPI_SUCCESS;
+            status->nompi_bytes = m->len;
+            status->nompi_cancelled = 0;
+        }
+    }
+    UNLOCK
+    return MPI_SUCCESS;
+}
+
+int MPI_Probe( int source, int tag, MPI_Comm comm, MPI_Status *status )
+{
+    int flag;
+
+    return Probe( source, tag, comm, 1, &flag, status );
+}
+
+int MPI_Iprobe( int source, int tag, MPI_Comm comm, int *flag,
+                MPI_Status *status )
+{
+    return Probe( source, tag, comm, 0, flag, status );
+}
+
+int MPI_Wait( MPI_Request *request, MPI_Status *status )
+{
+    struct nompi_request *r = *request;
+
+    if ( r == MPI_REQUEST_NULL ) {
+        EmptyStatus( status );
+        return MPI_SUCCESS;
+    }
+    LOCK
+    while ( !r->done ) {
+        Progress();
+        if ( r->done ) break;
+        Sleep();
+    }
+    UNLOCK
+    return Finish( request, status );
+}
+
+int MPI_Test( MPI_Request *request, int *flag, MPI_Status *status )
+{
+    struct nompi_request *r = *request;
+
+    if ( r == MPI_REQUEST_NULL ) {
+        EmptyStatus( status );
+        *flag = 1;
+        return MPI_SUCCESS;
+    }
+    LOCK
+    if ( !r->done ) Progress();
+    *flag = r->done;
+    UNLOCK
+    return *flag ? Finish( request, status ) : MPI_SUCCESS;
+}
+
+/* Index of a done request in requests[], or -1, or MPI_UNDEFINED if none is
+   active; lock held. */
+static int AnyDone( int count, MPI_Request requests[] )
+{
+    int i, active = 0;
+
+    Progress();
+    for ( i = 0; i < count; i++ ) {
+        struct nompi_request *r = requests[i];
+        if ( r == MPI_REQUEST_NULL || !r->active ) continue;
+        active = 1;
+        if ( r->done ) return i;
+    }
+    return active ? -1 : MPI_UNDEFINED;
+}
+
+int MPI_Waitany( int count, MPI_Request requests[], int *index,
+                 MPI_Status *status )
+{
+    int i;
+
+    LOCK
+    while ( ( i = AnyDone( count, requests ) ) == -1 )
+        Sleep();
+    UNLOCK
+    *index = i;
+    if ( i == MPI_UNDEFINED ) {
+        EmptyStatus( status );
+        return MPI_SUCCESS;
+    }
+    return Finish( &requests[i], status );
+}
+
+int MPI_Testany( int count, MPI_Request requests[], int *index, int *flag,
+                 MPI_Status *status )
+{
+    int i;
+
+    LOCK
+    i = AnyDone( count, requests );
+    UNLOCK
+    *flag = i != -1;
+    *index = i == -1 ? MPI_UNDEFINED : i;
+    if ( i == -1 || i == MPI_UNDEFINED ) {
+        EmptyStatus( status );
+        return MPI_SUCCESS;
+    }
+    return Finish( &requests[i], status );
+}
+
+int MPI_Waitall( int count, MPI_Request requests[], MPI_Status statuses[] )
+{
+    int i, err = MPI_SUCCESS;
+
+    for ( i = 0; i < count; i++ )
+        if ( MPI_Wait( &requests[i], statuses ? &statuses[i] : NULL ) )
+            err = MPI_ERR_OTHER;
+    return err;
+}
+
+int MPI_Cancel( MPI_Request *request )
+{
+    struct nompi_request *r = *request;
+
+    LOCK
+    if ( r->kind == REQ_RECV && !r->done ) {
+        Unpost( r );
+        r->done = 1;
+        memset( &r->status, 0, sizeof( r->status ) );
+        r->status.nompi_cancelled = 1;
+    }
+    UNLOCK
+    return MPI_SUCCESS;
+}
+
+int MPI_Test_cancelled( const MPI_Status *status, int *flag )
+{
+    *flag = status->nompi_cancelled;
+    return MPI_SUCCESS;
+}
+
+int MPI_Request_free( MPI_Request *request )
+{
+    struct nompi_request *r = *request;
+
+    if ( r == MPI_REQUEST_NULL ) return MPI_SUCCESS;
+    LOCK
+    if ( r->kind == REQ_RECV && !r->done ) Unpost( r );
+    UNLOCK
+    free( r );
+    *request = MPI_REQUEST_NULL;
+    return MPI_SUCCESS;
+}
+
+/*** collectives ***/
+
+static int CollSend( MPI_Comm comm, const void *buf, int count, MPI_Datatype t,
+                     int dest, int tag )
+{
+    return Post( buf, count, t, WorldRank( comm, dest ), comm->context + 1,
+                 comm->rank, tag );
+}
+
+static int CollRecv( MPI_Comm comm, void *buf, int count, MPI_Datatype t,
+                     int source, int tag )
+{
+    return Receive( buf, count, t, source, comm->context + 1, tag, NULL );
+}
+
+int MPI_Barrier( MPI_Comm comm )
+{
+    int i, err = MPI_SUCCESS;
+
+    CHECK( comm, !comm->inter, MPI_ERR_COMM )
+    if ( comm->rank != 0 ) {
+        err |= CollSend( comm, NULL, 0, MPI_BYTE, 0, TAG_BARRIER );
+        err |= CollRecv( comm, NULL, 0, MPI_BYTE, 0, TAG_BARRIER );
+    }
+    else {
+        for ( i = 1; i < comm->size; i++ )
+            err |= CollRecv( comm, NULL, 0, MPI_BYTE, i, TAG_BARRIER );
+        for ( i = 1; i < comm->size; i++ )
+            err |= CollSend( comm, NULL, 0, MPI_BYTE, i, TAG_BARRIER );
+    }
+    CHECK( comm, err == MPI_SUCCESS, MPI_ERR_OTHER )
+    return MPI_SUCCESS;
+}
+
+int MPI_Bcast( void *buffer, int count, MPI_Datatype datatype, int root,
+               MPI_Comm comm )
+{
+    int i, err = MPI_SUCCESS;
+
+    CHECK( comm, !comm->inter, MPI_ERR_COMM )
+    CHECK( comm, root >= 0 && root < comm->size, MPI_ERR_ROOT )
+    if ( comm->rank == root ) {
+        for ( i = 0; i < comm->size; i++ )
+            if ( i != root )
+                err |= CollSend( comm, buffer, count, datatype, i, TAG_BCAST );
+    }
+    else
+        err = CollRecv( comm, buffer, count, datatype, root, TAG_BCAST );
+    CHECK( comm, err == MPI_SUCCESS, err )
+    return MPI_SUCCESS;
+}
+
+/* Copies count elements of type t from in to out, via their packed form. */
+static int Copy( const void *in, int count, MPI_Datatype t, void *out,
+                 int outcount, MPI_Datatype outtype )
+{
+    MPI_Aint len = PackedLen( count, t );
+    char *tmp;
+
+    if ( len > PackedLen( outcount, outtype ) ) return MPI_ERR_TRUNCATE;
+    if ( len == 0 ) return MPI_SUCCESS;
+    if ( ( tmp = malloc( len ) ) == NULL ) return MPI_ERR_NO_MEM;
+    PackData( tmp, in, count, t );
+    UnpackData( tmp, out, outtype->size ? len / outtype->size : 0, outtype );
+    free( tmp );
+    return MPI_SUCCESS;
+}
+
+int MPI_Gatherv( const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                 void *recvbuf, const int recvcounts[], const int displs[],
+                 MPI_Datatype recvtype, int root, MPI_Comm comm )
+{
+    int i, err = MPI_SUCCESS;
+
+    CHECK( comm, !comm->inter, MPI_ERR_COMM )
+    CHECK( comm, root >= 0 && root < comm->size, MPI_ERR_ROOT )
+    if ( comm->rank != root )
+        err = CollSend( comm, sendbuf, sendcount, sendtype, root, TAG_GATHER );
+    else {
+        char *base = recvbuf;
+        for ( i = 0; i < comm->size; i++ ) {
+            char *at = base + displs[i] * recvtype->extent;
+            if ( i == root ) {
+                if ( sendbuf != MPI_IN_PLACE )
+                    err |= Copy( sendbuf, sendcount, sendtype, at,
+                                 recvcounts[i], recvtype );
+            }
+            else
+                err |= CollRecv( comm, at, recvcounts[i], recvtype, i,
+                                 TAG_GATHER );
+        }
+    }
+    CHECK( comm, err == MPI_SUCCESS, MPI_ERR_OTHER )
+    return MPI_SUCCESS;
+}
+
+int MPI_Scatterv( const void *sendbuf, const int sendcounts[],
+                  const int displs[], MPI_Datatype sendtype, void *recvbuf,
+                  int recvcount, MPI_Datatype recvtype, int root,
+                  MPI_Comm comm )
+{
+    int i, err = MPI_SUCCESS;
+
+    CHECK( comm, !comm->inter, MPI_ERR_COMM )
+    CHECK( comm, root >= 0 && root < comm->size, MPI_ERR_ROOT )
+    if ( comm->rank != root )
+        err = CollRecv( comm, recvbuf, recvcount, recvtype, root, TAG_SCATTER );
+    else {
+        const char *base = sendbuf;
+        for ( i = 0; i < comm->size; i++ ) {
+            const char *at = base + displs[i] * sendtype->extent;
+            if ( i == root ) {
+                if ( recvbuf != MPI_IN_PLACE )
+                    err |= Copy( at, sendcounts[i], sendtype, recvbuf,
+                                 recvcount, recvtype );
+            }
+            else
+                err |= CollSend( comm, at, sendcounts[i], sendtype, i,
+                                 TAG_SCATTER );
+        }
+    }
+    CHECK( comm, err == MPI_SUCCESS, MPI_ERR_OTHER )
+    return MPI_SUCCESS;
+}
+
+/* inout = in op inout, elementwise */
+static int Apply( MPI_Op op, void *in, void *inout, int count, MPI_Datatype t )
+{
+    if ( op >= NOMPI_USEROP ) {
+        if ( op - NOMPI_USEROP >= NumUserOps || !UserOps[op - NOMPI_USEROP] )
+            return MPI_ERR_OP;
+        UserOps[op - NOMPI_USEROP]( in, inout, &count, &t );
+        return MPI_SUCCESS;
+    }
+    return t->op ? t->op( op, in, inout, count ) : MPI_ERR_OP;
+}
+
+int MPI_Reduce( const void *sendbuf, void *recvbuf, int count,
+                MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm )
+{
+    int i, n, err = MPI_SUCCESS;
+    MPI_Aint bytes = count * datatype->extent;
+    char *vals;
+
+    /* contributors send to the root, which combines them in rank order */
+    if ( comm->inter ) {
+        if ( root == MPI_PROC_NULL ) return MPI_SUCCESS;
+        if ( root != MPI_ROOT ) {
+            err = CollSend( comm, sendbuf, count, datatype, root, TAG_REDUCE );
+            CHECK( comm, err == MPI_SUCCESS, err )
+            return MPI_SUCCESS;
+        }
+        n = comm->remote_size;
+    }
+    else {
+        CHECK( comm, root >= 0 && root < comm->size, MPI_ERR_ROOT )
+        if ( comm->rank != root ) {
+            err = CollSend( comm, sendbuf, count, datatype, root, TAG_REDUCE );
+            CHECK( comm, err == MPI_SUCCESS, err )
+            return MPI_SUCCESS;
+        }
+        n = comm->size;
+    }
+    if ( n == 0 || bytes == 0 ) return MPI_SUCCESS;
+
+    vals = malloc( n * bytes );
+    CHECK( comm, vals, MPI_ERR_NO_MEM )
+    for ( i = 0; i < n; i++ ) {
+        if ( !comm->inter && i == root )
+            memcpy( vals + i * bytes,
+                    sendbuf == MPI_IN_PLACE ? recvbuf : sendbuf, bytes );
+        else
+            err |= CollRecv( comm, vals + i * bytes, count, datatype, i,
+                             TAG_REDUCE );
+    }
+    for ( i = n - 2; i >= 0 && err == MPI_SUCCESS; i-- )
+        err = Apply( op, vals + i * bytes, vals + ( n - 1 ) * bytes, count,
+                     datatype );
+    if ( err == MPI_SUCCESS )
+        memcpy( recvbuf, vals + ( n - 1 ) * bytes, bytes );
+    free( vals );
+    CHECK( comm, err == MPI_SUCCESS, err )
+    return MPI_SUCCESS;
+}
+
+int MPI_Op_create( MPI_User_function *function, int commute, MPI_Op *op )
+{
+    MPI_User_function **ops = realloc( UserOps, ( NumUserOps + 1 )
+                                                * sizeof( *ops ) );
+
+    CHECK( NULL, ops, MPI_ERR_NO_MEM )
+    UserOps = ops;
+    UserOps[NumUserOps] = function;
+    *op = NOMPI_USEROP + NumUserOps++;
+    return MPI_SUCCESS;
+}
+
+int MPI_Op_free( MPI_Op *op )
+{
+    if ( *op >= NOMPI_USEROP && *op - NOMPI_USEROP < NumUserOps )
+        UserOps[*op - NOMPI_USEROP] = NULL;
+    *op = MPI_OP_NULL;
+    return MPI_SUCCESS;
+}
+
+/*** communicators and groups ***/
+
+/* Makes a communicator of the given world ranks, or NULL if short of memory. */
+static MPI_Comm NewComm( MPI_Comm parent, int context, int size,
+                         const int ranks[] )
+{
+    int i;
+    MPI_Comm c = calloc( 1, sizeof( struct nompi_comm ) );
+
+    if ( c == NULL || ( c->ranks = malloc( ( size + 1 ) * sizeof( int ) ) ) == NULL ) {
+        free( c );
+        return NULL;
+    }
+    c->context = context;
+    c->size = size;
+    c->rank = MPI_UNDEFINED;
+    for ( i = 0; i < size; i++ ) {
+        c->ranks[i] = ranks[i];
+        if ( ranks[i] == Rank ) c->rank = i;
+    }
+    c->errhandler = parent->errhandler;
+    return c;
+}
+
+/* Rank 0 of comm takes a fresh context and shares it with the others. */
+static int SharedContext( MPI_Comm comm, int *context )
+{
+    int i, err = MPI_SUCCESS;
+
+    if ( comm->rank == 0 ) {
+        LOCK
+        *context = Shared->next_context;
+        Shared->next_context += 2;
+        UNLOCK
+        for ( i = 1; i < comm->size; i++ )
+            err |= CollSend( comm, context, 1, MPI_INT, i, TAG_CONTEXT );
+    }
+    else
+        err = CollRecv( comm, context, 1, MPI_INT, 0, TAG_CONTEXT );
+    return err;
+}
+
+int MPI_Comm_rank( MPI_Comm comm, int *rank )
+{
+    CHECK( NULL, comm, MPI_ERR_COMM )
+    *rank = comm->rank;
+    return MPI_SUCCESS;
+}
+
+int MPI_Comm_size( MPI_Comm comm, int *size )
+{
+    CHECK( NULL, comm, MPI_ERR_COMM )
+    *size = comm->size;
+    return MPI_SUCCESS;
+}
+
+int MPI_Comm_dup( MPI_Comm comm, MPI_Comm *newcomm )
+{
+    int context;
+
+    CHECK( comm, !comm->inter, MPI_ERR_COMM )
+    CHECK( comm, SharedContext( comm, &context ) == MPI_SUCCESS, MPI_ERR_OTHER )
+    *newcomm = NewComm( comm, context, comm->size, comm->ranks );
+    CHECK( comm, *newcomm, MPI_ERR_NO_MEM )
+    return MPI_SUCCESS;
+}
+
+int MPI_Comm_create( MPI_Comm comm, MPI_Group group, MPI_Comm *newcomm )
+{
+    int i, context;
+
+    CHECK( comm, !comm->inter, MPI_ERR_COMM )
+    CHECK( comm, SharedContext( comm, &context ) == MPI_SUCCESS, MPI_ERR_OTHER )
+    *newcomm = MPI_COMM_NULL;
+    for ( i = 0; i < group->size; i++ )
+        if ( group->ranks[i] == Rank ) {
+            *newcomm = NewComm( comm, context, group->size, group->ranks );
+            CHECK( comm, *newcomm, MPI_ERR_NO_MEM )
+        }
+    return MPI_SUCCESS;
+}
+
+int MPI_Comm_split( MPI_Comm comm, int color, int key, MPI_Comm *newcomm )
+{
+    int i, j, n, err = MPI_SUCCESS;
+    int mine[2] = { color, key };
+    int *all = malloc( 3 * comm->size * sizeof( int ) );	// color, key, context
+    int *members = malloc( ( comm->size + 1 ) * sizeof( int ) );
+
+    CHECK( comm, !comm->inter, MPI_ERR_COMM )
+    CHECK( comm, all && members, MPI_ERR_NO_MEM )
+
+    /* rank 0 collects the colors and keys and gives each color a context */
+    if ( comm->rank != 0 ) {
+        err |= CollSend( comm, mine, 2, MPI_INT, 0, TAG_SPLIT );
+        err |= CollRecv( comm, all, 3 * comm->size, MPI_INT, 0, TAG_SPLIT );
+    }
+    else {
+        for ( i = 0; i < comm->size; i++ ) {
+            if ( i == 0 ) memcpy( all, mine, sizeof( mine ) );
+            else err |= CollRecv( comm, all + 3 * i, 2, MPI_INT, i, TAG_SPLIT );
+            all[3 * i + 2] = -1;
+            for ( j = 0; j < i; j++ )
+                if ( all[3 * j] == all[3 * i] ) all[3 * i + 2] = all[3 * j + 2];
+            if ( all[3 * i + 2] < 0 ) {
+                LOCK
+                all[3 * i + 2] = Shared->next_context;
+                Shared->next_context += 2;
+                UNLOCK
+            }
+        }
+        for ( i = 1; i < comm->size; i++ )
+            err |= CollSend( comm, all, 3 * comm->size, MPI_INT, i, TAG_SPLIT );
+    }
+
+    /* members of our color, by key and then by old rank */
+    *newcomm = MPI_COMM_NULL;
+    if ( err == MPI_SUCCESS && color != MPI_UNDEFINED ) {
+        for ( n = 0, i = 0; i < comm->size; i++ ) {
+            if ( all[3 * i] != color ) continue;
+            for ( j = n++; j > 0 && all[3 * members[j - 1] + 1] > all[3 * i + 1]; j-- )
+                members[j] = members[j - 1];
+            members[j] = i;
+        }
+        for ( i = 0; i < n; i++ )
+            members[i] = comm->ranks[members[i]];
+        *newcomm = NewComm( comm, all[3 * comm->rank + 2], n, members );
+        if ( *newcomm == MPI_COMM_NULL ) err = MPI_ERR_NO_MEM;
+    }
+    free( all );
+    free( members );
+    CHECK( comm, err == MPI_SUCCESS, err )
+    return MPI_SUCCESS;
+}
+
+int MPI_Comm_split_type( MPI_Comm comm, int split_type, int key, MPI_Info info,
+                         MPI_Comm *newcomm )
+{
+    /* all the ranks are on this node */
+    return MPI_Comm_split( comm, split_type == MPI_COMM_TYPE_SHARED
+                                 ? 0 : MPI_UNDEFINED, key, newcomm );
+}
+
+int MPI_Intercomm_create( MPI_Comm local_comm, int local_leader,
+                          MPI_Comm peer_comm, int remote_leader, int tag,
+                          MPI_Comm *newintercomm )
+{
+    int err = MPI_SUCCESS;
+    int head[2];		// context, remote size
+    int *remote = NULL;
+    MPI_Comm c;
+
+    CHECK( local_comm, !local_comm->inter, MPI_ERR_COMM )
+
+    /* the leaders swap groups, and the one lower in MPI_COMM_WORLD picks
+       the context */
+    if ( local_comm->rank == local_leader ) {
+        err |= CollSend( peer_comm, &local_comm->size, 1, MPI_INT,
+                         remote_leader, TAG_GROUP );
+        err |= CollSend( peer_comm, local_comm->ranks, local_comm->size,
+                         MPI_INT, remote_leader, TAG_GROUP );
+        err |= CollRecv( peer_comm, &head[1], 1, MPI_INT, remote_leader,
+                         TAG_GROUP );
+        remote = malloc( ( head[1] + 1 ) * sizeof( int ) );
+        CHECK( local_comm, remote, MPI_ERR_NO_MEM )
+        err |= CollRecv( peer_comm, remote, head[1], MPI_INT, remote_leader,
+                         TAG_GROUP );
+        if ( Rank < WorldRank( peer_comm, remote_leader ) ) {
+            LOCK
+            head[0] = Shared->next_context;
+            Shared->next_context += 2;
+            UNLOCK
+            err |= CollSend( peer_comm, &head[0], 1, MPI_INT, remote_leader,
+                             TAG_CONTEXT );
+        }
+        else
+            err |= CollRecv( peer_comm, &head[0], 1, MPI_INT, remote_leader,
+                             TAG_CONTEXT );
+    }
+
+    err |= MPI_Bcast( head, 2, MPI_INT, local_leader, local_comm );
+    if ( local_comm->rank != local_leader ) {
+        remote = malloc( ( head[1] + 1 ) * sizeof( int ) );
+        CHECK( local_comm, remote, MPI_ERR_NO_MEM )
+    }
+    err |= MPI_Bcast( remote, head[1], MPI_INT, local_leader, local_comm );
+    CHECK( local_comm, err == MPI_SUCCESS, MPI_ERR_OTHER )
+
+    c = NewComm( local_comm, head[0], local_comm->size, local_comm->ranks );
+    CHECK( local_comm, c, MPI_ERR_NO_MEM )
+    c->inter = 1;
+    c->remote_size = head[1];
+    c->remote_ranks = remote;
+    *newintercomm = c;
+    return MPI_SUCCESS;
+}
+
+int MPI_Comm_free( MPI_Comm *comm )
+{
+    MPI_Comm c = *comm;
+
+    CHECK( NULL, c && c != MPI_COMM_WORLD && c != MPI_COMM_SELF, MPI_ERR_COMM )
+    free( c->ranks );
+    free( c->remote_ranks );
+    free( c );
+    *comm = MPI_COMM_NULL;
+    return MPI_SUCCESS;
+}
+
+static MPI_Group NewGroup( int size )
+{
+    MPI_Group g = malloc( sizeof( struct nompi_group ) + size * sizeof( int ) );
+
+    if ( g ) g->size = size;
+    return g;
+}
+
+int MPI_Comm_group( MPI_Comm comm, MPI_Group *group )
+{
+    *group = NewGroup( comm->size );
+    CHECK( comm, *group, MPI_ERR_NO_MEM )
+    memcpy( ( *group )->ranks, comm->ranks, comm->size * sizeof( int ) );
+    return MPI_SUCCESS;
+}
+
+int MPI_Group_incl( MPI_Group group, int n, const int ranks[],
+                    MPI_Group *newgroup )
+{
+    int i;
+
+    *newgroup = NewGroup( n );
+    CHECK( NULL, *newgroup, MPI_ERR_NO_MEM )
+    for ( i = 0; i < n; i++ ) {
+        CHECK( NULL, ranks[i] >= 0 && ranks[i] < group->size, MPI_ERR_RANK )
+        ( *newgroup )->ranks[i] = group->ranks[ranks[i]];
+    }
+    return MPI_SUCCESS;
+}
+
+int MPI_Group_size( MPI_Group group, int *size )
+{
+    *size = group->size;
+    return MPI_SUCCESS;
+}
+
+int MPI_Group_translate_ranks( MPI_Group group1, int n, const int ranks1[],
+                               MPI_Group group2, int ranks2[] )
+{
+    int i, j;
+
+    for ( i = 0; i < n; i++ ) {
+        if ( ranks1[i] == MPI_PROC_NULL ) {
+            ranks2[i] = MPI_PROC_NULL;
+            continue;
+        }
+        ranks2[i] = MPI_UNDEFINED;
+        for ( j = 0; j < group2->size; j++ )
+            if ( group2->ranks[j] == group1->ranks[ranks1[i]] ) {
+                ranks2[i] = j;
+                break;
+            }
+    }
+    return MPI_SUCCESS;
+}
+
+int MPI_Group_free( MPI_Group *group )
+{
+    free( *group );
+    *group = MPI_GROUP_NULL;
+    return MPI_SUCCESS;
+}
+
+/*** windows ***/
+
+int MPI_Win_allocate_shared( MPI_Aint size, int disp_unit, MPI_Info info,
+                             MPI_Comm comm, void *baseptr, MPI_Win *win )
+{
+    int i, err = MPI_SUCCESS;
+    MPI_Win w = calloc( 1, sizeof( struct nompi_win ) );
+    long mine[2];
+
+    CHECK( comm, w, MPI_ERR_NO_MEM )
+    w->comm = comm;
+    w->bases = malloc( ( comm->size + 1 ) * sizeof( void * ) );
+    w->sizes = malloc( ( comm->size + 1 ) * sizeof( MPI_Aint ) );
+    CHECK( comm, w->bases && w->sizes, MPI_ERR_NO_MEM )
+    if ( size > 0 ) {
+        LOCK
+        w->mine = Alloc( size );
+        UNLOCK
+        CHECK( comm, w->mine, MPI_ERR_NO_MEM )
+    }
+
+    /* the arena is at the same address everywhere, so pointers can be shared */
+    mine[0] = (long)(uintptr_t)w->mine;
+    mine[1] = size;
+    for ( i = 0; i < comm->size; i++ ) {
+        long seg[2] = { mine[0], mine[1] };
+        err |= MPI_Bcast( seg, 2, MPI_LONG, i, comm );
+        w->bases[i] = (void *)(uintptr_t)seg[0];
+        w->sizes[i] = seg[1];
+    }
+    CHECK( comm, err == MPI_SUCCESS, MPI_ERR_OTHER )
+    *(void **)baseptr = w->mine;
+    *win = w;
+    return MPI_SUCCESS;
+}
+
+/* Every window is in the arena, so one-sided calls are just copies. */
+int MPI_Win_allocate( MPI_Aint size, int disp_unit, MPI_Info info,
+                      MPI_Comm comm, void *baseptr, MPI_Win *win )
+{
+    return MPI_Win_allocate_shared( size, disp_unit, info, comm, baseptr, win );
+}
+
+int MPI_Win_shared_query( MPI_Win win, int rank, MPI_Aint *size,
+                          int *disp_unit, void *baseptr )
+{
+    if ( rank == MPI_PROC_NULL )
+        for ( rank = 0; rank < win->comm->size - 1 && !win->sizes[rank]; rank++ )
+            ;
+    CHECK( win->comm, rank >= 0 && rank < win->comm->size, MPI_ERR_RANK )
+    *size = win->sizes[rank];
+    *disp_unit = 1;
+    *(void **)baseptr = win->bases[rank];
+    return MPI_SUCCESS;
+}
+
+int MPI_Win_lock_all( int assert, MPI_Win win )
+{
+    return MPI_SUCCESS;
+}
+
+int MPI_Win_unlock_all( MPI_Win win )
+{
+    return MPI_SUCCESS;
+}
+
+int MPI_Win_sync( MPI_Win win )
+{
+    __sync_synchronize();
+    return MPI_SUCCESS;
+}
+
+int MPI_Win_flush( int rank, MPI_Win win )
+{
+    __sync_synchronize();
+    return MPI_SUCCESS;
+}
+
+/* Copies between a local buffer and a target's segment, directly unless
+   either side is a struct. */
+static int Transfer( void *origin, int count, MPI_Datatype t, int rank,
+                     MPI_Aint disp, int tcount, MPI_Datatype tt, MPI_Win win,
+                     int put )
+{
+    char *target;
+
+    CHECK( win->comm, rank >= 0 && rank < win->comm->size, MPI_ERR_RANK )
+    target = (char *)win->bases[rank] + disp;
+    if ( t->kind == KIND_STRUCT || tt->kind == KIND_STRUCT )
+        return put ? Copy( origin, count, t, target, tcount, tt )
+                   : Copy( target, tcount, tt, origin, count, t );
+    CHECK( win->comm, PackedLen( count, t ) == PackedLen( tcount, tt ),
+           MPI_ERR_TRUNCATE )
+    if ( count > 0 ) {
+        if ( put ) memcpy( target, origin, PackedLen( count, t ) );
+        else memcpy( origin, target, PackedLen( count, t ) );
+    }
+    return MPI_SUCCESS;
+}
+
+int MPI_Put( const void *origin_addr, int origin_count,
+             MPI_Datatype origin_datatype, int target_rank,
+             MPI_Aint target_disp, int target_count,
+             MPI_Datatype target_datatype, MPI_Win win )
+{
+    return Transfer( (void *)origin_addr, origin_count, origin_datatype,
+                     target_rank, target_disp, target_count, target_datatype,
+                     win, 1 );
+}
+
+int MPI_Get( void *origin_addr, int origin_count,
+             MPI_Datatype origin_datatype, int target_rank,
+             MPI_Aint target_disp, int target_count,
+             MPI_Datatype target_datatype, MPI_Win win )
+{
+    return Transfer( origin_addr, origin_count, origin_datatype, target_rank,
+                     target_disp, target_count, target_datatype, win, 0 );
+}
+
+int MPI_Win_free( MPI_Win *win )
+{
+    MPI_Win w = *win;
+
+    MPI_Barrier( w->comm );	// nobody is still using our segment
+    if ( w->mine ) {
+        LOCK
+        Free( w->mine );
+        UNLOCK
+    }
+    free( w->bases );
+    free( w->sizes );
+    free( w );
+    *win = MPI_WIN_NULL;
+    return MPI_SUCCESS;
+}
+
+/*** environment ***/
+
+/* Rank 0: kills the other ranks */
+static void KillAll( void )
+{
+    int i;
+
+    for ( i = 1; i < Shared->size; i++ )
+        if ( Shared->box[i].pid > 0 ) kill( Shared->box[i].pid, SIGKILL );
+}
+
+/* Rank 0: another rank called MPI_Abort */
+static void OnAbort( int sig )
+{
+    KillAll();
+    _exit( Shared->abort_code );
+}
+
+/* Rank 0: a rank that died of a signal, or exited with an error before
+   MPI_Finalize, takes the whole program down, as mpirun would */
+static void OnChild( int sig )
+{
+    int i;
+    siginfo_t info;
+
+    for ( i = 1; i < Shared->size; i++ ) {
+        info.si_pid = 0;
+        if ( waitid( P_PID, Shared->box[i].pid, &info,
+                     WEXITED | WNOHANG | WNOWAIT ) != 0 || info.si_pid == 0 )
+            continue;
+        if ( info.si_code != CLD_EXITED || info.si_status != 0 ) {
+            KillAll();
+            _exit( info.si_code == CLD_EXITED ? info.si_status
+                                              : 128 + info.si_status );
+        }
+    }
+}
+
+/* Takes "-np N" or "-n N" out of the arguments; returns N or 0. */
+static int TakeNP( int *argc, char ***argv )
+{
+    int i, n;
+
+    if ( argc == NULL || argv == NULL || *argv == NULL ) return 0;
+    for ( i = 1; i < *argc - 1; i++ ) {
+        if ( strcmp( ( *argv )[i], "-np" ) != 0 && strcmp( ( *argv )[i], "-n" ) != 0 )
+            continue;
+        n = atoi( ( *argv )[i + 1] );
+        for ( *argc -= 2; i < *argc; i++ )
+            ( *argv )[i] = ( *argv )[i + 2];
+        ( *argv )[*argc] = NULL;
+        return n;
+    }
+    return 0;
+}
+
+static int Start( int *argc, char ***argv )
+{
+    int i, n = TakeNP( argc, argv );
+    size_t head;
+    pid_t pid;
+    pthread_mutexattr_t ma;
+    pthread_condattr_t ca;
+    struct sigaction sa;
+    static int world_self;
+
+    if ( Shared ) return MPI_SUCCESS;
+    if ( n <= 0 && getenv( "NOMPI_NP" ) ) n = atoi( getenv( "NOMPI_NP" ) );
+    if ( n <= 0 ) n = sysconf( _SC_NPROCESSORS_ONLN );
+    if ( n <= 0 ) n = 1;
+
+    Shared = mmap( NULL, NOMPI_ARENA, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+    if ( Shared == MAP_FAILED ) {
+        perror( "nompi: mapping shared arena" );
+        exit( 1 );
+    }
+    pthread_mutexattr_init( &ma );
+    pthread_mutexattr_setpshared( &ma, PTHREAD_PROCESS_SHARED );
+    pthread_mutex_init( &Shared->lock, &ma );
+    pthread_condattr_init( &ca );
+    pthread_condattr_setpshared( &ca, PTHREAD_PROCESS_SHARED );
+    for ( i = 0; i < n; i++ )
+        pthread_cond_init( &Shared->box[i].cond, &ca );
+    Shared->size = n;
+    Shared->next_context = 4;		// world is 0, self is 2
+    head = sizeof( Arena ) + n * sizeof( Mailbox );
+    Shared->top = (char *)Shared + ( head + NOMPI_ALIGN - 1 ) / NOMPI_ALIGN * NOMPI_ALIGN;
+    Shared->end = (char *)Shared + NOMPI_ARENA;
+    Shared->box[0].pid = getpid();
+
+    /* rank 0 is this process; the rest are forked from it */
+    fflush( NULL );
+    for ( Rank = 0, i = 1; i < n; i++ ) {
+        pid = fork();
+        if ( pid < 0 ) {
+            perror( "nompi: fork" );
+            KillAll();
+            exit( 1 );
+        }
+        if ( pid == 0 ) {
+            Rank = i;
+#ifdef __linux__
+            prctl( PR_SET_PDEATHSIG, SIGKILL );
+#endif
+            if ( getppid() != Shared->box[0].pid ) _exit( 1 );
+            break;
+        }
+        Shared->box[i].pid = pid;
+    }
+    if ( Rank == 0 ) {
+        memset( &sa, 0, sizeof( sa ) );
+        sa.sa_handler = OnAbort;
+        sigaction( SIGTERM, &sa, NULL );
+        sa.sa_handler = OnChild;
+        sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+        sigaction( SIGCHLD, &sa, NULL );
+    }
+
+    nompi_comm_world.context = 0;
+    nompi_comm_world.rank = Rank;
+    nompi_comm_world.size = n;
+    nompi_comm_world.ranks = malloc( n * sizeof( int ) );
+    for ( i = 0; i < n; i++ )
+        nompi_comm_world.ranks[i] = i;
+    world_self = Rank;
+    nompi_comm_self.context = 2;
+    nompi_comm_self.rank = 0;
+    nompi_comm_self.size = 1;
+    nompi_comm_self.ranks = &world_self;
+    return MPI_SUCCESS;
+}
+
+int MPI_Init( int *argc, char ***argv )
+{
+    return Start( argc, argv );
+}
+
+int MPI_Init_thread( int *argc, char ***argv, int required, int *provided )
+{
+    *provided = MPI_THREAD_MULTIPLE;
+    return Start( argc, argv );
+}
+
+int MPI_Initialized( int *flag )
+{
+    *flag = Shared != NULL;
+    return MPI_SUCCESS;
+}
+
+int MPI_Finalized( int *flag )
+{
+    *flag = Finalized;
+    return MPI_SUCCESS;
+}
+
+int MPI_Query_thread( int *provided )
+{
+    *provided = MPI_THREAD_MULTIPLE;
+    return MPI_SUCCESS;
+}
+
+int MPI_Finalize( void )
+{
+    int i, status;
+    struct sigaction sa;
+
+    MPI_Barrier( MPI_COMM_WORLD );
+    Finalized = 1;
+    if ( Rank != 0 ) return MPI_SUCCESS;
+
+    /* wait for the other ranks, reporting any that failed */
+    memset( &sa, 0, sizeof( sa ) );
+    sa.sa_handler = SIG_DFL;
+    sigaction( SIGCHLD, &sa, NULL );
+    for ( i = 1; i < Shared->size; i++ ) {
+        if ( waitpid( Shared->box[i].pid, &status, 0 ) < 0 ) continue;
+        if ( WIFSIGNALED( status ) )
+            fprintf( stderr, "nompi: rank %d killed by signal %d\n", i,
+                     WTERMSIG( status ) );
+        else if ( WEXITSTATUS( status ) != 0 )
+            fprintf( stderr, "nompi: rank %d exited with status %d\n", i,
+                     WEXITSTATUS( status ) );
+    }
+    return MPI_SUCCESS;
+}
+
+int MPI_Abort( MPI_Comm comm, int errorcode )
+{
+    if ( Shared == NULL ) exit( errorcode );
+    Shared->abort_code = errorcode ? errorcode : 1;
+    fflush( NULL );
+    if ( Rank == 0 )
+        KillAll();
+    else
+        kill( Shared->box[0].pid, SIGTERM );
+    _exit( Shared->abort_code );
+}
+
+double MPI_Wtime( void )
+{
+    struct timespec t;
+
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+double MPI_Wtick( void )
+{
+    struct timespec t;
+
+    clock_getres( CLOCK_MONOTONIC, &t );
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int MPI_Get_processor_name( char *name, int *resultlen )
+{
+    if ( gethostname( name, MPI_MAX_PROCESSOR_NAME ) != 0 )
+        strcpy( name, "localhost" );
+    name[MPI_MAX_PROCESSOR_NAME - 1] = '\0';
+    *resultlen = strlen( name );
+    return MPI_SUCCESS;
+}
+
+int MPI_Error_string( int errorcode, char *string, int *resultlen )
+{
+    snprintf( string, MPI_MAX_ERROR_STRING, "%s", ErrorText( errorcode ) );
+    *resultlen = strlen( string );
+    return MPI_SUCCESS;
+}
+
+int MPI_Attr_get( MPI_Comm comm, int keyval, void *attribute_val, int *flag )
+{
+    *flag = keyval == MPI_TAG_UB;
+    if ( *flag ) *(int **)attribute_val = &TagUB;
+    return MPI_SUCCESS;
+}
+
+int MPI_Comm_create_errhandler( MPI_Comm_errhandler_function *fn,
+                                MPI_Errhandler *errhandler )
+{
+    *errhandler = malloc( sizeof( struct nompi_errhandler ) );
+    CHECK( NULL, *errhandler, MPI_ERR_NO_MEM )
+    ( *errhandler )->fn = fn;
+    return MPI_SUCCESS;
+}
+
+int MPI_Comm_set_errhandler( MPI_Comm comm, MPI_Errhandler errhandler )
+{
+    comm->errhandler = errhandler;
+    return MPI_SUCCESS;
+}
+
+int MPI_Errhandler_free( MPI_Errhandler *errhandler )
+{
+    *errhandler = MPI_ERRHANDLER_NULL;	// communicators may still use it
+    return MPI_SUCCESS;
+}
+
+int MPI_Info_create( MPI_Info *info )
+{
+    *info = MPI_INFO_NULL;
+    return MPI_SUCCESS;
+}
+
+int MPI_Info_set( MPI_Info info, const char *key, const char *value )
+{
+    return MPI_SUCCESS;
+}
+
+int MPI_Info_free( MPI_Info *info )
+{
+    *info = MPI_INFO_NULL;
+    return MPI_SUCCESS;
+}
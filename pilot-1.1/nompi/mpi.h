@@ -0,0 +1,304 @@
+/***************************************************************************
+ * Copyright (c) 2008-2009 University of Guelph.
+ *                         All rights reserved.
+ *
+ * This file is part of the Pilot software package.  For license
+ * information, see the LICENSE file in the top level directory of the
+ * Pilot source distribution.
+ **************************************************************************/
+
+/*!
+********************************************************************************
+\file mpi.h
+\brief Single-node stand-in for MPI, for building Pilot without an MPI library
+
+Pilot built against this header (see "make nompi" in the Makefile) needs no MPI
+installation and no mpirun.  MPI_Init forks the program into the requested
+number of processes on the local machine, taken from a "-np <N>" or "-n <N>"
+argument, from the NOMPI_NP environment variable, or else one per online CPU.
+All messages go through one shared memory arena, so start-up takes
+milliseconds and the whole job can be run again in a tight loop, e.g. for the
+unit tests.  Several Pilot processes can still share one MPI process as threads
+or coroutines (-pithreads, -picoro); with "-np 1" the whole program then runs
+in a single address space.
+
+Only the part of MPI that Pilot and its tests call is provided.  Sends are
+buffered in the arena, so they complete at once.  Messages are matched in
+MPI order: per sender, communicator and tag, first sent is first received.
+*******************************************************************************/
+
+#ifndef NOMPI_MPI_H
+#define NOMPI_MPI_H
+
+#include <stddef.h>
+#include <stdio.h>	// as with common MPIs, programs may rely on it
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MPI_VERSION 3
+#define MPI_SUBVERSION 0
+
+/* opaque handles */
+typedef struct nompi_comm *MPI_Comm;
+typedef struct nompi_group *MPI_Group;
+typedef struct nompi_type *MPI_Datatype;
+typedef struct nompi_request *MPI_Request;
+typedef struct nompi_win *MPI_Win;
+typedef struct nompi_errhandler *MPI_Errhandler;
+typedef int MPI_Op;
+typedef int MPI_Info;
+typedef ptrdiff_t MPI_Aint;
+
+typedef struct {
+    int MPI_SOURCE;
+    int MPI_TAG;
+    int MPI_ERROR;
+    long nompi_bytes;		/* packed size of the message received */
+    int nompi_cancelled;
+} MPI_Status;
+
+typedef void MPI_User_function( void *invec, void *inoutvec, int *len,
+                                MPI_Datatype *datatype );
+typedef void MPI_Comm_errhandler_function( MPI_Comm *comm, int *code, ... );
+typedef MPI_Comm_errhandler_function MPI_Comm_errhandler_fn;
+
+/* error classes */
+#define MPI_SUCCESS		0
+#define MPI_ERR_BUFFER		1
+#define MPI_ERR_COUNT		2
+#define MPI_ERR_TYPE		3
+#define MPI_ERR_TAG		4
+#define MPI_ERR_COMM		5
+#define MPI_ERR_RANK		6
+#define MPI_ERR_REQUEST		7
+#define MPI_ERR_ROOT		8
+#define MPI_ERR_GROUP		9
+#define MPI_ERR_OP		10
+#define MPI_ERR_ARG		12
+#define MPI_ERR_TRUNCATE	14
+#define MPI_ERR_OTHER		15
+#define MPI_ERR_INTERN		16
+#define MPI_ERR_NO_MEM		34
+#define MPI_ERR_LASTCODE	74
+
+/* special values */
+#define MPI_ANY_SOURCE		(-1)
+#define MPI_ANY_TAG		(-1)
+#define MPI_PROC_NULL		(-2)
+#define MPI_ROOT		(-3)
+#define MPI_UNDEFINED		(-32766)
+#define MPI_BOTTOM		((void *)0)
+#define MPI_IN_PLACE		((void *)1)
+#define MPI_STATUS_IGNORE	((MPI_Status *)0)
+#define MPI_STATUSES_IGNORE	((MPI_Status *)0)
+#define MPI_MAX_ERROR_STRING	256
+#define MPI_MAX_PROCESSOR_NAME	256
+#define MPI_TAG_UB		1	/* attribute key */
+#define MPI_COMM_TYPE_SHARED	1
+#define MPI_MODE_NOCHECK	1024
+
+#define MPI_THREAD_SINGLE	0
+#define MPI_THREAD_FUNNELED	1
+#define MPI_THREAD_SERIALIZED	2
+#define MPI_THREAD_MULTIPLE	3
+
+#define MPI_COMM_NULL		((MPI_Comm)0)
+#define MPI_GROUP_NULL		((MPI_Group)0)
+#define MPI_DATATYPE_NULL	((MPI_Datatype)0)
+#define MPI_REQUEST_NULL	((MPI_Request)0)
+#define MPI_WIN_NULL		((MPI_Win)0)
+#define MPI_ERRHANDLER_NULL	((MPI_Errhandler)0)
+#define MPI_INFO_NULL		0
+#define MPI_OP_NULL		0
+
+extern struct nompi_comm nompi_comm_world, nompi_comm_self;
+#define MPI_COMM_WORLD		(&nompi_comm_world)
+#define MPI_COMM_SELF		(&nompi_comm_self)
+
+/* built-in datatypes: X( MPI name, C type ) */
+#define NOMPI_INT_TYPES( X ) \
+    X( MPI_CHAR, char ) \
+    X( MPI_SIGNED_CHAR, signed char ) \
+    X( MPI_UNSIGNED_CHAR, unsigned char ) \
+    X( MPI_SHORT, short ) \
+    X( MPI_UNSIGNED_SHORT, unsigned short ) \
+    X( MPI_INT, int ) \
+    X( MPI_UNSIGNED, unsigned ) \
+    X( MPI_LONG, long ) \
+    X( MPI_UNSIGNED_LONG, unsigned long ) \
+    X( MPI_LONG_LONG, long long ) \
+    X( MPI_UNSIGNED_LONG_LONG, unsigned long long )
+#define NOMPI_FLOAT_TYPES( X ) \
+    X( MPI_FLOAT, float ) \
+    X( MPI_DOUBLE, double ) \
+    X( MPI_LONG_DOUBLE, long double )
+
+#define NOMPI_DECLARE( name, ctype ) extern struct nompi_type nompi_##name;
+NOMPI_INT_TYPES( NOMPI_DECLARE )
+NOMPI_FLOAT_TYPES( NOMPI_DECLARE )
+NOMPI_DECLARE( MPI_BYTE, unsigned char )
+NOMPI_DECLARE( MPI_PACKED, unsigned char )
+#undef NOMPI_DECLARE
+
+#define MPI_CHAR		(&nompi_MPI_CHAR)
+#define MPI_SIGNED_CHAR		(&nompi_MPI_SIGNED_CHAR)
+#define MPI_UNSIGNED_CHAR	(&nompi_MPI_UNSIGNED_CHAR)
+#define MPI_SHORT		(&nompi_MPI_SHORT)
+#define MPI_UNSIGNED_SHORT	(&nompi_MPI_UNSIGNED_SHORT)
+#define MPI_INT			(&nompi_MPI_INT)
+#define MPI_UNSIGNED		(&nompi_MPI_UNSIGNED)
+#define MPI_LONG		(&nompi_MPI_LONG)
+#define MPI_UNSIGNED_LONG	(&nompi_MPI_UNSIGNED_LONG)
+#define MPI_LONG_LONG		(&nompi_MPI_LONG_LONG)
+#define MPI_LONG_LONG_INT	MPI_LONG_LONG
+#define MPI_UNSIGNED_LONG_LONG	(&nompi_MPI_UNSIGNED_LONG_LONG)
+#define MPI_FLOAT		(&nompi_MPI_FLOAT)
+#define MPI_DOUBLE		(&nompi_MPI_DOUBLE)
+#define MPI_LONG_DOUBLE		(&nompi_MPI_LONG_DOUBLE)
+#define MPI_BYTE		(&nompi_MPI_BYTE)
+#define MPI_PACKED		(&nompi_MPI_PACKED)
+
+/* built-in reduction operators */
+#define MPI_MAX		1
+#define MPI_MIN		2
+#define MPI_SUM		3
+#define MPI_PROD	4
+#define MPI_LAND	5
+#define MPI_BAND	6
+#define MPI_LOR		7
+#define MPI_BOR		8
+#define MPI_LXOR	9
+#define MPI_BXOR	10
+
+/* environment */
+int MPI_Init( int *argc, char ***argv );
+int MPI_Init_thread( int *argc, char ***argv, int required, int *provided );
+int MPI_Initialized( int *flag );
+int MPI_Finalized( int *flag );
+int MPI_Query_thread( int *provided );
+int MPI_Finalize( void );
+int MPI_Abort( MPI_Comm comm, int errorcode );
+double MPI_Wtime( void );
+double MPI_Wtick( void );
+int MPI_Get_processor_name( char *name, int *resultlen );
+int MPI_Error_string( int errorcode, char *string, int *resultlen );
+int MPI_Attr_get( MPI_Comm comm, int keyval, void *attribute_val, int *flag );
+int MPI_Comm_create_errhandler( MPI_Comm_errhandler_function *fn,
+                                MPI_Errhandler *errhandler );
+int MPI_Comm_set_errhandler( MPI_Comm comm, MPI_Errhandler errhandler );
+int MPI_Errhandler_free( MPI_Errhandler *errhandler );
+int MPI_Info_create( MPI_Info *info );
+int MPI_Info_set( MPI_Info info, const char *key, const char *value );
+int MPI_Info_free( MPI_Info *info );
+
+/* communicators and groups */
+int MPI_Comm_rank( MPI_Comm comm, int *rank );
+int MPI_Comm_size( MPI_Comm comm, int *size );
+int MPI_Comm_dup( MPI_Comm comm, MPI_Comm *newcomm );
+int MPI_Comm_create( MPI_Comm comm, MPI_Group group, MPI_Comm *newcomm );
+int MPI_Comm_split( MPI_Comm comm, int color, int key, MPI_Comm *newcomm );
+int MPI_Comm_split_type( MPI_Comm comm, int split_type, int key, MPI_Info info,
+                         MPI_Comm *newcomm );
+int MPI_Intercomm_create( MPI_Comm local_comm, int local_leader,
+                          MPI_Comm peer_comm, int remote_leader, int tag,
+                          MPI_Comm *newintercomm );
+int MPI_Comm_free( MPI_Comm *comm );
+int MPI_Comm_group( MPI_Comm comm, MPI_Group *group );
+int MPI_Group_incl( MPI_Group group, int n, const int ranks[],
+                    MPI_Group *newgroup );
+int MPI_Group_size( MPI_Group group, int *size );
+int MPI_Group_translate_ranks( MPI_Group group1, int n, const int ranks1[],
+                               MPI_Group group2, int ranks2[] );
+int MPI_Group_free( MPI_Group *group );
+
+/* datatypes */
+int MPI_Type_create_struct( int count, const int blocklengths[],
+                            const MPI_Aint displacements[],
+                            const MPI_Datatype types[], MPI_Datatype *newtype );
+int MPI_Type_commit( MPI_Datatype *datatype );
+int MPI_Type_free( MPI_Datatype *datatype );
+int MPI_Type_get_extent( MPI_Datatype datatype, MPI_Aint *lb,
+                         MPI_Aint *extent );
+int MPI_Type_size( MPI_Datatype datatype, int *size );
+int MPI_Get_address( const void *location, MPI_Aint *address );
+int MPI_Get_count( const MPI_Status *status, MPI_Datatype datatype,
+                   int *count );
+int MPI_Pack( const void *inbuf, int incount, MPI_Datatype datatype,
+              void *outbuf, int outsize, int *position, MPI_Comm comm );
+int MPI_Unpack( const void *inbuf, int insize, int *position, void *outbuf,
+                int outcount, MPI_Datatype datatype, MPI_Comm comm );
+int MPI_Pack_size( int incount, MPI_Datatype datatype, MPI_Comm comm,
+                   int *size );
+
+/* point-to-point */
+int MPI_Send( const void *buf, int count, MPI_Datatype datatype, int dest,
+              int tag, MPI_Comm comm );
+int MPI_Recv( void *buf, int count, MPI_Datatype datatype, int source,
+              int tag, MPI_Comm comm, MPI_Status *status );
+int MPI_Isend( const void *buf, int count, MPI_Datatype datatype, int dest,
+               int tag, MPI_Comm comm, MPI_Request *request );
+int MPI_Irecv( void *buf, int count, MPI_Datatype datatype, int source,
+               int tag, MPI_Comm comm, MPI_Request *request );
+int MPI_Send_init( const void *buf, int count, MPI_Datatype datatype, int dest,
+                   int tag, MPI_Comm comm, MPI_Request *request );
+int MPI_Recv_init( void *buf, int count, MPI_Datatype datatype, int source,
+                   int tag, MPI_Comm comm, MPI_Request *request );
+int MPI_Start( MPI_Request *request );
+int MPI_Probe( int source, int tag, MPI_Comm comm, MPI_Status *status );
+int MPI_Iprobe( int source, int tag, MPI_Comm comm, int *flag,
+                MPI_Status *status );
+int MPI_Wait( MPI_Request *request, MPI_Status *status );
+int MPI_Test( MPI_Request *request, int *flag, MPI_Status *status );
+int MPI_Waitany( int count, MPI_Request requests[], int *index,
+                 MPI_Status *status );
+int MPI_Testany( int count, MPI_Request requests[], int *index, int *flag,
+                 MPI_Status *status );
+int MPI_Waitall( int count, MPI_Request requests[], MPI_Status statuses[] );
+int MPI_Cancel( MPI_Request *request );
+int MPI_Test_cancelled( const MPI_Status *status, int *flag );
+int MPI_Request_free( MPI_Request *request );
+
+/* collectives */
+int MPI_Barrier( MPI_Comm comm );
+int MPI_Bcast( void *buffer, int count, MPI_Datatype datatype, int root,
+               MPI_Comm comm );
+int MPI_Gatherv( const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                 void *recvbuf, const int recvcounts[], const int displs[],
+                 MPI_Datatype recvtype, int root, MPI_Comm comm );
+int MPI_Scatterv( const void *sendbuf, const int sendcounts[],
+                  const int displs[], MPI_Datatype sendtype, void *recvbuf,
+                  int recvcount, MPI_Datatype recvtype, int root,
+                  MPI_Comm comm );
+int MPI_Reduce( const void *sendbuf, void *recvbuf, int count,
+                MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm );
+int MPI_Op_create( MPI_User_function *function, int commute, MPI_Op *op );
+int MPI_Op_free( MPI_Op *op );
+
+/* windows, all in shared memory */
+int MPI_Win_allocate( MPI_Aint size, int disp_unit, MPI_Info info,
+                      MPI_Comm comm, void *baseptr, MPI_Win *win );
+int MPI_Win_allocate_shared( MPI_Aint size, int disp_unit, MPI_Info info,
+                             MPI_Comm comm, void *baseptr, MPI_Win *win );
+int MPI_Win_shared_query( MPI_Win win, int rank, MPI_Aint *size,
+                          int *disp_unit, void *baseptr );
+int MPI_Win_lock_all( int assert, MPI_Win win );
+int MPI_Win_unlock_all( MPI_Win win );
+int MPI_Win_sync( MPI_Win win );
+int MPI_Win_free( MPI_Win *win );
+int MPI_Win_flush( int rank, MPI_Win win );
+int MPI_Put( const void *origin_addr, int origin_count,
+             MPI_Datatype origin_datatype, int target_rank,
+             MPI_Aint target_disp, int target_count,
+             MPI_Datatype target_datatype, MPI_Win win );
+int MPI_Get( void *origin_addr, int origin_count,
+             MPI_Datatype origin_datatype, int target_rank,
+             MPI_Aint target_disp, int target_count,
+             MPI_Datatype target_datatype, MPI_Win win );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NOMPI_MPI_H */
@@ -41,15 +41,17 @@ buffer; ParseFormatStrings not picky enough. V1.0 (EM)
 #include <string.h>
 #include <stdarg.h>
 #include <ctype.h>
+#include <sched.h>
+#include <sys/mman.h>
 
 /*** Pilot global variables ***/
 
 int PI_QuietMode = 0;		// quiet mode off
 int PI_CheckLevel = 1;		// default level of checking
 int PI_OnErrorReturn = 0;	// on any error, abort program
-int PI_Errno = PI_NO_ERROR;	// error code returned here (if no abort)
-const char *PI_CallerFile;	// filename of caller (set by macro)
-int PI_CallerLine;		// line no. of caller (set by macro)
+PI_THREAD_LOCAL int PI_Errno = PI_NO_ERROR;	// error code returned here (if no abort)
+PI_THREAD_LOCAL const char *PI_CallerFile;	// filename of caller (set by macro)
+PI_THREAD_LOCAL int PI_CallerLine;		// line no. of caller (set by macro)
 
 /*** Forward declarations of internal-use functions ***/
 static void HandleMPIErrors( MPI_Comm *comm, int *code, ... );
@@ -57,14 +59,108 @@ static char *ParseArgs( int *argc, char ***argv );
 static void *OnlineThreadFunc( void *arg );
 static int OnlineProcessFunc( int a1, void *a2 );
 static int ParseFormatString( IO_DIRECTION readOrWrite, PI_MPI_RTTI meta[], const char *fmt, va_list ap );
+static int CachedFormat( IO_DIRECTION readOrWrite, PI_MPI_RTTI meta[], const char *fmt, va_list ap );
+static int CompileFormatString( PI_FORMAT *f, const char *fmt );
+static int BindFormatArgs( const PI_FORMAT *f, PI_MPI_RTTI meta[], va_list ap );
+static void FreeFormats( void );
+static void WriteChannel( PI_CHANNEL *c, const char *format, PI_MPI_RTTI mpiArgs[], int mpiArgCount );
+static void ReadChannel( PI_CHANNEL *c, const char *format, PI_MPI_RTTI mpiArgs[], int mpiArgCount );
+static int PackedSize( PI_MPI_RTTI meta[], int n, MPI_Comm comm );
+static int PackItems( PI_MPI_RTTI meta[], int n, void *buf, int size, MPI_Comm comm );
+static void UnpackItems( PI_MPI_RTTI meta[], int n, void *buf, int size, MPI_Comm comm );
+static void BcastItems( PI_MPI_RTTI meta[], int n, int isRoot, MPI_Comm comm );
+static void GathervItems( PI_MPI_RTTI meta[], int n, MPI_Comm comm );
+static PI_REQUEST *NewRequest( PI_CHANNEL *c, IO_DIRECTION dir, const char *format );
+static void StartRequest( PI_REQUEST *r );
+static void CompleteRequest( PI_REQUEST *r );
+static void FinishRequest( PI_REQUEST *r );
+static void FreePersistent( void );
+static void FreeOps( void );
+static void FreeComms( void );
+static void EndStream( PI_BUNDLE *b );
+static int GrowChannels( int more );
+static PI_CHANNEL *NewChannel( const PI_PROCESS *from, const PI_PROCESS *to );
+static PI_PROCESS *ProcessAt( int rank, int thread );
+static PI_PROCESS *BundleHub( const PI_BUNDLE *b );
+static int StartThreads( void );
+static void *ProcessThreadFunc( void *arg );
+static int StartTasks( void );
+static void TaskMain( int i );
+static void ReadyTask( PI_TASK *t );
+static void SwitchTask( PI_TASK *t );
+static void YieldTask( void );
+static void ParkTask( PI_CHANNEL *c );
+static void WakeTask( PI_CHANNEL *c );
+static void JoinTasks( void );
+static void WaitMPI( MPI_Request *req, MPI_Status *status );
+static void WaitAnyMPI( int n, MPI_Request reqs[], int *index, MPI_Status *status );
+static void ProbeMPI( int source, int tag, MPI_Comm comm, MPI_Status *status );
+static void SendMPI( void *buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm );
+static void RecvMPI( void *buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm );
+static int LocalRings( void );
+static int AssignChannelComms( void );
+static int ShareChannels( void );
+static void FreeRings( void );
+static void RingIdle( void );
+static void RingWait( PI_CHANNEL *c );
+static long RingSend( PI_CHANNEL *c, PI_MPI_RTTI meta[], int n, PI_REQUEST *r );
+static int RingRecv( PI_CHANNEL *c, PI_MPI_RTTI meta[], int n, PI_REQUEST *r );
+static void RingProgress( PI_CHANNEL *c );
+static int RingTest( PI_REQUEST *r );
+static void StartRingRequest( PI_REQUEST *r );
+static void PostRequest( PI_REQUEST *r, int init );
+static int RmaChannels( void );
+static void FreeRMA( void );
+static void RmaSend( PI_CHANNEL *c, PI_MPI_RTTI meta[], int n, PI_REQUEST *r );
+static void RmaRecv( PI_CHANNEL *c, PI_MPI_RTTI meta[], int n );
+static int RmaLayout( PI_CHANNEL *c, PI_MPI_RTTI meta[], int n, MPI_Aint disp[] );
+static void RmaGet( PI_CHANNEL *c, PI_MPI_RTTI meta[], int n, MPI_Aint disp[] );
+static int RmaNext( PI_CHANNEL *c, int block );
+static int RmaTake( PI_CHANNEL *c, int block );
+static int RmaTest( PI_REQUEST *r );
+static void RmaWait( PI_REQUEST *r );
+static void StartRmaRequest( PI_REQUEST *r );
+static int BufferChannels( void );
+static void FreeBuffers( void );
+static int RmaSlot( PI_CHANNEL *c, int block );
+static int BufNext( PI_CHANNEL *c, int block );
+static int BufTest( PI_REQUEST *r );
+static void BufWait( PI_REQUEST *r );
+static void StartBufRequest( PI_REQUEST *r );
+static void BufRead( PI_CHANNEL *c );
+static int BuildRimIndex( PI_BUNDLE *b );
+static int RimIndex( const PI_BUNDLE *b, int rank );
+static int RimClash( const PI_BUNDLE *b, int i, int j );
+static int FairSelect( PI_BUNDLE *b, int block );
+static void FreeRequest( PI_REQUEST *r );
 
 /*** Logging facility ***/
-typedef enum { PILOT='P', USER='U', TABLES='T', CALLS='C', STATS='S' } LOGEVENT;
-static void LogEvent( LOGEVENT ev, const char *event );
+typedef enum { PILOT='P', USER='U', TABLES='T', CALLS='C', STATS='S', ENDS='E' } LOGEVENT;
+static void LogRecord( LOGEVENT ev, const char *code, int id, const char *text );
+static void LogEnd( const char *code, int id, int seq );
+static void TraceLog( const char *fname );
+static int StartLog( void );
+static void SyncClock( void );
+static void CorrectLog( const char *fname, const double *clock );
+static long ItemBytes( const PI_MPI_RTTI mpiArgs[], int mpiArgCount );
+static void CountCall( PI_COUNTER *k, long bytes, double t0 );
+static void FillStats( const PI_COUNTER *k, PI_STATS *stats );
+static void SendStats( void );
+static void ReportStats( const char *fname, const PI_COUNTER *totals );
+
+/*! Tags of the messages to the online process on log_comm: batches of log
+    records, clock pings (answered with the OLP's clock), the offsets from
+    its clock that the processes find with them, and -pisvc=s counters and
+    their histograms. */
+enum { TAG_BATCH=0, TAG_PING, TAG_CLOCK, TAG_STATS, TAG_HIST };
+static void FlushLog( int wait );
 
 
 #define LOUD if( !PI_QuietMode )
 
+/*! Scrambles an MPI rank for use as a hash key (Knuth's multiplicative hash). */
+#define RANK_HASH( rank ) ( (unsigned)(rank) * 2654435761u >> 8 )
+
 
 /*!
 ********************************************************************************
@@ -76,12 +172,52 @@ occur for bookkeeping purposes as reads/writes take place.
 *******************************************************************************/
 static PI_PROCENVT thisproc = { .phase=PREINIT };
 
-static int MPICallLine;	/*!< line number of last MPI library call (PI_CALLMPI macro) */
+static __thread int MPICallLine;	/*!< line number of last MPI library call by this thread (PI_CALLMPI macro) */
 static int MPIMaxTag;	/*!< max tag number allowed by this MPI implementation */
 static int MPIPreInit;	/*!< non-0 if MPI already initialized when Pilot invoked */
 
 static pthread_t OnlineThreadID; /*!< ID of online thread, if any */
 
+/*! The Pilot process run by the calling thread (NULL before PI_StartAll), and
+    its thread no. within this MPI process, which is 0 unless -pithreads=n. */
+static __thread PI_PROCESS *MyProcess;
+static __thread int MyThread;
+
+/*! Serializes updates of tables that the threads of an MPI process share,
+    when it runs several Pilot processes (-pithreads=n).  Coroutines never
+    run at once, so they don't need it. */
+static pthread_mutex_t SharedLock = PTHREAD_MUTEX_INITIALIZER;
+#define THREADED ( thisproc.threads > 1 && !thisproc.svc_flag[COROUTINES] )
+#define LOCK_SHARED if ( THREADED ) pthread_mutex_lock( &SharedLock );
+#define UNLOCK_SHARED if ( THREADED ) pthread_mutex_unlock( &SharedLock );
+
+/*! Scheduler for -picoro=n: the coroutine running now (NULL unless the
+    coroutines have been started), the queue of those ready to run, and how
+    many have not finished. */
+static PI_TASK *RunningTask;
+static PI_TASK *ReadyHead, *ReadyTail;
+static int LiveTasks;
+
+/*! The calling Pilot process, or the one owning this MPI process before PI_StartAll. */
+#define THIS_PROCESS ( MyProcess ? MyProcess : &thisproc.processes[thisproc.rank] )
+
+/*! Whether the calling Pilot process is the write/read end of channel c. */
+#define IS_WRITER( c ) ( (c)->producer==thisproc.rank && (c)->prod_thread==MyThread )
+#define IS_READER( c ) ( (c)->consumer==thisproc.rank && (c)->cons_thread==MyThread )
+
+/*! The -pisvc=s counter of request r's end of its channel. */
+#define REQ_COUNTER( r ) ( (r)->channel->stats[ \
+    (r)->direction==IO_DIRECTION_WRITE ? STAT_WRITES : STAT_READS ] )
+
+/*! Rows in the process table: one per MPI process, and with -pithreads=n,
+    n-1 more for each one that can run user processes (all but a Pilot OLP). */
+#define PROCESS_ROWS ( thisproc.worldsize + (thisproc.threads - 1) * \
+                       (thisproc.worldsize - thisproc.svc_flag[OLP_RANK]) )
+
+/*! Formats compiled on behalf of PI_Write, PI_Read, etc., hashed by format
+    pointer.  Entries are replaced on collision and freed by PI_StopMain. */
+static PI_FORMAT *FormatCache[PI_FORMAT_CACHE];
+
 /* Command-line options:
 These variables are only meaningful on node 0 (and we assume that only
 node 0 can write files).  The resulting service flag settings are broadcast
@@ -92,6 +228,9 @@ static char *LogFilename;	/*!< Path to log file. NULL = no log file needed. */
 static enum {OLP_NONE, OLP_THREAD, OLP_PILOT} OnlineProcess;
 enum {OPT_CALLS=0, OPT_STATS, OPT_TOPO, OPT_TRACE, OPT_DEADLOCK, OPT_END};
 static unsigned char Option[OPT_END];	/*!< List of command-line options. 1/0 = flag set/clear */
+static int ShmMode;		/*!< Use of shared memory rings (-pishm=n), see enum SHM_OFF. */
+static int Threads;		/*!< Most Pilot processes per MPI process (-pithreads=n). */
+static int Coroutines;		/*!< Non-0 if they are coroutines instead (-picoro=n). */
 
 
 /*** Public API; each PI_Foo_ is called via PI_Foo wrapper macro ***/
@@ -108,6 +247,9 @@ int PI_Configure_( int *argc, char ***argv )
 
     thisproc.phase = CONFIG;
     thisproc.start_time = -1.0;
+    thisproc.log_batch[0] = thisproc.log_batch[1] = NULL;	// made by PI_StartAll if logging
+    thisproc.log_req = MPI_REQUEST_NULL;
+    thisproc.log_comm = MPI_COMM_NULL;
 
     /* Process command line arguments into LogFilename, OnlineProcess, and
        Option array.  May override caller's setting of PI_CheckLevel.
@@ -132,7 +274,8 @@ int PI_Configure_( int *argc, char ***argv )
     MPI_Initialized( &MPIPreInit );	/* did user already initialize MPI? */
     if ( !MPIPreInit ) {
         MPI_Init_thread( argc, argv,
-                         OnlineProcess==OLP_THREAD ? MPI_THREAD_MULTIPLE : MPI_THREAD_SINGLE,
+                         OnlineProcess==OLP_THREAD || ( Threads > 1 && !Coroutines ) ?
+                         MPI_THREAD_MULTIPLE : MPI_THREAD_SINGLE,
                          &provided );		/* starts MPI */
     }
     else
@@ -159,7 +302,16 @@ int PI_Configure_( int *argc, char ***argv )
 /////////////// OnlineProcess is available for MPI_Init?
         /* go through the options and determine their runtime implications,
            setting appropriate service flags */
-        int i, anyopts = 0;
+        int i, anyopts = 0, nodeadlock = 0;
+
+        /* the deadlock detector only knows one Pilot process per MPI process */
+        if ( Threads > 1 && Option[OPT_DEADLOCK] ) {
+            Option[OPT_DEADLOCK] = 0;
+            nodeadlock = 1;
+        }
+        thisproc.threads = Threads;
+        thisproc.svc_flag[COROUTINES] = Coroutines;
+
         for ( i=0; i<OPT_END; i++ )
             anyopts = anyopts || Option[i];
 
@@ -169,6 +321,7 @@ int PI_Configure_( int *argc, char ***argv )
         thisproc.svc_flag[LOG_CALLS] = Option[OPT_CALLS] ||
             Option[OPT_TRACE] || Option[OPT_DEADLOCK] ? 1 : 0;
         thisproc.svc_flag[LOG_STATS] = Option[OPT_STATS] ? 1 : 0;
+        thisproc.svc_flag[LOG_TRACE] = Option[OPT_TRACE] ? 1 : 0;
 
         /* services needing an online process/thread */
         thisproc.svc_flag[OLP_DEADLOCK] = Option[OPT_DEADLOCK] ? 1 : 0;
@@ -199,6 +352,9 @@ int PI_Configure_( int *argc, char ***argv )
         thisproc.svc_flag[LOGGING] =
                 anyopts || thisproc.svc_flag[OLP_LOGFILE] ? 1 : 0;
 
+        /* channels between processes on the same node use rings unless off */
+        thisproc.svc_flag[SHM_MODE] = ShmMode;
+
 /* TESTING: print summary of args
         for ( i=0; i<OPT_END; i++) printf( " %d", Option[i] );
         printf( "; any = %d; olp = %d; fname = %s\n", anyopts, OnlineProcess,
@@ -222,6 +378,15 @@ int PI_Configure_( int *argc, char ***argv )
             if ( Option[OPT_TRACE] ) printf( " Tracing" );
             if ( Option[OPT_DEADLOCK] ) printf( " Deadlock_detection" );
             printf( "\n" );
+            if ( nodeadlock )
+                printf( "*** Deadlock detection is not available with -pi%s\n",
+                        Coroutines ? "coro" : "threads" );
+            if ( Threads > 1 )
+                printf( "*** Pilot processes per MPI process: up to %d, as %s\n",
+                        Threads, Coroutines ? "coroutines" : "threads" );
+            printf( "*** Channels within a node: %s\n",
+                    ShmMode==SHM_OFF ? "MPI" :
+                    ShmMode==SHM_SYNC ? "shared memory, synchronous" : "shared memory" );
             if ( LogFilename )
                 printf( "*** Logging to file: %s\n", LogFilename );
             if ( OnlineProcess==OLP_THREAD )
@@ -242,30 +407,53 @@ int PI_Configure_( int *argc, char ***argv )
 
     PI_CALLMPI( MPI_Bcast( thisproc.svc_flag, SVC_END, MPI_UNSIGNED_CHAR, PI_MAIN,
                            MPI_COMM_WORLD ) )
+    PI_CALLMPI( MPI_Bcast( &thisproc.threads, 1, MPI_INT, PI_MAIN, MPI_COMM_WORLD ) )
+
+    /* every MPI process running threads needs to be able to call MPI from them */
+    PI_ASSERT( , !THREADED || provided==MPI_THREAD_MULTIPLE, PI_THREAD_SUPPORT )
 
     /* initialize table of processes */
     thisproc.processes =
-        ( PI_PROCESS * ) malloc( sizeof( PI_PROCESS ) * thisproc.worldsize );
+        ( PI_PROCESS * ) malloc( sizeof( PI_PROCESS ) * PROCESS_ROWS );
     PI_ASSERT( , thisproc.processes, PI_MALLOC_ERROR )
 
     /* initialize table of process aliases: default is Pn */
-    for ( i = 0; i < thisproc.worldsize; i++ ) {
+    for ( i = 0; i < PROCESS_ROWS; i++ ) {
         sprintf( thisproc.processes[i].name, "P%d", i );
     }
 
     /* initialize table of function pointers */
-    for ( i = 0; i < thisproc.worldsize; i++ ) {
+    for ( i = 0; i < PROCESS_ROWS; i++ ) {
         thisproc.processes[i].run = NULL;
     }
-
-    thisproc.channels = NULL;	// grow using realloc on demand
-
-    /* allocate bundle table */
-    thisproc.bundles = malloc( sizeof( PI_BUNDLE * ) * PI_MAX_BUNDLES );
-
-    for ( i = 0; i < PI_MAX_BUNDLES; i++ ) {
-        thisproc.bundles[i] = NULL;
-    }
+    thisproc.workers = NULL;	// threads for processes past the first on
+    thisproc.allocated_workers = 0;	// each rank, started by PI_StartAll
+    thisproc.tasks = NULL;		// or coroutines instead (-picoro=n)
+    thisproc.allocated_tasks = 0;
+    thisproc.task_stacks = NULL;
+    RunningTask = ReadyHead = ReadyTail = NULL;
+    MyProcess = NULL;
+    MyThread = 0;
+
+    thisproc.channels = NULL;	// grow by doubling on demand
+    thisproc.channel_rows = 0;
+    thisproc.allocated_comms = 0;	// channel communicators, dup'd by PI_StartAll
+    thisproc.comms = NULL;
+    thisproc.queue_width = 0;
+    thisproc.recvs = thisproc.recvs_waiting = 0;
+    thisproc.node_comm = MPI_COMM_NULL;	// made by PI_StartAll, with the rings
+    thisproc.ring_win = MPI_WIN_NULL;
+    thisproc.rings = 0;
+    thisproc.local_rings = NULL;
+    thisproc.flow_comm = MPI_COMM_NULL;	// made by PI_StartAll if any channel needs it
+    thisproc.rma_win = MPI_WIN_NULL;
+    thisproc.formats = NULL;	// no compiled formats yet
+    thisproc.persistent = NULL;	// no persistent requests yet
+    thisproc.allocated_ops = 0;	// no user-defined reduction ops yet
+    thisproc.ops = NULL;
+
+    thisproc.bundles = NULL;	// grow by doubling on demand
+    thisproc.bundle_rows = 0;
 
     /* initialize process, channel, bundle counts */
     thisproc.allocated_processes = 0;
@@ -287,18 +475,21 @@ int PI_Configure_( int *argc, char ***argv )
 			"Pilot Online Process" );
     }
 
-    return i;	/* no. of processes available to user, including PI_MAIN */
+    return i * thisproc.threads;	/* no. of processes available to user, including PI_MAIN */
 }
 
-/* Note: Process IDs (=MPI rank) run from 0 */
+/* Note: Process IDs run from 0, and are the MPI rank for the first worldsize */
 PI_PROCESS *PI_CreateProcess_( PI_WORK_FUNC f, int index, void *opt_pointer )
 {
     PI_ON_ERROR_RETURN( NULL )
     PI_ASSERT( , thisproc.phase==CONFIG, PI_WRONG_PHASE )
 
-    /* assign the new process the next available MPI process rank */
-    int r = thisproc.allocated_processes++;
-    PI_ASSERT( , r<thisproc.worldsize, PI_INSUFFICIENT_MPIPROCS )
+    /* assign the new process the next available MPI process rank, or once
+       they're all taken, the next thread, dealing them out over the ranks
+       that run user processes */
+    int r = thisproc.allocated_processes;
+    PI_ASSERT( , r<PROCESS_ROWS, PI_INSUFFICIENT_MPIPROCS )
+    thisproc.allocated_processes++;
 
     /* must supply function unless it's the zero main process */
     PI_ASSERT( , r==0 || f!=NULL, PI_NULL_FUNCTION )
@@ -308,62 +499,120 @@ PI_PROCESS *PI_CreateProcess_( PI_WORK_FUNC f, int index, void *opt_pointer )
     snprintf( thisproc.processes[r].name, PI_MAX_NAMELEN, "P%d", r ); // default name "Pn"
     thisproc.processes[r].argument = index;
     thisproc.processes[r].argument2 = opt_pointer;
-    thisproc.processes[r].rank = r;
+    if ( r < thisproc.worldsize ) {
+        thisproc.processes[r].rank = r;
+        thisproc.processes[r].thread = 0;
+    }
+    else {
+        int olp = thisproc.svc_flag[OLP_RANK];	// rank 1 if Pilot OLP, else none
+        int k = r - thisproc.worldsize, ranks = thisproc.worldsize - olp;
+        thisproc.processes[r].rank = k % ranks + ( olp && k % ranks >= olp );
+        thisproc.processes[r].thread = 1 + k / ranks;
+    }
     thisproc.processes[r].magic = PI_PROC;
     return &thisproc.processes[r];
 }
 
-/* Note: Channel tags run from 1, with 0 reserved for special use, i.e.,
-   log messages */
-PI_CHANNEL *PI_CreateChannel_( PI_PROCESS *from, PI_PROCESS *to )
+PI_PROCESS **PI_CreateProcessArray_( PI_WORK_FUNC f, int size, void *opt_pointer )
 {
     PI_ON_ERROR_RETURN( NULL )
     PI_ASSERT( , thisproc.phase==CONFIG, PI_WRONG_PHASE )
+    PI_ASSERT( , size>0, PI_ZERO_MEMBERS )
+    PI_ASSERT( , f!=NULL, PI_NULL_FUNCTION )
+
+    /* check capacity up front, so that nothing is created if it won't fit */
+    PI_ASSERT( , thisproc.allocated_processes+size<=PROCESS_ROWS,
+		PI_INSUFFICIENT_MPIPROCS )
+
+    PI_PROCESS **newArray = malloc( sizeof( PI_PROCESS * ) * size );
+    PI_ASSERT( , newArray, PI_MALLOC_ERROR )
+
+    int i;
+    for ( i = 0; i < size; i++ ) {
+        newArray[i] = PI_CreateProcess_( f, i, opt_pointer );
+        if ( newArray[i] == NULL ) {	// error already reported
+            free( newArray );
+            return NULL;
+        }
+    }
+    return newArray;
+}
 
-    int f, t;		// MPI ranks of from/to processes
+/* Note: Channel tags and communicators are assigned by PI_StartAll; log
+   messages use tag 0 on MPI_COMM_WORLD */
+PI_CHANNEL *PI_CreateChannel_( PI_PROCESS *from, PI_PROCESS *to )
+{
+    PI_ON_ERROR_RETURN( NULL )
+    PI_ASSERT( , thisproc.phase==CONFIG, PI_WRONG_PHASE )
 
     if ( from == NULL ) {
-        f = PI_MAIN;
+        from = &thisproc.processes[PI_MAIN];
     } else {
         PI_ASSERT( LEVEL(1), ISVALID(PI_PROC,from), PI_SYSTEM_ERROR )
-        f = from->rank;
     }
 
     if ( to == NULL ) {
-        t = PI_MAIN;
+        to = &thisproc.processes[PI_MAIN];
     } else {
         PI_ASSERT( LEVEL(1), ISVALID(PI_PROC,to), PI_SYSTEM_ERROR )
-        t = to->rank;
     }
 
-    PI_ASSERT( , t!=f, PI_ENDPOINT_DUPLICATE )
+    PI_ASSERT( , to!=from, PI_ENDPOINT_DUPLICATE )
 
-    PI_CHANNEL *pc = malloc( sizeof( PI_CHANNEL ) );
-    PI_ASSERT( , pc, PI_MALLOC_ERROR )
+    return NewChannel( from, to );
+}
 
-    // expand array of PI_CHANNEL* pointers
-    thisproc.channels = realloc( thisproc.channels,
-			(1+thisproc.allocated_channels)*sizeof(PI_CHANNEL*) );
-    PI_ASSERT( , thisproc.channels, PI_MALLOC_ERROR )
-    thisproc.channels[thisproc.allocated_channels] = pc;
+/* Note: Credits and send slots are made by PI_StartAll (see BufferChannels) */
+PI_CHANNEL *PI_CreateBufferedChannel_( PI_PROCESS *from, PI_PROCESS *to, int capacity )
+{
+    PI_ON_ERROR_RETURN( NULL )
+    PI_ASSERT( , thisproc.phase==CONFIG, PI_WRONG_PHASE )
+    PI_ASSERT( , capacity>=1, PI_CHANNEL_CAPACITY )
 
-    /* channel ID & initial tag is just 1+no. allocated so far */
-    pc->chan_id = pc->chan_tag = ++thisproc.allocated_channels;
+    PI_CHANNEL *c = PI_CreateChannel_( from, to );
+    if ( c == NULL ) return NULL;	// error already reported
 
-    /* it's unlikely that the user will blow past this limit, but better check */
-    PI_ASSERT( , pc->chan_tag<MPIMaxTag, PI_MAX_TAGS )
+    c->capacity = capacity;
+    return c;
+}
 
-    pc->producer = f;
-    pc->consumer = t;
+PI_CHANNEL **PI_CreateChannelArray_( PI_PROCESS *const from[], PI_PROCESS *const to[], int size )
+{
+    PI_ON_ERROR_RETURN( NULL )
+    PI_ASSERT( , thisproc.phase==CONFIG, PI_WRONG_PHASE )
+    PI_ASSERT( , size>0, PI_ZERO_MEMBERS )
 
-    snprintf( pc->name, PI_MAX_NAMELEN,
-		"C%d:P%d>P%d", pc->chan_id, f, t ); // default name "Cn:Pf>Pt"
+    /* check all the endpoints before creating anything */
+    int i;
+    PI_PROCESS *f, *t, *pmain = &thisproc.processes[PI_MAIN];
+    for ( i = 0; i < size; i++ ) {
+        f = t = pmain;
+        if ( from && from[i] ) {
+            PI_ASSERT( LEVEL(1), ISVALID(PI_PROC,from[i]), PI_SYSTEM_ERROR )
+            f = from[i];
+        }
+        if ( to && to[i] ) {
+            PI_ASSERT( LEVEL(1), ISVALID(PI_PROC,to[i]), PI_SYSTEM_ERROR )
+            t = to[i];
+        }
+        PI_ASSERT( , t!=f, PI_ENDPOINT_DUPLICATE )
+    }
 
-    pc->bundle = NULL;		/* initially not part of bundle */
-    pc->write_count = 0;
-    pc->magic = PI_CHAN;
+    /* make room for all of them at once */
+    if ( !GrowChannels( size ) ) return NULL;	// error already reported
 
-    return pc;
+    PI_CHANNEL **newArray = malloc( sizeof( PI_CHANNEL * ) * size );
+    PI_ASSERT( , newArray, PI_MALLOC_ERROR )
+
+    for ( i = 0; i < size; i++ ) {
+        f = from && from[i] ? from[i] : pmain;
+        t = to && to[i] ? to[i] : pmain;
+        if ( ( newArray[i] = NewChannel( f, t ) ) == NULL ) {
+            free( newArray );
+            return NULL;			// error already reported
+        }
+    }
+    return newArray;
 }
 
 PI_BUNDLE *PI_CreateBundle_( enum PI_BUNUSE usage, PI_CHANNEL *const array[], int size )
@@ -372,7 +621,16 @@ PI_BUNDLE *PI_CreateBundle_( enum PI_BUNUSE usage, PI_CHANNEL *const array[], in
     PI_ASSERT( , thisproc.phase==CONFIG, PI_WRONG_PHASE )
     PI_ASSERT( , array, PI_NULL_CHANNEL )
     PI_ASSERT( , size>0, PI_ZERO_MEMBERS )
-    PI_ASSERT( , thisproc.allocated_bundles<PI_MAX_BUNDLES, PI_MAX_BUNDLES )
+
+    /* expand table of PI_BUNDLE* pointers if full; IDs are indexes, so
+       existing bundles keep theirs */
+    if ( thisproc.allocated_bundles == thisproc.bundle_rows ) {
+        int rows = thisproc.bundle_rows ? 2 * thisproc.bundle_rows : PI_BUNDLE_ROWS;
+        PI_BUNDLE **table = realloc( thisproc.bundles, rows * sizeof( PI_BUNDLE * ) );
+        PI_ASSERT( , table, PI_MALLOC_ERROR )
+        thisproc.bundles = table;
+        thisproc.bundle_rows = rows;
+    }
 
     PI_BUNDLE *b = malloc( sizeof( PI_BUNDLE ) );
     PI_ASSERT( , b, PI_MALLOC_ERROR )
@@ -380,19 +638,28 @@ PI_BUNDLE *PI_CreateBundle_( enum PI_BUNUSE usage, PI_CHANNEL *const array[], in
     /* Depending on the bundle usage, we'll extract some properties from the
        first channel and propagate them to the others in the bundle:
        - all have a common endpoint, either the producer or consumer
-       - a Selector has a common tag; collective bundles don't use tags
+       - a Selector will have a common tag and communicator, assigned by
+         PI_StartAll; collective bundles don't use tags
     */
     PI_ASSERT( LEVEL(1), ISVALID(PI_CHAN,array[0]), PI_SYSTEM_ERROR )
-    int commonEnd = usage==PI_BROADCAST ? array[0]->producer : array[0]->consumer;
-    int commonTag = usage==PI_SELECT ? array[0]->chan_tag : 0;
+    int fromHub = usage==PI_BROADCAST || usage==PI_SCATTER;	// hub writes
+    int commonEnd = fromHub ? array[0]->producer : array[0]->consumer;
+    int commonThread = fromHub ? array[0]->prod_thread : array[0]->cons_thread;
 
     b->usage = usage;
     b->size = size;
+    b->policy = PI_SELECT_FIFO;
+    b->weights = b->current = NULL;
+    b->cursor = 0;
+    b->streamreq = NULL;
+    b->streambuf = NULL;
+    b->streamsize = b->streamleft = 0;
+    memset( &b->stats, 0, sizeof( b->stats ) );
     b->channels = malloc( sizeof( PI_CHANNEL * ) * size );
     PI_ASSERT( , b->channels, PI_MALLOC_ERROR )
 
-    /* copy array of channels into bundle, checking/setting properties */
-    int i, j;
+    /* copy array of channels into bundle, checking properties */
+    int i;
     for ( i = 0; i < size; i++ ) {
         PI_ASSERT( LEVEL(1), ISVALID(PI_CHAN,array[i]), PI_SYSTEM_ERROR )
 
@@ -400,33 +667,37 @@ PI_BUNDLE *PI_CreateBundle_( enum PI_BUNUSE usage, PI_CHANNEL *const array[], in
         switch ( usage ) {
         case PI_SELECT:
 	case PI_GATHER:
-            PI_ASSERT( , array[i]->consumer==commonEnd, PI_BUNDLE_READEND )
+	case PI_GATHERV:
+	case PI_REDUCE:
+            PI_ASSERT( , array[i]->consumer==commonEnd &&
+                         array[i]->cons_thread==commonThread, PI_BUNDLE_READEND )
             break;
         case PI_BROADCAST:
-            PI_ASSERT( , array[i]->producer==commonEnd, PI_BUNDLE_WRITEEND )
+        case PI_SCATTER:
+            PI_ASSERT( , array[i]->producer==commonEnd &&
+                         array[i]->prod_thread==commonThread, PI_BUNDLE_WRITEEND )
             break;
         }
 
-        /* verify that there are no duplicate processes on rim */
-        for ( j = 1; j < i; j++ ) {
-            if ( usage == PI_BROADCAST ) {
-                PI_ASSERT( , array[i]->consumer!=array[j]->consumer, PI_BUNDLE_DUPLICATE )
-            } else {
-                PI_ASSERT( , array[i]->producer!=array[j]->producer, PI_BUNDLE_DUPLICATE )
-            }
-        }
-
-        /* propagate common tag for Selector bundle */
-        if ( usage == PI_SELECT )
-            array[i]->chan_tag = commonTag;
-        /* make each member of collective channel point to this bundle */
-        else
-            array[i]->bundle = b;
+        /* a collective's processes each need a rank in its communicator */
+        PI_ASSERT( , usage==PI_SELECT || commonEnd !=
+                     ( fromHub ? array[i]->consumer : array[i]->producer ),
+                     PI_BUNDLE_RANKS )
 
         b->channels[i] = array[i];	// store the channel member in bundle
     }
 
-    b->narrow_end = usage==PI_BROADCAST ? FROM : TO;
+    b->narrow_end = fromHub ? FROM : TO;
+
+    /* build table to map rank of rim process => channel index; this also
+       verifies that there are no duplicate processes on rim */
+    if ( !BuildRimIndex( b ) ) return NULL;	// error already reported
+
+    /* make each member of collective channel point to this bundle */
+    if ( usage != PI_SELECT ) {
+        for ( i = 0; i < size; i++ )
+            array[i]->bundle = b;
+    }
 
     if ( usage == PI_SELECT ) {
         b->comm = MPI_COMM_WORLD;
@@ -441,11 +712,11 @@ PI_BUNDLE *PI_CreateBundle_( enum PI_BUNUSE usage, PI_CHANNEL *const array[], in
         PI_ASSERT( , ranks, PI_MALLOC_ERROR )
 
         /* fill in ranks array for new group; bundle base goes in rank 0 */
-        if ( usage == PI_BROADCAST ) {
+        if ( fromHub ) {		/* BROADCAST or SCATTER */
             ranks[0] = b->channels[0]->producer;
             for ( i = 1; i < ( b->size + 1 ); i++ )
                 ranks[i] = b->channels[i-1]->consumer;
-        } else {	/* GATHER */
+        } else {	/* GATHER, GATHERV or REDUCE */
             ranks[0] = b->channels[0]->consumer;
             for ( i = 1; i < ( b->size + 1 ); i++ )
                 ranks[i] = b->channels[i-1]->producer;
@@ -455,6 +726,21 @@ PI_BUNDLE *PI_CreateBundle_( enum PI_BUNUSE usage, PI_CHANNEL *const array[], in
         free( ranks );
 
         PI_CALLMPI( MPI_Comm_create( MPI_COMM_WORLD, group, &( b->comm ) ) )
+
+        /* The hub receives PI_Reduce's result without contributing to it,
+           which is how MPI_Reduce works across an intercommunicator, so
+           split the bundle's communicator into a hub group and a rim group */
+        if ( usage == PI_REDUCE && b->comm != MPI_COMM_NULL ) {
+            MPI_Comm side, inter;
+            int hub = thisproc.rank == b->channels[0]->consumer;
+
+            PI_CALLMPI( MPI_Comm_split( b->comm, hub ? 0 : 1, 0, &side ) )
+            PI_CALLMPI( MPI_Intercomm_create( side, 0, b->comm, hub ? 1 : 0,
+                                              0, &inter ) )
+            PI_CALLMPI( MPI_Comm_free( &side ) )
+            PI_CALLMPI( MPI_Comm_free( &( b->comm ) ) )
+            b->comm = inter;
+        }
     }
 
     b->magic = PI_BUND;
@@ -463,12 +749,76 @@ PI_BUNDLE *PI_CreateBundle_( enum PI_BUNUSE usage, PI_CHANNEL *const array[], in
     /* bundle ID is just 1+no. allocated so far */
     b->bund_id = ++thisproc.allocated_bundles;
 
-    snprintf( b->name, PI_MAX_NAMELEN,
-		"B%d@P%d", b->bund_id, commonEnd ); // default name "Bn@Pc"
+    snprintf( b->name, PI_MAX_NAMELEN, "B%d@P%d", b->bund_id,
+		(int)( ProcessAt( commonEnd, commonThread ) - thisproc.processes ) ); // default name "Bn@Pc"
 
     return b;
 }
 
+void PI_SetSelectPolicy_( PI_BUNDLE *b, enum PI_SELPOLICY policy, const int weights[] )
+{
+    PI_ON_ERROR_RETURN()
+    PI_ASSERT( , thisproc.phase==CONFIG, PI_WRONG_PHASE )
+    PI_ASSERT( , b, PI_NULL_BUNDLE )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_BUND,b), PI_SYSTEM_ERROR )
+    PI_ASSERT( , b->usage==PI_SELECT, PI_BUNDLE_USAGE )
+    PI_ASSERT( , policy==PI_SELECT_FIFO || policy==PI_SELECT_ROUND_ROBIN ||
+                 policy==PI_SELECT_PRIORITY, PI_SELECT_POLICY )
+
+    int i, total = 0;
+
+    if ( policy == PI_SELECT_PRIORITY ) {
+        PI_ASSERT( , weights, PI_SELECT_POLICY )
+        for ( i = 0; i < b->size; i++ ) {
+            PI_ASSERT( , weights[i] >= 0, PI_SELECT_POLICY )
+            total += weights[i];
+        }
+        PI_ASSERT( , total > 0, PI_SELECT_POLICY )
+    }
+
+    /* discard any previous policy's weights */
+    free( b->weights );
+    free( b->current );
+    b->weights = b->current = NULL;
+
+    if ( policy == PI_SELECT_PRIORITY ) {
+        b->weights = malloc( sizeof( int ) * b->size );
+        b->current = calloc( b->size, sizeof( int ) );
+        PI_ASSERT( , b->weights && b->current, PI_MALLOC_ERROR )
+        memcpy( b->weights, weights, sizeof( int ) * b->size );
+    }
+
+    b->policy = policy;
+    b->cursor = 0;
+}
+
+void PI_SetRMA_( PI_CHANNEL *c, int size )
+{
+    PI_ON_ERROR_RETURN()
+    PI_ASSERT( , thisproc.phase==CONFIG, PI_WRONG_PHASE )
+    PI_ASSERT( , c, PI_NULL_CHANNEL )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_CHAN,c), PI_SYSTEM_ERROR )
+    PI_ASSERT( , size==0 || size>=PI_RMA_MIN, PI_RMA_SIZE )	// else never used
+
+    c->rma_size = size;
+}
+
+int PI_CreateOp_( PI_OPFUNC *func, int commute )
+{
+    PI_ON_ERROR_RETURN( -1 )
+    PI_ASSERT( , thisproc.phase==CONFIG, PI_WRONG_PHASE )
+    PI_ASSERT( , func, PI_NULL_FUNCTION )
+
+    MPI_Op *ops = realloc( thisproc.ops, sizeof( MPI_Op ) * (thisproc.allocated_ops + 1) );
+    PI_ASSERT( , ops, PI_MALLOC_ERROR )
+    thisproc.ops = ops;
+
+    PI_CALLMPI( MPI_Op_create( (MPI_User_function *)func, commute,
+                               &ops[thisproc.allocated_ops] ) )
+
+    return PI_BUILTIN_OPS + thisproc.allocated_ops++;
+}
+
 PI_CHANNEL **PI_CopyChannels_( enum PI_COPYDIR direction, PI_CHANNEL *const array[], int size )
 {
     PI_ON_ERROR_RETURN(NULL)
@@ -476,21 +826,28 @@ PI_CHANNEL **PI_CopyChannels_( enum PI_COPYDIR direction, PI_CHANNEL *const arra
     PI_ASSERT( , array, PI_NULL_CHANNEL )
     PI_ASSERT( , size>0, PI_ZERO_MEMBERS )
 
-    PI_CHANNEL **newArray = malloc( sizeof( PI_CHANNEL * ) * size );
-    PI_ASSERT( , newArray, PI_MALLOC_ERROR )
-
-    /* create channels with same or reversed endpoints */
     int i;
-    PI_PROCESS *from, *to;
     for ( i = 0; i < size; i++ ) {
         PI_ASSERT( LEVEL(1), ISVALID(PI_CHAN,array[i]), PI_SYSTEM_ERROR )
+    }
 
-	from = &thisproc.processes[array[i]->producer];
-	to = &thisproc.processes[array[i]->consumer];
+    /* make room for all of them at once */
+    if ( !GrowChannels( size ) ) return NULL;	// error already reported
 
+    PI_CHANNEL **newArray = malloc( sizeof( PI_CHANNEL * ) * size );
+    PI_ASSERT( , newArray, PI_MALLOC_ERROR )
+
+    /* create channels with same or reversed endpoints */
+    for ( i = 0; i < size; i++ ) {
+	PI_PROCESS *from = ProcessAt( array[i]->producer, array[i]->prod_thread );
+	PI_PROCESS *to = ProcessAt( array[i]->consumer, array[i]->cons_thread );
 	newArray[i] = direction==PI_SAME ?
-	    PI_CreateChannel_( from, to ) :
-	    PI_CreateChannel_( to, from );
+	    NewChannel( from, to ) :
+	    NewChannel( to, from );
+	if ( newArray[i] == NULL ) {
+	    free( newArray );
+	    return NULL;			// error already reported
+	}
     }
     return newArray;
 }
@@ -531,6 +888,21 @@ int PI_StartAll_( void )
 
     thisproc.phase = RUNNING;
 
+    /* give channels their MPI communicators and tags, now they're all known */
+    if ( !AssignChannelComms() ) return 0;	// error already reported
+
+    /* make the RMA slots before the rings, which leave those channels alone */
+    if ( !RmaChannels() ) return 0;	// error already reported
+
+    /* as they do buffered channels, which get their send slots */
+    if ( !BufferChannels() ) return 0;	// error already reported
+
+    /* and put channels within a node on shared memory rings */
+    if ( !ShareChannels() ) return 0;	// error already reported
+
+    /* and give the processes that log their batches for log records */
+    if ( !StartLog() ) return 0;	// error already reported
+
     if ( thisproc.rank == 0 ) {
 
         LOUD printf( "*** Allocated Pilot processes: %d; channels: %d; bundles: %d\n",
@@ -543,6 +915,7 @@ int PI_StartAll_( void )
 
         /* synchronize on barrier below, now we're done printing */
         MPI_Barrier( MPI_COMM_WORLD );  //// matches barrier below ////
+        thisproc.log_start = MPI_Wtime();	// log records are timed from here
 
         /* If an online thread needs to be started, create it now */
         if ( OnlineProcess == OLP_THREAD ) {
@@ -551,6 +924,8 @@ int PI_StartAll_( void )
                 PI_START_THREAD )
         }
 
+        MyProcess = &thisproc.processes[0];
+
         /* If there is a log file, we have to explicitly send the filename
            length and string.  The online process/thread will be waiting to
            receive this.  (An online thread could get it out of this node's
@@ -566,15 +941,24 @@ int PI_StartAll_( void )
             }
         }
 
+        /* now the OLP is ready for our clock to be compared with its own,
+           then other processes here can log */
+        SyncClock();
+        if ( !StartThreads() ) return 0;	// error already reported
+
         return 0;
         /* continues executing main(), the master process */
     }
 
     MPI_Barrier( MPI_COMM_WORLD );  //// matches barrier above ////
+    thisproc.log_start = MPI_Wtime();
+    SyncClock();
 
-    PI_PROCESS *p = &thisproc.processes[thisproc.rank];
+    PI_PROCESS *p = MyProcess = &thisproc.processes[thisproc.rank];
     int status = 0;
 
+    if ( !StartThreads() ) return 0;	// error already reported
+
     if ( p->run ) {
         /* execute function associated with allocated process */
         status = p->run( p->argument, p->argument2 );
@@ -603,7 +987,7 @@ const char *PI_GetName_(const void *object)
     /* special case NULL object -> name of this process */
 
     if ( object == NULL )
-	return thisproc.processes[thisproc.rank].name;
+	return THIS_PROCESS->name;
 
     /* probe magic number to identify object type */
 
@@ -625,6 +1009,31 @@ int PI_GetMyRank( void )
     return thisproc.rank;
 }
 
+PI_FORMAT *PI_CompileFormat_( enum PI_FMTDIR direction, const char *format )
+{
+    PI_ON_ERROR_RETURN( NULL )
+    PI_ASSERT( , thisproc.phase==CONFIG || thisproc.phase==RUNNING, PI_WRONG_PHASE )
+    PI_ASSERT( , format, PI_NULL_FORMAT )
+    PI_ASSERT( , direction==PI_READ || direction==PI_WRITE, PI_FORMAT_ARGS )
+
+    PI_FORMAT *f = malloc( sizeof( PI_FORMAT ) );
+    PI_ASSERT( , f, PI_MALLOC_ERROR )
+
+    f->direction = direction==PI_READ ? IO_DIRECTION_READ : IO_DIRECTION_WRITE;
+    if ( CompileFormatString( f, format ) < 0 ) {
+        free( f );
+        return NULL;		// error already reported
+    }
+
+    /* link into list of user formats so PI_StopMain can free it */
+    LOCK_SHARED
+    f->next = thisproc.formats;
+    thisproc.formats = f;
+    UNLOCK_SHARED
+
+    return f;
+}
+
 void PI_Write_( PI_CHANNEL *c, const char *format, ... )
 {
     PI_ON_ERROR_RETURN()
@@ -632,9 +1041,8 @@ void PI_Write_( PI_CHANNEL *c, const char *format, ... )
     PI_ASSERT( , c, PI_NULL_CHANNEL )
     PI_ASSERT( , format, PI_NULL_FORMAT )
     PI_ASSERT( LEVEL(1), ISVALID(PI_CHAN,c), PI_SYSTEM_ERROR )
-    PI_ASSERT( , c->producer==thisproc.rank, PI_ENDPOINT_WRITER )
+    PI_ASSERT( , IS_WRITER( c ), PI_ENDPOINT_WRITER )
 
-    int i;
     va_list argptr;
     int mpiArgCount;
     PI_MPI_RTTI mpiArgs[ PI_MAX_FORMATLEN ];
@@ -645,36 +1053,47 @@ void PI_Write_( PI_CHANNEL *c, const char *format, ... )
 	/* make sure we're on the rim of the bundled channel */
         PI_ASSERT( LEVEL(1), ISVALID(PI_BUND,b), PI_SYSTEM_ERROR )
 	PI_ASSERT( , b->narrow_end==TO, PI_BUNDLED_CHANNEL )
+	PI_ASSERT( , b->usage!=PI_REDUCE, PI_BUNDLE_USAGE )	// rim uses PI_Reduce
     }
 
     va_start( argptr, format );
     mpiArgCount = ParseFormatString( IO_DIRECTION_WRITE, mpiArgs, format, argptr );
     va_end( argptr );
+    if ( mpiArgCount < 0 ) return;	// error already reported
 
-    for ( i = 0; i < mpiArgCount; i++ ) {
-        PI_MPI_RTTI* arg = &mpiArgs[ i ];
-
-        /* Log first item only */
-        if ( i==0 ) LOGCALL( "Wri", c->chan_id, format )
+    WriteChannel( c, format, mpiArgs, mpiArgCount );
+}
 
-        if ( b==NULL ) {
+void PI_WriteF_( PI_CHANNEL *c, const PI_FORMAT *f, ... )
+{
+    PI_ON_ERROR_RETURN()
+    PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
+    PI_ASSERT( , c, PI_NULL_CHANNEL )
+    PI_ASSERT( , f, PI_NULL_FORMAT )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_CHAN,c), PI_SYSTEM_ERROR )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_FMT,f), PI_SYSTEM_ERROR )
+    PI_ASSERT( , f->direction==IO_DIRECTION_WRITE, PI_FORMAT_ARGS )
+    PI_ASSERT( , IS_WRITER( c ), PI_ENDPOINT_WRITER )
 
-            PI_CALLMPI( MPI_Send( arg->buf, arg->count, arg->type, c->consumer,
-                                  c->chan_tag, MPI_COMM_WORLD ) )
-        }
-        else {
+    va_list argptr;
+    int mpiArgCount;
+    PI_MPI_RTTI mpiArgs[ PI_MAX_FORMATLEN ];
 
-            /* MPI_Gatherv here sends data to consumer process within comm
-               communicator (dedicated to this bundle).  In PI_Gather, the
-               same MPI_Gatherv receives the data. */
-            PI_CALLMPI( MPI_Gatherv(
-                            arg->buf, arg->count, arg->type, // what we're sending
-                            NULL, NULL, NULL, 0,	// ignored on sender call
-                            0, b->comm ) )		// "root" is rank 0 in bundle
-        }
+    PI_BUNDLE *b = c->bundle;	// collective bundle associated with channel
+    if ( b ) {			// NULL if point-to-point
 
-        c->write_count = c->write_count + 1;
+	/* make sure we're on the rim of the bundled channel */
+        PI_ASSERT( LEVEL(1), ISVALID(PI_BUND,b), PI_SYSTEM_ERROR )
+	PI_ASSERT( , b->narrow_end==TO, PI_BUNDLED_CHANNEL )
+	PI_ASSERT( , b->usage!=PI_REDUCE, PI_BUNDLE_USAGE )	// rim uses PI_Reduce
     }
+
+    va_start( argptr, f );
+    mpiArgCount = BindFormatArgs( f, mpiArgs, argptr );
+    va_end( argptr );
+    if ( mpiArgCount < 0 ) return;	// error already reported
+
+    WriteChannel( c, f->text, mpiArgs, mpiArgCount );
 }
 
 void PI_Read_( PI_CHANNEL *c, const char *format, ... )
@@ -684,13 +1103,11 @@ void PI_Read_( PI_CHANNEL *c, const char *format, ... )
     PI_ASSERT( , c, PI_NULL_CHANNEL )
     PI_ASSERT( , format, PI_NULL_FORMAT )
     PI_ASSERT( LEVEL(1), ISVALID(PI_CHAN,c), PI_SYSTEM_ERROR )
-    PI_ASSERT( , c->consumer==thisproc.rank, PI_ENDPOINT_READER )
+    PI_ASSERT( , IS_READER( c ), PI_ENDPOINT_READER )
 
-    int i;
     va_list argptr;
     int mpiArgCount;
     PI_MPI_RTTI mpiArgs[ PI_MAX_FORMATLEN ];
-    MPI_Status status;
 
     PI_BUNDLE *b = c->bundle;	// collective bundle associated with channel
     if ( b ) {			// NULL if point-to-point
@@ -703,652 +1120,4446 @@ void PI_Read_( PI_CHANNEL *c, const char *format, ... )
     va_start( argptr, format );
     mpiArgCount = ParseFormatString( IO_DIRECTION_READ, mpiArgs, format, argptr );
     va_end( argptr );
+    if ( mpiArgCount < 0 ) return;	// error already reported
 
-    c->write_count++;
-
-    for ( i = 0; i < mpiArgCount; i++ ) {
-        PI_MPI_RTTI* arg = &mpiArgs[ i ];
-        /* Log first item only */
-        if ( i==0 ) LOGCALL( "Rea", c->chan_id, format )
-
-        if ( b==NULL ) {
-
-            PI_CALLMPI( MPI_Recv( arg->buf, arg->count, arg->type, c->producer,
-                                  c->chan_tag, MPI_COMM_WORLD, &status ) )
-        }
-        else {
-
-            /* MPI_Bcast here receives data from producer process within comm
-               communicator (dedicated to this bundle).  In PI_Broadcast, the
-               same MPI_Bcast sends the data. */
-
-            PI_CALLMPI( MPI_Bcast(
-                            arg->buf, arg->count, arg->type,	// what we're sending
-                            0, b->comm ) )		// "root" is rank 0 in bundle
-        }
-    }
+    ReadChannel( c, format, mpiArgs, mpiArgCount );
 }
 
-int PI_Select_( PI_BUNDLE *b )
+void PI_ReadF_( PI_CHANNEL *c, const PI_FORMAT *f, ... )
 {
-    PI_ON_ERROR_RETURN( 0 )
+    PI_ON_ERROR_RETURN()
     PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
-    PI_ASSERT( , b, PI_NULL_BUNDLE )
-    PI_ASSERT( LEVEL(1), ISVALID(PI_BUND,b), PI_SYSTEM_ERROR )
-    PI_ASSERT( , b->usage==PI_SELECT, PI_BUNDLE_USAGE )
-    PI_ASSERT( , b->narrow_end==TO, PI_ENDPOINT_READER )
-
-    MPI_Status status;
-    int i;
-
-    LOGCALL( "Sel", b->bund_id, "" )
+    PI_ASSERT( , c, PI_NULL_CHANNEL )
+    PI_ASSERT( , f, PI_NULL_FORMAT )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_CHAN,c), PI_SYSTEM_ERROR )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_FMT,f), PI_SYSTEM_ERROR )
+    PI_ASSERT( , f->direction==IO_DIRECTION_READ, PI_FORMAT_ARGS )
+    PI_ASSERT( , IS_READER( c ), PI_ENDPOINT_READER )
 
-    PI_CALLMPI( MPI_Probe( MPI_ANY_SOURCE, b->channels[0]->chan_tag,
-                           MPI_COMM_WORLD, &status ) )
+    va_list argptr;
+    int mpiArgCount;
+    PI_MPI_RTTI mpiArgs[ PI_MAX_FORMATLEN ];
 
-    /* note: this is a sequential search! suppose bundle is large?
-       May want to build (on the fly) lookup table (hash?) for rank=>index.
-       Another alt (since each rank will likely participate in few bundles) is
-       to make small lookup table in rank's PI_PROCENVT: [rank].table:tag=>index.
-       The table could be PI_MAX_BUNDLES long, and CreateBundle fills in the next entry
-       for each producer process.
-    */
+    PI_BUNDLE *b = c->bundle;	// collective bundle associated with channel
+    if ( b ) {			// NULL if point-to-point
 
-    for ( i = 0; i < b->size; i++ ) {
-        if ( b->channels[i]->producer == status.MPI_SOURCE )
-            return i;
+	/* make sure we're on the rim of the bundled channel */
+        PI_ASSERT( LEVEL(1), ISVALID(PI_BUND,b), PI_SYSTEM_ERROR )
+	PI_ASSERT( , b->narrow_end==FROM, PI_BUNDLED_CHANNEL )
     }
 
-    /* If the message source does not match the producer of any of the bundle's
-       channels, that's a problem.  PI_ASSERT(, 0, ...) will always abort. */
-    PI_ASSERT( , 0, PI_SYSTEM_ERROR )
-    return 0;	// never reached, but satisfies compiler
+    va_start( argptr, f );
+    mpiArgCount = BindFormatArgs( f, mpiArgs, argptr );
+    va_end( argptr );
+    if ( mpiArgCount < 0 ) return;	// error already reported
+
+    ReadChannel( c, f->text, mpiArgs, mpiArgCount );
 }
 
-int PI_ChannelHasData_( PI_CHANNEL *c )
+PI_REQUEST *PI_WriteAsync_( PI_CHANNEL *c, const char *format, ... )
 {
-    PI_ON_ERROR_RETURN( 0 )
+    PI_ON_ERROR_RETURN( NULL )
     PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
     PI_ASSERT( , c, PI_NULL_CHANNEL )
+    PI_ASSERT( , format, PI_NULL_FORMAT )
     PI_ASSERT( LEVEL(1), ISVALID(PI_CHAN,c), PI_SYSTEM_ERROR )
+    PI_ASSERT( , IS_WRITER( c ), PI_ENDPOINT_WRITER )
+    PI_ASSERT( , c->bundle==NULL, PI_BUNDLE_USAGE )	// collectives block
 
-    int flag;
-    MPI_Status s;
-
-    LOGCALL( "Has", c->chan_id, "" )
+    va_list argptr;
+    PI_REQUEST *r = NewRequest( c, IO_DIRECTION_WRITE, format );
+    if ( r == NULL ) return NULL;	// error already reported
 
-    PI_CALLMPI( MPI_Iprobe( c->producer, c->chan_tag, MPI_COMM_WORLD, &flag, &s ) )
+    /* parse straight into the request, so that scalars are copied there */
+    va_start( argptr, format );
+    r->count = ParseFormatString( IO_DIRECTION_WRITE, r->args, format, argptr );
+    va_end( argptr );
+    if ( r->count < 0 ) {		// error already reported
+        FreeRequest( r );
+        return NULL;
+    }
 
-    return flag;
+    StartRequest( r );
+    r->msgno = ++c->write_count;
+    return r;
 }
 
-
-int PI_TrySelect_( PI_BUNDLE *b )
+PI_REQUEST *PI_ReadAsync_( PI_CHANNEL *c, const char *format, ... )
 {
-    PI_ON_ERROR_RETURN( -1 )
+    PI_ON_ERROR_RETURN( NULL )
     PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
-    PI_ASSERT( , b, PI_NULL_BUNDLE )
-    PI_ASSERT( LEVEL(1), ISVALID(PI_BUND,b), PI_SYSTEM_ERROR )
-    PI_ASSERT( , b->usage==PI_SELECT, PI_BUNDLE_USAGE )
-    PI_ASSERT( , b->narrow_end==TO, PI_ENDPOINT_READER )
-
-    int flag, i;
-    MPI_Status status;
-
-    LOGCALL( "Try", b->bund_id, "" )
+    PI_ASSERT( , c, PI_NULL_CHANNEL )
+    PI_ASSERT( , format, PI_NULL_FORMAT )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_CHAN,c), PI_SYSTEM_ERROR )
+    PI_ASSERT( , IS_READER( c ), PI_ENDPOINT_READER )
+    PI_ASSERT( , c->bundle==NULL, PI_BUNDLE_USAGE )	// collectives block
 
-    PI_CALLMPI( MPI_Iprobe( MPI_ANY_SOURCE, b->channels[0]->chan_tag,
-			    MPI_COMM_WORLD, &flag, &status ) )
-    if ( flag == 0 ) return -1;		// no channel has data
+    va_list argptr;
+    PI_REQUEST *r = NewRequest( c, IO_DIRECTION_READ, format );
+    if ( r == NULL ) return NULL;	// error already reported
 
-    /* lookup message source's corresponding channel index in bundle
-       (see comment in PI_Select_ re sequential search) */
-    for ( i = 0; i < b->size; i++ ) {
-        if ( b->channels[i]->producer == status.MPI_SOURCE )
-            return i;
+    va_start( argptr, format );
+    r->count = ParseFormatString( IO_DIRECTION_READ, r->args, format, argptr );
+    va_end( argptr );
+    if ( r->count < 0 ) {		// error already reported
+        FreeRequest( r );
+        return NULL;
     }
 
-    /* If the message source does not match the producer of any of the bundle's
-       channels, that's a problem.  PI_ASSERT(, 0, ...) will always abort. */
-    PI_ASSERT( , 0, PI_SYSTEM_ERROR )
-    return 0;	// never reached, but satisfies compiler
+    StartRequest( r );
+    r->msgno = ++c->write_count;
+    return r;
 }
 
-PI_CHANNEL *PI_GetBundleChannel_( const PI_BUNDLE *b, int index )
+void PI_Wait_( PI_REQUEST **r )
 {
-    PI_ON_ERROR_RETURN( NULL )
+    PI_ON_ERROR_RETURN()
     PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
-    PI_ASSERT( , b, PI_NULL_BUNDLE )
-    PI_ASSERT( LEVEL(1), ISVALID(PI_BUND,b), PI_SYSTEM_ERROR )
-    PI_ASSERT( , index >= 0 && index < b->size, PI_BUNDLE_INDEX )
+    PI_ASSERT( , r, PI_NULL_REQUEST )
 
-    return b->channels[index];
-}
+    if ( *r == NULL ) return;		// already completed
+    PI_ASSERT( LEVEL(1), ISVALID(PI_REQ,*r), PI_SYSTEM_ERROR )
+    PI_ASSERT( , !(*r)->persistent, PI_REQUEST_STATE )	// use PI_Complete
 
-int PI_GetBundleSize_( const PI_BUNDLE *b )
-{
-    PI_ON_ERROR_RETURN( 0 )
-    PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
-    PI_ASSERT( , b, PI_NULL_BUNDLE )
-    PI_ASSERT( LEVEL(1), ISVALID(PI_BUND,b), PI_SYSTEM_ERROR )
+    /* the request's call was counted as it finished, but the wait is here */
+    PI_COUNTER *k = &REQ_COUNTER( *r );
+    double t0 = STATS_CLOCK;
 
-    return b->size;
+    if ( (*r)->ring ) {
+        while ( !RingTest( *r ) ) RingIdle();
+    }
+    else if ( (*r)->rma ) {
+        RmaWait( *r );
+    }
+    else if ( (*r)->buffered ) {
+        BufWait( *r );
+    }
+    else {
+        WaitMPI( &(*r)->req, MPI_STATUS_IGNORE );
+    }
+    CompleteRequest( *r );
+    *r = NULL;
+    if ( thisproc.svc_flag[LOG_STATS] ) k->wait += MPI_Wtime() - t0;
 }
 
-
-void PI_Broadcast_( PI_BUNDLE *b, const char *format, ... )
+void PI_WaitAll_( PI_REQUEST *array[], int size )
 {
     PI_ON_ERROR_RETURN()
     PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
-    PI_ASSERT( , b, PI_NULL_BUNDLE )
-    PI_ASSERT( , format, PI_NULL_FORMAT )
-    PI_ASSERT( LEVEL(1), ISVALID(PI_BUND,b), PI_SYSTEM_ERROR )
-    PI_ASSERT( , b->usage==PI_BROADCAST, PI_BUNDLE_USAGE )
-    PI_ASSERT( , thisproc.rank==b->channels[0]->producer, PI_ENDPOINT_WRITER )
+    PI_ASSERT( , array, PI_NULL_REQUEST )
+    PI_ASSERT( , size>=0, PI_REQUEST_COUNT )
 
     int i;
-    va_list argptr;
-    int mpiArgCount;
-    PI_MPI_RTTI mpiArgs[ PI_MAX_FORMATLEN ];
+    for ( i = 0; i < size; i++ ) {
+        if ( array[i] ) {
+            PI_ASSERT( LEVEL(1), ISVALID(PI_REQ,array[i]), PI_SYSTEM_ERROR )
+            PI_ASSERT( , !array[i]->persistent, PI_REQUEST_STATE )
+        }
+    }
+    if ( size == 0 ) return;
 
-    va_start( argptr, format );
-    mpiArgCount = ParseFormatString( IO_DIRECTION_WRITE, mpiArgs, format, argptr );
-    va_end( argptr );
+    MPI_Request *reqs = malloc( sizeof( MPI_Request ) * size );
+    PI_ASSERT( , reqs, PI_MALLOC_ERROR )
+    double t0 = STATS_CLOCK;
 
-    for ( i = 0; i < mpiArgCount; i++ ) {
-        PI_MPI_RTTI* arg = &mpiArgs[ i ];
+    /* NULL entries go to MPI as null requests, which it ignores; so do
+       requests on ring and RMA channels, and buffered writes, which are
+       waited for first */
+    for ( i = 0; i < size; i++ )
+        reqs[i] = array[i] ? array[i]->req : MPI_REQUEST_NULL;
+
+    for ( i = 0; i < size; i++ ) {
+        if ( array[i] && array[i]->ring ) {
+            while ( !RingTest( array[i] ) ) RingIdle();
+            reqs[i] = MPI_REQUEST_NULL;
+        }
+        else if ( array[i] && array[i]->rma ) {
+            RmaWait( array[i] );
+            reqs[i] = MPI_REQUEST_NULL;
+        }
+        else if ( array[i] && array[i]->buffered ) {
+            BufWait( array[i] );
+            reqs[i] = MPI_REQUEST_NULL;
+        }
+    }
 
-        /* Log first item only */
-        if ( i==0 ) LOGCALL( "Bro", b->bund_id, format )
+    if ( RunningTask ) {
+        for ( i = 0; i < size; i++ )
+            WaitMPI( &reqs[i], MPI_STATUS_IGNORE );
+    }
+    else {
+        PI_CALLMPI( MPI_Waitall( size, reqs, MPI_STATUSES_IGNORE ) )
+    }
 
-        PI_CALLMPI( MPI_Bcast(
-                        arg->buf, arg->count, arg->type,	// what we're sending
-                        0, b->comm ) )		// "root" is rank 0 in bundle
+    /* each request kept the caller waiting till the last was done */
+    double wait = thisproc.svc_flag[LOG_STATS] ? MPI_Wtime() - t0 : 0.0;
+    for ( i = 0; i < size; i++ ) {
+        if ( array[i] ) {
+            if ( thisproc.svc_flag[LOG_STATS] ) REQ_COUNTER( array[i] ).wait += wait;
+            CompleteRequest( array[i] );
+            array[i] = NULL;
+        }
     }
+    free( reqs );
 }
 
+int PI_WaitAny_( PI_REQUEST *array[], int size )
+{
+    PI_ON_ERROR_RETURN( -1 )
+    PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
+    PI_ASSERT( , array, PI_NULL_REQUEST )
+    PI_ASSERT( , size>=0, PI_REQUEST_COUNT )
 
-void PI_Gather_( PI_BUNDLE *b, const char *format, ... )
+    int i, index, rings = 0;
+    for ( i = 0; i < size; i++ ) {
+        if ( array[i] ) {
+            PI_ASSERT( LEVEL(1), ISVALID(PI_REQ,array[i]), PI_SYSTEM_ERROR )
+            PI_ASSERT( , !array[i]->persistent, PI_REQUEST_STATE )
+            if ( array[i]->ring || array[i]->rma || array[i]->buffered ) rings++;
+        }
+    }
+    if ( size == 0 ) return -1;		// nothing to wait for
+
+    MPI_Request *reqs = malloc( sizeof( MPI_Request ) * size );
+    PI_ASSERT( , reqs, PI_MALLOC_ERROR )
+    for ( i = 0; i < size; i++ )
+        reqs[i] = array[i] ? array[i]->req : MPI_REQUEST_NULL;
+    double t0 = STATS_CLOCK;
+
+    if ( rings ) {
+        /* MPI can't wait on the rings or the RMA and buffered queues, so poll
+           everything in turn */
+        for ( index = 0; ; index = (index + 1) % size ) {
+            int flag = 0;
+            if ( array[index] == NULL ) continue;
+            if ( array[index]->ring )
+                flag = RingTest( array[index] );
+            else if ( array[index]->rma )
+                flag = RmaTest( array[index] );
+            else if ( array[index]->buffered )
+                flag = BufTest( array[index] );
+            else {
+                PI_CALLMPI( MPI_Test( &array[index]->req, &flag, MPI_STATUS_IGNORE ) )
+            }
+            if ( flag ) break;
+            if ( index == size - 1 ) RingIdle();
+        }
+    }
+    else {
+        WaitAnyMPI( size, reqs, &index, MPI_STATUS_IGNORE );
+    }
+    free( reqs );
+    if ( index == MPI_UNDEFINED ) return -1;	// all entries were NULL
+
+    /* the wait is counted for the request that ended it */
+    if ( thisproc.svc_flag[LOG_STATS] )
+        REQ_COUNTER( array[index] ).wait += MPI_Wtime() - t0;
+    CompleteRequest( array[index] );
+    array[index] = NULL;
+    return index;
+}
+
+int PI_Test_( PI_REQUEST **r )
 {
-    PI_ON_ERROR_RETURN()
+    PI_ON_ERROR_RETURN( 0 )
     PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
-    PI_ASSERT( , b, PI_NULL_BUNDLE )
+    PI_ASSERT( , r, PI_NULL_REQUEST )
+
+    if ( *r == NULL ) return 1;		// already completed
+    PI_ASSERT( LEVEL(1), ISVALID(PI_REQ,*r), PI_SYSTEM_ERROR )
+    PI_ASSERT( , !(*r)->persistent, PI_REQUEST_STATE )	// use PI_Complete
+
+    int flag;
+    if ( (*r)->ring )
+        flag = RingTest( *r );
+    else if ( (*r)->rma )
+        flag = RmaTest( *r );
+    else if ( (*r)->buffered )
+        flag = BufTest( *r );
+    else {
+        PI_CALLMPI( MPI_Test( &(*r)->req, &flag, MPI_STATUS_IGNORE ) )
+    }
+    if ( flag ) {
+        CompleteRequest( *r );
+        *r = NULL;
+    }
+    return flag;
+}
+
+PI_REQUEST *PI_CreatePersistentWrite_( PI_CHANNEL *c, const char *format, ... )
+{
+    PI_ON_ERROR_RETURN( NULL )
+    PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
+    PI_ASSERT( , c, PI_NULL_CHANNEL )
     PI_ASSERT( , format, PI_NULL_FORMAT )
-    PI_ASSERT( LEVEL(1), ISVALID(PI_BUND,b), PI_SYSTEM_ERROR )
-    PI_ASSERT( , b->usage==PI_GATHER, PI_BUNDLE_USAGE )
-    PI_ASSERT( , thisproc.rank==b->channels[0]->consumer, PI_ENDPOINT_READER )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_CHAN,c), PI_SYSTEM_ERROR )
+    PI_ASSERT( , IS_WRITER( c ), PI_ENDPOINT_WRITER )
+    PI_ASSERT( , c->bundle==NULL, PI_BUNDLE_USAGE )	// collectives block
 
-    int i;
     va_list argptr;
-    int mpiArgCount;
-    PI_MPI_RTTI mpiArgs[ PI_MAX_FORMATLEN ];
+    PI_REQUEST *r = NewRequest( c, IO_DIRECTION_WRITE, format );
+    if ( r == NULL ) return NULL;	// error already reported
 
+    /* variables are bound by reference, so parse them like a read */
     va_start( argptr, format );
-    mpiArgCount = ParseFormatString( IO_DIRECTION_READ, mpiArgs, format, argptr );
+    r->count = ParseFormatString( IO_DIRECTION_READ, r->args, format, argptr );
     va_end( argptr );
+    if ( r->count < 0 ) {		// error already reported
+        FreeRequest( r );
+        return NULL;
+    }
 
-    for ( i = 0; i < mpiArgCount; i++ ) {
-        PI_MPI_RTTI* arg = &mpiArgs[ i ];
+    r->persistent = 1;
+    StartRequest( r );
 
-        /* set up args for MPI_Gather (receiving side) */
-        char sendbuf[1];	// root sends 0-length data, so make dummy buffer
-        int recvcounts[b->size+1];	// count that each process sends
-        int displs[b->size+1];		// displacements in userbuf for recv
+    /* link into list of persistent requests so PI_StopMain can free it */
+    LOCK_SHARED
+    r->next = thisproc.persistent;
+    thisproc.persistent = r;
+    UNLOCK_SHARED
+    return r;
+}
 
-        /* Log first item only */
-        if ( i==0 ) LOGCALL( "Gat", b->bund_id, format )
+PI_REQUEST *PI_CreatePersistentRead_( PI_CHANNEL *c, const char *format, ... )
+{
+    PI_ON_ERROR_RETURN( NULL )
+    PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
+    PI_ASSERT( , c, PI_NULL_CHANNEL )
+    PI_ASSERT( , format, PI_NULL_FORMAT )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_CHAN,c), PI_SYSTEM_ERROR )
+    PI_ASSERT( , IS_READER( c ), PI_ENDPOINT_READER )
+    PI_ASSERT( , c->bundle==NULL, PI_BUNDLE_USAGE )	// collectives block
 
-        /* prepare recvcounts and displs arrays so that root sends nothing,
-           and all the rest send 'count' items */
-        recvcounts[0] = displs[0] = 0;
-        for ( i=1; i<=b->size; i++ ) {
-            recvcounts[i] = arg->count;
-            displs[i] = (i-1) * arg->count;	// fits buffer of size*count items
-        }
+    va_list argptr;
+    PI_REQUEST *r = NewRequest( c, IO_DIRECTION_READ, format );
+    if ( r == NULL ) return NULL;	// error already reported
 
-        PI_CALLMPI( MPI_Gatherv(
-                        sendbuf, 0, arg->type,	// send 0 data from "root"
-                        arg->buf, recvcounts, displs, arg->type,	// receives all data
-                        0, b->comm ) )		// "root" is P0 in bundle communicator
+    va_start( argptr, format );
+    r->count = ParseFormatString( IO_DIRECTION_READ, r->args, format, argptr );
+    va_end( argptr );
+    if ( r->count < 0 ) {		// error already reported
+        FreeRequest( r );
+        return NULL;
     }
-}
 
+    r->persistent = 1;
+    StartRequest( r );
 
-void PI_StartTime( void )
-{
-    thisproc.start_time = MPI_Wtime( );
+    LOCK_SHARED
+    r->next = thisproc.persistent;
+    thisproc.persistent = r;
+    UNLOCK_SHARED
+    return r;
 }
 
-double PI_EndTime( void )
+void PI_Start_( PI_REQUEST *r )
 {
-    double now = MPI_Wtime( );
-
-    if ( thisproc.start_time > 0.0 )
-        return (now - thisproc.start_time);
+    PI_ON_ERROR_RETURN()
+    PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
+    PI_ASSERT( , r, PI_NULL_REQUEST )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_REQ,r), PI_SYSTEM_ERROR )
+    PI_ASSERT( , r->persistent && !r->active, PI_REQUEST_STATE )
+
+    /* pick up the current values of the bound variables */
+    if ( r->channel->ring )
+        StartRingRequest( r );
+    else if ( r->channel->rma_size )
+        StartRmaRequest( r );
+    else if ( r->channel->capacity && r->direction==IO_DIRECTION_WRITE )
+        StartBufRequest( r );
+    else {
+        if ( r->direction==IO_DIRECTION_WRITE && r->packbuf )
+            PackItems( r->args, r->count, r->packbuf, r->packsize, MPI_COMM_WORLD );
 
-    fprintf( stderr,
-             "\nPI_EndTime: Timing not initialized.  Call PI_StartTime() first." );
-    return 0.0;
+        PI_CALLMPI( MPI_Start( &r->req ) )
+    }
+    r->active = 1;
+    r->msgno = ++r->channel->write_count;
 }
 
-
-int PI_IsLogging()
+void PI_Complete_( PI_REQUEST *r )
 {
-    return thisproc.svc_flag[OLP_LOGFILE];
-}
+    PI_ON_ERROR_RETURN()
+    PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
+    PI_ASSERT( , r, PI_NULL_REQUEST )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_REQ,r), PI_SYSTEM_ERROR )
+    PI_ASSERT( , r->persistent && r->active, PI_REQUEST_STATE )
 
+    double t0 = STATS_CLOCK;
 
-void PI_Log_( const char *text )
+    if ( r->ring ) {
+        while ( !RingTest( r ) ) RingIdle();
+    }
+    else if ( r->rma ) {
+        RmaWait( r );
+    }
+    else if ( r->buffered ) {
+        BufWait( r );
+    }
+    else {
+        WaitMPI( &r->req, MPI_STATUS_IGNORE );
+    }
+    r->active = 0;
+    FinishRequest( r );
+    if ( thisproc.svc_flag[LOG_STATS] ) REQ_COUNTER( r ).wait += MPI_Wtime() - t0;
+}
+
+int PI_Select_( PI_BUNDLE *b )
 {
-    PI_ON_ERROR_RETURN()
+    PI_ON_ERROR_RETURN( 0 )
     PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
+    PI_ASSERT( , b, PI_NULL_BUNDLE )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_BUND,b), PI_SYSTEM_ERROR )
+    PI_ASSERT( , b->usage==PI_SELECT, PI_BUNDLE_USAGE )
+    PI_ASSERT( , b->narrow_end==TO, PI_ENDPOINT_READER )
 
-    /* if logging to file enabled, forward to LogEvent as USER type event */
-    if ( thisproc.svc_flag[OLP_LOGFILE] ) LogEvent( USER, text );
-}
+    MPI_Status status;
+    int i;
+    double t0 = STATS_CLOCK;
 
+    LOGCALL( "Sel", b->bund_id, "" )
 
-/* This function might be called before Pilot's tables are all set up, so be
-   sure we don't deref. any NULL pointers.  It can be called in any phase of
-   the program by any process.  If MPI is not even running yet, it will call
-   abort() and get out that way.  If Pilot is in the configuration phase (where
-   the same code is running on all nodes), only rank 0 will print, to avoid
-   cluttering the display with many duplicate messages.
-*/
-void PI_Abort( const int errcode, const char *text, const char *file, const int line )
-{
-    if ( thisproc.phase != CONFIG || thisproc.rank == 0 ) {
-	char *procname = "";
-	int procarg = 0;
-	if ( thisproc.processes ) {
-            procname = thisproc.processes[thisproc.rank].name;
-            procarg = thisproc.processes[thisproc.rank].argument;
-	}
-    	fprintf( stderr,
-             "\n*** PI_Abort *** (MPI process #%d) Pilot process '%s'(%d), %s:%d:\n%s%s\n",
-             thisproc.rank, procname, procarg, file, line,
-             ( errcode >= PI_MIN_ERROR && errcode <= PI_MAX_ERROR ) ?
-             ErrorText[errcode] : "",
-             text ? text : "" );
+    if ( b->policy != PI_SELECT_FIFO )
+        i = FairSelect( b, 1 );
+    else {
+        ProbeMPI( MPI_ANY_SOURCE, b->channels[0]->chan_tag,
+                  b->channels[0]->chan_comm, &status );
+
+        /* lookup message source's corresponding channel index in bundle */
+        i = RimIndex( b, status.MPI_SOURCE );
+
+        /* If the message source does not match the producer of any of the
+           bundle's channels, that's a problem.  PI_ASSERT(, 0, ...) will
+           always abort. */
+        PI_ASSERT( , i >= 0, PI_SYSTEM_ERROR )
     }
 
-    /* MPI should shut down the application and may call exit/abort(errcode) */
-    int MPI_up;
-    MPI_Initialized( &MPI_up );
-    if ( MPI_up )
-        MPI_Abort( MPI_COMM_WORLD, errcode );
-    else
-        abort();
-    /******** does not return *********/
+    LOGEND( "Sel", b->bund_id, 0 )
+    COUNTCALL( b->stats, 0, t0 )
+    return i;
 }
 
-void PI_StopMain_( int status )
+int PI_ChannelHasData_( PI_CHANNEL *c )
 {
-    PI_ON_ERROR_RETURN()
+    PI_ON_ERROR_RETURN( 0 )
     PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
+    PI_ASSERT( , c, PI_NULL_CHANNEL )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_CHAN,c), PI_SYSTEM_ERROR )
 
-    int i /***********, j**********/ ;
-
-    /* First job is to shutdown logging, if it's active. */
-    if ( thisproc.svc_flag[LOGGING] ) {
+    int flag;
+    MPI_Status s;
 
-	/* Notify log that this process is finished (unless this *is* the log
-	   process on rank 1) */
-	if ( thisproc.rank != 1 || thisproc.svc_flag[OLP_RANK] != 1 ) {
-	    char buff[PI_MAX_LOGLEN];
-	    sprintf( buff, "FIN" PI_LOGSEP "%d", status );
-            LogEvent( PILOT, buff );
-	}
+    LOGCALL( "Has", c->chan_id, "" )
 
-	/* If online thread was running (on rank 0), join with it */
-        if ( thisproc.rank == 0 && thisproc.svc_flag[OLP_RANK] == 0 )
-            pthread_join( OnlineThreadID, NULL );
+    /* on a ring, a message is only for PI_Read once the queued reads have theirs */
+    if ( c->ring ) {
+        RingProgress( c );
+        flag = c->queue==NULL &&
+               c->ring->taken < __atomic_load_n( &c->ring->sent, __ATOMIC_ACQUIRE );
     }
-
-    MPI_Barrier( MPI_COMM_WORLD );	/* synchronize all processes */
-
-    /* If user pre-initialized MPI, then leave it initialized.  This is to
-       allow Pilot to be re-configured and used again in this program, which is
-       needed for running benchmarks, but not in ordinary use.
-    */
-    if ( MPIPreInit )
-        thisproc.phase = PREINIT;
     else {
-        thisproc.phase = POSTRUN;
-        MPI_Finalize( );
+        PI_CALLMPI( MPI_Iprobe( c->producer, c->chan_tag, c->chan_comm, &flag, &s ) )
     }
 
-    /* deallocate memory */
+    /* a coroutine polling in a loop must let the one it's waiting for run */
+    if ( !flag ) YieldTask();
+    return flag;
+}
 
-/********** old data structure
-    for ( i = 0; i < thisproc.worldsize; i++ ) {
-        for ( j = 0; j < thisproc.worldsize; j++ ) {
-            if ( thisproc.channels[i][j] != NULL )
-                free( thisproc.channels[i][j] );
-        }
-        if ( thisproc.channels[i] != NULL )
-            free( thisproc.channels[i] );
+
+int PI_TrySelect_( PI_BUNDLE *b )
+{
+    PI_ON_ERROR_RETURN( -1 )
+    PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
+    PI_ASSERT( , b, PI_NULL_BUNDLE )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_BUND,b), PI_SYSTEM_ERROR )
+    PI_ASSERT( , b->usage==PI_SELECT, PI_BUNDLE_USAGE )
+    PI_ASSERT( , b->narrow_end==TO, PI_ENDPOINT_READER )
+
+    int flag, i;
+    MPI_Status status;
+
+    LOGCALL( "Try", b->bund_id, "" )
+
+    if ( b->policy != PI_SELECT_FIFO ) {
+        i = FairSelect( b, 0 );
+        if ( i < 0 ) YieldTask();	// as for PI_ChannelHasData
+        return i;
     }
-******************************/
 
-    for ( i = 0; i < thisproc.allocated_channels; i++ )
-	free( thisproc.channels[i] );
+    PI_CALLMPI( MPI_Iprobe( MPI_ANY_SOURCE, b->channels[0]->chan_tag,
+			    b->channels[0]->chan_comm, &flag, &status ) )
+    if ( flag == 0 ) {
+        YieldTask();			// as for PI_ChannelHasData
+        return -1;			// no channel has data
+    }
 
-    if ( thisproc.channels != NULL )
-        free( thisproc.channels );
+    /* lookup message source's corresponding channel index in bundle */
+    i = RimIndex( b, status.MPI_SOURCE );
 
-    if ( thisproc.processes != NULL )
-        free( thisproc.processes );
+    /* If the message source does not match the producer of any of the bundle's
+       channels, that's a problem.  PI_ASSERT(, 0, ...) will always abort. */
+    PI_ASSERT( , i >= 0, PI_SYSTEM_ERROR )
+    return i;
+}
 
-    if ( thisproc.bundles != NULL )
-        free( thisproc.bundles );
+PI_CHANNEL *PI_GetBundleChannel_( const PI_BUNDLE *b, int index )
+{
+    PI_ON_ERROR_RETURN( NULL )
+    PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
+    PI_ASSERT( , b, PI_NULL_BUNDLE )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_BUND,b), PI_SYSTEM_ERROR )
+    PI_ASSERT( , index >= 0 && index < b->size, PI_BUNDLE_INDEX )
 
-    /* The main process always returns, but other processes normally exit
-       here because otherwise they would return from PI_StartAll and (re)execute
-       main's code.  However, if Pilot is in "bench mode", we do return so
-       that another Pilot application can be configured and executed.
-    */
-    if ( thisproc.rank!=0 && !MPIPreInit ) exit( 0 );
+    return b->channels[index];
 }
 
+int PI_GetBundleSize_( const PI_BUNDLE *b )
+{
+    PI_ON_ERROR_RETURN( 0 )
+    PI_ASSERT( , thisproc.phase==CONFIG || thisproc.phase==RUNNING, PI_WRONG_PHASE )
+    PI_ASSERT( , b, PI_NULL_BUNDLE )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_BUND,b), PI_SYSTEM_ERROR )
 
-/*** Internal Functions ***/
+    return b->size;
+}
 
 
-/********* want a function that investigates what "reasonable" values are for
- pointers on this platform.  It should check static, stack, & malloc'd addrs,
- and come up with min/max ranges for valid pointers (as opposed to data).  This
- is for use in PI_Read where user must remember to code "&".  Since the "figuring
- out" may be inaccurate on a given platform, the check should occur at Level 2,
- only if the user wants.  So the function calculates the range, then a macro
+void PI_Broadcast_( PI_BUNDLE *b, const char *format, ... )
+{
+    PI_ON_ERROR_RETURN()
+    PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
+    PI_ASSERT( , b, PI_NULL_BUNDLE )
+    PI_ASSERT( , format, PI_NULL_FORMAT )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_BUND,b), PI_SYSTEM_ERROR )
+    PI_ASSERT( , b->usage==PI_BROADCAST, PI_BUNDLE_USAGE )
+    PI_ASSERT( , IS_WRITER( b->channels[0] ), PI_ENDPOINT_WRITER )
+
+    va_list argptr;
+    int mpiArgCount;
+    PI_MPI_RTTI mpiArgs[ PI_MAX_FORMATLEN ];
+
+    va_start( argptr, format );
+    mpiArgCount = ParseFormatString( IO_DIRECTION_WRITE, mpiArgs, format, argptr );
+    va_end( argptr );
+    if ( mpiArgCount < 0 ) return;	// error already reported
+
+    double t0 = STATS_CLOCK;
+    LOGCALL( "Bro", b->bund_id, format )
+
+    /* MPI_Bcast sends all items to the rim processes at once; they
+       receive it with the same call in PI_Read */
+    BcastItems( mpiArgs, mpiArgCount, 1, b->comm );
+    LOGEND( "Bro", b->bund_id, 0 )
+    COUNTCALL( b->stats, ItemBytes( mpiArgs, mpiArgCount ), t0 )
+}
+
+
+void PI_Gather_( PI_BUNDLE *b, const char *format, ... )
+{
+    PI_ON_ERROR_RETURN()
+    PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
+    PI_ASSERT( , b, PI_NULL_BUNDLE )
+    PI_ASSERT( , format, PI_NULL_FORMAT )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_BUND,b), PI_SYSTEM_ERROR )
+    PI_ASSERT( , b->usage==PI_GATHER, PI_BUNDLE_USAGE )
+    PI_ASSERT( , IS_READER( b->channels[0] ), PI_ENDPOINT_READER )
+
+    int i, k;
+    va_list argptr;
+    int mpiArgCount;
+    PI_MPI_RTTI mpiArgs[ PI_MAX_FORMATLEN ];
+
+    va_start( argptr, format );
+    mpiArgCount = ParseFormatString( IO_DIRECTION_READ, mpiArgs, format, argptr );
+    va_end( argptr );
+    if ( mpiArgCount < 0 ) return;	// error already reported
+
+    /* set up args for MPI_Gatherv (receiving side) */
+    char sendbuf[1];		// root sends 0-length data, so make dummy buffer
+    int recvcounts[b->size+1];	// count that each process sends
+    int displs[b->size+1];	// displacements in userbuf for recv
+    double t0 = STATS_CLOCK;
+
+    LOGCALL( "Gat", b->bund_id, format )
+
+    if ( mpiArgCount == 1 ) {
+        PI_MPI_RTTI* arg = &mpiArgs[ 0 ];
+
+        /* prepare recvcounts and displs arrays so that root sends nothing,
+           and all the rest send 'count' items */
+        recvcounts[0] = displs[0] = 0;
+        for ( i=1; i<=b->size; i++ ) {
+            recvcounts[i] = arg->count;
+            displs[i] = (i-1) * arg->count;	// fits buffer of size*count items
+        }
+
+        PI_CALLMPI( MPI_Gatherv(
+                        sendbuf, 0, arg->type,	// send 0 data from "root"
+                        arg->buf, recvcounts, displs, arg->type,	// receives all data
+                        0, b->comm ) )		// "root" is P0 in bundle communicator
+        LOGEND( "Gat", b->bund_id, 0 )
+        COUNTCALL( b->stats, b->size * ItemBytes( mpiArgs, mpiArgCount ), t0 )
+        return;
+    }
+
+    /* With several items, each rim process packs its items into one buffer
+       of 'size' bytes (see WriteChannel), so gather those into one big buffer
+       and unpack each process's segment into the users' arrays. */
+    int size = PackedSize( mpiArgs, mpiArgCount, b->comm );
+    char *packbuf = malloc( (size_t)size * b->size );
+    PI_ASSERT( , packbuf, PI_MALLOC_ERROR )
+
+    recvcounts[0] = displs[0] = 0;
+    for ( i=1; i<=b->size; i++ ) {
+        recvcounts[i] = size;
+        displs[i] = (i-1) * size;
+    }
+
+    PI_CALLMPI( MPI_Gatherv(
+                    sendbuf, 0, MPI_PACKED,	// send 0 data from "root"
+                    packbuf, recvcounts, displs, MPI_PACKED,	// receives all data
+                    0, b->comm ) )		// "root" is P0 in bundle communicator
+
+    for ( i=0; i<b->size; i++ ) {
+        int position = 0;
+        for ( k=0; k<mpiArgCount; k++ ) {
+            PI_MPI_RTTI* arg = &mpiArgs[ k ];
+            MPI_Aint lb, extent;
+
+            /* item k from the i'th process goes in slot i of its array */
+            PI_CALLMPI( MPI_Type_get_extent( arg->type, &lb, &extent ) )
+            PI_CALLMPI( MPI_Unpack( packbuf + (size_t)i*size, size, &position,
+                            (char*)arg->buf + i * arg->count * extent,
+                            arg->count, arg->type, b->comm ) )
+        }
+    }
+    free( packbuf );
+    LOGEND( "Gat", b->bund_id, 0 )
+    COUNTCALL( b->stats, b->size * ItemBytes( mpiArgs, mpiArgCount ), t0 )
+}
+
+
+void PI_GatherStream_( PI_BUNDLE *b )
+{
+    PI_ON_ERROR_RETURN()
+    PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
+    PI_ASSERT( , b, PI_NULL_BUNDLE )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_BUND,b), PI_SYSTEM_ERROR )
+    PI_ASSERT( , b->usage==PI_SELECT, PI_BUNDLE_USAGE )
+    PI_ASSERT( , IS_READER( b->channels[0] ), PI_ENDPOINT_READER )
+    PI_ASSERT( , b->streamleft==0, PI_REQUEST_STATE )
+
+    if ( b->streamreq == NULL ) {
+        b->streamreq = malloc( sizeof( MPI_Request ) * b->size );
+        PI_ASSERT( , b->streamreq, PI_MALLOC_ERROR )
+    }
+
+    /* receives are posted by the first PI_GatherNext, which has the format */
+    b->streamsize = 0;
+    b->streamleft = b->size;
+}
+
+int PI_GatherNext_( PI_BUNDLE *b, int *index, const char *format, ... )
+{
+    PI_ON_ERROR_RETURN( 0 )
+    PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
+    PI_ASSERT( , b, PI_NULL_BUNDLE )
+    PI_ASSERT( , format, PI_NULL_FORMAT )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_BUND,b), PI_SYSTEM_ERROR )
+    PI_ASSERT( , b->usage==PI_SELECT, PI_BUNDLE_USAGE )
+    PI_ASSERT( , IS_READER( b->channels[0] ), PI_ENDPOINT_READER )
+    PI_ASSERT( , b->streamleft>0, PI_REQUEST_STATE )
+
+    int i, size;
+    va_list argptr;
+    int mpiArgCount;
+    PI_MPI_RTTI mpiArgs[ PI_MAX_FORMATLEN ];
+    MPI_Status status;
+    double t0 = STATS_CLOCK;
+
+    va_start( argptr, format );
+    mpiArgCount = ParseFormatString( IO_DIRECTION_READ, mpiArgs, format, argptr );
+    va_end( argptr );
+    if ( mpiArgCount < 0 ) return 0;	// error already reported
+
+    LOGCALL( "Sel", b->bund_id, "" )
+
+    /* Post a receive on every channel.  Any message can be received as
+       MPI_PACKED, whichever way SendItems sent it, so one buffer of the
+       items' packed size per channel will do. */
+    if ( b->streamsize == 0 ) {
+        size = PackedSize( mpiArgs, mpiArgCount, MPI_COMM_WORLD );
+        b->streambuf = malloc( (size_t)size * b->size + 1 );
+        PI_ASSERT( , b->streambuf, PI_MALLOC_ERROR )
+        b->streamsize = size;
+
+        for ( i = 0; i < b->size; i++ ) {
+            PI_CHANNEL *c = b->channels[i];
+
+            /* earlier non-blocking reads on an RMA channel empty its slot first */
+            if ( c->rma_size )
+                while ( c->queue ) RmaTake( c, 1 );
+            PI_CALLMPI( MPI_Irecv( b->streambuf + (size_t)i*size, size, MPI_PACKED,
+                                   c->producer, c->chan_tag, c->chan_comm,
+                                   &b->streamreq[i] ) )
+        }
+    }
+    size = b->streamsize;
+
+    /* completed receives become MPI_REQUEST_NULL, so this only waits for
+       contributions not yet returned */
+    WaitAnyMPI( b->size, b->streamreq, &i, &status );
+    PI_ASSERT( , i != MPI_UNDEFINED, PI_SYSTEM_ERROR )
+
+    LOGEND( "Sel", b->bund_id, 0 )
+
+    PI_CHANNEL *c = b->channels[i];
+    c->write_count++;
+    LOGCALL( "Rea", c->chan_id, format )
+
+    /* a message in an RMA slot only sent its notice by MPI */
+    MPI_Aint disp[ PI_MAX_FORMATLEN ];
+    if ( c->rma_size && RmaLayout( c, mpiArgs, mpiArgCount, disp ) )
+        RmaGet( c, mpiArgs, mpiArgCount, disp );
+    else
+        UnpackItems( mpiArgs, mpiArgCount, b->streambuf + (size_t)i*size, size,
+                     MPI_COMM_WORLD );
+    if ( c->capacity ) BufRead( c );	// return the writer's credit
+    LOGEND( "Rea", c->chan_id, c->write_count )
+    COUNTCALL( c->stats[STAT_READS], ItemBytes( mpiArgs, mpiArgCount ), t0 )
+
+    if ( --b->streamleft == 0 ) {
+        free( b->streambuf );
+        b->streambuf = NULL;
+        b->streamsize = 0;
+    }
+
+    if ( index ) *index = i;
+    return b->streamleft;
+}
+
+void PI_Gatherv_( PI_BUNDLE *b, int counts[], int offsets[], const char *format, ... )
+{
+    PI_ON_ERROR_RETURN()
+    PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
+    PI_ASSERT( , b, PI_NULL_BUNDLE )
+    PI_ASSERT( , format, PI_NULL_FORMAT )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_BUND,b), PI_SYSTEM_ERROR )
+    PI_ASSERT( , b->usage==PI_GATHERV, PI_BUNDLE_USAGE )
+    PI_ASSERT( , IS_READER( b->channels[0] ), PI_ENDPOINT_READER )
+
+    int i, k;
+    va_list argptr;
+    int mpiArgCount;
+    PI_MPI_RTTI mpiArgs[ PI_MAX_FORMATLEN ];
+
+    va_start( argptr, format );
+    mpiArgCount = ParseFormatString( IO_DIRECTION_READ, mpiArgs, format, argptr );
+    va_end( argptr );
+    if ( mpiArgCount < 0 ) return;	// error already reported
+
+    /* each argument is a pointer to the user's buffer pointer, so no lengths */
+    for ( k=0; k<mpiArgCount; k++ )
+        PI_ASSERT( , mpiArgs[k].count==1, PI_FORMAT_ARGS )
+
+    int n = mpiArgCount;
+    long bytes = 0;
+    double t0 = STATS_CLOCK;
+
+    /* one allocation holds the counts from the rim, and the counts and
+       offsets if the user didn't supply them, so errors have one to free */
+    int *work = malloc( sizeof( int ) * (3*n+1) * b->size );
+    PI_ASSERT( , work, PI_MALLOC_ERROR )
+    int *info = work;
+    int *cnt = counts ? counts : work + (n+1) * b->size;
+    int *off = offsets ? offsets : work + (2*n+1) * b->size;
+
+    /* set up args for MPI_Gatherv (receiving side) */
+    char sendbuf[1];		// root sends 0-length data, so make dummy buffer
+    int recvcounts[b->size+1];	// count that each process sends
+    int displs[b->size+1];	// displacements in userbuf for recv
+
+    LOGCALL( "Gat", b->bund_id, format )
+
+    /* First, each rim process sends its element count for each item,
+       followed by the size of its packed items (see WriteChannel) */
+    recvcounts[0] = displs[0] = 0;
+    for ( i=1; i<=b->size; i++ ) {
+        recvcounts[i] = n+1;
+        displs[i] = (i-1) * (n+1);
+    }
+    PI_CALLMPI( MPI_Gatherv(
+                    sendbuf, 0, MPI_INT,	// send 0 data from "root"
+                    info, recvcounts, displs, MPI_INT,	// receives all counts
+                    0, b->comm ) )		// "root" is P0 in bundle communicator
+
+    /* lay out each item's elements in channel order, allocating the
+       buffers the user left to us */
+    for ( k=0; k<n; k++ ) {
+        PI_MPI_RTTI* arg = &mpiArgs[ k ];
+        void **where = arg->buf;
+        MPI_Aint lb, extent;
+        int total = 0;
+
+        for ( i=0; i<b->size; i++ ) {
+            cnt[k*b->size + i] = info[i*(n+1) + k];
+            off[k*b->size + i] = total;
+            total += info[i*(n+1) + k];
+        }
+
+        PI_CALLMPI( MPI_Type_get_extent( arg->type, &lb, &extent ) )
+        bytes += (long)total * extent;
+        if ( *where == NULL ) {
+            *where = malloc( total * extent + 1 );	// +1 so 0 elements != NULL
+            if ( *where == NULL ) free( work );
+            PI_ASSERT( , *where, PI_MALLOC_ERROR )
+        }
+    }
+
+    if ( n == 1 ) {
+        PI_MPI_RTTI* arg = &mpiArgs[ 0 ];
+
+        for ( i=1; i<=b->size; i++ ) {
+            recvcounts[i] = cnt[i-1];
+            displs[i] = off[i-1];
+        }
+        PI_CALLMPI( MPI_Gatherv(
+                        sendbuf, 0, arg->type,	// send 0 data from "root"
+                        *(void **)arg->buf, recvcounts, displs, arg->type,
+                        0, b->comm ) )		// "root" is P0 in bundle communicator
+    }
+    else {
+        /* Several items arrive packed, in segments of whatever size each
+           rim process reported; unpack each item of a segment to its place */
+        int packed = 0;
+        for ( i=1; i<=b->size; i++ ) {
+            recvcounts[i] = info[(i-1)*(n+1) + n];
+            displs[i] = packed;
+            packed += recvcounts[i];
+        }
+        char *packbuf = malloc( packed + 1 );
+        if ( packbuf == NULL ) free( work );
+        PI_ASSERT( , packbuf, PI_MALLOC_ERROR )
+
+        PI_CALLMPI( MPI_Gatherv(
+                        sendbuf, 0, MPI_PACKED,	// send 0 data from "root"
+                        packbuf, recvcounts, displs, MPI_PACKED,	// receives all data
+                        0, b->comm ) )		// "root" is P0 in bundle communicator
+
+        for ( i=0; i<b->size; i++ ) {
+            int position = 0;
+            for ( k=0; k<n; k++ ) {
+                PI_MPI_RTTI* arg = &mpiArgs[ k ];
+                MPI_Aint lb, extent;
+
+                PI_CALLMPI( MPI_Type_get_extent( arg->type, &lb, &extent ) )
+                PI_CALLMPI( MPI_Unpack( packbuf + displs[i+1], recvcounts[i+1],
+                                &position,
+                                *(char **)arg->buf + off[k*b->size + i] * extent,
+                                cnt[k*b->size + i], arg->type, b->comm ) )
+            }
+        }
+        free( packbuf );
+    }
+
+    free( work );
+    LOGEND( "Gat", b->bund_id, 0 )
+    COUNTCALL( b->stats, bytes, t0 )
+}
+
+void PI_Scatter_( PI_BUNDLE *b, const char *format, ... )
+{
+    PI_ON_ERROR_RETURN()
+    PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
+    PI_ASSERT( , b, PI_NULL_BUNDLE )
+    PI_ASSERT( , format, PI_NULL_FORMAT )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_BUND,b), PI_SYSTEM_ERROR )
+    PI_ASSERT( , b->usage==PI_SCATTER, PI_BUNDLE_USAGE )
+    PI_ASSERT( , IS_WRITER( b->channels[0] ), PI_ENDPOINT_WRITER )
+
+    int i, k;
+    va_list argptr;
+    int mpiArgCount;
+    PI_MPI_RTTI mpiArgs[ PI_MAX_FORMATLEN ];
+
+    /* like PI_Gather, the arguments are arrays holding one slice for each
+       channel, so parse them as pointers */
+    va_start( argptr, format );
+    mpiArgCount = ParseFormatString( IO_DIRECTION_READ, mpiArgs, format, argptr );
+    va_end( argptr );
+    if ( mpiArgCount < 0 ) return;	// error already reported
+
+    /* set up args for MPI_Scatterv (sending side) */
+    char recvbuf[1];		// root receives 0-length data, so make dummy buffer
+    int sendcounts[b->size+1];	// count that each process receives
+    int displs[b->size+1];	// displacements in userbuf for send
+    double t0 = STATS_CLOCK;
+
+    LOGCALL( "Sca", b->bund_id, format )
+
+    if ( mpiArgCount == 1 ) {
+        PI_MPI_RTTI* arg = &mpiArgs[ 0 ];
+
+        /* prepare sendcounts and displs arrays so that root gets nothing,
+           and all the rest get 'count' items */
+        sendcounts[0] = displs[0] = 0;
+        for ( i=1; i<=b->size; i++ ) {
+            sendcounts[i] = arg->count;
+            displs[i] = (i-1) * arg->count;	// slice i-1 of buffer
+        }
+
+        PI_CALLMPI( MPI_Scatterv(
+                        arg->buf, sendcounts, displs, arg->type,	// sends all data
+                        recvbuf, 0, arg->type,	// receive 0 data at "root"
+                        0, b->comm ) )		// "root" is P0 in bundle communicator
+        LOGEND( "Sca", b->bund_id, 0 )
+        COUNTCALL( b->stats, b->size * ItemBytes( mpiArgs, mpiArgCount ), t0 )
+        return;
+    }
+
+    /* With several items, pack each channel's slices of the users' arrays
+       into its own segment of 'size' bytes, which ReadChannel unpacks */
+    int size = PackedSize( mpiArgs, mpiArgCount, b->comm );
+    char *packbuf = malloc( (size_t)size * b->size );
+    PI_ASSERT( , packbuf, PI_MALLOC_ERROR )
+
+    for ( i=0; i<b->size; i++ ) {
+        int position = 0;
+        for ( k=0; k<mpiArgCount; k++ ) {
+            PI_MPI_RTTI* arg = &mpiArgs[ k ];
+            MPI_Aint lb, extent;
+
+            /* slot i of item k's array goes to the i'th process */
+            PI_CALLMPI( MPI_Type_get_extent( arg->type, &lb, &extent ) )
+            PI_CALLMPI( MPI_Pack( (char*)arg->buf + i * arg->count * extent,
+                            arg->count, arg->type,
+                            packbuf + (size_t)i*size, size, &position, b->comm ) )
+        }
+    }
+
+    sendcounts[0] = displs[0] = 0;
+    for ( i=1; i<=b->size; i++ ) {
+        sendcounts[i] = size;
+        displs[i] = (i-1) * size;
+    }
+
+    PI_CALLMPI( MPI_Scatterv(
+                    packbuf, sendcounts, displs, MPI_PACKED,	// sends all data
+                    recvbuf, 0, MPI_PACKED,	// receive 0 data at "root"
+                    0, b->comm ) )		// "root" is P0 in bundle communicator
+    free( packbuf );
+    LOGEND( "Sca", b->bund_id, 0 )
+    COUNTCALL( b->stats, b->size * ItemBytes( mpiArgs, mpiArgCount ), t0 )
+}
+
+void PI_Reduce_( PI_BUNDLE *b, int op, const char *format, ... )
+{
+    PI_ON_ERROR_RETURN()
+    PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
+    PI_ASSERT( , b, PI_NULL_BUNDLE )
+    PI_ASSERT( , format, PI_NULL_FORMAT )
+    PI_ASSERT( LEVEL(1), ISVALID(PI_BUND,b), PI_SYSTEM_ERROR )
+    PI_ASSERT( , b->usage==PI_REDUCE, PI_BUNDLE_USAGE )
+    PI_ASSERT( , op>=0 && op<PI_BUILTIN_OPS+thisproc.allocated_ops, PI_REDUCE_OP )
+
+    static const MPI_Op builtin[ PI_BUILTIN_OPS ] =	// order of enum PI_REDOP
+        { MPI_SUM, MPI_PROD, MPI_MIN, MPI_MAX, MPI_BAND, MPI_BOR };
+    MPI_Op mpiop = op < PI_BUILTIN_OPS ? builtin[op] : thisproc.ops[op-PI_BUILTIN_OPS];
+
+    int hub = IS_READER( b->channels[0] );
+    int i, k;
+    double t0 = STATS_CLOCK;
+    va_list argptr;
+    int mpiArgCount;
+    PI_MPI_RTTI mpiArgs[ PI_MAX_FORMATLEN ];
+
+    /* find our channel if we're on the rim */
+    i = hub ? 0 : RimIndex( b, thisproc.rank );
+    PI_ASSERT( , i >= 0 && ( hub || IS_WRITER( b->channels[i] ) ), PI_ENDPOINT_WRITER )
+
+    /* the hub reads results, the rim writes values */
+    va_start( argptr, format );
+    mpiArgCount = ParseFormatString( hub ? IO_DIRECTION_READ : IO_DIRECTION_WRITE,
+                                     mpiArgs, format, argptr );
+    va_end( argptr );
+    if ( mpiArgCount < 0 ) return;	// error already reported
+
+    if ( hub ) {
+        LOGCALL( "Red", b->bund_id, format )
+    } else {
+        /* to the deadlock detector, a rim contribution is a write */
+        LOGCALL( "Wri", b->channels[i]->chan_id, format )
+        b->channels[i]->write_count++;
+    }
+
+    /* b->comm is an intercommunicator between the hub and the rim, so the
+       hub is MPI_ROOT and receives only the rim's combined values, while
+       the rim sends to root 0 of the remote (hub) group */
+    for ( k=0; k<mpiArgCount; k++ ) {
+        PI_MPI_RTTI* arg = &mpiArgs[ k ];
+
+        if ( hub ) {
+            PI_CALLMPI( MPI_Reduce( NULL, arg->buf, arg->count, arg->type,
+                                    mpiop, MPI_ROOT, b->comm ) )
+        } else {
+            PI_CALLMPI( MPI_Reduce( arg->buf, NULL, arg->count, arg->type,
+                                    mpiop, 0, b->comm ) )
+        }
+    }
+
+    /* like the log, count a rim contribution as a write on its channel */
+    if ( hub ) {
+        LOGEND( "Red", b->bund_id, 0 )
+        COUNTCALL( b->stats, ItemBytes( mpiArgs, mpiArgCount ), t0 )
+    } else {
+        LOGEND( "Wri", b->channels[i]->chan_id, 0 )
+        COUNTCALL( b->channels[i]->stats[STAT_WRITES],
+                   ItemBytes( mpiArgs, mpiArgCount ), t0 )
+    }
+}
+
+void PI_StartTime( void )
+{
+    thisproc.start_time = MPI_Wtime( );
+}
+
+double PI_EndTime( void )
+{
+    double now = MPI_Wtime( );
+
+    if ( thisproc.start_time > 0.0 )
+        return (now - thisproc.start_time);
+
+    fprintf( stderr,
+             "\nPI_EndTime: Timing not initialized.  Call PI_StartTime() first." );
+    return 0.0;
+}
+
+
+int PI_IsLogging()
+{
+    return thisproc.svc_flag[OLP_LOGFILE];
+}
+
+void PI_GetStats_( const void *object, PI_STATS *stats )
+{
+    PI_ON_ERROR_RETURN()
+    PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
+    PI_ASSERT( , object, PI_INVALID_OBJ )
+    PI_ASSERT( , stats, PI_NULL_STATS )
+
+    const PI_CHANNEL *c = object;
+    const PI_BUNDLE *b = object;
+
+    /* probe magic number to identify object type, as PI_GetName does */
+    if ( ISVALID(PI_CHAN,c) )
+        FillStats( &c->stats[ IS_WRITER( c ) ? STAT_WRITES : STAT_READS ], stats );
+    else if ( ISVALID(PI_BUND,b) )
+        FillStats( &b->stats, stats );
+    else
+        PI_ASSERT( , 0, PI_INVALID_OBJ )
+}
+
+
+void PI_Log_( const char *text )
+{
+    PI_ON_ERROR_RETURN()
+    PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
+
+    /* if logging to file enabled, forward to LogRecord as USER type event */
+    if ( thisproc.svc_flag[OLP_LOGFILE] ) LogRecord( USER, NULL, 0, text );
+}
+
+
+/* This function might be called before Pilot's tables are all set up, so be
+   sure we don't deref. any NULL pointers.  It can be called in any phase of
+   the program by any process.  If MPI is not even running yet, it will call
+   abort() and get out that way.  If Pilot is in the configuration phase (where
+   the same code is running on all nodes), only rank 0 will print, to avoid
+   cluttering the display with many duplicate messages.
+*/
+void PI_Abort( const int errcode, const char *text, const char *file, const int line )
+{
+    if ( thisproc.phase != CONFIG || thisproc.rank == 0 ) {
+	char *procname = "";
+	int procarg = 0;
+	if ( thisproc.processes ) {
+            procname = THIS_PROCESS->name;
+            procarg = THIS_PROCESS->argument;
+	}
+    	fprintf( stderr,
+             "\n*** PI_Abort *** (MPI process #%d) Pilot process '%s'(%d), %s:%d:\n%s%s\n",
+             thisproc.rank, procname, procarg, file, line,
+             ( errcode >= PI_MIN_ERROR && errcode <= PI_MAX_ERROR ) ?
+             ErrorText[errcode] : "",
+             text ? text : "" );
+    }
+
+    /* MPI should shut down the application and may call exit/abort(errcode) */
+    int MPI_up;
+    MPI_Initialized( &MPI_up );
+    if ( MPI_up )
+        MPI_Abort( MPI_COMM_WORLD, errcode );
+    else
+        abort();
+    /******** does not return *********/
+}
+
+void PI_StopMain_( int status )
+{
+    PI_ON_ERROR_RETURN()
+    PI_ASSERT( , thisproc.phase==RUNNING, PI_WRONG_PHASE )
+
+    int i /***********, j**********/ ;
+
+    /* Any other processes on this rank (-pithreads=n) must finish first. */
+    for ( i = 0; i < thisproc.allocated_workers; i++ )
+        pthread_join( thisproc.workers[i], NULL );
+    free( thisproc.workers );
+    thisproc.workers = NULL;
+    thisproc.allocated_workers = 0;
+    JoinTasks();
+
+    /* Next job is to shutdown logging, if it's active. */
+    if ( thisproc.svc_flag[LOGGING] ) {
+
+	/* Notify log that this process is finished (unless this *is* the log
+	   process on rank 1) */
+	if ( thisproc.rank != 1 || thisproc.svc_flag[OLP_RANK] != 1 ) {
+	    char buff[PI_MAX_LOGLEN];
+
+	    /* matching queue statistics: communicators, most channels on one,
+	       plain reads, and how many found their message already waiting */
+	    if ( thisproc.svc_flag[LOG_STATS] ) {
+	        sprintf( buff, "QUE" PI_LOGSEP "%d" PI_LOGSEP "%d" PI_LOGSEP "%ld"
+	                 PI_LOGSEP "%ld", thisproc.allocated_comms,
+	                 thisproc.queue_width, thisproc.recvs, thisproc.recvs_waiting );
+	        LogRecord( STATS, NULL, 0, buff );
+	        SendStats();
+	    }
+
+	    SyncClock();	// again, so the OLP can allow for drift
+
+	    sprintf( buff, "FIN" PI_LOGSEP "%d", status );
+	    LogRecord( PILOT, NULL, 0, buff );
+	    FlushLog( 1 );	// the last batch, which must arrive before we go
+	}
+	free( thisproc.log_batch[0] );
+	free( thisproc.log_batch[1] );
+	thisproc.log_batch[0] = thisproc.log_batch[1] = NULL;
+
+	/* If online thread was running (on rank 0), join with it */
+        if ( thisproc.rank == 0 && thisproc.svc_flag[OLP_RANK] == 0 )
+            pthread_join( OnlineThreadID, NULL );
+	MPI_Comm_free( &thisproc.log_comm );	// only now the OLP is done with it
+    }
+
+    FreePersistent();	/* frees MPI objects, so must precede MPI_Finalize */
+    FreeOps();
+    for ( i = 0; i < thisproc.allocated_bundles; i++ )
+        EndStream( thisproc.bundles[i] );
+    FreeBuffers();	/* waits for messages written ahead to be received */
+    FreeComms();
+    FreeRings();
+    FreeRMA();
+
+    MPI_Barrier( MPI_COMM_WORLD );	/* synchronize all processes */
+
+    /* If user pre-initialized MPI, then leave it initialized.  This is to
+       allow Pilot to be re-configured and used again in this program, which is
+       needed for running benchmarks, but not in ordinary use.
+    */
+    if ( MPIPreInit )
+        thisproc.phase = PREINIT;
+    else {
+        thisproc.phase = POSTRUN;
+        MPI_Finalize( );
+    }
+
+    /* deallocate memory */
+
+/********** old data structure
+    for ( i = 0; i < thisproc.worldsize; i++ ) {
+        for ( j = 0; j < thisproc.worldsize; j++ ) {
+            if ( thisproc.channels[i][j] != NULL )
+                free( thisproc.channels[i][j] );
+        }
+        if ( thisproc.channels[i] != NULL )
+            free( thisproc.channels[i] );
+    }
+******************************/
+
+    /* histograms of -pisvc=s, allocated as they were used */
+    for ( i = 0; i < thisproc.allocated_channels; i++ ) {
+        free( thisproc.channels[i]->stats[STAT_WRITES].hist );
+        free( thisproc.channels[i]->stats[STAT_READS].hist );
+    }
+
+    /* channels come in slabs, each pointed to by its first channel */
+    for ( i = 0; i < thisproc.allocated_channels; i += PI_CHANNEL_SLAB )
+	free( thisproc.channels[i] );
+
+    if ( thisproc.channels != NULL )
+        free( thisproc.channels );
+
+    if ( thisproc.processes != NULL )
+        free( thisproc.processes );
+    thisproc.processes = NULL;
+    MyProcess = NULL;
+
+    for ( i = 0; i < thisproc.allocated_bundles; i++ ) {
+        free( thisproc.bundles[i]->channels );
+        free( thisproc.bundles[i]->lookup );
+        free( thisproc.bundles[i]->weights );
+        free( thisproc.bundles[i]->current );
+        free( thisproc.bundles[i]->streamreq );
+        free( thisproc.bundles[i]->stats.hist );
+        free( thisproc.bundles[i] );
+    }
+
+    if ( thisproc.bundles != NULL )
+        free( thisproc.bundles );
+
+    FreeFormats();
+
+    /* The main process always returns, but other processes normally exit
+       here because otherwise they would return from PI_StartAll and (re)execute
+       main's code.  However, if Pilot is in "bench mode", we do return so
+       that another Pilot application can be configured and executed.
+    */
+    if ( thisproc.rank!=0 && !MPIPreInit ) exit( 0 );
+}
+
+
+/*** Internal Functions ***/
+
+
+/********* want a function that investigates what "reasonable" values are for
+ pointers on this platform.  It should check static, stack, & malloc'd addrs,
+ and come up with min/max ranges for valid pointers (as opposed to data).  This
+ is for use in PI_Read where user must remember to code "&".  Since the "figuring
+ out" may be inaccurate on a given platform, the check should occur at Level 2,
+ only if the user wants.  So the function calculates the range, then a macro
  ISPTR(p) checks it.  Even if this is dreaming, we can at least check for NULL.
 **********/
 
 /*!
 ********************************************************************************
-Called by MPI to handle error in library function.
-Handle the error reported from MPI by printing message and aborting.
+Called by MPI to handle error in library function.
+Handle the error reported from MPI by printing message and aborting.
+
+\param comm MPI communicator where error occurred (will be MPI_COMM_WORLD).
+\param code MPI error code
+\param ... additional implementation-specific args (ignore)
+*******************************************************************************/
+static void HandleMPIErrors( MPI_Comm *comm, int *code, ... )
+{
+    char buff[MPI_MAX_ERROR_STRING], text[MPI_MAX_ERROR_STRING+80];
+    int len;
+
+    MPI_Error_string( *code, buff, &len );	// obtain text for error code
+
+    snprintf( text, sizeof(text), " at " __FILE__ ":%d; MPI error code %d:\n%s",
+              MPICallLine, *code, buff );
+
+    PI_Abort( PI_SYSTEM_ERROR, text, PI_CallerFile, PI_CallerLine );
+    /***** does not return *****/
+}
+
+/*!
+********************************************************************************
+Parse command-line arguments to Pilot. Fills in #Option.
+*******************************************************************************/
+static char *ParseArgs( int *argc, char ***argv )
+{
+    int i, j, unrec, count=0, moveto=0;
+    char *badargs = NULL;		// assume all -pi... args will be OK
+
+    memset( Option, 0, OPT_END );	// clear all option flags
+    LogFilename = NULL;			// assume no log needed
+    ShmMode = SHM_BUFFERED;		// assume rings wherever possible
+    Threads = 1;			// assume one Pilot process per MPI process
+    Coroutines = 0;
+    OnlineProcess = OLP_NONE;		// assume no online process needed
+
+    /* scan args, shuffling non-Pilot args up in *argv array */
+    for ( i=0; i<*argc; i++ ) {
+        unrec = 0;
+        if ( 0==strncmp( (*argv)[i], "-pi", 3 ) ) {	// -pi... arg found
+
+            /* '-pisvc=...' runtime services */
+            if ( 0==strncmp( (*argv)[i]+3, "svc=", 4 ) ) {
+                for ( j=7; (*argv)[i][j]; j++ ) {
+                    switch ( toupper( (*argv)[i][j] ) ) {
+                    case 'C':
+                        Option[OPT_CALLS] = 1;
+                        break;
+                    case 'S':
+                        Option[OPT_STATS] = 1;
+                        break;
+                    case 'M':
+                        Option[OPT_TOPO] = 1;
+                        break;
+                    case 'T':
+                        Option[OPT_TRACE] = 1;
+                        break;
+                    case 'D':
+                        Option[OPT_DEADLOCK] = 1;
+                        break;
+                    default:
+                        unrec = 1;
+                    }
+                }
+            }
+
+            /* '-pilog=t|p =filename =t|p:filename' */
+            else if ( 0==strncmp( (*argv)[i]+3, "log=", 4 ) ) {
+                char tp = toupper( (*argv)[i][7] ); // possible t or p flag
+                int len = strlen( (*argv)[i] );
+                if ( len < 8 ) unrec = 1;
+                else if ( len == 8 ) {
+                    if ( 'T'==tp || 'P'==tp )
+                        OnlineProcess = 'T'==tp ? OLP_THREAD : OLP_PILOT;
+                    else LogFilename = (*argv)[i]+7; // found 1-char filename
+                }
+                else if ( ':'==(*argv)[i][8] ) {
+                    if ( 'T'==tp || 'P'==tp )
+                        OnlineProcess = 'T'==tp ? OLP_THREAD : OLP_PILOT;
+                    else unrec = 1;
+                    if ( len > 9 )
+                        LogFilename = (*argv)[i]+9;	// found :filename
+                }
+                else LogFilename = (*argv)[i]+7;	// found filename
+            }
+
+            /* '-picheck=n' */
+            else if ( 0==strncmp( (*argv)[i]+3, "check=", 6 ) ) {
+                if ( 10==strlen( (*argv)[i] ) ) {
+                    j = (*argv)[i][9];	// extract level number
+                    if ( isdigit(j) ) PI_CheckLevel = j - '0';
+                    else unrec = 1;
+                }
+                else unrec = 1;
+            }
+
+            /* '-pishm=n' */
+            else if ( 0==strncmp( (*argv)[i]+3, "shm=", 4 ) ) {
+                if ( 8==strlen( (*argv)[i] ) ) {
+                    j = (*argv)[i][7];	// extract mode number
+                    if ( j >= '0' && j <= '2' ) ShmMode = j - '0';
+                    else unrec = 1;
+                }
+                else unrec = 1;
+            }
+
+            /* '-pithreads=n' */
+            else if ( 0==strncmp( (*argv)[i]+3, "threads=", 8 ) ) {
+                char *end;
+                long n = strtol( (*argv)[i]+11, &end, 10 );
+                if ( isdigit( (*argv)[i][11] ) && *end == '\0' && n >= 1 &&
+                     n <= PI_MAX_THREADS ) {
+                    Threads = n;
+                    Coroutines = 0;
+                }
+                else unrec = 1;
+            }
+
+            /* '-picoro=n' */
+            else if ( 0==strncmp( (*argv)[i]+3, "coro=", 5 ) ) {
+                char *end;
+                long n = strtol( (*argv)[i]+8, &end, 10 );
+                if ( isdigit( (*argv)[i][8] ) && *end == '\0' && n >= 1 &&
+                     n <= PI_MAX_THREADS ) {
+                    Threads = n;
+                    Coroutines = 1;
+                }
+                else unrec = 1;
+            }
+
+            else unrec = 1;
+
+            /* save up all unrecognized arguments to return to caller */
+            if ( unrec ) {
+                j = badargs ? strlen(badargs) : 0;	// current string len
+                badargs = realloc( badargs, j + strlen((*argv)[i]) + 1 );
+                strcpy( badargs+j, " " );
+                strcpy( badargs+j+1, (*argv)[i] );
+            }
+        }
+        else {
+            if ( count < i ) (*argv)[moveto] = (*argv)[i];
+            count++;
+            moveto++;
+        }
+    }
+    *argc = count;	// adjust remaining arg count
+
+    return badargs;
+}
+
+
+/*!
+********************************************************************************
+This thread is used to invoke OnlineProcessFunc when the latter has to run
+as a thread on node 0.
+*******************************************************************************/
+static void *OnlineThreadFunc( void *arg )
+{
+    OnlineProcessFunc( 0, NULL );
+    return NULL;    // thread will be joined by PI_StopMain
+}
+
+
+/*!
+********************************************************************************
+Starts a thread for each Pilot process placed on this MPI process after the
+first (-pithreads=n).  PI_StopMain joins them.
+
+\return 1 if successful, 0 if an error was reported.
+*******************************************************************************/
+static int StartThreads( void )
+{
+    PI_ON_ERROR_RETURN( 0 )
+    int i;
+
+    if ( thisproc.threads == 1 ) return 1;
+    if ( thisproc.svc_flag[COROUTINES] ) return StartTasks();
+
+    thisproc.workers = malloc( sizeof( pthread_t ) * ( thisproc.threads - 1 ) );
+    PI_ASSERT( , thisproc.workers, PI_MALLOC_ERROR )
+
+    for ( i = thisproc.worldsize; i < thisproc.allocated_processes; i++ ) {
+        if ( thisproc.processes[i].rank != thisproc.rank ) continue;
+        PI_ASSERT( , 0==pthread_create( &thisproc.workers[thisproc.allocated_workers],
+                                        NULL, ProcessThreadFunc,
+                                        &thisproc.processes[i] ),
+                   PI_START_THREAD )
+        thisproc.allocated_workers++;
+    }
+    return 1;
+}
+
+
+/*!
+********************************************************************************
+This thread runs the work function of a Pilot process sharing an MPI process
+with others (-pithreads=n).  Its return value is dropped, as only the first
+process on each MPI process reports its status to PI_StopMain.
+*******************************************************************************/
+static void *ProcessThreadFunc( void *arg )
+{
+    MyProcess = arg;
+    MyThread = MyProcess->thread;
+    MyProcess->run( MyProcess->argument, MyProcess->argument2 );
+    return NULL;    // thread will be joined by PI_StopMain
+}
+
+/*
+   Scheduler for -picoro=n.  Each MPI process runs its Pilot processes as
+   coroutines on its one thread, switching only inside Pilot calls that have
+   to wait, so none of them needs a lock.  A coroutine waiting for a channel
+   whose other end is also here parks on the channel's ring, to be woken by
+   that end's next move (see RingWait); one waiting for MPI polls, yielding
+   to the next ready coroutine between polls.  If every coroutine here is
+   parked, none of them can ever be woken, so that is reported as a deadlock.
+   Collective operations are still made by one MPI call that blocks the
+   whole MPI process.
+*/
+
+/*!
+********************************************************************************
+Makes a coroutine for each Pilot process placed on this MPI process after the
+first, which becomes the first coroutine on the thread's own stack.  None of
+the others runs until it waits.  PI_StopMain runs them to the end.
+
+\return 1 if successful, 0 if an error was reported.
+*******************************************************************************/
+static int StartTasks( void )
+{
+    PI_ON_ERROR_RETURN( 0 )
+    int i, n = 1;
+    PI_TASK *t;
+
+    for ( i = thisproc.worldsize; i < thisproc.allocated_processes; i++ )
+        n += thisproc.processes[i].rank == thisproc.rank;
+    if ( n == 1 ) return 1;
+
+    thisproc.tasks = malloc( sizeof( PI_TASK ) * n );
+    PI_ASSERT( , thisproc.tasks, PI_MALLOC_ERROR )
+
+    /* one mapping for all the stacks, whose pages are only taken when used */
+    thisproc.task_stacks = mmap( NULL, (size_t)PI_CORO_STACK * ( n - 1 ),
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                                 -1, 0 );
+    PI_ASSERT( , thisproc.task_stacks != MAP_FAILED, PI_MALLOC_ERROR )
+
+    t = &thisproc.tasks[0];
+    t->process = MyProcess;
+    t->state = TASK_RUNNING;
+    RunningTask = t;
+    thisproc.allocated_tasks = LiveTasks = 1;
+
+    for ( i = thisproc.worldsize; i < thisproc.allocated_processes; i++ ) {
+        if ( thisproc.processes[i].rank != thisproc.rank ) continue;
+        t = &thisproc.tasks[thisproc.allocated_tasks];
+        t->process = &thisproc.processes[i];
+        getcontext( &t->context );
+        t->context.uc_stack.ss_sp = thisproc.task_stacks +
+                            (size_t)PI_CORO_STACK * ( thisproc.allocated_tasks - 1 );
+        t->context.uc_stack.ss_size = PI_CORO_STACK;
+        t->context.uc_link = NULL;	// TaskMain never returns
+        makecontext( &t->context, (void (*)( void ))TaskMain, 1,
+                     thisproc.allocated_tasks );
+        ReadyTask( t );
+        thisproc.allocated_tasks++;
+        LiveTasks++;
+    }
+    return 1;
+}
+
+/*!
+********************************************************************************
+Runs the work function of coroutine \p i (-picoro=n), then switches away for
+good.  As for ProcessThreadFunc, its return value is dropped.
+*******************************************************************************/
+static void TaskMain( int i )
+{
+    PI_TASK *t = &thisproc.tasks[i];
+
+    t->process->run( t->process->argument, t->process->argument2 );
+    t->state = TASK_DONE;
+
+    /* the first may be waiting in PI_StopMain for the last to finish */
+    if ( --LiveTasks == 1 && thisproc.tasks[0].state == TASK_PARKED )
+        ReadyTask( &thisproc.tasks[0] );
+    ParkTask( NULL );
+}
+
+/*!
+********************************************************************************
+Puts coroutine \p t at the end of the ready queue.
+*******************************************************************************/
+static void ReadyTask( PI_TASK *t )
+{
+    t->state = TASK_READY;
+    t->next = NULL;
+    if ( ReadyTail ) ReadyTail->next = t;
+    else ReadyHead = t;
+    ReadyTail = t;
+}
+
+/*!
+********************************************************************************
+Takes coroutine \p t off the front of the ready queue and switches to it; the
+caller, which must already be queued, parked or done, resumes when some
+coroutine switches back to it.
+*******************************************************************************/
+static void SwitchTask( PI_TASK *t )
+{
+    PI_TASK *self = RunningTask;
+
+    ReadyHead = t->next;
+    if ( ReadyHead == NULL ) ReadyTail = NULL;
+
+    t->state = TASK_RUNNING;
+    RunningTask = t;
+    MyProcess = t->process;
+    MyThread = t->process->thread;
+    swapcontext( &self->context, &t->context );
+}
+
+/*!
+********************************************************************************
+Lets the other ready coroutines run before the caller carries on, if there are
+any.  Does nothing unless coroutines are running (-picoro=n).
+*******************************************************************************/
+static void YieldTask( void )
+{
+    if ( RunningTask == NULL || ReadyHead == NULL ) return;
+    ReadyTask( RunningTask );
+    SwitchTask( ReadyHead );
+}
+
+/*!
+********************************************************************************
+Parks the calling coroutine until the other end of ring channel \p c wakes it
+(or, if \p c is NULL, until it is readied by TaskMain), and runs the next ready
+one meanwhile.  It may also be resumed early, so callers check again.  Aborts
+if no coroutine is ready, since they are all waiting for each other.
+*******************************************************************************/
+static void ParkTask( PI_CHANNEL *c )
+{
+    if ( ReadyHead == NULL )
+        PI_Abort( PI_DEADLOCK, ": all Pilot processes on this MPI process "
+                  "are waiting for one another (-picoro)",
+                  PI_CallerFile, PI_CallerLine );
+    if ( RunningTask->state != TASK_DONE ) RunningTask->state = TASK_PARKED;
+    if ( c ) c->waiter = RunningTask;
+    SwitchTask( ReadyHead );
+}
+
+/*!
+********************************************************************************
+Readies the coroutine parked on ring channel \p c, now that the ring has moved.
+*******************************************************************************/
+static void WakeTask( PI_CHANNEL *c )
+{
+    PI_TASK *t = c->waiter;
+
+    c->waiter = NULL;
+    if ( t->state == TASK_PARKED ) ReadyTask( t );
+}
+
+/*!
+********************************************************************************
+Called by the first coroutine from PI_StopMain: runs the others till they
+have all finished, then frees them.  Does nothing without -picoro=n.
+*******************************************************************************/
+static void JoinTasks( void )
+{
+    if ( RunningTask == NULL ) return;
+
+    while ( LiveTasks > 1 ) ParkTask( NULL );
+
+    RunningTask = ReadyHead = ReadyTail = NULL;
+    munmap( thisproc.task_stacks,
+            (size_t)PI_CORO_STACK * ( thisproc.allocated_tasks - 1 ) );
+    free( thisproc.tasks );
+    thisproc.task_stacks = NULL;
+    thisproc.tasks = NULL;
+    thisproc.allocated_tasks = 0;
+}
+
+
+/*!
+********************************************************************************
+This process handles collecting/printing log entries, and running any other
+online services such as deadlock detection.  The log filename, if any,
+is received from PI_MAIN.
+
+Log records arrive in batches from LogRecord, each decoded into the text line
+it stands for, which is what the deadlock detector and the log file see.  The
+timestamp is the one the record got where it was made, in usec from
+PI_StartAll on that process, corrected to this process's clock by the offset
+the two found at PI_StartAll (see SyncClock).  When all have finished, the
+log file is rewritten to allow for the drift of each clock from ours as well,
+going by the offset found again at PI_StopMain.  MPI semantics guarantee that
+the events from any given process will be logged in order, but since each
+process sends its records a batch at a time, lines from different processes
+are not in time order in the file; sorting it on the first field puts them in
+order.
+
+\note If the program crashes, log entries -- maybe the entire file -- may be
+lost in OS buffers, as well as any still in a batch on their way.  We should
+probably do some selective periodic flushing, but not every line to avoid
+burdening the program with disk activity.
+*******************************************************************************/
+static int OnlineProcessFunc( int dum1, void *dum2 )
+{
+    MPI_Status stat;
+    int flen, size, at;
+    char *fname = NULL;
+    FILE *logfile = NULL;
+    char *batch, *event;
+    double now, *clock, *k;
+    int *syncs, *stats_at;
+    PI_COUNTER *totals = NULL;
+    PI_LOGREC *rec;
+
+    /* get filename length; 0 = no log file */
+    PI_CALLMPI( MPI_Recv( &flen, 1, MPI_INT, PI_MAIN, 0, MPI_COMM_WORLD, &stat ) )
+
+    /* open the log file if needed */
+    if ( flen ) {
+        PI_OLP_ASSERT( fname = malloc( flen ), PI_MALLOC_ERROR )
+        PI_CALLMPI( MPI_Recv( fname, flen, MPI_CHAR,
+                              PI_MAIN, 0, MPI_COMM_WORLD, &stat ) )
+        logfile = fopen( fname, "w" );
+        if ( NULL==logfile )
+            PI_Abort( PI_LOG_OPEN, fname, __FILE__, __LINE__  );
+        /***** does not return *****/
+    }
+
+    /* room for a batch, and for the longest line a record in it can make */
+    PI_OLP_ASSERT( batch = malloc( PI_LOG_BATCH ), PI_MALLOC_ERROR )
+    PI_OLP_ASSERT( event = malloc( PI_LOG_BATCH + PI_MAX_LOGLEN ), PI_MALLOC_ERROR )
+
+    /* for each rank, the time and offset of its clock from ours found at
+       PI_StartAll, then at PI_StopMain */
+    PI_OLP_ASSERT( clock = calloc( 4 * thisproc.worldsize, sizeof( double ) ),
+                   PI_MALLOC_ERROR )
+    PI_OLP_ASSERT( syncs = calloc( thisproc.worldsize, sizeof( int ) ),
+                   PI_MALLOC_ERROR )
+
+    /* for -pisvc=s, the sums of every process's counters (see SendStats),
+       and how many of them each has sent so far */
+    int counters = 2 * thisproc.allocated_channels + thisproc.allocated_bundles;
+    PI_OLP_ASSERT( stats_at = calloc( thisproc.worldsize, sizeof( int ) ),
+                   PI_MALLOC_ERROR )
+    if ( thisproc.svc_flag[LOG_STATS] )
+        PI_OLP_ASSERT( totals = calloc( counters + 1, sizeof( PI_COUNTER ) ),
+                       PI_MALLOC_ERROR )
+
+    if ( thisproc.svc_flag[LOG_TABLES] );   // dump tables to log file
+    // might be easier to do in PI_MAIN with calls to LogRecord
+
+    /* startup other OLPs */
+    if ( thisproc.svc_flag[OLP_DEADLOCK] ) PI_DetectDL_start_( &thisproc );
+
+
+    /******** main loop till "FIN" messages ********/
+
+    /* no. of FINs that have to check in (1 less if we are Pilot process) */
+    int FINs = thisproc.worldsize - thisproc.svc_flag[OLP_RANK];
+    while ( FINs > 0 ) {
+        /* wait for next batch from LogRecord, or message from SyncClock */
+        PI_CALLMPI( MPI_Recv( batch, PI_LOG_BATCH, MPI_BYTE,
+                              MPI_ANY_SOURCE, MPI_ANY_TAG, thisproc.log_comm, &stat ) )
+        k = clock + 4 * stat.MPI_SOURCE;
+
+        if ( stat.MPI_TAG == TAG_PING ) {
+            now = MPI_Wtime() - thisproc.log_start;
+            PI_CALLMPI( MPI_Send( &now, 1, MPI_DOUBLE, stat.MPI_SOURCE,
+                                  TAG_PING, thisproc.log_comm ) )
+            continue;
+        }
+        if ( stat.MPI_TAG == TAG_CLOCK ) {
+            if ( syncs[stat.MPI_SOURCE]++ ) k += 2;	// second time, at PI_StopMain
+            memcpy( k, batch, 2 * sizeof( double ) );
+            continue;
+        }
+        PI_CALLMPI( MPI_Get_count( &stat, MPI_BYTE, &size ) )
+
+        if ( stat.MPI_TAG == TAG_STATS ) {
+            PI_COUNTER *from = (PI_COUNTER *)batch;
+            PI_COUNTER *to = totals + stats_at[stat.MPI_SOURCE];
+            int i, n = size / sizeof( PI_COUNTER );
+
+            for ( i = 0; i < n; i++ ) {
+                to[i].calls += from[i].calls;
+                to[i].bytes += from[i].bytes;
+                to[i].wait += from[i].wait;
+            }
+            stats_at[stat.MPI_SOURCE] += n;
+            continue;
+        }
+        if ( stat.MPI_TAG == TAG_HIST ) {
+            long *h = (long *)batch;
+            int i, j, n = size / sizeof( long );
+
+            /* each is the index of its counter, then its buckets */
+            for ( i = 0; i + PI_HIST_BUCKETS < n; i += PI_HIST_BUCKETS + 1 ) {
+                PI_COUNTER *to = totals + h[i];
+                if ( to->hist == NULL )
+                    PI_OLP_ASSERT( to->hist = calloc( PI_HIST_BUCKETS, sizeof( long ) ),
+                                   PI_MALLOC_ERROR )
+                for ( j = 0; j < PI_HIST_BUCKETS; j++ )
+                    to->hist[j] += h[i + 1 + j];
+            }
+            continue;
+        }
+
+        for ( at = 0; at < size; at += PI_LOGREC_SIZE( rec->len ) ) {
+            rec = (PI_LOGREC *)( batch + at );
+
+            /* rebuild the line: type, process no., then call code and
+               channel/bundle ID for calls and their ends, then the text */
+            if ( rec->type == CALLS || rec->type == ENDS )
+                sprintf( event, "%c" PI_LOGSEP "%d" PI_LOGSEP "%.3s" PI_LOGSEP
+                         "%d" PI_LOGSEP "%s", rec->type, rec->proc, rec->code,
+                         rec->id, (char *)( rec + 1 ) );
+            else
+                sprintf( event, "%c" PI_LOGSEP "%d" PI_LOGSEP "%s",
+                         rec->type, rec->proc, (char *)( rec + 1 ) );
+
+            /* forward to OLP if event type is one it wants */
+            if ( thisproc.svc_flag[OLP_DEADLOCK] )
+                if ( event[0] == PILOT || event[0] == CALLS )
+                    PI_DetectDL_event_( event );
+
+            /* write event to log file with its timestamp (usec from start) */
+            if ( logfile )
+                fprintf( logfile, "%.6ld" PI_LOGSEP "%s\n",
+                            (long int)( (rec->time + k[1]) * 1000000 ), event );
+
+            /* check for "P_n_FIN" pattern, where P is the PILOT message type
+               char, _ is the separator, and n is the process number.  We need
+               to get one from all processes, so decrement counter.
+            */
+            if ( event[0] == PILOT ) {
+                char *sep = strpbrk( event+2, PI_LOGSEP );   // skip over P_n
+                if ( sep && 0==strncmp( sep+1, "FIN", 3 ) ) FINs--;
+            }
+        }
+    }
+
+    /* terminate OLPs */
+    if ( thisproc.svc_flag[OLP_DEADLOCK] ) PI_DetectDL_end_();
+
+    if ( thisproc.svc_flag[LOG_STATS] ) ReportStats( fname, totals );
+
+    if ( logfile ) {
+        fclose( logfile );
+        CorrectLog( fname, clock );
+        if ( thisproc.svc_flag[LOG_TRACE] ) TraceLog( fname );
+    }
+    free( fname );
+    free( batch );
+    free( event );
+    free( clock );
+    free( syncs );
+    free( stats_at );
+    for ( at = 0; totals && at < counters; at++ )
+        free( totals[at].hist );
+    free( totals );
+
+    return 0;
+}
+
+/*!
+********************************************************************************
+Rewrites the log file \p fname, once every process has compared its clock with
+the online process's a second time at PI_StopMain.  Its lines were timed
+allowing for the offset found at PI_StartAll; now the drift is allowed for as
+well, taking it to be steady from the first comparison to the second.
+\p clock holds 4 numbers for each rank: the time of each comparison by its
+clock and the offset found.  Leaves the file as it is if it can't be rewritten.
+*******************************************************************************/
+static void CorrectLog( const char *fname, const double *clock )
+{
+    FILE *log, *tmp;
+    char *line = NULL, *rest;
+    size_t cap = 0;
+    const double *k;
+    double t;
+    int proc;
+
+    if ( (log = fopen( fname, "r" )) == NULL ) return;
+    if ( (tmp = tmpfile()) == NULL ) {
+        fclose( log );
+        return;
+    }
+
+    /* time (usec), type, process no., then the rest of the line as it was */
+    while ( getline( &line, &cap, log ) > 0 ) {
+        t = strtol( line, &rest, 10 ) / 1000000.0;
+        if ( sscanf( rest, PI_LOGSEP "%*c" PI_LOGSEP "%d", &proc ) == 1 &&
+             proc >= 0 && proc < thisproc.allocated_processes ) {
+            k = clock + 4 * thisproc.processes[proc].rank;
+            if ( k[2] > k[0] )		// 2nd - 1st offset, over 2nd - 1st time
+                t += (k[3] - k[1]) / (k[2] - k[0]) * (t - k[1] - k[0]);
+        }
+        fprintf( tmp, "%.6ld%s", (long int)( t * 1000000 ), rest );
+    }
+    fclose( log );
+    free( line );
+
+    if ( (log = fopen( fname, "w" )) != NULL ) {
+        int c;
+        rewind( tmp );
+        while ( (c = getc( tmp )) != EOF ) putc( c, log );
+        fclose( log );
+    }
+    fclose( tmp );
+}
+
+/*!
+********************************************************************************
+Returns the bytes of user data in the parsed items \p mpiArgs, for -pisvc=s.
+*******************************************************************************/
+static long ItemBytes( const PI_MPI_RTTI mpiArgs[], int mpiArgCount )
+{
+    long bytes = 0;
+    int i, size;
+
+    for ( i = 0; i < mpiArgCount; i++ ) {
+        MPI_Type_size( mpiArgs[i].type, &size );
+        bytes += (long)mpiArgs[i].count * size;
+    }
+    return bytes;
+}
+
+/*!
+********************************************************************************
+Finds the histogram bucket for a time of \p ns nanoseconds.  As in an HDR
+histogram, times below 2^PI_HIST_BITS each have a bucket; above that, each
+doubling is split into 2^PI_HIST_BITS buckets, found from the highest bits.
+*******************************************************************************/
+static int HistBucket( long ns )
+{
+    int top = PI_HIST_BITS;	// highest bit set in ns
+
+    if ( ns < 0 ) ns = 0;
+    if ( ns >= 1L << PI_HIST_RANGE ) ns = (1L << PI_HIST_RANGE) - 1;
+    if ( ns < 1L << PI_HIST_BITS ) return ns;
+
+    while ( ns >> (top + 1) ) top++;
+    return ( (top - PI_HIST_BITS + 1) << PI_HIST_BITS ) +
+           ( (ns >> (top - PI_HIST_BITS)) & ((1 << PI_HIST_BITS) - 1) );
+}
+
+/*!
+********************************************************************************
+Returns the longest time, in seconds, that counts in histogram bucket \p i.
+*******************************************************************************/
+static double HistTime( int i )
+{
+    int shift = ( i >> PI_HIST_BITS ) - 1;	// bits below the highest ones
+    long sub = i & ((1 << PI_HIST_BITS) - 1);
+
+    if ( shift < 0 ) return i / 1e9;
+    return ( ( ((1L << PI_HIST_BITS) + sub + 1) << shift ) - 1 ) / 1e9;
+}
+
+/*!
+********************************************************************************
+Returns the time, in seconds, that fraction \p q of the calls counted in
+histogram \p hist took no longer than; 0 if none were counted.
+*******************************************************************************/
+static double Percentile( const long *hist, double q )
+{
+    long total = 0, seen = 0;
+    int i;
+
+    if ( hist == NULL ) return 0.0;
+    for ( i = 0; i < PI_HIST_BUCKETS; i++ ) total += hist[i];
+    for ( i = 0; i < PI_HIST_BUCKETS; i++ ) {
+        seen += hist[i];
+        if ( seen > 0 && seen >= q * total ) return HistTime( i );
+    }
+    return 0.0;
+}
+
+/*!
+********************************************************************************
+Fills in \p stats from counter \p k.
+*******************************************************************************/
+static void FillStats( const PI_COUNTER *k, PI_STATS *stats )
+{
+    stats->calls = k->calls;
+    stats->bytes = k->bytes;
+    stats->wait = k->wait;
+    stats->p50 = Percentile( k->hist, 0.5 );
+    stats->p99 = Percentile( k->hist, 0.99 );
+    stats->p999 = Percentile( k->hist, 0.999 );
+}
+
+/*!
+********************************************************************************
+Counts a call carrying \p bytes of user data in \p k, with the time since
+\p t0 if it's not negative (see COUNTCALL).  The histogram is allocated by
+the first timed call; if that fails, only the totals are kept.
+*******************************************************************************/
+static void CountCall( PI_COUNTER *k, long bytes, double t0 )
+{
+    k->calls++;
+    k->bytes += bytes;
+    if ( t0 >= 0.0 ) {
+        double t = MPI_Wtime() - t0;
+        k->wait += t;
+        if ( k->hist == NULL ) k->hist = calloc( PI_HIST_BUCKETS, sizeof( long ) );
+        if ( k->hist ) k->hist[ HistBucket( (long)( t * 1e9 ) ) ]++;
+    }
+}
+
+/*!
+********************************************************************************
+Returns counter \p i of this MPI process, as laid out for the online process:
+both of each channel's, in ID order, then each bundle's.
+*******************************************************************************/
+static PI_COUNTER *CounterAt( int i )
+{
+    int nchan = thisproc.allocated_channels;
+
+    if ( i < 2 * nchan ) return &thisproc.channels[i / 2]->stats[i % 2];
+    return &thisproc.bundles[i - 2 * nchan]->stats;
+}
+
+/*!
+********************************************************************************
+Sends this MPI process's -pisvc=s counters to the online process at
+PI_StopMain, laid out as by CounterAt, then the histograms of those that have
+one, each after its index.  Only the ends used here have counted anything,
+so the OLP just adds up what every process sends.  Sent in pieces no bigger
+than a log batch, which is all the OLP receives at once.
+*******************************************************************************/
+static void SendStats( void )
+{
+    PI_ON_ERROR_RETURN()
+    int olp = thisproc.svc_flag[OLP_RANK];
+    int n = 2 * thisproc.allocated_channels + thisproc.allocated_bundles;
+    int i, at, len, piece = PI_LOG_BATCH / sizeof( PI_COUNTER );
+    int rec = PI_HIST_BUCKETS + 1;		// longs per histogram sent
+
+    PI_COUNTER *k = malloc( sizeof( PI_COUNTER ) * n + 1 );
+    long *h = malloc( PI_LOG_BATCH );
+    PI_ASSERT( , k && h, PI_MALLOC_ERROR )
+
+    for ( i = 0; i < n; i++ )
+        k[i] = *CounterAt( i );
+    for ( at = 0; at < n; at += piece ) {
+        len = n - at < piece ? n - at : piece;
+        PI_CALLMPI( MPI_Send( k + at, len * sizeof( PI_COUNTER ), MPI_BYTE, olp,
+                              TAG_STATS, thisproc.log_comm ) )
+    }
+
+    for ( len = i = 0; i < n; i++ ) {
+        if ( k[i].hist == NULL ) continue;
+        h[len] = i;
+        memcpy( h + len + 1, k[i].hist, PI_HIST_BUCKETS * sizeof( long ) );
+        len += rec;
+        if ( (len + rec) * sizeof( long ) > PI_LOG_BATCH ) {
+            PI_CALLMPI( MPI_Send( h, len * sizeof( long ), MPI_BYTE, olp,
+                                  TAG_HIST, thisproc.log_comm ) )
+            len = 0;
+        }
+    }
+    if ( len ) {
+        PI_CALLMPI( MPI_Send( h, len * sizeof( long ), MPI_BYTE, olp,
+                              TAG_HIST, thisproc.log_comm ) )
+    }
+    free( k );
+    free( h );
+}
+
+/*!
+********************************************************************************
+Writes \p s to \p f as a JSON string.
+*******************************************************************************/
+static void JsonString( FILE *f, const char *s )
+{
+    putc( '"', f );
+    for ( ; *s; s++ ) {
+        if ( *s == '"' || *s == '\\' ) fprintf( f, "\\%c", *s );
+        else if ( (unsigned char)*s < ' ' ) fprintf( f, "\\u%04x", *s );
+        else putc( *s, f );
+    }
+    putc( '"', f );
+}
+
+/*!
+********************************************************************************
+Writes counter \p k to \p f as a JSON object: its totals, percentiles, and the
+buckets of its histogram that aren't empty, each as the longest time that
+counts in it and the number of calls.  Times are in seconds.
+*******************************************************************************/
+static void JsonCounter( FILE *f, const PI_COUNTER *k )
+{
+    PI_STATS st;
+    int i, first = 1;
+
+    FillStats( k, &st );
+    fprintf( f, "{\"calls\": %ld, \"bytes\": %ld, \"wait\": %.6f, \"p50\": %.9f, "
+             "\"p99\": %.9f, \"p999\": %.9f, \"hist\": [", st.calls, st.bytes,
+             st.wait, st.p50, st.p99, st.p999 );
+    for ( i = 0; k->hist && i < PI_HIST_BUCKETS; i++ ) {
+        if ( k->hist[i] == 0 ) continue;
+        fprintf( f, "%s[%.9f, %ld]", first ? "" : ", ", HistTime( i ), k->hist[i] );
+        first = 0;
+    }
+    fprintf( f, "]}" );
+}
+
+/*!
+********************************************************************************
+Prints a row of the -pisvc=s table for counter \p k, if it counted anything.
+*******************************************************************************/
+static void PrintCounter( const char *name, const char *kind, const char *ends,
+                          const PI_COUNTER *k )
+{
+    PI_STATS st;
+
+    if ( k->calls == 0 ) return;
+    FillStats( k, &st );
+    printf( "%-16.16s %-9s %-24.24s %9ld %12ld %9.3f %9.1f %9.1f %9.1f\n",
+            name, kind, ends, st.calls, st.bytes, st.wait, st.p50 * 1e6,
+            st.p99 * 1e6, st.p999 * 1e6 );
+}
+
+/*!
+********************************************************************************
+Reports the -pisvc=s counters of all processes, added up by the online
+process in \p totals (laid out as by CounterAt).  Prints a table of the
+channels and bundles that were used, and writes every one to the file
+\p fname with ".json" added, for other programs to read.
+*******************************************************************************/
+static void ReportStats( const char *fname, const PI_COUNTER *totals )
+{
+    static const char *usage[] =	// order of enum PI_BUNUSE
+        { "broadcast", "gather", "select", "reduce", "scatter", "gatherv" };
+    int nchan = thisproc.allocated_channels;
+    int i;
+    char ends[2 * PI_MAX_NAMELEN + 8];
+    FILE *f = NULL;
+
+    LOUD {
+        printf( "\n*** Statistics (-pisvc=s):\n" );
+        printf( "%-16s %-9s %-24s %9s %12s %9s %9s %9s %9s\n", "Name", "Kind",
+                "Ends", "Calls", "Bytes", "Wait(s)", "p50(us)", "p99(us)",
+                "p999(us)" );
+        for ( i = 0; i < nchan; i++ ) {
+            PI_CHANNEL *c = thisproc.channels[i];
+            sprintf( ends, "%s -> %s", ProcessAt( c->producer, c->prod_thread )->name,
+                     ProcessAt( c->consumer, c->cons_thread )->name );
+            PrintCounter( c->name, "writes", ends, totals + 2*i );
+            PrintCounter( c->name, "reads", ends, totals + 2*i + 1 );
+        }
+        for ( i = 0; i < thisproc.allocated_bundles; i++ ) {
+            PI_BUNDLE *b = thisproc.bundles[i];
+            sprintf( ends, "at %s", BundleHub( b )->name );
+            PrintCounter( b->name, usage[b->usage], ends, totals + 2*nchan + i );
+        }
+    }
+
+    if ( fname ) {
+        char *json = malloc( strlen( fname ) + 6 );
+        if ( json ) {
+            sprintf( json, "%s.json", fname );
+            f = fopen( json, "w" );
+            free( json );
+        }
+    }
+    if ( f == NULL ) return;
+
+    fprintf( f, "{\"channels\": [" );
+    for ( i = 0; i < nchan; i++ ) {
+        PI_CHANNEL *c = thisproc.channels[i];
+        fprintf( f, "%s\n  {\"id\": %d, \"name\": ", i ? "," : "", c->chan_id );
+        JsonString( f, c->name );
+        fprintf( f, ", \"from\": " );
+        JsonString( f, ProcessAt( c->producer, c->prod_thread )->name );
+        fprintf( f, ", \"to\": " );
+        JsonString( f, ProcessAt( c->consumer, c->cons_thread )->name );
+        fprintf( f, ",\n   \"writes\": " );
+        JsonCounter( f, totals + 2*i );
+        fprintf( f, ",\n   \"reads\": " );
+        JsonCounter( f, totals + 2*i + 1 );
+        fprintf( f, "}" );
+    }
+    fprintf( f, "],\n \"bundles\": [" );
+    for ( i = 0; i < thisproc.allocated_bundles; i++ ) {
+        PI_BUNDLE *b = thisproc.bundles[i];
+        fprintf( f, "%s\n  {\"id\": %d, \"name\": ", i ? "," : "", b->bund_id );
+        JsonString( f, b->name );
+        fprintf( f, ", \"usage\": \"%s\", \"hub\": ", usage[b->usage] );
+        JsonString( f, BundleHub( b )->name );
+        fprintf( f, ",\n   \"ops\": " );
+        JsonCounter( f, totals + 2*nchan + i );
+        fprintf( f, "}" );
+    }
+    fprintf( f, "]}\n" );
+    fclose( f );
+}
+
+/*!
+********************************************************************************
+Writes one event of the timeline made by TraceLog to \p f: a complete event
+(Chrome's "X") if \p dur isn't negative, else an instant one.  Its track is
+that of Pilot process \p proc, grouped by MPI rank, and it is named by the call
+\p code and the name of its channel or bundle \p id, or by \p text for other
+log entries.
+*******************************************************************************/
+static void TraceEvent( FILE *f, long ts, long dur, int proc, const char *code,
+                        int id, const char *text )
+{
+    static const char *bundled = "Sel Try Bro Gat Sca Red";  // codes of bundle calls
+    const char *obj = "?";
+    char name[PI_MAX_NAMELEN + 8];
+
+    if ( code && strstr( bundled, code ) ) {
+        if ( id >= 1 && id <= thisproc.allocated_bundles )
+            obj = thisproc.bundles[id - 1]->name;
+    }
+    else if ( code ) {
+        if ( id >= 1 && id <= thisproc.allocated_channels )
+            obj = thisproc.channels[id - 1]->name;
+    }
+    if ( code ) snprintf( name, sizeof( name ), "%s %s", code, obj );
+
+    fprintf( f, ",\n{\"name\": " );
+    JsonString( f, code ? name : text );
+    if ( dur >= 0 )
+        fprintf( f, ", \"ph\": \"X\", \"ts\": %ld, \"dur\": %ld", ts, dur );
+    else
+        fprintf( f, ", \"ph\": \"i\", \"s\": \"t\", \"ts\": %ld", ts );
+    fprintf( f, ", \"pid\": %d, \"tid\": %d", thisproc.processes[proc].rank, proc );
+    if ( code && *text ) {
+        fprintf( f, ", \"args\": {\"format\": " );
+        JsonString( f, text );
+        fprintf( f, "}" );
+    }
+    fprintf( f, "}" );
+}
+
+/*!
+********************************************************************************
+Makes a timeline of the calls in the log file \p fname, once its times have
+been corrected, for -pisvc=t.  It is written in Chrome's Trace Event format
+(which Perfetto also reads) to the file \p fname with ".trace.json" added.
+Each Pilot process has a track of its own.  A call whose end was logged
+becomes a slice from its start to its end, and other entries become instants.
+Arrows link the slice of each write to that of its read, which have the same
+channel and message number (see LOGEND).  A process's entries are in time
+order, so its call is ended by the next ENDS entry, if any, before its next
+call.
+*******************************************************************************/
+static void TraceLog( const char *fname )
+{
+    FILE *log, *f;
+    char *line = NULL, *rest, *json, type, code[4];
+    size_t cap = 0;
+    long t;
+    int i, n, proc, id, seq, at, read;
+    int procs = thisproc.allocated_processes;
+    int olp = thisproc.svc_flag[OLP_RANK] ? 1 : -1;	// Pilot OLP logs nothing
+
+    /* per process, the call that started last and hasn't ended: its time,
+       code, ID and format (which is NULL if there's none) */
+    long *start = malloc( sizeof( long ) * procs + 1 );
+    char (*calls)[4] = malloc( sizeof( *calls ) * procs + 1 );
+    int *ids = malloc( sizeof( int ) * procs + 1 );
+    char **formats = calloc( procs + 1, sizeof( char * ) );
+
+    json = malloc( strlen( fname ) + 12 );
+    if ( !start || !calls || !ids || !formats || !json ) goto done;
+    sprintf( json, "%s.trace.json", fname );
+    if ( (log = fopen( fname, "r" )) == NULL ) goto done;
+    if ( (f = fopen( json, "w" )) == NULL ) {
+        fclose( log );
+        goto done;
+    }
+
+    /* name the tracks: MPI ranks, and the Pilot processes on them */
+    fprintf( f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n"
+             "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, "
+             "\"args\": {\"name\": \"MPI rank 0\"}}" );
+    for ( i = 1; i < thisproc.worldsize; i++ ) {
+        if ( i == olp ) continue;
+        fprintf( f, ",\n{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, "
+                 "\"args\": {\"name\": \"MPI rank %d\"}}", i, i );
+    }
+    for ( i = 0; i < procs; i++ ) {
+        if ( i == olp ) continue;
+        fprintf( f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, "
+                 "\"tid\": %d, \"args\": {\"name\": ", thisproc.processes[i].rank, i );
+        JsonString( f, thisproc.processes[i].name );
+        fprintf( f, "}}" );
+    }
+
+    /* time (usec), type, process no., then for calls and their ends the
+       call code, channel/bundle ID, and format or message no. */
+    while ( (n = getline( &line, &cap, log )) > 0 ) {
+        if ( line[n - 1] == '\n' ) line[n - 1] = '\0';
+        t = strtol( line, &rest, 10 );
+        if ( sscanf( rest, PI_LOGSEP "%c" PI_LOGSEP "%d%n", &type, &proc, &at ) < 2
+             || proc < 0 || proc >= procs ) continue;
+        rest += at;
+
+        if ( type == CALLS || type == ENDS ) {
+            if ( sscanf( rest, PI_LOGSEP "%3[^" PI_LOGSEP "]" PI_LOGSEP "%d%n",
+                         code, &id, &at ) < 2 ) continue;
+            rest += at;
+            if ( *rest ) rest++;		// the text follows a separator
+        }
+
+        if ( type == CALLS ) {
+            if ( formats[proc] )		// last call had no end
+                TraceEvent( f, start[proc], -1, proc, calls[proc], ids[proc],
+                            formats[proc] );
+            free( formats[proc] );
+            formats[proc] = strdup( rest );
+            start[proc] = t;
+            memcpy( calls[proc], code, sizeof( code ) );
+            ids[proc] = id;
+        }
+        else if ( type == ENDS ) {
+            if ( formats[proc] == NULL || ids[proc] != id ||
+                 strcmp( calls[proc], code ) ) continue;	// not this call's
+            TraceEvent( f, start[proc], t - start[proc], proc, code, id,
+                        formats[proc] );
+            free( formats[proc] );
+            formats[proc] = NULL;
+
+            /* an arrow from the start of the write's slice to the end of
+               the read's, when the message is in */
+            seq = atoi( rest );
+            read = strcmp( code, "Rea" ) == 0 || strcmp( code, "Ard" ) == 0;
+            if ( seq > 0 )
+                fprintf( f, ",\n{\"name\": \"message\", \"cat\": \"message\", "
+                         "\"ph\": \"%s\", \"id\": \"%d.%d\", \"ts\": %ld, "
+                         "\"pid\": %d, \"tid\": %d}",
+                         read ? "f\", \"bp\": \"e" : "s", id, seq,
+                         read ? t : start[proc], thisproc.processes[proc].rank, proc );
+        }
+        else if ( type == USER || type == PILOT ) {
+            TraceEvent( f, t, -1, proc, NULL, 0, rest + 1 );
+        }
+    }
+    for ( i = 0; i < procs; i++ )
+        if ( formats[i] )
+            TraceEvent( f, start[i], -1, i, calls[i], ids[i], formats[i] );
+
+    fprintf( f, "\n]}\n" );
+    fclose( f );
+    fclose( log );
+
+done:
+    for ( i = 0; formats && i < procs; i++ ) free( formats[i] );
+    free( formats );
+    free( ids );
+    free( calls );
+    free( start );
+    free( json );
+    free( line );
+}
+
+
+/*!
+********************************************************************************
+Gives this MPI process its batches of log records, if logging, and the
+communicator for them, which the online process shares.  Called by
+PI_StartAll before its barrier; the clock the records are timed by starts
+after it.  A Pilot online process logs nothing.
+
+\return 1 if successful, 0 if an error was reported.
+*******************************************************************************/
+static int StartLog( void )
+{
+    PI_ON_ERROR_RETURN( 0 )
+
+    thisproc.log_sent = 0.0;
+    thisproc.log_used = 0;
+
+    if ( !thisproc.svc_flag[LOGGING] ) return 1;
+    PI_CALLMPI( MPI_Comm_dup( MPI_COMM_WORLD, &thisproc.log_comm ) )
+    if ( thisproc.rank == 1 && thisproc.svc_flag[OLP_RANK] == 1 ) return 1;
+
+    thisproc.log_batch[0] = malloc( PI_LOG_BATCH );
+    thisproc.log_batch[1] = malloc( PI_LOG_BATCH );
+    PI_ASSERT( , thisproc.log_batch[0] && thisproc.log_batch[1], PI_MALLOC_ERROR )
+    return 1;
+}
+
+/*!
+********************************************************************************
+Compares this process's clock with the online process's, by PI_CLOCK_SAMPLES
+round trips of an empty ping, each answered with the time by the OLP's clock.
+The offset is taken from the quickest, as seen from its middle, since that
+bounds the error best.  The time and offset are sent to the OLP, which uses
+them to correct the times of this process's log records.  Called at
+PI_StartAll and at PI_StopMain, so the OLP can also allow for drift.
+*******************************************************************************/
+static void SyncClock( void )
+{
+    int i, olp = thisproc.svc_flag[OLP_RANK];
+    double t0, t1, ref, best = -1.0, clock[2] = { 0.0, 0.0 };
+
+    if ( thisproc.log_batch[0] == NULL ) return;	// not logging here
+
+    for ( i = 0; i < PI_CLOCK_SAMPLES; i++ ) {
+        t0 = MPI_Wtime();
+        PI_CALLMPI( MPI_Send( NULL, 0, MPI_BYTE, olp, TAG_PING, thisproc.log_comm ) )
+        PI_CALLMPI( MPI_Recv( &ref, 1, MPI_DOUBLE, olp, TAG_PING,
+                              thisproc.log_comm, MPI_STATUS_IGNORE ) )
+        t1 = MPI_Wtime();
+        if ( best < 0.0 || t1 - t0 < best ) {
+            best = t1 - t0;
+            clock[0] = (t0 + t1) / 2 - thisproc.log_start;
+            clock[1] = ref - clock[0];
+        }
+    }
+    PI_CALLMPI( MPI_Send( clock, sizeof( clock ), MPI_BYTE, olp, TAG_CLOCK,
+                          thisproc.log_comm ) )
+}
+
+/*!
+********************************************************************************
+Add process number and time, and put in this MPI process's batch of log
+records as a PI_LOGREC.  The batch is sent to the online process (see
+FlushLog) when the next record wouldn't fit, or when PI_LOG_INTERVAL has
+passed since the last one was sent.  For deadlock detection, each record is
+sent at once, since the detector has to know about a call before the caller
+can be stuck in it.
+
+  - ev is the log event type
+  - code and id are the call code and channel/bundle ID of a CALLS or ENDS
+    event, else code is NULL
+  - text is the rest of the event, cut short to fit in an empty batch
+
+Overflow will only be an issue with user events (via PI_Log).
+*******************************************************************************/
+static void LogRecord( LOGEVENT ev, const char *code, int id, const char *text )
+{
+    PI_LOGREC *rec;
+    double now = MPI_Wtime() - thisproc.log_start;
+    int len = strlen( text ) + 1;
+
+    if ( thisproc.log_batch[0] == NULL ) return;	// not logging here
+    if ( PI_LOGREC_SIZE( len ) > PI_LOG_BATCH )
+        len = PI_LOG_BATCH - sizeof( PI_LOGREC );
+
+    LOCK_SHARED		// one batch for all the threads
+
+    if ( thisproc.log_used + PI_LOGREC_SIZE( len ) > PI_LOG_BATCH )
+        FlushLog( 0 );
+
+    rec = (PI_LOGREC *)( thisproc.log_batch[0] + thisproc.log_used );
+    rec->time = now;
+    rec->proc = (int)( THIS_PROCESS - thisproc.processes );
+    rec->id = id;
+    rec->len = len;
+    rec->type = ev;
+    if ( code ) memcpy( rec->code, code, sizeof( rec->code ) );
+    memcpy( rec + 1, text, len - 1 );
+    ((char *)( rec + 1 ))[len - 1] = '\0';
+    thisproc.log_used += PI_LOGREC_SIZE( len );
+
+    if ( thisproc.svc_flag[OLP_DEADLOCK] )
+        FlushLog( 1 );
+    else if ( now - thisproc.log_sent >= PI_LOG_INTERVAL )
+        FlushLog( 0 );
+
+    UNLOCK_SHARED
+}
+
+/*!
+********************************************************************************
+Logs the end of a call logged by LOGCALL, with the number \p seq of the
+message it wrote or read (see LOGEND) as its text.
+*******************************************************************************/
+static void LogEnd( const char *code, int id, int seq )
+{
+    char text[16];
+
+    sprintf( text, "%d", seq );
+    LogRecord( ENDS, code, id, text );
+}
+
+/*!
+********************************************************************************
+Sends the batch of log records being filled, if any, to the online process,
+and starts filling the other one once its own send has completed.  If \p wait
+is non-0, waits for this send to complete too.  Rank of OLP is in
+svc_flag[OLP_RANK].
+Callers in threads must hold SharedLock.
+*******************************************************************************/
+static void FlushLog( int wait )
+{
+    char *full = thisproc.log_batch[0];
+    int used = thisproc.log_used;
+
+    if ( full == NULL || used == 0 ) return;
+
+    PI_CALLMPI( MPI_Wait( &thisproc.log_req, MPI_STATUS_IGNORE ) )
+    thisproc.log_batch[0] = thisproc.log_batch[1];
+    thisproc.log_batch[1] = full;
+    thisproc.log_used = 0;
+    thisproc.log_sent = MPI_Wtime() - thisproc.log_start;
+
+    PI_CALLMPI( MPI_Isend( full, used, MPI_BYTE, thisproc.svc_flag[OLP_RANK],
+                           TAG_BATCH, thisproc.log_comm, &thisproc.log_req ) )
+    if ( wait ) {
+        PI_CALLMPI( MPI_Wait( &thisproc.log_req, MPI_STATUS_IGNORE ) )
+    }
+}
+
+/*!
+********************************************************************************
+Returns the number of bytes needed to pack all \p n items with MPI_Pack.
+Both ends of a channel compute the same size when their formats match.
+*******************************************************************************/
+static int PackedSize( PI_MPI_RTTI meta[], int n, MPI_Comm comm )
+{
+    int i, size, total = 0;
+
+    for ( i = 0; i < n; i++ ) {
+        PI_CALLMPI( MPI_Pack_size( meta[i].count, meta[i].type, comm, &size ) )
+        total += size;
+    }
+    return total;
+}
+
+/*!
+********************************************************************************
+Packs all \p n items into \p buf, which has room for \p size bytes.
+\return Number of bytes actually packed.
+*******************************************************************************/
+static int PackItems( PI_MPI_RTTI meta[], int n, void *buf, int size, MPI_Comm comm )
+{
+    int i, position = 0;
+
+    for ( i = 0; i < n; i++ ) {
+        PI_CALLMPI( MPI_Pack( meta[i].buf, meta[i].count, meta[i].type,
+                              buf, size, &position, comm ) )
+    }
+    return position;
+}
+
+/*!
+********************************************************************************
+Unpacks all \p n items from \p buf, which holds up to \p size bytes.
+*******************************************************************************/
+static void UnpackItems( PI_MPI_RTTI meta[], int n, void *buf, int size, MPI_Comm comm )
+{
+    int i, position = 0;
+
+    for ( i = 0; i < n; i++ ) {
+        PI_CALLMPI( MPI_Unpack( buf, size, &position,
+                                meta[i].buf, meta[i].count, meta[i].type, comm ) )
+    }
+}
+
+/*!
+********************************************************************************
+Builds a committed struct datatype describing all \p n items at their
+absolute addresses, for use with MPI_BOTTOM.  The caller must free it.
+*******************************************************************************/
+static MPI_Datatype StructType( PI_MPI_RTTI meta[], int n )
+{
+    int i;
+    int blocklens[ PI_MAX_FORMATLEN ];
+    MPI_Aint displs[ PI_MAX_FORMATLEN ];
+    MPI_Datatype types[ PI_MAX_FORMATLEN ];
+    MPI_Datatype t;
+
+    for ( i = 0; i < n; i++ ) {
+        blocklens[i] = meta[i].count;
+        types[i] = meta[i].type;
+        PI_CALLMPI( MPI_Get_address( meta[i].buf, &displs[i] ) )
+    }
+    PI_CALLMPI( MPI_Type_create_struct( n, blocklens, displs, types, &t ) )
+    PI_CALLMPI( MPI_Type_commit( &t ) )
+    return t;
+}
+
+/*
+   The following functions move all the items of one read/write call in a
+   single MPI message, so a multi-item format costs one message latency
+   instead of one per item.  A single item is sent as is.  Several items
+   that pack into at most PI_PACK_MAX bytes are packed into a stack buffer;
+   larger ones are described by a struct datatype so they are not copied.
+   Both ends make the same choice since they compute the same packed size.
+*/
+
+/*!
+********************************************************************************
+Completes MPI request \p req, like MPI_Wait.  A coroutine (-picoro=n) polls it
+instead, yielding to the others between polls.
+*******************************************************************************/
+static void WaitMPI( MPI_Request *req, MPI_Status *status )
+{
+    int flag;
+
+    if ( RunningTask == NULL ) {
+        PI_CALLMPI( MPI_Wait( req, status ) )
+        return;
+    }
+    for ( ;; ) {
+        PI_CALLMPI( MPI_Test( req, &flag, status ) )
+        if ( flag ) return;
+        YieldTask();
+    }
+}
+
+/*!
+********************************************************************************
+Completes one of the \p n requests in \p reqs, like MPI_Waitany, and yields
+while polling them as WaitMPI does.
+*******************************************************************************/
+static void WaitAnyMPI( int n, MPI_Request reqs[], int *index, MPI_Status *status )
+{
+    int flag;
+
+    if ( RunningTask == NULL ) {
+        PI_CALLMPI( MPI_Waitany( n, reqs, index, status ) )
+        return;
+    }
+    for ( ;; ) {
+        PI_CALLMPI( MPI_Testany( n, reqs, index, &flag, status ) )
+        if ( flag ) return;
+        YieldTask();
+    }
+}
+
+/*!
+********************************************************************************
+Waits for a message to match, like MPI_Probe, and yields while polling for it
+as WaitMPI does.
+*******************************************************************************/
+static void ProbeMPI( int source, int tag, MPI_Comm comm, MPI_Status *status )
+{
+    int flag;
+
+    if ( RunningTask == NULL ) {
+        PI_CALLMPI( MPI_Probe( source, tag, comm, status ) )
+        return;
+    }
+    for ( ;; ) {
+        PI_CALLMPI( MPI_Iprobe( source, tag, comm, &flag, status ) )
+        if ( flag ) return;
+        YieldTask();
+    }
+}
+
+/*!
+********************************************************************************
+Sends one message, like MPI_Send, or for a coroutine starts it and completes
+it with WaitMPI.
+*******************************************************************************/
+static void SendMPI( void *buf, int count, MPI_Datatype type, int dest, int tag,
+                     MPI_Comm comm )
+{
+    MPI_Request req;
+
+    if ( RunningTask == NULL ) {
+        PI_CALLMPI( MPI_Send( buf, count, type, dest, tag, comm ) )
+        return;
+    }
+    PI_CALLMPI( MPI_Isend( buf, count, type, dest, tag, comm, &req ) )
+    WaitMPI( &req, MPI_STATUS_IGNORE );
+}
+
+/*!
+********************************************************************************
+Receives one message, like MPI_Recv, or for a coroutine starts it and
+completes it with WaitMPI.
+*******************************************************************************/
+static void RecvMPI( void *buf, int count, MPI_Datatype type, int source, int tag,
+                     MPI_Comm comm )
+{
+    MPI_Request req;
+
+    if ( RunningTask == NULL ) {
+        PI_CALLMPI( MPI_Recv( buf, count, type, source, tag, comm, MPI_STATUS_IGNORE ) )
+        return;
+    }
+    PI_CALLMPI( MPI_Irecv( buf, count, type, source, tag, comm, &req ) )
+    WaitMPI( &req, MPI_STATUS_IGNORE );
+}
+
+/*!
+********************************************************************************
+Sends all \p n items to \p dest in one message.
+*******************************************************************************/
+static void SendItems( PI_MPI_RTTI meta[], int n, int dest, int tag, MPI_Comm comm )
+{
+    if ( n == 1 ) {
+        SendMPI( meta[0].buf, meta[0].count, meta[0].type, dest, tag, comm );
+        return;
+    }
+
+    int size = PackedSize( meta, n, comm );
+    if ( size <= PI_PACK_MAX ) {
+        char packbuf[ PI_PACK_MAX ];
+        int used = PackItems( meta, n, packbuf, size, comm );
+        SendMPI( packbuf, used, MPI_PACKED, dest, tag, comm );
+    }
+    else {
+        MPI_Datatype t = StructType( meta, n );
+        SendMPI( MPI_BOTTOM, 1, t, dest, tag, comm );
+        PI_CALLMPI( MPI_Type_free( &t ) )
+    }
+}
+
+/*!
+********************************************************************************
+Receives all \p n items from \p source, as sent by SendItems.
+*******************************************************************************/
+static void RecvItems( PI_MPI_RTTI meta[], int n, int source, int tag, MPI_Comm comm )
+{
+    if ( n == 1 ) {
+        RecvMPI( meta[0].buf, meta[0].count, meta[0].type, source, tag, comm );
+        return;
+    }
+
+    int size = PackedSize( meta, n, comm );
+    if ( size <= PI_PACK_MAX ) {
+        char packbuf[ PI_PACK_MAX ];
+        RecvMPI( packbuf, size, MPI_PACKED, source, tag, comm );
+        UnpackItems( meta, n, packbuf, size, comm );
+    }
+    else {
+        MPI_Datatype t = StructType( meta, n );
+        RecvMPI( MPI_BOTTOM, 1, t, source, tag, comm );
+        PI_CALLMPI( MPI_Type_free( &t ) )
+    }
+}
+
+/*!
+********************************************************************************
+Broadcasts all \p n items from rank 0 of \p comm (\p isRoot true) to the
+other ranks, in one MPI_Bcast.
+*******************************************************************************/
+static void BcastItems( PI_MPI_RTTI meta[], int n, int isRoot, MPI_Comm comm )
+{
+    if ( n == 1 ) {
+        PI_CALLMPI( MPI_Bcast( meta[0].buf, meta[0].count, meta[0].type, 0, comm ) )
+        return;
+    }
+
+    int size = PackedSize( meta, n, comm );
+    if ( size <= PI_PACK_MAX ) {
+        char packbuf[ PI_PACK_MAX ];
+        if ( isRoot ) PackItems( meta, n, packbuf, size, comm );
+        PI_CALLMPI( MPI_Bcast( packbuf, size, MPI_PACKED, 0, comm ) )
+        if ( !isRoot ) UnpackItems( meta, n, packbuf, size, comm );
+    }
+    else {
+        MPI_Datatype t = StructType( meta, n );
+        PI_CALLMPI( MPI_Bcast( MPI_BOTTOM, 1, t, 0, comm ) )
+        PI_CALLMPI( MPI_Type_free( &t ) )
+    }
+}
+
+/*!
+********************************************************************************
+Sends a rim process's \p n items to the hub's PI_Gatherv over the bundle's
+communicator \p comm: first the element count of each item plus the size of
+the packed items, then the items themselves (packed if more than one).
+*******************************************************************************/
+static void GathervItems( PI_MPI_RTTI meta[], int n, MPI_Comm comm )
+{
+    PI_ON_ERROR_RETURN()
+    int i, info[ PI_MAX_FORMATLEN + 1 ];
+
+    for ( i = 0; i < n; i++ )
+        info[i] = meta[i].count;
+    info[n] = n > 1 ? PackedSize( meta, n, comm ) : 0;
+
+    PI_CALLMPI( MPI_Gatherv( info, n+1, MPI_INT,	// what we're sending
+                             NULL, NULL, NULL, 0,	// ignored on sender call
+                             0, comm ) )		// "root" is rank 0 in bundle
+
+    if ( n == 1 ) {
+        PI_CALLMPI( MPI_Gatherv( meta[0].buf, meta[0].count, meta[0].type,
+                                 NULL, NULL, NULL, 0, 0, comm ) )
+        return;
+    }
+
+    /* send exactly the size we reported, as PI_Gatherv expects */
+    char *packbuf = calloc( info[n], 1 );
+    PI_ASSERT( , packbuf, PI_MALLOC_ERROR )
+    PackItems( meta, n, packbuf, info[n], comm );
+
+    PI_CALLMPI( MPI_Gatherv( packbuf, info[n], MPI_PACKED,
+                             NULL, NULL, NULL, 0, 0, comm ) )
+    free( packbuf );
+}
+
+/*!
+********************************************************************************
+Makes sure the channels table has room for \p more channels beyond those
+already allocated, doubling it (starting from PI_CHANNEL_SLAB rows) as often
+as needed.  Growing geometrically keeps the cost of creating C channels O(C).
+
+\return 1 if successful, 0 if an error was reported.
+*******************************************************************************/
+static int GrowChannels( int more )
+{
+    PI_ON_ERROR_RETURN( 0 )
+    int need = thisproc.allocated_channels + more;
+
+    if ( need <= thisproc.channel_rows ) return 1;
+
+    int rows = thisproc.channel_rows ? thisproc.channel_rows : PI_CHANNEL_SLAB;
+    while ( rows < need ) rows *= 2;
+
+    PI_CHANNEL **table = realloc( thisproc.channels, rows * sizeof( PI_CHANNEL * ) );
+    PI_ASSERT( , table, PI_MALLOC_ERROR )
+    thisproc.channels = table;
+    thisproc.channel_rows = rows;
+    return 1;
+}
+
+/*!
+********************************************************************************
+Creates a channel from process \p from to process \p to, which the caller has
+already validated, and enters it in the channels table.
+
+Channel structs are carved out of slabs of PI_CHANNEL_SLAB, so that a large
+configuration doesn't make a separate malloc call for each one.  A new slab
+is started whenever the number of channels is a multiple of PI_CHANNEL_SLAB,
+so the first channel of each slab points to the start of its memory.
+
+The channel's MPI communicator and tag are left for AssignChannelComms.
+
+\return The new channel, or NULL if an error was reported.
+*******************************************************************************/
+static PI_CHANNEL *NewChannel( const PI_PROCESS *from, const PI_PROCESS *to )
+{
+    PI_ON_ERROR_RETURN( NULL )
+    int n = thisproc.allocated_channels;
+
+    if ( !GrowChannels( 1 ) ) return NULL;	// error already reported
+
+    PI_CHANNEL *pc;
+    if ( n % PI_CHANNEL_SLAB == 0 ) {
+        pc = malloc( PI_CHANNEL_SLAB * sizeof( PI_CHANNEL ) );
+        PI_ASSERT( , pc, PI_MALLOC_ERROR )
+    }
+    else
+        pc = thisproc.channels[n-1] + 1;
+
+    thisproc.channels[n] = pc;
+
+    /* channel ID is just 1+no. allocated so far */
+    pc->chan_id = ++thisproc.allocated_channels;
+    pc->chan_tag = -1;		/* not assigned yet */
+    pc->chan_comm = MPI_COMM_NULL;
+
+    pc->producer = from->rank;
+    pc->consumer = to->rank;
+    pc->prod_thread = from->thread;
+    pc->cons_thread = to->thread;
+
+    snprintf( pc->name, PI_MAX_NAMELEN, "C%d:P%d>P%d", pc->chan_id,
+		(int)( from - thisproc.processes ),
+		(int)( to - thisproc.processes ) ); // default name "Cn:Pf>Pt"
+
+    pc->bundle = NULL;		/* initially not part of bundle */
+    pc->ring = NULL;		/* not known till PI_StartAll */
+    pc->queue = pc->queue_end = NULL;
+    pc->waiter = NULL;
+    pc->rma_size = 0;		/* no RMA slot unless PI_SetRMA */
+    pc->rma_disp = 0;
+    pc->rma_free = 1;
+    pc->capacity = 0;		/* unbuffered unless PI_CreateBufferedChannel */
+    pc->credits = 0;
+    pc->slots = NULL;
+    pc->next_slot = 0;
+    pc->flow_tag = 0;
+    pc->flow_req = MPI_REQUEST_NULL;
+    pc->write_count = 0;
+    memset( pc->stats, 0, sizeof( pc->stats ) );
+    pc->magic = PI_CHAN;
+
+    return pc;
+}
+
+/*!
+********************************************************************************
+Finds the process on thread \p thread of MPI rank \p rank; the inverse of the
+placement made by PI_CreateProcess.
+*******************************************************************************/
+static PI_PROCESS *ProcessAt( int rank, int thread )
+{
+    int olp = thisproc.svc_flag[OLP_RANK];	// rank without threads, if any
+
+    if ( thread == 0 ) return &thisproc.processes[rank];
+    return &thisproc.processes[ thisproc.worldsize +
+                                ( thread - 1 ) * ( thisproc.worldsize - olp ) +
+                                rank - ( olp && rank > olp ) ];
+}
+
+/*!
+********************************************************************************
+Finds the process at the common end of bundle \p b's channels.
+*******************************************************************************/
+static PI_PROCESS *BundleHub( const PI_BUNDLE *b )
+{
+    const PI_CHANNEL *c = b->channels[0];
+
+    if ( b->narrow_end == FROM ) return ProcessAt( c->producer, c->prod_thread );
+    return ProcessAt( c->consumer, c->cons_thread );
+}
+
+/*!
+********************************************************************************
+Gives every channel the MPI communicator and tag it will use, sharding each
+process's incoming channels across duplicates of MPI_COMM_WORLD.
+
+MPI matches a receive against the messages waiting for this process on the
+same communicator, so a process that reads from hundreds of channels on one
+communicator walks a long queue on every receive.  Instead, the channels
+coming into each process are numbered in turn (a Selector's channels share
+one number, since it probes them all with one tag), and each run of
+PI_QUEUE_CHANNELS numbers goes on its own communicator, with tags 1 up.  Only
+the consumer matches on a (communicator, tag) pair, so the same pairs are
+reused for every consumer, and the number of communicators depends on the
+most channels coming into any one process, not on the total.
+
+If that would take more than PI_CHANNEL_COMMS communicators, runs are made
+longer instead, as far as MPI_TAG_UB allows; past that, there are as many
+communicators as needed, so the number of channels is never limited by tags.
+
+Every process has the same configuration, so they all compute the same
+assignment, and all take part in the MPI_Comm_dup calls.  Also records, for
+the -pisvc=s statistics, how many channels feed the widest matching queue on
+this process.
+
+\return 1 if successful, 0 if an error was reported.
+*******************************************************************************/
+static int AssignChannelComms( void )
+{
+    PI_ON_ERROR_RETURN( 0 )
+    int i, k, n, most = 0, run, unit;
+    PI_CHANNEL *c;
+
+    /* count of numbers given out so far to each consumer */
+    int *units = calloc( thisproc.worldsize, sizeof( int ) );
+    PI_ASSERT( , units, PI_MALLOC_ERROR )
+
+    /* number the channels; selector first, as a Selector's channels are not
+       marked as bundled; chan_tag holds the number till the end */
+    for ( i = 0; i < thisproc.allocated_bundles; i++ ) {
+        PI_BUNDLE *b = thisproc.bundles[i];
+        if ( b->usage != PI_SELECT ) continue;
+        unit = units[b->channels[0]->consumer]++;
+        for ( k = 0; k < b->size; k++ )
+            b->channels[k]->chan_tag = unit;
+    }
+    for ( i = 0; i < thisproc.allocated_channels; i++ ) {
+        c = thisproc.channels[i];
+        if ( c->chan_tag < 0 )
+            c->chan_tag = units[c->consumer]++;
+    }
+
+    for ( i = 0; i < thisproc.worldsize; i++ )
+        if ( units[i] > most ) most = units[i];
+
+    /* how many numbers to a run (= tags per communicator) */
+    run = PI_QUEUE_CHANNELS;
+    if ( most > run * PI_CHANNEL_COMMS )
+        run = (most + PI_CHANNEL_COMMS - 1) / PI_CHANNEL_COMMS;
+    if ( run > MPIMaxTag ) run = MPIMaxTag;
+    n = most ? (most + run - 1) / run : 0;
+
+    thisproc.queue_width = units[thisproc.rank] < run ? units[thisproc.rank] : run;
+    free( units );
+
+    if ( n > 0 ) {
+        thisproc.comms = malloc( n * sizeof( MPI_Comm ) );
+        PI_ASSERT( , thisproc.comms, PI_MALLOC_ERROR )
+    }
+    for ( ; thisproc.allocated_comms < n; thisproc.allocated_comms++ ) {
+        PI_CALLMPI( MPI_Comm_dup( MPI_COMM_WORLD,
+                                  &thisproc.comms[thisproc.allocated_comms] ) )
+    }
+
+    for ( i = 0; i < thisproc.allocated_channels; i++ ) {
+        c = thisproc.channels[i];
+        c->chan_comm = thisproc.comms[c->chan_tag / run];
+        c->chan_tag = c->chan_tag % run + 1;
+    }
+    return 1;
+}
+
+/*!
+********************************************************************************
+Puts each channel whose ends are on the same node on a shared memory ring
+(PI_RING), so that its small messages are copied into and out of memory both
+processes can see instead of going through MPI.
+
+The processes on each node share one MPI window, found with
+MPI_Comm_split_type, and each process's segment holds the rings of the
+channels it reads, in channel ID order.  Selector channels are left alone,
+since PI_Select probes for their messages with MPI, as are collective
+channels, those with an RMA slot (see RmaChannels), and those beyond the
+first PI_SHM_CHANNELS into any one process.
+Messages too large for the ring still go by MPI (see RingSend).  Channels
+between threads of one MPI process get private rings (see LocalRings).
+
+Every process has the same configuration, so they all agree on which
+channels have rings and where they are.  The rings are made before the
+barrier in PI_StartAll, so none is used before it is initialized.
+
+\return 1 if successful, 0 if an error was reported.
+*******************************************************************************/
+static int ShareChannels( void )
+{
+    PI_ON_ERROR_RETURN( 0 )
+
+    if ( thisproc.svc_flag[SHM_MODE] == SHM_OFF ) return 1;
+
+    if ( !LocalRings() ) return 0;	// error already reported
+
+#if MPI_VERSION >= 3
+    int i, k, *node, *slot, *rings;
+    MPI_Group world, group;
+    MPI_Info info;
+    MPI_Aint segsize;
+    PI_RING *base;
+    PI_CHANNEL *c;
+
+    PI_CALLMPI( MPI_Comm_split_type( MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0,
+                                     MPI_INFO_NULL, &thisproc.node_comm ) )
+
+    /* node[r] = rank in node_comm of world rank r, or MPI_UNDEFINED */
+    node = malloc( thisproc.worldsize * sizeof( int ) );
+    slot = malloc( (thisproc.allocated_channels + 1) * sizeof( int ) );
+    rings = calloc( thisproc.worldsize, sizeof( int ) );
+    if ( node==NULL || slot==NULL || rings==NULL ) {
+        free( node ); free( slot ); free( rings );
+        PI_ASSERT( , 0, PI_MALLOC_ERROR )
+    }
+    for ( i = 0; i < thisproc.worldsize; i++ )
+        rings[i] = i;		// world ranks to translate, then ring counts
+    PI_CALLMPI( MPI_Comm_group( MPI_COMM_WORLD, &world ) )
+    PI_CALLMPI( MPI_Comm_group( thisproc.node_comm, &group ) )
+    PI_CALLMPI( MPI_Group_translate_ranks( world, thisproc.worldsize, rings,
+                                           group, node ) )
+    MPI_Group_free( &world );
+    MPI_Group_free( &group );
+    memset( rings, 0, thisproc.worldsize * sizeof( int ) );
+
+    /* slot[i] = index of channel i's ring in its consumer's segment, or -1 */
+    for ( i = 0; i < thisproc.allocated_channels; i++ )
+        slot[i] = 0;
+    for ( i = 0; i < thisproc.allocated_bundles; i++ ) {
+        PI_BUNDLE *b = thisproc.bundles[i];
+        if ( b->usage != PI_SELECT ) continue;
+        for ( k = 0; k < b->size; k++ )
+            slot[b->channels[k]->chan_id - 1] = -1;
+    }
+    for ( i = 0; i < thisproc.allocated_channels; i++ ) {
+        c = thisproc.channels[i];
+        if ( slot[i] < 0 || c->bundle || c->rma_size || c->capacity
+             || c->producer == c->consumer
+             || node[c->producer] == MPI_UNDEFINED
+             || node[c->consumer] == MPI_UNDEFINED
+             || rings[c->consumer] == PI_SHM_CHANNELS )
+            slot[i] = -1;
+        else
+            slot[i] = rings[c->consumer]++;
+    }
+    thisproc.rings = rings[thisproc.rank];
+
+    /* each segment on its own pages, so rings don't share cache lines */
+    MPI_Info_create( &info );
+    MPI_Info_set( info, "alloc_shared_noncontig", "true" );
+    PI_CALLMPI( MPI_Win_allocate_shared( thisproc.rings * sizeof( PI_RING ), 1,
+                                         info, thisproc.node_comm, &base,
+                                         &thisproc.ring_win ) )
+    MPI_Info_free( &info );
+    PI_CALLMPI( MPI_Win_lock_all( MPI_MODE_NOCHECK, thisproc.ring_win ) )
+
+    for ( i = 0; i < thisproc.rings; i++ )
+        base[i].head = base[i].sent = base[i].tail = base[i].taken = 0;
+    PI_CALLMPI( MPI_Win_sync( thisproc.ring_win ) )
+
+    /* find the rings of the channels this process reads or writes */
+    for ( i = 0; i < thisproc.allocated_channels; i++ ) {
+        c = thisproc.channels[i];
+        if ( slot[i] < 0 || (c->producer != thisproc.rank &&
+                             c->consumer != thisproc.rank) )
+            continue;
+        PI_CALLMPI( MPI_Win_shared_query( thisproc.ring_win, node[c->consumer],
+                                          &segsize, &k, &base ) )
+        c->ring = base + slot[i];
+    }
+
+    free( node );
+    free( slot );
+    free( rings );
+#endif
+    return 1;
+}
+
+/*!
+********************************************************************************
+Frees the shared window made for rings by ShareChannels.
+*******************************************************************************/
+static void FreeRings( void )
+{
+#if MPI_VERSION >= 3
+    if ( thisproc.ring_win != MPI_WIN_NULL ) {
+        MPI_Win_unlock_all( thisproc.ring_win );
+        MPI_Win_free( &thisproc.ring_win );
+    }
+#endif
+    if ( thisproc.node_comm != MPI_COMM_NULL )
+        MPI_Comm_free( &thisproc.node_comm );
+    thisproc.rings = 0;
+    free( thisproc.local_rings );
+    thisproc.local_rings = NULL;
+}
+
+/*!
+********************************************************************************
+Gives each channel that PI_SetRMA gave a size its slot: an area of that many
+bytes in its consumer's segment of one MPI window over all processes, made
+with MPI_Win_allocate so that MPI can register it for RDMA.  Each segment
+holds the slots of the channels read there, in channel ID order, each on a
+new cache line.  The slot sizes of collective channels, of channels within
+one MPI process, and of buffered channels are cleared, as they never use one.
+
+The producer learns its slot is free from notices on flow_comm (see
+BufferChannels).  Every process has the same configuration, so they all agree
+on where the slots are, and all take part in making the window.  Without
+MPI-3, no channel has a slot.
+
+\return 1 if successful, 0 if an error was reported.
+*******************************************************************************/
+static int RmaChannels( void )
+{
+    PI_ON_ERROR_RETURN( 0 )
+    int i, n = 0;
+    PI_CHANNEL *c;
+
+    for ( i = 0; i < thisproc.allocated_channels; i++ ) {
+        c = thisproc.channels[i];
+#if MPI_VERSION >= 3
+        if ( c->bundle || c->producer == c->consumer || c->capacity )
+            c->rma_size = 0;
+#else
+        c->rma_size = 0;	// needs MPI_Win_allocate
+#endif
+        if ( c->rma_size ) n++;
+    }
+    if ( n == 0 ) return 1;
+
+#if MPI_VERSION >= 3
+    void *base;
+    MPI_Aint *used = calloc( thisproc.worldsize, sizeof( MPI_Aint ) );
+    PI_ASSERT( , used, PI_MALLOC_ERROR )
+
+    for ( i = 0; i < thisproc.allocated_channels; i++ ) {
+        c = thisproc.channels[i];
+        if ( c->rma_size == 0 ) continue;
+        c->rma_disp = used[c->consumer];
+        used[c->consumer] += (c->rma_size + PI_CACHE_LINE - 1) & ~(PI_CACHE_LINE - 1);
+    }
+
+    PI_CALLMPI( MPI_Win_allocate( used[thisproc.rank], 1, MPI_INFO_NULL,
+                                  MPI_COMM_WORLD, &base, &thisproc.rma_win ) )
+    PI_CALLMPI( MPI_Win_lock_all( MPI_MODE_NOCHECK, thisproc.rma_win ) )
+    free( used );
+#endif
+    return 1;
+}
+
+/*!
+********************************************************************************
+Frees the window made by RmaChannels.
+*******************************************************************************/
+static void FreeRMA( void )
+{
+#if MPI_VERSION >= 3
+    if ( thisproc.rma_win == MPI_WIN_NULL ) return;
+
+    MPI_Win_unlock_all( thisproc.rma_win );
+    MPI_Win_free( &thisproc.rma_win );
+#endif
+}
+
+/*!
+********************************************************************************
+Numbers the RMA and buffered channels that each process writes, giving each
+one the tag on flow_comm of the notices its consumer sends back, and gives
+the buffered channels written here their credits and send slots.  The
+capacities of collective channels are cleared, as they never use them.
+
+\return 1 if successful, 0 if an error was reported.
+*******************************************************************************/
+static int BufferChannels( void )
+{
+    PI_ON_ERROR_RETURN( 0 )
+    int i, k, n = 0;
+    PI_CHANNEL *c;
+    int *tags = calloc( thisproc.worldsize, sizeof( int ) );
+    PI_ASSERT( , tags, PI_MALLOC_ERROR )
+
+    for ( i = 0; i < thisproc.allocated_channels; i++ ) {
+        c = thisproc.channels[i];
+        if ( c->bundle ) c->capacity = 0;
+        if ( c->rma_size == 0 && c->capacity == 0 ) continue;
+
+        n++;
+        c->flow_tag = ++tags[c->producer];
+        if ( c->flow_tag > MPIMaxTag ) {
+            free( tags );
+            PI_ASSERT( , 0, PI_MAX_TAGS )
+        }
+        if ( c->capacity == 0 || c->producer != thisproc.rank ) continue;
+
+        /* slots start big enough for any message that would be packed */
+        c->credits = c->capacity;
+        c->slots = malloc( c->capacity * sizeof( PI_SLOT ) );
+        for ( k = 0; c->slots && k < c->capacity; k++ ) {
+            c->slots[k].buf = malloc( PI_PACK_MAX );
+            c->slots[k].size = c->slots[k].buf ? PI_PACK_MAX : 0;
+            c->slots[k].req = MPI_REQUEST_NULL;
+        }
+        if ( c->slots == NULL ) {
+            free( tags );
+            PI_ASSERT( , 0, PI_MALLOC_ERROR )
+        }
+    }
+    free( tags );
+
+    if ( n > 0 ) {
+        PI_CALLMPI( MPI_Comm_dup( MPI_COMM_WORLD, &thisproc.flow_comm ) )
+    }
+    return 1;
+}
+
+/*!
+********************************************************************************
+Waits for the messages written ahead on buffered channels to be received,
+since their readers are still owed them, and frees the send slots.  Then
+collects the notices still owed to this process for RMA and buffered channels
+before freeing flow_comm, since a notice left behind would be matched in
+whatever communicator MPI makes next in its place.
+*******************************************************************************/
+static void FreeBuffers( void )
+{
+    int i, k;
+
+    for ( i = 0; i < thisproc.allocated_channels; i++ ) {
+        PI_CHANNEL *c = thisproc.channels[i];
+        if ( c->producer != thisproc.rank ) continue;
+        if ( c->slots ) {
+            for ( k = 0; k < c->capacity; k++ ) {
+                MPI_Wait( &c->slots[k].req, MPI_STATUS_IGNORE );
+                free( c->slots[k].buf );
+            }
+            free( c->slots );
+            c->slots = NULL;
+        }
+        if ( c->rma_size ) RmaSlot( c, 1 );
+        for ( ; c->credits < c->capacity; c->credits++ ) {
+            if ( c->flow_req == MPI_REQUEST_NULL )
+                MPI_Irecv( NULL, 0, MPI_BYTE, c->consumer, c->flow_tag,
+                           thisproc.flow_comm, &c->flow_req );
+            MPI_Wait( &c->flow_req, MPI_STATUS_IGNORE );
+        }
+    }
+    if ( thisproc.flow_comm != MPI_COMM_NULL )
+        MPI_Comm_free( &thisproc.flow_comm );
+}
+
+/*!
+********************************************************************************
+Gives each channel between two threads of this MPI process (-pithreads=n) a
+ring in ordinary memory, so that its messages are queued in memory rather than
+sent by MPI to this process itself.  As for ShareChannels, Selector and
+collective channels are left alone.  The rings are used just like shared
+ones, so large messages still go by MPI.
+
+\return 1 if successful, 0 if an error was reported.
+*******************************************************************************/
+static int LocalRings( void )
+{
+    PI_ON_ERROR_RETURN( 0 )
+    int i, k, n = 0;
+    char *local;
+    PI_CHANNEL *c;
+
+    if ( thisproc.threads == 1 ) return 1;
+
+    /* local[i] = 1 if channel i gets a ring */
+    local = malloc( thisproc.allocated_channels + 1 );
+    PI_ASSERT( , local, PI_MALLOC_ERROR )
+    for ( i = 0; i < thisproc.allocated_channels; i++ ) {
+        c = thisproc.channels[i];
+        local[i] = c->producer == thisproc.rank && c->consumer == thisproc.rank
+                   && c->bundle == NULL && c->capacity == 0;
+    }
+    for ( i = 0; i < thisproc.allocated_bundles; i++ ) {
+        PI_BUNDLE *b = thisproc.bundles[i];
+        if ( b->usage != PI_SELECT ) continue;
+        for ( k = 0; k < b->size; k++ )
+            local[b->channels[k]->chan_id - 1] = 0;
+    }
+    for ( i = 0; i < thisproc.allocated_channels; i++ )
+        n += local[i];
+
+    /* calloc leaves the counts 0, and pages untouched till used */
+    if ( n > 0 ) {
+        thisproc.local_rings = calloc( n, sizeof( PI_RING ) );
+        if ( thisproc.local_rings == NULL ) {
+            free( local );
+            PI_ASSERT( , 0, PI_MALLOC_ERROR )
+        }
+    }
+    for ( i = 0, k = 0; i < thisproc.allocated_channels; i++ )
+        if ( local[i] ) thisproc.channels[i]->ring = &thisproc.local_rings[k++];
+
+    free( local );
+    return 1;
+}
+
+/*!
+********************************************************************************
+Builds the table that maps the rank of each rim process of bundle \p b to the
+index of its channel, so that PI_Select can find the channel in constant time
+however wide the bundle is.
+
+If the world is small enough (see PI_DENSE_LOOKUP_MAX), the table is simply
+indexed by rank, with -1 for ranks not in the bundle.  Otherwise it is an open
+addressing hash table of (rank,index) pairs with at least twice as many slots
+as the bundle has channels, and lookupmask is the number of slots less one.
+
+Since every rim process is looked up while the table is built, this is also
+where duplicates are caught, in linear time rather than by comparing pairs.
+
+\return 1 if successful, 0 if an error was reported (e.g., PI_BUNDLE_DUPLICATE,
+or PI_BUNDLE_RANKS for two rim processes on one rank).
+*******************************************************************************/
+static int BuildRimIndex( PI_BUNDLE *b )
+{
+    PI_ON_ERROR_RETURN( 0 )
+    int i, rank, slot;
+
+    if ( thisproc.worldsize <= PI_DENSE_LOOKUP_MAX ||
+         thisproc.worldsize <= 4 * b->size ) {
+        b->lookupmask = 0;
+        b->lookup = malloc( sizeof( int ) * thisproc.worldsize );
+        PI_ASSERT( , b->lookup, PI_MALLOC_ERROR )
+        for ( i = 0; i < thisproc.worldsize; i++ )
+            b->lookup[i] = -1;
+    }
+    else {
+        int slots = 2;
+        while ( slots < 2 * b->size ) slots *= 2;
+        b->lookupmask = slots - 1;
+        b->lookup = malloc( sizeof( int ) * 2 * slots );
+        PI_ASSERT( , b->lookup, PI_MALLOC_ERROR )
+        for ( i = 0; i < 2 * slots; i++ )
+            b->lookup[i] = -1;
+    }
+
+    for ( i = 0; i < b->size; i++ ) {
+        rank = b->narrow_end==FROM ? b->channels[i]->consumer
+                                   : b->channels[i]->producer;
+        if ( b->lookupmask == 0 ) {
+            PI_ASSERT( , b->lookup[rank] < 0, RimClash( b, b->lookup[rank], i ) )
+            b->lookup[rank] = i;
+            continue;
+        }
+        slot = RANK_HASH( rank ) & b->lookupmask;
+        while ( b->lookup[2*slot] >= 0 ) {	// linear probing
+            PI_ASSERT( , b->lookup[2*slot] != rank,
+                       RimClash( b, b->lookup[2*slot+1], i ) )
+            slot = (slot + 1) & b->lookupmask;
+        }
+        b->lookup[2*slot] = rank;
+        b->lookup[2*slot+1] = i;
+    }
+    return 1;
+}
+
+/*!
+********************************************************************************
+Returns the error for rim channels \p i and \p j of bundle \p b having their
+rim ends on the same rank: PI_BUNDLE_DUPLICATE if the ends are the same
+process, else PI_BUNDLE_RANKS (they are threads, see -pithreads).
+*******************************************************************************/
+static int RimClash( const PI_BUNDLE *b, int i, int j )
+{
+    const PI_CHANNEL *x = b->channels[i], *y = b->channels[j];
+    int same = b->narrow_end==FROM ? x->cons_thread==y->cons_thread
+                                   : x->prod_thread==y->prod_thread;
+
+    return same ? PI_BUNDLE_DUPLICATE : PI_BUNDLE_RANKS;
+}
+
+/*!
+********************************************************************************
+Returns the index of the channel in bundle \p b whose rim process has MPI
+rank \p rank, or -1 if there is none.
+*******************************************************************************/
+static int RimIndex( const PI_BUNDLE *b, int rank )
+{
+    if ( b->lookupmask == 0 )
+        return rank >= 0 && rank < thisproc.worldsize ? b->lookup[rank] : -1;
+
+    int slot = RANK_HASH( rank ) & b->lookupmask;
+    while ( b->lookup[2*slot] >= 0 ) {
+        if ( b->lookup[2*slot] == rank )
+            return b->lookup[2*slot+1];
+        slot = (slot + 1) & b->lookupmask;
+    }
+    return -1;
+}
+
+/*!
+********************************************************************************
+Chooses a channel of selector bundle \p b that has data, according to its
+policy (other than PI_SELECT_FIFO), by probing each channel in turn.
+
+For PI_SELECT_PRIORITY this is a smooth weighted round robin: each channel
+with data adds its weight to its running total, the one with the largest total
+is chosen, and the sum of the weights is subtracted from its total.  Channels
+of weight 0 are only considered if no other channel has data.
+
+\param b Selector bundle.
+\param block If no channel has data, wait for one if true, else return -1.
+\return Index of the channel chosen, or -1.
+*******************************************************************************/
+static int FairSelect( PI_BUNDLE *b, int block )
+{
+    int i, k, flag, pick, zero, total;
+    int tag = b->channels[0]->chan_tag;	// common tag of Selector
+    MPI_Comm comm = b->channels[0]->chan_comm;	// and its communicator
+    MPI_Status status;
+
+    while ( 1 ) {
+        pick = -1;
+
+        if ( b->policy == PI_SELECT_ROUND_ROBIN ) {
+            for ( k = 0; k < b->size; k++ ) {
+                i = (b->cursor + k) % b->size;
+                PI_CALLMPI( MPI_Iprobe( b->channels[i]->producer, tag,
+                                        comm, &flag, &status ) )
+                if ( flag ) {
+                    pick = i;
+                    b->cursor = (i + 1) % b->size;
+                    break;
+                }
+            }
+        }
+        else {			/* PI_SELECT_PRIORITY */
+            total = 0;
+            zero = -1;
+            for ( i = 0; i < b->size; i++ ) {
+                PI_CALLMPI( MPI_Iprobe( b->channels[i]->producer, tag,
+                                        comm, &flag, &status ) )
+                if ( !flag ) continue;
+                if ( b->weights[i] == 0 ) {
+                    if ( zero < 0 ) zero = i;
+                    continue;
+                }
+                b->current[i] += b->weights[i];
+                total += b->weights[i];
+                if ( pick < 0 || b->current[i] > b->current[pick] )
+                    pick = i;
+            }
+            if ( pick >= 0 )
+                b->current[pick] -= total;
+            else
+                pick = zero;
+        }
+
+        if ( pick >= 0 || !block ) return pick;
+
+        /* no channel has data, so wait till one does, then choose again */
+        ProbeMPI( MPI_ANY_SOURCE, tag, comm, &status );
+    }
+}
+
+/*
+   The following functions move messages through a channel's PI_RING.  The
+   producer numbers its messages with sent, and puts each one in the ring if
+   it is small enough and there is room; otherwise it sends it by MPI on the
+   channel's communicator and tag as usual, so a write never waits for the
+   ring.  The consumer reads message number taken from the ring if that is
+   where it is, and otherwise receives it by MPI, which keeps the messages in
+   order.  For -pishm=2, the producer also waits until taken has passed its
+   message, so a write completes only once the matching read has begun, as it
+   would by rendezvous.
+*/
+
+/*!
+********************************************************************************
+Lets other processes run while waiting on a ring, and keeps this process's
+MPI transfers moving (MPI only makes progress inside MPI calls).
+*******************************************************************************/
+static void RingIdle( void )
+{
+    static __thread unsigned idles;
+    int flag;
+
+    if ( ++idles % PI_SHM_PROGRESS == 0 ) {
+        PI_CALLMPI( MPI_Iprobe( MPI_ANY_SOURCE, MPI_ANY_TAG,
+                                thisproc.node_comm != MPI_COMM_NULL ?
+                                thisproc.node_comm : MPI_COMM_WORLD,
+                                &flag, MPI_STATUS_IGNORE ) )
+    }
+    if ( RunningTask ) YieldTask();
+    else sched_yield();
+}
+
+/*!
+********************************************************************************
+Waits for the other end of ring channel \p c to move.  A coroutine waiting on
+a channel within its MPI process (-picoro=n) parks until the other end, which
+is another coroutine here, wakes it; otherwise it is RingIdle.
+*******************************************************************************/
+static void RingWait( PI_CHANNEL *c )
+{
+    if ( RunningTask && c->producer == c->consumer ) ParkTask( c );
+    else RingIdle();
+}
+
+/*!
+********************************************************************************
+Finds room in ring \p q for a message of \p len packed bytes, marking the rest
+of the ring to be skipped if the message must wrap around to the start.
+\return Where to pack the message, or NULL if there is no room yet; \p *at
+gets the position of its header, to pass to RingCommit.
+*******************************************************************************/
+static char *RingClaim( PI_RING *q, int len, long *at )
+{
+    long head = q->head;
+    long off = head & (PI_SHM_RING - 1);
+    long need = PI_RECORD_SIZE( len );
+    long skip = off + need > PI_SHM_RING ? PI_SHM_RING - off : 0;
+
+    if ( head + skip + need - __atomic_load_n( &q->tail, __ATOMIC_ACQUIRE )
+         > PI_SHM_RING )
+        return NULL;
+
+    if ( skip ) {	// not visible to the consumer till RingCommit
+        ((PI_RECORD *)( q->data + off ))->len = -1;
+        head += skip;
+        off = 0;
+    }
+    *at = head;
+    return q->data + off + sizeof( PI_RECORD );
+}
+
+/*!
+********************************************************************************
+Makes message \p seq of \p len bytes, packed where RingClaim said, visible to
+the consumer of ring \p q.
+*******************************************************************************/
+static void RingCommit( PI_RING *q, long at, int len, long seq )
+{
+    PI_RECORD *h = (PI_RECORD *)( q->data + (at & (PI_SHM_RING - 1)) );
+
+    h->len = len;
+    h->seq = seq;
+    __atomic_store_n( &q->head, at + PI_RECORD_SIZE( len ), __ATOMIC_RELEASE );
+}
+
+/*!
+********************************************************************************
+\return The oldest message in ring \p q, or NULL if it is empty.
+*******************************************************************************/
+static PI_RECORD *RingPeek( PI_RING *q )
+{
+    long tail = q->tail;
+    PI_RECORD *h;
+
+    if ( tail == __atomic_load_n( &q->head, __ATOMIC_ACQUIRE ) ) return NULL;
+
+    h = (PI_RECORD *)( q->data + (tail & (PI_SHM_RING - 1)) );
+    if ( h->len < 0 ) {	// skip is committed with the message after it
+        tail += PI_SHM_RING - (tail & (PI_SHM_RING - 1));
+        __atomic_store_n( &q->tail, tail, __ATOMIC_RELEASE );
+        h = (PI_RECORD *)q->data;
+    }
+    return h;
+}
+
+/*!
+********************************************************************************
+Writes all \p n items on ring channel \p c as one message: into the ring if
+possible, else by MPI.  If \p r is not NULL, the MPI send is non-blocking and
+\p r records how the message went.
+\return Number of the message on the channel.
+*******************************************************************************/
+static long RingSend( PI_CHANNEL *c, PI_MPI_RTTI meta[], int n, PI_REQUEST *r )
+{
+    PI_RING *q = c->ring;
+    long seq = q->sent, at;
+    int size = PackedSize( meta, n, MPI_COMM_WORLD );
+    char *p = size <= PI_SHM_LARGE ? RingClaim( q, size, &at ) : NULL;
+
+    if ( r ) r->seq = seq;
+
+    if ( p ) {
+        size = PackItems( meta, n, p, size, MPI_COMM_WORLD );
+        RingCommit( q, at, size, seq );
+        __atomic_store_n( &q->sent, seq + 1, __ATOMIC_RELEASE );
+        if ( c->waiter ) WakeTask( c );
+        if ( r ) r->ring = RING_DONE;
+        return seq;
+    }
+
+    /* the consumer must know there is a message before a blocking send,
+       which may wait for the receive */
+    __atomic_store_n( &q->sent, seq + 1, __ATOMIC_RELEASE );
+    if ( c->waiter ) WakeTask( c );
+    if ( r ) {
+        PostRequest( r, 0 );
+        r->ring = RING_MPI;
+    }
+    else SendItems( meta, n, c->consumer, c->chan_tag, c->chan_comm );
+    return seq;
+}
+
+/*!
+********************************************************************************
+Reads the next message on ring channel \p c into all \p n items, if it has
+been written: from the ring if it is there, else by MPI.  If \p r is not NULL,
+the MPI receive is non-blocking and \p r records how the message came.
+\return 1 if the message was read (or its receive started), 0 if not written yet.
+*******************************************************************************/
+static int RingRecv( PI_CHANNEL *c, PI_MPI_RTTI meta[], int n, PI_REQUEST *r )
+{
+    PI_RING *q = c->ring;
+    long seq = q->taken;
+    PI_RECORD *h;
+
+    if ( __atomic_load_n( &q->sent, __ATOMIC_ACQUIRE ) == seq ) return 0;
+
+    /* messages are put in the ring in order, so if the oldest one there is
+       not this one, this one went by MPI */
+    h = RingPeek( q );
+    if ( h && h->seq == (unsigned)seq ) {
+        UnpackItems( meta, n, h + 1, h->len, MPI_COMM_WORLD );
+        __atomic_store_n( &q->tail, q->tail + PI_RECORD_SIZE( h->len ),
+                          __ATOMIC_RELEASE );
+        if ( r ) r->ring = RING_DONE;
+    }
+    else if ( r ) {
+        PostRequest( r, 0 );
+        r->ring = RING_MPI;
+    }
+    else RecvItems( meta, n, c->producer, c->chan_tag, c->chan_comm );
+
+    __atomic_store_n( &q->taken, seq + 1, __ATOMIC_RELEASE );
+    if ( c->waiter ) WakeTask( c );
+    return 1;
+}
+
+/*!
+********************************************************************************
+Reads messages on ring channel \p c for its queued non-blocking reads, oldest
+first, for as long as messages are there.
+*******************************************************************************/
+static void RingProgress( PI_CHANNEL *c )
+{
+    PI_REQUEST *r;
+
+    while ( (r = c->queue) && RingRecv( c, r->args, r->count, r ) ) {
+        c->queue = r->ring_next;
+        r->ring_next = NULL;
+    }
+}
+
+/*!
+********************************************************************************
+Tests whether request \p r on a ring channel has completed.
+*******************************************************************************/
+static int RingTest( PI_REQUEST *r )
+{
+    PI_CHANNEL *c = r->channel;
+    int flag = 1;
+
+    if ( r->ring == RING_QUEUED ) {
+        RingProgress( c );
+        if ( r->ring == RING_QUEUED ) return 0;
+    }
+    if ( r->ring == RING_MPI ) {
+        PI_CALLMPI( MPI_Test( &r->req, &flag, MPI_STATUS_IGNORE ) )
+    }
+    if ( flag && r->direction==IO_DIRECTION_WRITE &&
+         thisproc.svc_flag[SHM_MODE] == SHM_SYNC )
+        flag = __atomic_load_n( &c->ring->taken, __ATOMIC_ACQUIRE ) > r->seq;
+    return flag;
+}
+
+/*!
+********************************************************************************
+Starts request \p r on a ring channel: a write is sent at once, while a read
+joins the channel's queue until its message has been written.
+*******************************************************************************/
+static void StartRingRequest( PI_REQUEST *r )
+{
+    PI_CHANNEL *c = r->channel;
 
-\param comm MPI communicator where error occurred (will be MPI_COMM_WORLD).
-\param code MPI error code
-\param ... additional implementation-specific args (ignore)
+    if ( r->direction==IO_DIRECTION_WRITE ) {
+        RingSend( c, r->args, r->count, r );
+        return;
+    }
+
+    r->ring = RING_QUEUED;
+    r->ring_next = NULL;
+    if ( c->queue ) c->queue_end->ring_next = r;
+    else c->queue = r;
+    c->queue_end = r;
+    RingProgress( c );
+}
+
+/*
+   The following functions move messages through a channel's RMA slot (see
+   PI_SetRMA).  A message that fits is put by MPI_Put straight from the
+   writer's items into the slot, in the consumer's segment of rma_win, and
+   then an empty notice is sent on the channel's communicator and tag as a
+   message would be, so selects and probes see it as usual.  The reader gets
+   the items out of the slot and sends an empty notice back on flow_comm to
+   say the slot is free, which the writer waits for before its next put.
+   Other messages are sent as usual, in order with the rest: a non-blocking
+   write waiting for the slot holds up later writes in the channel's queue,
+   and non-blocking reads of the slot are queued so that they empty it in
+   order, before any blocking read.
+*/
+
+/*!
+********************************************************************************
+Lays out the \p n items of a message on RMA channel \p c in its slot, each on
+a 16-byte boundary, giving their displacements in the consumer's segment in
+\p disp.  Both ends compute the same layout when their formats match.
+\return 1 if the message goes through the slot, 0 if it is sent as usual.
 *******************************************************************************/
-static void HandleMPIErrors( MPI_Comm *comm, int *code, ... )
+static int RmaLayout( PI_CHANNEL *c, PI_MPI_RTTI meta[], int n, MPI_Aint disp[] )
 {
-    char buff[MPI_MAX_ERROR_STRING], text[MPI_MAX_ERROR_STRING+80];
-    int len;
+    MPI_Aint lb, extent, at = 0;
+    int i;
 
-    MPI_Error_string( *code, buff, &len );	// obtain text for error code
+    for ( i = 0; i < n; i++ ) {
+        PI_CALLMPI( MPI_Type_get_extent( meta[i].type, &lb, &extent ) )
+        at = (at + 15) & ~(MPI_Aint)15;
+        disp[i] = c->rma_disp + at - lb;
+        at += meta[i].count * extent;
+    }
+    return at >= PI_RMA_MIN && at <= c->rma_size;
+}
 
-    snprintf( text, sizeof(text), " at " __FILE__ ":%d; MPI error code %d:\n%s",
-              MPICallLine, *code, buff );
+/*!
+********************************************************************************
+Checks whether the slot of RMA channel \p c, written by this process, is free,
+waiting till it is if \p block is non-0.
+\return Non-0 if the slot is free.
+*******************************************************************************/
+static int RmaSlot( PI_CHANNEL *c, int block )
+{
+    int flag = 1;
 
-    PI_Abort( PI_SYSTEM_ERROR, text, PI_CallerFile, PI_CallerLine );
-    /***** does not return *****/
+    if ( c->rma_free ) return 1;
+
+    if ( c->flow_req == MPI_REQUEST_NULL ) {
+        PI_CALLMPI( MPI_Irecv( NULL, 0, MPI_BYTE, c->consumer, c->flow_tag,
+                               thisproc.flow_comm, &c->flow_req ) )
+    }
+    if ( block ) WaitMPI( &c->flow_req, MPI_STATUS_IGNORE );
+    else {
+        PI_CALLMPI( MPI_Test( &c->flow_req, &flag, MPI_STATUS_IGNORE ) )
+    }
+    return c->rma_free = flag;
 }
 
 /*!
 ********************************************************************************
-Parse command-line arguments to Pilot. Fills in #Option.
+Writes all \p n items on RMA channel \p c as one message: through the slot,
+once it is free, if the message goes there; else as usual.  If \p r is not
+NULL, the notice or message is sent with a non-blocking send in r's request.
+Earlier writes on the channel must have been sent already.
 *******************************************************************************/
-static char *ParseArgs( int *argc, char ***argv )
+static void RmaSend( PI_CHANNEL *c, PI_MPI_RTTI meta[], int n, PI_REQUEST *r )
 {
-    int i, j, unrec, count=0, moveto=0;
-    char *badargs = NULL;		// assume all -pi... args will be OK
+    MPI_Aint disp[ PI_MAX_FORMATLEN ];
+    int i;
 
-    memset( Option, 0, OPT_END );	// clear all option flags
-    LogFilename = NULL;			// assume no log needed
-    OnlineProcess = OLP_NONE;		// assume no online process needed
+    if ( !RmaLayout( c, meta, n, disp ) ) {
+        if ( r ) PostRequest( r, 0 );
+        else SendItems( meta, n, c->consumer, c->chan_tag, c->chan_comm );
+        return;
+    }
 
-    /* scan args, shuffling non-Pilot args up in *argv array */
-    for ( i=0; i<*argc; i++ ) {
-        unrec = 0;
-        if ( 0==strncmp( (*argv)[i], "-pi", 3 ) ) {	// -pi... arg found
+    RmaSlot( c, 1 );
+    for ( i = 0; i < n; i++ ) {
+        PI_CALLMPI( MPI_Put( meta[i].buf, meta[i].count, meta[i].type,
+                             c->consumer, disp[i], meta[i].count, meta[i].type,
+                             thisproc.rma_win ) )
+    }
+    PI_CALLMPI( MPI_Win_flush( c->consumer, thisproc.rma_win ) )
+    c->rma_free = 0;
 
-            /* '-pisvc=...' runtime services */
-            if ( 0==strncmp( (*argv)[i]+3, "svc=", 4 ) ) {
-                for ( j=7; (*argv)[i][j]; j++ ) {
-                    switch ( toupper( (*argv)[i][j] ) ) {
-                    case 'C':
-                        Option[OPT_CALLS] = 1;
-                        break;
-                    case 'S':
-                        Option[OPT_STATS] = 1;
-                        break;
-                    case 'M':
-                        Option[OPT_TOPO] = 1;
-                        break;
-                    case 'T':
-                        Option[OPT_TRACE] = 1;
-                        break;
-                    case 'D':
-                        Option[OPT_DEADLOCK] = 1;
-                        break;
-                    default:
-                        unrec = 1;
-                    }
-                }
-            }
+    if ( r ) {
+        PI_CALLMPI( MPI_Isend( NULL, 0, MPI_BYTE, c->consumer, c->chan_tag,
+                               c->chan_comm, &r->req ) )
+    }
+    else SendMPI( NULL, 0, MPI_BYTE, c->consumer, c->chan_tag, c->chan_comm );
+}
 
-            /* '-pilog=t|p =filename =t|p:filename' */
-            else if ( 0==strncmp( (*argv)[i]+3, "log=", 4 ) ) {
-                char tp = toupper( (*argv)[i][7] ); // possible t or p flag
-                int len = strlen( (*argv)[i] );
-                if ( len < 8 ) unrec = 1;
-                else if ( len == 8 ) {
-                    if ( 'T'==tp || 'P'==tp )
-                        OnlineProcess = 'T'==tp ? OLP_THREAD : OLP_PILOT;
-                    else LogFilename = (*argv)[i]+7; // found 1-char filename
-                }
-                else if ( ':'==(*argv)[i][8] ) {
-                    if ( 'T'==tp || 'P'==tp )
-                        OnlineProcess = 'T'==tp ? OLP_THREAD : OLP_PILOT;
-                    else unrec = 1;
-                    if ( len > 9 )
-                        LogFilename = (*argv)[i]+9;	// found :filename
-                }
-                else LogFilename = (*argv)[i]+7;	// found filename
-            }
+/*!
+********************************************************************************
+Copies all \p n items of the message in the slot of RMA channel \p c out to
+their variables, from the displacements given by RmaLayout in \p disp, then
+tells the writer that the slot is free.
+*******************************************************************************/
+static void RmaGet( PI_CHANNEL *c, PI_MPI_RTTI meta[], int n, MPI_Aint disp[] )
+{
+    int i;
+
+    for ( i = 0; i < n; i++ ) {
+        PI_CALLMPI( MPI_Get( meta[i].buf, meta[i].count, meta[i].type,
+                             thisproc.rank, disp[i], meta[i].count, meta[i].type,
+                             thisproc.rma_win ) )
+    }
+    PI_CALLMPI( MPI_Win_flush( thisproc.rank, thisproc.rma_win ) )
+    SendMPI( NULL, 0, MPI_BYTE, c->producer, c->flow_tag, thisproc.flow_comm );
+}
+
+/*!
+********************************************************************************
+Reads the next message on RMA channel \p c into all \p n items: out of the
+slot once its notice comes, if the message goes there; else as usual.
+Queued non-blocking reads on the channel must have had theirs already.
+*******************************************************************************/
+static void RmaRecv( PI_CHANNEL *c, PI_MPI_RTTI meta[], int n )
+{
+    MPI_Aint disp[ PI_MAX_FORMATLEN ];
+
+    if ( !RmaLayout( c, meta, n, disp ) ) {
+        RecvItems( meta, n, c->producer, c->chan_tag, c->chan_comm );
+        return;
+    }
+
+    RecvMPI( NULL, 0, MPI_BYTE, c->producer, c->chan_tag, c->chan_comm );
+    RmaGet( c, meta, n, disp );
+}
+
+/*!
+********************************************************************************
+Sends the oldest queued non-blocking write on RMA channel \p c, if the slot
+allows, or once it does if \p block is non-0.
+\return 1 if a write was sent, 0 if not (or none was queued).
+*******************************************************************************/
+static int RmaNext( PI_CHANNEL *c, int block )
+{
+    MPI_Aint disp[ PI_MAX_FORMATLEN ];
+    PI_REQUEST *r = c->queue;
+
+    if ( r == NULL ) return 0;
+    if ( RmaLayout( c, r->args, r->count, disp ) && !RmaSlot( c, block ) )
+        return 0;
+
+    c->queue = r->ring_next;
+    r->ring_next = NULL;
+    RmaSend( c, r->args, r->count, r );
+    r->rma = RMA_MPI;
+    return 1;
+}
+
+/*!
+********************************************************************************
+Copies the message for the oldest queued non-blocking read on RMA channel \p c
+out of the slot, if its notice has come, or once it does if \p block is non-0.
+\return 1 if a read was done, 0 if not (or none was queued).
+*******************************************************************************/
+static int RmaTake( PI_CHANNEL *c, int block )
+{
+    MPI_Aint disp[ PI_MAX_FORMATLEN ];
+    PI_REQUEST *r = c->queue;
+    int flag = 1;
+
+    if ( r == NULL ) return 0;
+    if ( block ) WaitMPI( &r->req, MPI_STATUS_IGNORE );
+    else {
+        PI_CALLMPI( MPI_Test( &r->req, &flag, MPI_STATUS_IGNORE ) )
+    }
+    if ( !flag ) return 0;
+
+    c->queue = r->ring_next;
+    r->ring_next = NULL;
+    RmaLayout( c, r->args, r->count, disp );
+    RmaGet( c, r->args, r->count, disp );
+    r->rma = RMA_DONE;
+    return 1;
+}
+
+/*!
+********************************************************************************
+Tests whether request \p r on an RMA channel has completed, moving the
+channel's queue along as far as it can go without waiting.
+*******************************************************************************/
+static int RmaTest( PI_REQUEST *r )
+{
+    PI_CHANNEL *c = r->channel;
+    int flag;
+
+    if ( r->rma == RMA_QUEUED ) {
+        if ( r->direction==IO_DIRECTION_WRITE ) while ( RmaNext( c, 0 ) ) ;
+        else while ( RmaTake( c, 0 ) ) ;
+        if ( r->rma == RMA_QUEUED ) return 0;
+    }
+    if ( r->rma == RMA_DONE ) return 1;
+
+    PI_CALLMPI( MPI_Test( &r->req, &flag, MPI_STATUS_IGNORE ) )
+    return flag;
+}
+
+/*!
+********************************************************************************
+Waits for request \p r on an RMA channel to complete, along with the requests
+queued ahead of it.
+*******************************************************************************/
+static void RmaWait( PI_REQUEST *r )
+{
+    PI_CHANNEL *c = r->channel;
+
+    while ( r->rma == RMA_QUEUED ) {
+        if ( r->direction==IO_DIRECTION_WRITE ) RmaNext( c, 1 );
+        else RmaTake( c, 1 );
+    }
+    if ( r->rma == RMA_MPI ) WaitMPI( &r->req, MPI_STATUS_IGNORE );
+}
+
+/*!
+********************************************************************************
+Starts request \p r on an RMA channel.  A write joins the channel's queue and
+is sent as soon as its turn and the slot allow, which may be at once.  A read
+whose message goes through the slot starts receiving the notice and joins the
+queue; any other read is simply posted.
+*******************************************************************************/
+static void StartRmaRequest( PI_REQUEST *r )
+{
+    PI_CHANNEL *c = r->channel;
+    MPI_Aint disp[ PI_MAX_FORMATLEN ];
+
+    if ( r->direction==IO_DIRECTION_READ ) {
+        if ( !RmaLayout( c, r->args, r->count, disp ) ) {
+            PostRequest( r, 0 );
+            r->rma = RMA_MPI;
+            return;
+        }
+        PI_CALLMPI( MPI_Irecv( NULL, 0, MPI_BYTE, c->producer, c->chan_tag,
+                               c->chan_comm, &r->req ) )
+    }
+
+    r->rma = RMA_QUEUED;
+    r->ring_next = NULL;
+    if ( c->queue ) c->queue_end->ring_next = r;
+    else c->queue = r;
+    c->queue_end = r;
+
+    if ( r->direction==IO_DIRECTION_WRITE )
+        while ( RmaNext( c, 0 ) ) ;
+}
+
+/*
+   The following functions write ahead on a buffered channel (see
+   PI_CreateBufferedChannel).  The producer starts with capacity credits, and
+   each write spends one: the message is packed into the next of the
+   producer's capacity slots and sent from there by MPI_Isend, so the write
+   returns at once.  For each message it reads, the reader sends an empty
+   notice back on flow_comm, which gives the credit back; so no more than
+   capacity messages are ever on their way, and the reader's queue of
+   unexpected messages stays bounded however fast the writer is.  A write with
+   no credit left waits for a notice, while a non-blocking one joins the
+   channel's queue, holding up later writes.  A packed message can be received
+   as the items packed in it, so reads, selects, and probes work as usual.
+*/
+
+/*!
+********************************************************************************
+Checks whether the producer of buffered channel \p c has a credit to write
+with, collecting the notices of reads that have come back if not, and waiting
+for one if \p block is non-0.
+\return Non-0 if there is a credit.
+*******************************************************************************/
+static int BufCredit( PI_CHANNEL *c, int block )
+{
+    int flag = 1;
+
+    if ( c->credits > 0 ) return 1;
+
+    while ( flag && c->credits < c->capacity ) {
+        if ( c->flow_req == MPI_REQUEST_NULL ) {
+            PI_CALLMPI( MPI_Irecv( NULL, 0, MPI_BYTE, c->consumer, c->flow_tag,
+                                   thisproc.flow_comm, &c->flow_req ) )
+        }
+        if ( block && c->credits == 0 ) WaitMPI( &c->flow_req, MPI_STATUS_IGNORE );
+        else {
+            PI_CALLMPI( MPI_Test( &c->flow_req, &flag, MPI_STATUS_IGNORE ) )
+        }
+        if ( flag ) c->credits++;
+    }
+    return c->credits > 0;
+}
+
+/*!
+********************************************************************************
+Writes all \p n items on buffered channel \p c as one message, spending a
+credit the caller has made sure of.  Earlier writes on the channel must have
+been sent already.
+*******************************************************************************/
+static void BufSend( PI_CHANNEL *c, PI_MPI_RTTI meta[], int n )
+{
+    PI_ON_ERROR_RETURN()
+    PI_SLOT *s = &c->slots[c->next_slot];
+    int size = PackedSize( meta, n, MPI_COMM_WORLD );
+
+    /* the slot was last used capacity messages ago, which has been read */
+    WaitMPI( &s->req, MPI_STATUS_IGNORE );
+    if ( size > s->size ) {
+        void *buf = realloc( s->buf, size );
+        PI_ASSERT( , buf, PI_MALLOC_ERROR )
+        s->buf = buf;
+        s->size = size;
+    }
+
+    size = PackItems( meta, n, s->buf, size, MPI_COMM_WORLD );
+    PI_CALLMPI( MPI_Isend( s->buf, size, MPI_PACKED, c->consumer, c->chan_tag,
+                           c->chan_comm, &s->req ) )
+    c->next_slot = (c->next_slot + 1) % c->capacity;
+    c->credits--;
+}
+
+/*!
+********************************************************************************
+Tells the producer of buffered channel \p c that a message has been read.
+*******************************************************************************/
+static void BufRead( PI_CHANNEL *c )
+{
+    SendMPI( NULL, 0, MPI_BYTE, c->producer, c->flow_tag, thisproc.flow_comm );
+}
+
+/*!
+********************************************************************************
+Sends the oldest queued non-blocking write on buffered channel \p c, if there
+is a credit, or once there is if \p block is non-0.
+\return 1 if a write was sent, 0 if not (or none was queued).
+*******************************************************************************/
+static int BufNext( PI_CHANNEL *c, int block )
+{
+    PI_REQUEST *r = c->queue;
+
+    if ( r == NULL || !BufCredit( c, block ) ) return 0;
+
+    c->queue = r->ring_next;
+    r->ring_next = NULL;
+    BufSend( c, r->args, r->count );
+    r->buffered = BUF_DONE;
+    return 1;
+}
+
+/*!
+********************************************************************************
+Tests whether write request \p r on a buffered channel has completed, sending
+the channel's queued writes as far as the credits go.
+*******************************************************************************/
+static int BufTest( PI_REQUEST *r )
+{
+    if ( r->buffered == BUF_QUEUED )
+        while ( BufNext( r->channel, 0 ) ) ;
+    return r->buffered == BUF_DONE;
+}
+
+/*!
+********************************************************************************
+Waits for write request \p r on a buffered channel to complete, along with
+the writes queued ahead of it.
+*******************************************************************************/
+static void BufWait( PI_REQUEST *r )
+{
+    while ( r->buffered == BUF_QUEUED )
+        BufNext( r->channel, 1 );
+}
+
+/*!
+********************************************************************************
+Starts write request \p r on a buffered channel: it joins the channel's queue
+and is sent as soon as its turn and a credit allow, which may be at once.
+Reads on a buffered channel are posted as usual.
+*******************************************************************************/
+static void StartBufRequest( PI_REQUEST *r )
+{
+    PI_CHANNEL *c = r->channel;
+
+    r->buffered = BUF_QUEUED;
+    r->ring_next = NULL;
+    if ( c->queue ) c->queue_end->ring_next = r;
+    else c->queue = r;
+    c->queue_end = r;
+
+    while ( BufNext( c, 0 ) ) ;
+}
+
+/*!
+********************************************************************************
+Sends the parsed items of one PI_Write/PI_WriteF call on channel \p c, which
+the caller has already validated.  \p format is only used for logging.
+*******************************************************************************/
+static void WriteChannel( PI_CHANNEL *c, const char *format,
+                          PI_MPI_RTTI mpiArgs[], int mpiArgCount )
+{
+    PI_ON_ERROR_RETURN()
+    PI_BUNDLE *b = c->bundle;	// collective bundle associated with channel
+    double t0 = STATS_CLOCK;
+
+    LOGCALL( "Wri", c->chan_id, format )
+
+    if ( c->ring ) {
+        long seq = RingSend( c, mpiArgs, mpiArgCount, NULL );
+
+        /* for -pishm=2, wait till the reader has come for it */
+        if ( thisproc.svc_flag[SHM_MODE] == SHM_SYNC )
+            while ( __atomic_load_n( &c->ring->taken, __ATOMIC_ACQUIRE ) <= seq )
+                RingWait( c );
+    }
+    else if ( c->rma_size ) {
+        /* earlier non-blocking writes go first */
+        while ( c->queue ) RmaNext( c, 1 );
+        RmaSend( c, mpiArgs, mpiArgCount, NULL );
+    }
+    else if ( c->capacity ) {
+        /* earlier non-blocking writes go first */
+        while ( c->queue ) BufNext( c, 1 );
+        BufCredit( c, 1 );
+        BufSend( c, mpiArgs, mpiArgCount );
+    }
+    else if ( b==NULL ) {
+        SendItems( mpiArgs, mpiArgCount, c->consumer, c->chan_tag, c->chan_comm );
+    }
+    else if ( b->usage == PI_GATHERV ) {
+        GathervItems( mpiArgs, mpiArgCount, b->comm );
+    }
+    else if ( mpiArgCount == 1 ) {
+        PI_MPI_RTTI* arg = &mpiArgs[ 0 ];
+
+        /* MPI_Gatherv here sends data to consumer process within comm
+           communicator (dedicated to this bundle).  In PI_Gather, the
+           same MPI_Gatherv receives the data. */
+        PI_CALLMPI( MPI_Gatherv(
+                        arg->buf, arg->count, arg->type, // what we're sending
+                        NULL, NULL, NULL, 0,	// ignored on sender call
+                        0, b->comm ) )		// "root" is rank 0 in bundle
+    }
+    else {
+        /* Several items are packed into exactly 'size' bytes, since every
+           rim process must send the amount PI_Gather expects */
+        int size = PackedSize( mpiArgs, mpiArgCount, b->comm );
+        char *packbuf = calloc( size, 1 );
+        PI_ASSERT( , packbuf, PI_MALLOC_ERROR )
+        PackItems( mpiArgs, mpiArgCount, packbuf, size, b->comm );
+
+        PI_CALLMPI( MPI_Gatherv(
+                        packbuf, size, MPI_PACKED, // what we're sending
+                        NULL, NULL, NULL, 0,	// ignored on sender call
+                        0, b->comm ) )		// "root" is rank 0 in bundle
+        free( packbuf );
+    }
+
+    c->write_count++;
+    LOGEND( "Wri", c->chan_id, b && b->usage!=PI_SELECT ? 0 : c->write_count )
+    COUNTCALL( c->stats[STAT_WRITES], ItemBytes( mpiArgs, mpiArgCount ), t0 )
+}
+
+/*!
+********************************************************************************
+Receives the parsed items of one PI_Read/PI_ReadF call on channel \p c, which
+the caller has already validated.  \p format is only used for logging.
+*******************************************************************************/
+static void ReadChannel( PI_CHANNEL *c, const char *format,
+                         PI_MPI_RTTI mpiArgs[], int mpiArgCount )
+{
+    PI_ON_ERROR_RETURN()
+    PI_BUNDLE *b = c->bundle;	// collective bundle associated with channel
+    double t0 = STATS_CLOCK;
 
-            /* '-picheck=n' */
-            else if ( 0==strncmp( (*argv)[i]+3, "check=", 6 ) ) {
-                if ( 10==strlen( (*argv)[i] ) ) {
-                    j = (*argv)[i][9];	// extract level number
-                    if ( isdigit(j) ) PI_CheckLevel = j - '0';
-                    else unrec = 1;
-                }
-                else unrec = 1;
-            }
+    c->write_count++;
 
-            else unrec = 1;
+    LOGCALL( "Rea", c->chan_id, format )
+
+    if ( b==NULL ) {
+        /* for statistics, note whether the message was already waiting in
+           the matching queue */
+        if ( thisproc.svc_flag[LOG_STATS] ) {
+            int flag;
+            if ( c->ring )
+                flag = c->ring->taken <
+                       __atomic_load_n( &c->ring->sent, __ATOMIC_ACQUIRE );
+            else {
+                PI_CALLMPI( MPI_Iprobe( c->producer, c->chan_tag, c->chan_comm,
+                                        &flag, MPI_STATUS_IGNORE ) )
+            }
+            __atomic_add_fetch( &thisproc.recvs, 1, __ATOMIC_RELAXED );
+            __atomic_add_fetch( &thisproc.recvs_waiting, flag, __ATOMIC_RELAXED );
+        }
 
-            /* save up all unrecognized arguments to return to caller */
-            if ( unrec ) {
-                j = badargs ? strlen(badargs) : 0;	// current string len
-                badargs = realloc( badargs, j + strlen((*argv)[i]) + 1 );
-                strcpy( badargs+j, " " );
-                strcpy( badargs+j+1, (*argv)[i] );
+        if ( c->ring ) {
+            /* earlier non-blocking reads get the earlier messages */
+            while ( c->queue ) {
+                RingProgress( c );
+                if ( c->queue ) RingWait( c );
             }
+            while ( !RingRecv( c, mpiArgs, mpiArgCount, NULL ) )
+                RingWait( c );
+        }
+        else if ( c->rma_size ) {
+            /* earlier non-blocking reads empty the slot first */
+            while ( c->queue ) RmaTake( c, 1 );
+            RmaRecv( c, mpiArgs, mpiArgCount );
         }
         else {
-            if ( count < i ) (*argv)[moveto] = (*argv)[i];
-            count++;
-            moveto++;
+            RecvItems( mpiArgs, mpiArgCount, c->producer, c->chan_tag, c->chan_comm );
+            if ( c->capacity ) BufRead( c );
         }
     }
-    *argc = count;	// adjust remaining arg count
+    else if ( b->usage == PI_BROADCAST ) {
+        /* MPI_Bcast here receives data from producer process within comm
+           communicator (dedicated to this bundle).  In PI_Broadcast, the
+           same MPI_Bcast sends the data. */
+        BcastItems( mpiArgs, mpiArgCount, 0, b->comm );
+    }
+    else if ( mpiArgCount == 1 ) {
+        PI_MPI_RTTI* arg = &mpiArgs[ 0 ];
+
+        /* MPI_Scatterv here receives this process's slice; in PI_Scatter,
+           the same MPI_Scatterv sends the data. */
+        PI_CALLMPI( MPI_Scatterv(
+                        NULL, NULL, NULL, arg->type,	// ignored on receiver call
+                        arg->buf, arg->count, arg->type, // what we're receiving
+                        0, b->comm ) )		// "root" is rank 0 in bundle
+    }
+    else {
+        /* Several items arrive packed into exactly 'size' bytes, as
+           PI_Scatter packs them */
+        int size = PackedSize( mpiArgs, mpiArgCount, b->comm );
+        char *packbuf = malloc( size );
+        PI_ASSERT( , packbuf, PI_MALLOC_ERROR )
+
+        PI_CALLMPI( MPI_Scatterv(
+                        NULL, NULL, NULL, MPI_PACKED,	// ignored on receiver call
+                        packbuf, size, MPI_PACKED,	// what we're receiving
+                        0, b->comm ) )		// "root" is rank 0 in bundle
+        UnpackItems( mpiArgs, mpiArgCount, packbuf, size, b->comm );
+        free( packbuf );
+    }
 
-    return badargs;
+    LOGEND( "Rea", c->chan_id, b && b->usage!=PI_SELECT ? 0 : c->write_count )
+    COUNTCALL( c->stats[STAT_READS], ItemBytes( mpiArgs, mpiArgCount ), t0 )
 }
 
-
 /*!
 ********************************************************************************
-This thread is used to invoke OnlineProcessFunc when the latter has to run
-as a thread on node 0.
+Allocates a request for a non-blocking read or write on channel \p c.
+\return The request, or NULL if an error occured.
 *******************************************************************************/
-static void *OnlineThreadFunc( void *arg )
+static PI_REQUEST *NewRequest( PI_CHANNEL *c, IO_DIRECTION dir, const char *format )
 {
-    OnlineProcessFunc( 0, NULL );
-    return NULL;    // thread will be joined by PI_StopMain
-}
+    PI_ON_ERROR_RETURN( NULL )
 
+    PI_REQUEST *r = malloc( sizeof( PI_REQUEST ) );
+    PI_ASSERT( , r, PI_MALLOC_ERROR )
+
+    r->channel = c;
+    r->direction = dir;
+    r->format = strdup( format );	// may be logged long after caller returns
+    r->count = 0;
+    r->packbuf = NULL;
+    r->packsize = 0;
+    r->type = MPI_DATATYPE_NULL;
+    r->req = MPI_REQUEST_NULL;
+    r->ring = RING_NONE;
+    r->seq = 0;
+    r->ring_next = NULL;
+    r->rma = RMA_NONE;
+    r->buffered = BUF_NONE;
+    r->persistent = r->active = r->msgno = 0;
+    r->next = NULL;
+    r->magic = PI_REQ;
+    if ( r->format == NULL ) {
+        free( r );
+        PI_ASSERT( , 0, PI_MALLOC_ERROR )
+    }
+    return r;
+}
 
 /*!
 ********************************************************************************
-This process handles collecting/printing log entries, and running any other
-online services such as deadlock detection.  The log filename, if any,
-is received from PI_MAIN.
-
-Currently, the log timestamp is being added here. MPI semantics guarantee
-that the events from any given process will be logged in order, but there
-is no guarantee of a total ordering of all events from all processes. It
-would be more accurate to have PI_Log timestamp the event on its own node,
-then have this function apply a correction, like how MPE tries to synchronize
-all the clocks.
-
-\note If the program crashes, log entries -- maybe the entire file -- may be
-lost in OS buffers. We should probably do some selective periodic flushing,
-but not every line to avoid burdening the program with disk activity.
+Starts a request whose items have been parsed.  On a ring or RMA channel, or
+for a write on a buffered channel, a persistent request does nothing till
+PI_Start.
 *******************************************************************************/
-static int OnlineProcessFunc( int dum1, void *dum2 )
+static void StartRequest( PI_REQUEST *r )
 {
-    MPI_Status stat;
-    int flen;
-    char *fname;
-    FILE *logfile = NULL;
-    char buff[PI_MAX_LOGLEN];
-
-    double start = MPI_Wtime();     // capture time at start of run
-
-    /* get filename length; 0 = no log file */
-    PI_CALLMPI( MPI_Recv( &flen, 1, MPI_INT, PI_MAIN, 0, MPI_COMM_WORLD, &stat ) )
-
-    /* open the log file if needed */
-    if ( flen ) {
-        PI_OLP_ASSERT( fname = malloc( flen ), PI_MALLOC_ERROR )
-        PI_CALLMPI( MPI_Recv( fname, flen, MPI_CHAR,
-                              PI_MAIN, 0, MPI_COMM_WORLD, &stat ) )
-        logfile = fopen( fname, "w" );
-        if ( NULL==logfile )
-            PI_Abort( PI_LOG_OPEN, fname, __FILE__, __LINE__  );
-        /***** does not return *****/
-
-        free( fname );
+    if ( r->channel->ring ) {
+        if ( !r->persistent ) StartRingRequest( r );
     }
+    else if ( r->channel->rma_size ) {
+        if ( !r->persistent ) StartRmaRequest( r );
+    }
+    else if ( r->channel->capacity && r->direction==IO_DIRECTION_WRITE ) {
+        if ( !r->persistent ) StartBufRequest( r );
+    }
+    else PostRequest( r, r->persistent );
+}
 
-    if ( thisproc.svc_flag[LOG_TABLES] );   // dump tables to log file
-    // might be easier to do in PI_MAIN with calls to LogEvent
-
-    /* startup other OLPs */
-    if ( thisproc.svc_flag[OLP_DEADLOCK] ) PI_DetectDL_start_( &thisproc );
-
-
-    /******** main loop till "FIN" messages ********/
+/*!
+********************************************************************************
+Starts the MPI_Isend or MPI_Irecv for a request, or if \p init is non-0, sets
+up the MPI_Send_init or MPI_Recv_init for a persistent request.
+
+The message is built the same way as by SendItems, so either end of a channel
+may be blocking or not.  The pack buffer is on the heap, since it has to
+outlast the caller.  A persistent write is packed by PI_Start instead, since
+its values may change between transfers.  On a ring channel, a persistent
+request may be posted each time it is started, so the buffer or datatype
+made the first time is kept, as it is on an RMA channel.
+*******************************************************************************/
+static void PostRequest( PI_REQUEST *r, int init )
+{
+    PI_ON_ERROR_RETURN()
+    PI_CHANNEL *c = r->channel;
+    int write = r->direction==IO_DIRECTION_WRITE;
+    int peer = write ? c->consumer : c->producer;
+    void *buf;
+    int count;
+    MPI_Datatype type;
+
+    if ( r->count == 1 ) {
+        buf = r->args[0].buf;
+        count = r->args[0].count;
+        type = r->args[0].type;
+    }
+    else if ( (r->packsize = PackedSize( r->args, r->count, MPI_COMM_WORLD ))
+              <= PI_PACK_MAX ) {
+        if ( r->packbuf == NULL ) r->packbuf = malloc( r->packsize );
+        PI_ASSERT( , r->packbuf, PI_MALLOC_ERROR )
+        buf = r->packbuf;
+        count = r->packsize;
+        type = MPI_PACKED;
+        if ( write && !init )
+            count = PackItems( r->args, r->count, r->packbuf, r->packsize, MPI_COMM_WORLD );
+    }
+    else {
+        if ( r->type == MPI_DATATYPE_NULL )
+            r->type = StructType( r->args, r->count );
+        buf = MPI_BOTTOM;
+        count = 1;
+        type = r->type;
+    }
 
-    /* no. of FINs that have to check in (1 less if we are Pilot process) */
-    int FINs = thisproc.worldsize - thisproc.svc_flag[OLP_RANK];
-    while ( FINs > 0 ) {
-        /* wait for next message from LogEvent */
-        PI_CALLMPI( MPI_Recv( buff, PI_MAX_LOGLEN, MPI_CHAR,
-                              MPI_ANY_SOURCE, 0, MPI_COMM_WORLD, &stat ) )
-
-        char *event = buff;
-        int contchar = PI_MAX_LOGLEN - 1;   // index of continuation char
-        int source = stat.MPI_SOURCE;
-
-        /* receive rest of message while continuation char found */
-        while ( event[contchar] == '+' ) {
-            if ( event == buff )            // first extension
-                event = strdup( buff );     // get msg in dynamic storage
-            int msglen = strlen( event );
-            PI_OLP_ASSERT( event = realloc( event, msglen+PI_MAX_LOGLEN ),
-                            PI_MALLOC_ERROR )   // extend buffer
-
-            /* continue receiving just from source of partial message */
-            PI_CALLMPI( MPI_Recv( event+msglen, PI_MAX_LOGLEN, MPI_CHAR,
-                              source, 0, MPI_COMM_WORLD, &stat ) )
-            contchar = msglen + PI_MAX_LOGLEN - 1;
-        }
-
-        /* forward to OLP if event type is one it wants */
-        if ( thisproc.svc_flag[OLP_DEADLOCK] )
-            if ( event[0] == PILOT || event[0] == CALLS )
-                PI_DetectDL_event_( event );
-
-        /* get timestamp (nsec from start) and write event to log file */
-        if ( logfile )
-            fprintf( logfile, "%.6ld" PI_LOGSEP "%s\n",
-                        (long int)((MPI_Wtime()-start)*1000000), event );
-
-        /* check for "P_n_FIN" pattern, where P is the PILOT message type char,
-            _ is the separator, and n is the process number.  We need to get
-           one from all processes, so decrement counter.
-        */
-        if ( event[0] == PILOT ) {
-            char *sep = strpbrk( event+2, PI_LOGSEP );   // skip over P_n
-            if ( sep && 0==strncmp( sep+1, "FIN", 3 ) ) FINs--;
+    if ( init ) {
+        if ( write ) {
+            PI_CALLMPI( MPI_Send_init( buf, count, type, peer, c->chan_tag,
+                                       c->chan_comm, &r->req ) )
+        }
+        else {
+            PI_CALLMPI( MPI_Recv_init( buf, count, type, peer, c->chan_tag,
+                                       c->chan_comm, &r->req ) )
         }
-
-        if ( event != buff ) free( event ); // it was malloc'd
     }
+    else if ( write ) {
+        PI_CALLMPI( MPI_Isend( buf, count, type, peer, c->chan_tag,
+                               c->chan_comm, &r->req ) )
+    }
+    else {
+        PI_CALLMPI( MPI_Irecv( buf, count, type, peer, c->chan_tag,
+                               c->chan_comm, &r->req ) )
+    }
+}
 
-    /* terminate OLPs */
-    if ( thisproc.svc_flag[OLP_DEADLOCK] ) PI_DetectDL_end_();
-
-    if ( thisproc.svc_flag[LOG_STATS] );    // TODO dump stats to log file
-    // who collects the stats?
+/*!
+********************************************************************************
+Finishes a request whose MPI request has completed, and frees it.
+*******************************************************************************/
+static void CompleteRequest( PI_REQUEST *r )
+{
+    FinishRequest( r );
+    FreeRequest( r );
+}
 
-    if ( logfile ) fclose( logfile );
+/*!
+********************************************************************************
+Finishes a request whose MPI request has completed: unpacks the items of a
+read, gives back the credit for a read on a buffered channel, and logs the
+call.
 
-    return 0;
+A non-blocking call is logged when it completes rather than when it starts,
+because it is only then known that it was matched.  The deadlock detector
+treats these events as not blocking the process.
+*******************************************************************************/
+static void FinishRequest( PI_REQUEST *r )
+{
+    if ( r->direction==IO_DIRECTION_READ && r->packbuf && r->ring!=RING_DONE
+         && r->rma!=RMA_DONE )
+        UnpackItems( r->args, r->count, r->packbuf, r->packsize, MPI_COMM_WORLD );
+    if ( r->direction==IO_DIRECTION_READ && r->channel->capacity )
+        BufRead( r->channel );
+
+    if ( r->direction==IO_DIRECTION_WRITE ) {
+        LOGCALL( "Awr", r->channel->chan_id, r->format )
+        LOGEND( "Awr", r->channel->chan_id, r->msgno )
+        COUNTCALL( r->channel->stats[STAT_WRITES], ItemBytes( r->args, r->count ), -1.0 )
+    }
+    else {
+        LOGCALL( "Ard", r->channel->chan_id, r->format )
+        LOGEND( "Ard", r->channel->chan_id, r->msgno )
+        COUNTCALL( r->channel->stats[STAT_READS], ItemBytes( r->args, r->count ), -1.0 )
+    }
 }
 
-
 /*!
 ********************************************************************************
-Add process number and send to online process.  Format of fixed len message:
+Frees a request and anything it owns.
+*******************************************************************************/
+static void FreeRequest( PI_REQUEST *r )
+{
+    if ( r->persistent && r->req != MPI_REQUEST_NULL )
+        MPI_Request_free( &r->req );
+    if ( r->type != MPI_DATATYPE_NULL )
+        MPI_Type_free( &r->type );
+    free( r->packbuf );
+    free( r->format );
+    r->magic = 0;
+    free( r );
+}
 
- 		Pn_t_event...c
+/*!
+********************************************************************************
+Frees all the persistent requests created by this process.
+*******************************************************************************/
+static void FreePersistent( void )
+{
+    PI_REQUEST *r, *next;
 
-  - Pn is the process no. (rank)	<- can't sort this w/o leading 0's
-  - _ is the field separator PI_LOGSEP
-  - t is the numeric log event type
-  - event is as much of the text as will fit, leaving room for \\0
-  - c is the continuation character '+' or space for last line
+    for ( r = thisproc.persistent; r; r = next ) {
+        next = r->next;
+        FreeRequest( r );
+    }
+    thisproc.persistent = NULL;
+}
 
-Overflow will only be an issue with user events (via PI_Log).
-Rank of OLP is in svc_flag[OLP_RANK]. We use tag=0 since it is not assigned
-for channels.
-\note This can probably be improved with non-blocking sends (for the last
-line), but then the function won't be reentrant (which probably doesn't
-matter).
+/*!
+********************************************************************************
+Frees the operations made by PI_CreateOp.
 *******************************************************************************/
-static void LogEvent( LOGEVENT ev, const char *event )
+static void FreeOps( void )
 {
-    char buff[PI_MAX_LOGLEN];
-    int len = snprintf( buff, PI_MAX_LOGLEN-1,
-                        "%c" PI_LOGSEP "%d" PI_LOGSEP "%s",
-                        ev, thisproc.rank, event );
+    int i;
+
+    for ( i = 0; i < thisproc.allocated_ops; i++ )
+        MPI_Op_free( &thisproc.ops[i] );
+    free( thisproc.ops );
+    thisproc.ops = NULL;
+    thisproc.allocated_ops = 0;
+}
 
-    /* len >= LOGLEN-1 means that overflow bytes remain in event, so send another
-       line starting from that point */
-    const char *next =
-            event + PI_MAX_LOGLEN-2 - (strpbrk( buff+2, PI_LOGSEP )-buff+1);
+/*!
+********************************************************************************
+Frees the communicators made for channels by AssignChannelComms.
+*******************************************************************************/
+static void FreeComms( void )
+{
+    int i;
 
-    while ( len >= PI_MAX_LOGLEN-1 ) {
-        buff[PI_MAX_LOGLEN-1] = '+';	// insert continuation character
+    for ( i = 0; i < thisproc.allocated_comms; i++ )
+        MPI_Comm_free( &thisproc.comms[i] );
+    free( thisproc.comms );
+    thisproc.comms = NULL;
+    thisproc.allocated_comms = 0;
+}
 
-        PI_CALLMPI( MPI_Send( buff, PI_MAX_LOGLEN, MPI_CHAR,
-                              thisproc.svc_flag[OLP_RANK], 0, MPI_COMM_WORLD ) )
+/*!
+********************************************************************************
+Cancels the receives still posted for a stream on bundle \p b, if any.
+*******************************************************************************/
+static void EndStream( PI_BUNDLE *b )
+{
+    int i;
 
-        len = snprintf( buff, PI_MAX_LOGLEN-1, "%s", next );
-        next = next + PI_MAX_LOGLEN-2;
+    if ( b->streamsize > 0 ) {
+        for ( i = 0; i < b->size; i++ ) {
+            if ( b->streamreq[i] != MPI_REQUEST_NULL ) {
+                MPI_Cancel( &b->streamreq[i] );
+                MPI_Wait( &b->streamreq[i], MPI_STATUS_IGNORE );
+            }
+        }
+        free( b->streambuf );
+        b->streambuf = NULL;
+        b->streamsize = 0;
     }
-    buff[PI_MAX_LOGLEN-1] = ' ';    // indicate last line
-
-    PI_CALLMPI( MPI_Send( buff, PI_MAX_LOGLEN, MPI_CHAR,
-                          thisproc.svc_flag[OLP_RANK], 0, MPI_COMM_WORLD ) )
+    b->streamleft = 0;
 }
 
 /* -------- Format String Parsing -------- */
@@ -1495,7 +5706,7 @@ static int LookupConversionSpec( const char *key, PI_MPI_RTTI *rtti )
     case CONVERSION_SPEC( 'L', 'f', 0 ):
         cType = CTYPE_LONG_DOUBLE;
         mpiType = MPI_LONG_DOUBLE;
-        skip = 3;
+        skip = 2;
         break;
 
     case CONVERSION_SPEC( 'm', 0, 0 ):
@@ -1519,21 +5730,15 @@ static int LookupConversionSpec( const char *key, PI_MPI_RTTI *rtti )
 
 /*!
 ********************************************************************************
-Parse a printf like format string into data which describes MPI data.
+Compile a printf like format string into an array of PI_FORMAT_SPECs.
 
-\param readOrWrite  Whether the va_list should be interpreted as a list of
-pointers or scalars.
-\param meta  An array of size PI_MAX_FORMATLEN to hold the parsed arguments.
+\param f  The format to fill in.  Its \c direction must already be set.
 \param fmt  Printf like format to be parsed.
-\param ap  The va_list to read the arguments from. This function uses the
-va_arg macro, so the value of `ap` is undefined after the call. This
-function does not call va_end. See stdarg(3).
 
-\return The number of arguments parsed or -1 when an invalid format string
-is encountered.
+\return The number of conversion specs parsed or -1 when an invalid format
+string is encountered.
 *******************************************************************************/
-static int ParseFormatString( IO_DIRECTION readOrWrite, PI_MPI_RTTI meta[],
-                              const char *fmt, va_list ap )
+static int CompileFormatString( PI_FORMAT *f, const char *fmt )
 {
     const char *s = fmt;
     int metaIndex;
@@ -1542,7 +5747,8 @@ static int ParseFormatString( IO_DIRECTION readOrWrite, PI_MPI_RTTI meta[],
     PI_ASSERT( , fmt != NULL, PI_NULL_FORMAT );
 
     for ( metaIndex = 0; metaIndex < PI_MAX_FORMATLEN; metaIndex++ ) {
-        PI_MPI_RTTI *rtti = &meta[ metaIndex ];
+        PI_FORMAT_SPEC *spec = &f->spec[ metaIndex ];
+        PI_MPI_RTTI rtti;
         int count = -1; /* -1 for not user specified */
 
         /* Skip whitespace in fmt */
@@ -1570,20 +5776,77 @@ static int ParseFormatString( IO_DIRECTION readOrWrite, PI_MPI_RTTI meta[],
             PI_ASSERT( , count > 1, PI_FORMAT_ARGS );
         }
 
-        /* '*' specifies the field width */
+        /* '*' specifies the field width, which comes from the arg list */
         if ( *s == '*' ) {
             /* Make sure the count has not already been specified */
             PI_ASSERT( , count == -1, PI_FORMAT_ARGS );
-            count = va_arg( ap, int );
-            PI_ASSERT( , count > 0, PI_FORMAT_ARGS );
+            count = 0;
             s++;
             PI_ASSERT( , *s != '\0', PI_FORMAT_ARGS );
         }
 
         /* Figure out which MPI type to use */
-        int skip = LookupConversionSpec( s, rtti );
+        int skip = LookupConversionSpec( s, &rtti );
         PI_ASSERT( , skip > 0, PI_FORMAT_ARGS );
 
+        spec->cType = rtti.cType;
+        spec->type = rtti.type;
+        spec->count = count;
+
+        /* Move onto the next conversion specifier. */
+        s += skip;
+    }
+
+    /* The format string is nothing but whitespace. */
+    PI_ASSERT( , metaIndex != 0, PI_FORMAT_ARGS );
+    /* The format string contains too many arguments. */
+    PI_ASSERT( , metaIndex != PI_MAX_FORMATLEN, PI_FORMAT_ARGS );
+
+    f->size = metaIndex;
+    f->key = fmt;
+    f->text = strdup( fmt );
+    PI_ASSERT( , f->text, PI_MALLOC_ERROR );
+    f->next = NULL;
+    f->magic = PI_FMT;
+
+    return metaIndex;
+}
+
+/*!
+********************************************************************************
+Bind the arguments of a read/write call to a compiled format.
+
+\param f  The compiled format.  Its \c direction says whether the va_list
+should be interpreted as a list of pointers or scalars.
+\param meta  An array of size PI_MAX_FORMATLEN to hold the bound arguments.
+\param ap  The va_list to read the arguments from. This function uses the
+va_arg macro, so the value of `ap` is undefined after the call. This
+function does not call va_end. See stdarg(3).
+
+\return The number of arguments bound or -1 when the arguments do not match
+the format.
+*******************************************************************************/
+static int BindFormatArgs( const PI_FORMAT *f, PI_MPI_RTTI meta[], va_list ap )
+{
+    IO_DIRECTION readOrWrite = f->direction;
+    int metaIndex;
+
+    PI_ON_ERROR_RETURN( -1 );
+
+    for ( metaIndex = 0; metaIndex < f->size; metaIndex++ ) {
+        const PI_FORMAT_SPEC *spec = &f->spec[ metaIndex ];
+        PI_MPI_RTTI *rtti = &meta[ metaIndex ];
+        int count = spec->count;
+
+        /* '*' specifies the field width */
+        if ( count == 0 ) {
+            count = va_arg( ap, int );
+            PI_ASSERT( , count > 0, PI_FORMAT_ARGS );
+        }
+
+        rtti->cType = spec->cType;
+        rtti->type = spec->type;
+
         /* Set `rtti->buf` to point to the appropriate data. */
         if ( readOrWrite == IO_DIRECTION_READ || count >= 1 ) {
             if ( count <= 0 )
@@ -1632,8 +5895,8 @@ static int ParseFormatString( IO_DIRECTION readOrWrite, PI_MPI_RTTI meta[],
                     rtti->buf = &rtti->data.lu;
                     break;
                 case CTYPE_UNSIGNED:
-                    rtti->data.ld = va_arg( ap, unsigned int );
-                    rtti->buf = &rtti->data.ld;
+                    rtti->data.u = va_arg( ap, unsigned int );
+                    rtti->buf = &rtti->data.u;
                     break;
                 case CTYPE_FLOAT:
                     rtti->data.f = ( float )va_arg( ap, double );
@@ -1671,19 +5934,103 @@ static int ParseFormatString( IO_DIRECTION readOrWrite, PI_MPI_RTTI meta[],
         else {
             PI_ASSERT( , 0, PI_SYSTEM_ERROR );
         }
-
-        /* Move onto the next conversion specifier. */
-        s += skip;
     }
 
-    /* The format string is nothing but whitespace. */
-    PI_ASSERT( , metaIndex != 0, PI_FORMAT_ARGS );
-    /* The format string contains too many arguments. */
-    PI_ASSERT( , metaIndex != PI_MAX_FORMATLEN, PI_FORMAT_ARGS );
-
     /* End of format string -- there should now be two PI_END args */
     PI_ASSERT( LEVEL(1), PI_END1==va_arg(ap,int) && PI_END2==va_arg(ap,int),
                PI_FORMAT_ARGS )
 
     return metaIndex;
 }
+
+/*!
+********************************************************************************
+Parse a printf like format string into data which describes MPI data.
+
+The compiled form of \p fmt is looked up in #FormatCache by the format
+pointer (and direction), so a call site that passes the same string literal
+repeatedly only pays for parsing once.  The cached text is compared too,
+since the same pointer could later hold a different string.
+
+\param readOrWrite  Whether the va_list should be interpreted as a list of
+pointers or scalars.
+\param meta  An array of size PI_MAX_FORMATLEN to hold the parsed arguments.
+\param fmt  Printf like format to be parsed.
+\param ap  The va_list to read the arguments from. This function uses the
+va_arg macro, so the value of `ap` is undefined after the call. This
+function does not call va_end. See stdarg(3).
+
+\return The number of arguments parsed or -1 when an invalid format string
+is encountered.
+*******************************************************************************/
+static int ParseFormatString( IO_DIRECTION readOrWrite, PI_MPI_RTTI meta[],
+                              const char *fmt, va_list ap )
+{
+    int n;
+
+    LOCK_SHARED		// cache entries may be replaced by other threads
+    n = CachedFormat( readOrWrite, meta, fmt, ap );
+    UNLOCK_SHARED
+    return n;
+}
+
+/*!
+********************************************************************************
+Does the work of ParseFormatString, with #FormatCache to itself.
+*******************************************************************************/
+static int CachedFormat( IO_DIRECTION readOrWrite, PI_MPI_RTTI meta[],
+                         const char *fmt, va_list ap )
+{
+    PI_ON_ERROR_RETURN( -1 );
+    PI_ASSERT( , fmt != NULL, PI_NULL_FORMAT );
+
+    unsigned long hash = (unsigned long)fmt;
+    int slot = ( ( hash ^ ( hash >> 9 ) ) * 2 + readOrWrite ) % PI_FORMAT_CACHE;
+    PI_FORMAT *f = FormatCache[ slot ];
+
+    if ( f == NULL || f->key != fmt || f->direction != readOrWrite ||
+         0 != strcmp( f->text, fmt ) ) {
+
+        /* cache miss: compile the format and replace this slot's entry */
+        PI_FORMAT *newf = malloc( sizeof( PI_FORMAT ) );
+        PI_ASSERT( , newf, PI_MALLOC_ERROR );
+
+        newf->direction = readOrWrite;
+        if ( CompileFormatString( newf, fmt ) < 0 ) {
+            free( newf );
+            return -1;		// error already reported
+        }
+
+        if ( f ) {
+            free( f->text );
+            free( f );
+        }
+        FormatCache[ slot ] = f = newf;
+    }
+
+    return BindFormatArgs( f, meta, ap );
+}
+
+/*!
+********************************************************************************
+Free the format cache and all formats created by PI_CompileFormat.
+*******************************************************************************/
+static void FreeFormats( void )
+{
+    int i;
+    PI_FORMAT *f;
+
+    for ( i = 0; i < PI_FORMAT_CACHE; i++ ) {
+        if ( FormatCache[i] ) {
+            free( FormatCache[i]->text );
+            free( FormatCache[i] );
+            FormatCache[i] = NULL;
+        }
+    }
+
+    while ( ( f = thisproc.formats ) != NULL ) {
+        thisproc.formats = f->next;
+        free( f->text );
+        free( f );
+    }
+}
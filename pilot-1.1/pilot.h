@@ -36,6 +36,8 @@ typedef int(*PI_WORK_FUNC)(int,void*);
 typedef struct OPAQUE PI_PROCESS;
 typedef struct OPAQUE PI_CHANNEL;
 typedef struct OPAQUE PI_BUNDLE;
+typedef struct OPAQUE PI_FORMAT;
+typedef struct OPAQUE PI_REQUEST;
 #endif
 
 #include "pilot_limits.h"
@@ -92,22 +94,31 @@ PI_Errno.
 *******************************************************************************/
 extern int PI_OnErrorReturn;
 
+/*! Storage class of the variables below, which each thread has its own copy
+    of, so Pilot processes run as threads (-pithreads) don't see each other's
+    errors or callers.  SWIG only needs to know their types. */
+#ifdef SWIG
+#define PI_THREAD_LOCAL
+#else
+#define PI_THREAD_LOCAL __thread
+#endif
+
 /*!
 ********************************************************************************
-The last error encountered by the library.
+The last error encountered by the library by the calling thread.
 
 If PI_OnErrorReturn is non-zero and an error was detected by a library
 function, then after the function returns, an error code > 0 (from pilate_error.h) will
 be here, and further calls to library functions will be undefined.  If no error
 occurred, this variable will be zero (=PI_NO_ERROR).
 *******************************************************************************/
-extern int PI_Errno;
+extern PI_THREAD_LOCAL int PI_Errno;
 
 /*! Filename of current library caller. */
-extern const char *PI_CallerFile;
+extern PI_THREAD_LOCAL const char *PI_CallerFile;
 
 /*! Line number of current library caller. */
-extern int PI_CallerLine;
+extern PI_THREAD_LOCAL int PI_CallerLine;
 
 
 /*!
@@ -139,18 +150,96 @@ Optional command line arguments (all start with "-pi"):
 - -pisvc=\<runtime services\>
   - c: make log of API calls
   - d: perform deadlock detection (uses one additional MPI process)
+  - s: count calls on each channel and bundle, and report them at the end
+  - t: log the start and end of API calls, and make a timeline of them
 
 - -pilog=\<filename\>
 
+- -pishm=\<mode number\>
+  - 0: channels within a node use MPI like any others
+  - 1: channels within a node use shared memory (default)
+  - 2: as 1, but a write waits until the matching read has begun
+
+- -pithreads=\<number\>
+
+- -picoro=\<number\>
+
 \c -picheck overrides any programmer setting of the PI_CheckLevel global variable
 made prior to calling \c PI_Configure(). Level N includes all levels below it.
 
 \c -pisvc only causes relevant data to be dumped to the log file. Another program
 is needed to analyze and print/visualize the results. Other services are planned
-for future versions.
+for future versions.  Each MPI process keeps its log entries as compact binary
+records, timed when they are made, and sends them to the online process in
+batches of up to PI_LOG_BATCH bytes: when a batch is full, once PI_LOG_INTERVAL
+seconds have passed, and at PI_StopMain (or each at once, for deadlock
+detection).  The online process writes them as lines of text, in order for
+each process; sort the log on its first field, the time in usec, to merge them.
+The times are by the online process's clock: each process compares its own
+with it at PI_StartAll and again at PI_StopMain, so the offset and drift
+between them are allowed for.  Entries still in a batch are lost if the
+program aborts.
+
+With \c -pisvc=s, each process counts, for its own end of every channel, the
+reads or writes it made, the bytes of data they carried, and the seconds it
+spent blocked in them; and for each bundle it is the hub of, the PI_Select
+calls or collective operations.  Non-blocking calls are counted as they
+complete, with the time spent in PI_Wait, PI_WaitAll, PI_WaitAny or
+PI_Complete (a PI_WaitAll's time counts for each of its requests).  The
+time of each blocking call is also counted in a histogram of fixed size
+(see PI_HIST_BITS), giving its 50th, 99th and 99.9th percentiles.  Counting takes
+no messages, and a process can look at its own counts with PI_GetStats; at
+PI_StopMain the online process adds up every process's counts and
+histograms, prints a table of the channels and bundles that were used, and
+writes all of them as JSON to a file named like the log file with ".json"
+added.
+
+With \c -pisvc=t, calls are logged as with \c c, and so is the end of each
+one that may block.  Once the log's times have been corrected, the online
+process turns it into a timeline in the Trace Event format of Chrome, which
+Perfetto (ui.perfetto.dev) and chrome://tracing can show, named like the log
+file with ".trace.json" added.  Each Pilot process has a track, grouped by MPI
+process; each call is a slice on it, named by the call and its channel or
+bundle, and an arrow joins each write on a channel to the read that took its
+message.  Calls whose end isn't logged, like PI_TrySelect, and PI_Log
+entries are shown as instants.
 
 \c -pilog allows the name of the log file to be changed from the default "pilot.log"
 
+\c -pishm applies to channels whose two processes are on the same node, other
+than those in a Selector or collective bundle, buffered (see
+PI_CreateBufferedChannel), or given an RMA slot (see PI_SetRMA).  Their small
+messages are copied through a ring in memory the two processes share, so a
+write normally returns
+without waiting for the reader; large messages, or any that find the ring full,
+still go by MPI, which copies large ones directly.  Mode 2 keeps the classic rendezvous, for
+programs whose correctness or deadlock checking relies on it.
+
+\c -pithreads lets up to that many Pilot processes share each MPI process, as
+threads (MPI must support MPI_THREAD_MULTIPLE).  The first processes created
+get an MPI process each as usual; further ones are dealt out over the MPI
+processes in turn and run as threads next to the process already there.
+Channels between two threads of one MPI process are queues in its memory
+(unless -pishm=0); the rest use MPI or shared memory as usual.  The rim
+processes of a bundle, and the hub and rim of a collective bundle, must all be
+on different MPI processes (error PI_BUNDLE_RANKS), and deadlock detection is
+not available.  The return value of a threaded process's work function is
+ignored.  Each thread has its own PI_Errno and record of its caller, so an
+error is reported to, and located in, the process that made it.
+
+\c -picoro places processes just as \c -pithreads does, but runs those sharing
+an MPI process as coroutines on its one thread, which needs no thread support
+from MPI and scales to many thousands of processes per MPI process.  A
+coroutine runs until it has to wait in a Pilot call (or PI_ChannelHasData or
+PI_TrySelect finds nothing), then the next one that can proceed runs.  Waiting
+on a channel between two coroutines costs nothing until the other end moves;
+if all the coroutines of an MPI process are waiting on each other, the program
+aborts with PI_DEADLOCK.  A coroutine that computes for a long time, or calls
+a blocking function other than Pilot's, holds up the others, as do collective
+operations until they complete.  Each coroutine has a stack of PI_CORO_STACK
+bytes.  The same restrictions as for \c -pithreads apply, except that the
+coroutines of an MPI process share one PI_Errno.
+
 \note Only specifying -pilog=fname does not by itself create a log. Some
 logging service (presently only "c") must also be selected.
 
@@ -160,7 +249,8 @@ logging service (presently only "c") must also be selected.
 \return The number of MPI processes available for Pilot process creation. This
 number is a total that includes main (which is running and does not need to be
 explicitly created) and deadlock detection (if selected).  If N is returned,
-then PI_CreateProcess can be called at most N-1 times.
+then PI_CreateProcess can be called at most N-1 times.  With -pithreads=n or
+-picoro=n, the number is n times as large.
 
 \pre argc/argv are unmodified.
 \post MPI and Pilot are initialized. Pilot calls can be made. Pilot
@@ -197,6 +287,31 @@ PI_PROCESS *PI_CreateProcess_( PI_WORK_FUNC f, int index, void *opt_pointer );
 	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
 	PI_CreateProcess_( f, index, opt_pointer ))
 
+/*!
+********************************************************************************
+Creates an array of processes that all run the same function.
+
+Equivalent to calling PI_CreateProcess \p size times, passing index 0 to
+size-1, but checks up front that there are enough MPI processes for all of them.
+
+\param f Pointer to the function each process 'runs'.
+\param size Number of processes to create.
+\param opt_pointer A pointer passed to every process's work function.
+
+\return Returns a pointer to an array of \p size PROCESS*, in index order, or
+NULL if an error occured.
+
+\pre PI_Configure() has been called.
+\post Processes have been created, stored in process table.
+
+\note The main program should call free() on the returned array, since it is
+obtained via malloc.
+*******************************************************************************/
+PI_PROCESS **PI_CreateProcessArray_( PI_WORK_FUNC f, int size, void *opt_pointer );
+#define PI_CreateProcessArray( f, size, opt_pointer ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_CreateProcessArray_( f, size, opt_pointer ))
+
 /*!
 ********************************************************************************
 Creates a new channel between the specified processes.
@@ -222,12 +337,73 @@ PI_CHANNEL *PI_CreateChannel_( PI_PROCESS *from, PI_PROCESS *to );
 	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
 	PI_CreateChannel_( from, to ))
 
+/*!
+********************************************************************************
+Creates an array of channels, from from[i] to to[i].
+
+Equivalent to calling PI_CreateChannel \p size times, but all the endpoints
+are checked before any channel is created, and room is made for them in one
+step, which matters when configuring very many channels.
+
+\param from Array of pointers to the 'write-ends' of the channels, or NULL if
+they all start at PI_MAIN.
+\param to Array of pointers to the 'read-ends' of the channels, or NULL if
+they all end at PI_MAIN.
+\param size Number of channels to create.
+
+\return Returns a pointer to an array of \p size CHANNEL*, or NULL if an error
+occured.
+
+\post 'size' new channels were created, each having its default name.
+
+\note As with PI_CreateChannel, a PI_MAIN/NULL element of either array
+represents the master/main process (rank 0).
+\note The main program should call free() on the returned array, since it is
+obtained via malloc.
+*******************************************************************************/
+PI_CHANNEL **PI_CreateChannelArray_( PI_PROCESS *const from[], PI_PROCESS *const to[], int size );
+#define PI_CreateChannelArray( from, to, size ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_CreateChannelArray_( from, to, size ))
+
+/*!
+********************************************************************************
+Creates a new channel between the specified processes, on which the writer
+may run up to \p capacity messages ahead of the reader.
+
+A write on a plain channel may or may not wait for the reader, depending on
+the size of the message and on MPI.  On a buffered channel, a write copies the
+message and returns, as long as fewer than \p capacity messages written
+before it are still unread; otherwise it waits till the reader has read one.
+The reader tells the writer of each message it reads, so no more than
+\p capacity messages are ever queued for the reader, however fast the writer.
+Non-blocking writes wait for their turn in the same way.  Reads, selects, and
+PI_ChannelHasData behave as on any channel, and the deadlock detector
+(-pisvc=d) takes the capacity into account.
+
+\param from A pointer to the 'write-end' of the channel.
+\param to A pointer to the 'read-end' of the channel.
+\param capacity Most messages written but not yet read, at least 1.
+
+\return A pointer to the newly created channel, or NULL if an error occured.
+
+\note The writer keeps \p capacity buffers, each as large as the largest
+message that has been copied to it.
+\note Ignored for channels in collective bundles, which behave as usual.
+Buffered channels are never given rings (-pishm) or an RMA slot (PI_SetRMA).
+*******************************************************************************/
+PI_CHANNEL *PI_CreateBufferedChannel_( PI_PROCESS *from, PI_PROCESS *to, int capacity );
+#define PI_CreateBufferedChannel( from, to, capacity ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_CreateBufferedChannel_( from, to, capacity ))
+
 /*!
 ********************************************************************************
 Specifies which type of bundle to create.
 \see PI_CreateBundle
 *******************************************************************************/
-enum PI_BUNUSE { PI_BROADCAST, PI_GATHER, PI_SELECT };
+enum PI_BUNUSE { PI_BROADCAST, PI_GATHER, PI_SELECT, PI_REDUCE, PI_SCATTER,
+		PI_GATHERV };
 
 /*!
 ********************************************************************************
@@ -239,7 +415,8 @@ bundle ID, and e is the process ID of the common endpoint.  Returns a bundle
 pointer.
 
 \param usage Symbol denoting how the bundle will be used. If PI_Broadcast
- will be called, then code PI_BROADCAST.
+ will be called, then code PI_BROADCAST; for PI_Reduce, code PI_REDUCE; for
+ PI_Scatter, code PI_SCATTER; for PI_Gatherv, code PI_GATHERV.
 \param array Channels to store in selector.
 \param size Number of channels in array.
 
@@ -255,6 +432,73 @@ PI_BUNDLE *PI_CreateBundle_( enum PI_BUNUSE usage, PI_CHANNEL *const array[], in
 	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
 	PI_CreateBundle_( usage, array, size ))
 
+/*!
+********************************************************************************
+Specifies how PI_Select and PI_TrySelect choose among channels with data.
+\see PI_SetSelectPolicy
+*******************************************************************************/
+enum PI_SELPOLICY { PI_SELECT_FIFO, PI_SELECT_ROUND_ROBIN, PI_SELECT_PRIORITY };
+
+/*!
+********************************************************************************
+Sets the policy a selector bundle uses to choose among its channels.
+
+By default (PI_SELECT_FIFO), PI_Select returns whichever channel's message
+MPI matches first.  This is fastest, but under load a few fast writers can
+starve the rest.  The other policies look at every channel that has data:
+
+- PI_SELECT_ROUND_ROBIN: channels take turns, starting after the one chosen
+  last time.
+- PI_SELECT_PRIORITY: channels are chosen in proportion to their weights, e.g.,
+  a channel of weight 3 is chosen 3 times as often as one of weight 1 while
+  both have data.  A channel of weight 0 is only chosen when no other channel
+  has data.
+
+\param b Selector bundle.
+\param policy Selection policy.
+\param weights Array of one weight >= 0 per channel (in bundle order) for
+PI_SELECT_PRIORITY, not all 0.  Ignored (may be NULL) for the other policies.
+A copy is made.
+
+\pre Bundle \p b was created with PI_SELECT usage.
+
+\note The fair policies probe each channel, so the cost of a select grows with
+the width of the bundle.
+*******************************************************************************/
+void PI_SetSelectPolicy_( PI_BUNDLE *b, enum PI_SELPOLICY policy, const int weights[] );
+#define PI_SetSelectPolicy( b, policy, weights ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_SetSelectPolicy_( b, policy, weights ))
+
+/*!
+********************************************************************************
+Gives a channel a slot of \p size bytes in an MPI window on its consumer, for
+moving large messages by one-sided MPI_Put instead of MPI_Send.
+
+A message whose items take PI_RMA_MIN to \p size bytes in all is put
+straight from the writer's variables into the slot, followed by a short
+notice on the channel, and the reader copies it out of the slot.  (Each item
+after the first starts on a 16-byte boundary, so allow for the padding.)  The
+reader's receive need not be posted before the data moves, and the writer's
+data is not copied by MPI on the way.  Smaller and larger messages are sent
+as usual.  Reads, writes, selects, and PI_ChannelHasData behave as before,
+except that a write may complete as soon as its data is in the slot; the
+next write of a slot-sized message then waits till the reader has copied it
+out.  Every process in the program gets the window at PI_StartAll, so it
+takes \p size bytes of memory on the consumer from then on.
+
+\param c Channel to give a slot.
+\param size Bytes in the slot: the largest message that will use it, or 0
+to take away a slot given before.
+
+\note Ignored for channels in collective bundles, and for channels between
+two processes on one MPI process (-pithreads=n or -picoro=n).  Needs MPI-3.
+*******************************************************************************/
+void PI_SetRMA_( PI_CHANNEL *c, int size );
+#define PI_SetRMA( c, size ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_SetRMA_( c, size ))
+
 /*!
 ********************************************************************************
 Specifies which direction the channels should point after a copy operation.
@@ -416,6 +660,274 @@ void PI_Read_( PI_CHANNEL *c, const char *format, ... );
 	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
 	PI_Read_( c, format, __VA_ARGS__, PI_END1, PI_END2 ))
 
+/*!
+********************************************************************************
+Specifies whether a compiled format will be used for writing or reading.
+\see PI_CompileFormat
+*******************************************************************************/
+enum PI_FMTDIR { PI_READ, PI_WRITE };
+
+/*!
+********************************************************************************
+Compiles a read/write format string into a reusable format handle.
+
+The format string is parsed once, and the resulting handle can then be passed
+to PI_WriteF or PI_ReadF any number of times, avoiding the cost of parsing
+the format on every call.  This is worthwhile when the same small message is
+sent repeatedly in a tight loop.  The format codes are the same as for
+PI_Write.  Array sizes given by "*" are still taken from the argument list
+of each PI_WriteF/PI_ReadF call.
+
+\param direction PI_WRITE if the handle will be used with PI_WriteF, or
+PI_READ for PI_ReadF.
+\param format Format string specifying the type of each variable.
+
+\return The compiled format handle, or NULL if the format is invalid.
+
+\pre PI_Configure has been called.
+\post The handle remains valid until PI_StopMain is called, which frees it.
+
+\note PI_Write, PI_Read, PI_Broadcast and PI_Gather keep a small internal
+cache of compiled formats (keyed on the format pointer), so programs that use
+string literals as formats get most of this benefit without any changes.
+*******************************************************************************/
+PI_FORMAT *PI_CompileFormat_( enum PI_FMTDIR direction, const char *format );
+#define PI_CompileFormat( direction, format ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_CompileFormat_( direction, format ))
+
+/*!
+********************************************************************************
+Writes a number of values to the specified channel using a compiled format.
+
+Same as PI_Write, except that the format has been compiled in advance by
+PI_CompileFormat.
+
+\param c Channel to write to.
+\param f Format handle created by PI_CompileFormat(PI_WRITE, ...).
+
+\pre Channel must be open.
+\post Channel now contains the variables written to it.
+*******************************************************************************/
+void PI_WriteF_( PI_CHANNEL *c, const PI_FORMAT *f, ... );
+#define PI_WriteF( c, f, ... ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_WriteF_( c, f, __VA_ARGS__, PI_END1, PI_END2 ))
+
+/*!
+********************************************************************************
+Reads a number of values from the specified channel using a compiled format.
+
+Same as PI_Read, except that the format has been compiled in advance by
+PI_CompileFormat.
+
+\param c Channel to read from.
+\param f Format handle created by PI_CompileFormat(PI_READ, ...).
+
+\pre Channel must be open, should contain variables to read.
+\post Channel no longer contains variables read from it.
+*******************************************************************************/
+void PI_ReadF_( PI_CHANNEL *c, const PI_FORMAT *f, ... );
+#define PI_ReadF( c, f, ... ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_ReadF_( c, f, __VA_ARGS__, PI_END1, PI_END2 ))
+
+/*!
+********************************************************************************
+Starts writing a number of values to the specified channel, without waiting.
+
+Same as PI_Write, except that the call returns as soon as the write has been
+started, so that the process can compute while the data is being sent.  The
+write is finished by passing the returned request to PI_Wait, PI_WaitAll,
+PI_WaitAny or PI_Test.  A non-blocking write can be read by either PI_Read or
+PI_ReadAsync at the other end.
+
+\param c Channel to write to.
+\param format Format string specifying the type of each variable.
+
+\return Request for the write, or NULL if an error occured.
+
+\pre Channel must be open, and not part of a broadcaster or gatherer bundle.
+\post The write has been started.
+
+\warning Arrays must not be modified until the request has completed.
+Scalars are copied, so they may be changed at once.
+\note Every request must be completed before PI_StopMain is called.
+*******************************************************************************/
+PI_REQUEST *PI_WriteAsync_( PI_CHANNEL *c, const char *format, ... );
+#define PI_WriteAsync( c, format, ... ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_WriteAsync_( c, format, __VA_ARGS__, PI_END1, PI_END2 ))
+
+/*!
+********************************************************************************
+Starts reading a number of values from the specified channel, without waiting.
+
+Same as PI_Read, except that the call returns as soon as the read has been
+started.  The variables are not filled in until the returned request has been
+completed by PI_Wait, PI_WaitAll, PI_WaitAny or PI_Test.
+
+\param c Channel to read from.
+\param format Format string specifying the type of each variable.
+
+\return Request for the read, or NULL if an error occured.
+
+\pre Channel must be open, and not part of a broadcaster or gatherer bundle.
+\post The read has been started.
+
+\warning Variables must not be used until the request has completed.
+\note Every request must be completed before PI_StopMain is called.
+*******************************************************************************/
+PI_REQUEST *PI_ReadAsync_( PI_CHANNEL *c, const char *format, ... );
+#define PI_ReadAsync( c, format, ... ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_ReadAsync_( c, format, __VA_ARGS__, PI_END1, PI_END2 ))
+
+/*!
+********************************************************************************
+Waits for a non-blocking read or write to complete.
+
+\param r Address of the request returned by PI_WriteAsync or PI_ReadAsync.
+If *r is NULL, the call returns at once.
+
+\post The operation is complete, the request is freed and *r is set to NULL.
+*******************************************************************************/
+void PI_Wait_( PI_REQUEST **r );
+#define PI_Wait( r ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_Wait_( r ))
+
+/*!
+********************************************************************************
+Waits for all of a number of non-blocking reads or writes to complete.
+
+\param array Requests to wait for.  NULL entries are ignored.
+\param size Number of requests in array (may be 0).
+
+\post All the operations are complete, their requests are freed and the
+entries in array are set to NULL.
+*******************************************************************************/
+void PI_WaitAll_( PI_REQUEST *array[], int size );
+#define PI_WaitAll( array, size ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_WaitAll_( array, size ))
+
+/*!
+********************************************************************************
+Waits for any one of a number of non-blocking reads or writes to complete.
+
+\param array Requests to wait for.  NULL entries are ignored.
+\param size Number of requests in array (may be 0).
+
+\return Index of the request that completed, or -1 if all entries were NULL
+or there were none.
+
+\post The operation is complete, its request is freed and its entry in array
+is set to NULL.
+*******************************************************************************/
+int PI_WaitAny_( PI_REQUEST *array[], int size );
+#define PI_WaitAny( array, size ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_WaitAny_( array, size ))
+
+/*!
+********************************************************************************
+Tests whether a non-blocking read or write has completed.
+
+\param r Address of the request returned by PI_WriteAsync or PI_ReadAsync.
+
+\retval 1 if the operation has completed (or *r is NULL).  The request is
+freed and *r is set to NULL.
+\retval 0 if the operation is still in progress.
+*******************************************************************************/
+int PI_Test_( PI_REQUEST **r );
+#define PI_Test( r ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_Test_( r ))
+
+/*!
+********************************************************************************
+Creates a persistent write for repeated transfers of the same variables.
+
+For a channel that carries the same format and variables over and over (e.g.
+a boundary row of a grid), the format is parsed and the transfer set up just
+once, here.  Each PI_Start then sends the current values of the variables,
+and PI_Complete waits for the send to finish.  The other end may read with
+PI_Read, PI_ReadAsync or a persistent read.
+
+\param c Channel to write to.
+\param format Format string specifying the type of each variable.
+
+\return Persistent request, or NULL if an error occured.
+
+\pre Channel must be open, and not part of a broadcaster or gatherer bundle.
+\post The request is ready for PI_Start, and stays valid until PI_StopMain
+is called, which frees it.
+
+\note Unlike PI_Write, scalar variables are given by reference (&arg), since
+their values are taken each time PI_Start is called.  "*" array sizes are
+fixed at the values given here.
+\warning The variables must not be modified between PI_Start and
+PI_Complete.
+*******************************************************************************/
+PI_REQUEST *PI_CreatePersistentWrite_( PI_CHANNEL *c, const char *format, ... );
+#define PI_CreatePersistentWrite( c, format, ... ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_CreatePersistentWrite_( c, format, __VA_ARGS__, PI_END1, PI_END2 ))
+
+/*!
+********************************************************************************
+Creates a persistent read for repeated transfers into the same variables.
+
+Same as PI_CreatePersistentWrite, for the reading end.  Each PI_Start starts
+a read into the variables, and they are filled in when PI_Complete returns.
+The other end may write with PI_Write, PI_WriteAsync or a persistent write.
+
+\param c Channel to read from.
+\param format Format string specifying the type of each variable.
+
+\return Persistent request, or NULL if an error occured.
+
+\pre Channel must be open, and not part of a broadcaster or gatherer bundle.
+\post The request is ready for PI_Start, and stays valid until PI_StopMain
+is called, which frees it.
+*******************************************************************************/
+PI_REQUEST *PI_CreatePersistentRead_( PI_CHANNEL *c, const char *format, ... );
+#define PI_CreatePersistentRead( c, format, ... ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_CreatePersistentRead_( c, format, __VA_ARGS__, PI_END1, PI_END2 ))
+
+/*!
+********************************************************************************
+Starts one transfer of a persistent read or write.
+
+\param r Request made by PI_CreatePersistentWrite or PI_CreatePersistentRead.
+
+\pre The request is not already started.
+\post The transfer is in progress; call PI_Complete to finish it.
+*******************************************************************************/
+void PI_Start_( PI_REQUEST *r );
+#define PI_Start( r ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_Start_( r ))
+
+/*!
+********************************************************************************
+Waits for the transfer started by PI_Start to finish.
+
+\param r Request made by PI_CreatePersistentWrite or PI_CreatePersistentRead.
+
+\pre The request has been started by PI_Start.
+\post The transfer is complete, and the request can be started again.
+
+\note Persistent requests cannot be passed to PI_Wait, PI_WaitAll,
+PI_WaitAny or PI_Test, since those free the request.
+*******************************************************************************/
+void PI_Complete_( PI_REQUEST *r );
+#define PI_Complete( r ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_Complete_( r ))
+
 /*!
 ********************************************************************************
 Returns the index of a channel in the bundle that has data to read.
@@ -492,7 +1004,8 @@ Provides the number of channels in the specified bundle.
 \param b Bundle to return the size for.
 \return Number of channels in this bundle.
 
-\pre Bundle \p b has been created.
+\pre Bundle \p b has been created.  It can be called before PI_StartAll, so
+that a bundle's size is known when setting its select policy.
 *******************************************************************************/
 int PI_GetBundleSize_( const PI_BUNDLE *b );
 #define PI_GetBundleSize( b ) \
@@ -531,6 +1044,150 @@ void PI_Gather_( PI_BUNDLE *b, const char *format, ... );
 	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
 	PI_Gather_( f, format, __VA_ARGS__, PI_END1, PI_END2 ))
 
+/*!
+********************************************************************************
+Starts collecting one contribution from every channel of a selector bundle,
+in whatever order they arrive.
+
+Call PI_GatherNext once per channel to receive them.  Unlike PI_Gather, the
+hub can start on the first contribution while slow processes are still
+working.  The rim processes write with ordinary PI_Write.
+
+\param b Selector bundle to read from.
+\pre No earlier stream on \p b is still in progress.
+\see PI_GatherNext
+*******************************************************************************/
+void PI_GatherStream_( PI_BUNDLE *b );
+#define PI_GatherStream( b ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_GatherStream_( b ))
+
+/*!
+********************************************************************************
+Reads the next contribution to arrive on a stream started by PI_GatherStream.
+
+The first call posts non-blocking receives on all the bundle's channels, so
+every call of the stream must use the same format.  Each call then waits for
+any contribution not yet returned, and reads it as PI_Read would.
+
+\param b Selector bundle with a stream in progress.
+\param index If not NULL, receives the bundle index of the channel read.
+\param format Format string and pointers, as for PI_Read.
+\return Number of contributions still to come in this stream.
+\note To the deadlock detector, this looks like PI_Select followed by PI_Read.
+*******************************************************************************/
+int PI_GatherNext_( PI_BUNDLE *b, int *index, const char *format, ... );
+#define PI_GatherNext( b, index, format, ... ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_GatherNext_( b, index, format, __VA_ARGS__, PI_END1, PI_END2 ))
+
+/*!
+********************************************************************************
+Reads from all channels in the specified bundle, where the rim processes may
+write different numbers of elements.
+
+Each rim process calls PI_Write on its channel with the same conversions, in
+the same order, but its own array lengths, e.g., "%*d %lf" with any length for
+the ints.  The hub codes the conversions without lengths (e.g., "%d %lf"), and
+for each one passes the address of a pointer to the element type: if the
+pointer is NULL, a buffer just large enough for all the elements is allocated
+(free it with free()), otherwise it must already point to a large enough
+buffer.  Each rim process's elements land in channel order, one after another.
+
+Counts are collected first and then all the data, so each call is two
+collectives, however many items the format has.
+
+\param b Gatherer bundle (PI_GATHERV) to read from.
+\param counts If not NULL, array of (bundle size) x (items in format) ints to
+receive the element counts: counts[k*size + i] is the number of elements of
+item k from channel i.
+\param offsets If not NULL, array like \p counts to receive the offsets of
+those elements in item k's buffer.
+\param format Format string and pointers to buffer pointers.
+\pre Bundle must be a PI_GATHERV gatherer bundle.
+*******************************************************************************/
+void PI_Gatherv_( PI_BUNDLE *b, int counts[], int offsets[], const char *format, ... );
+#define PI_Gatherv( b, counts, offsets, format, ... ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_Gatherv_( b, counts, offsets, format, __VA_ARGS__, PI_END1, PI_END2 ))
+
+/*!
+********************************************************************************
+Writes a different slice of data to each channel in the specified bundle.
+
+The mirror image of PI_Gather: each argument is an array holding one slice per
+channel, in bundle order, and the i'th rim process receives the i'th slice of
+every item with an ordinary PI_Read.  E.g., "%5d" sends ints 0..4 of the array
+to the first channel, 5..9 to the second, and so on, so the array must hold
+5 * (bundle size) ints, and the rim reads them with "%5d".
+
+\param b Scatterer bundle to write to.
+\param format Format string and arrays to write to the bundle.
+\pre Bundle must be a scatterer bundle.
+*******************************************************************************/
+void PI_Scatter_( PI_BUNDLE *b, const char *format, ... );
+#define PI_Scatter( b, format, ... ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_Scatter_( b, format, __VA_ARGS__, PI_END1, PI_END2 ))
+
+/*!
+********************************************************************************
+Built-in operations for PI_Reduce.  PI_BAND and PI_BOR (bitwise and/or) only
+apply to integer types.
+\see PI_CreateOp
+*******************************************************************************/
+enum PI_REDOP { PI_SUM, PI_PROD, PI_MIN, PI_MAX, PI_BAND, PI_BOR };
+
+/*!
+********************************************************************************
+User function for a reduction operation made by PI_CreateOp.
+
+Combines \p len elements of \p in with those of \p inout, leaving the results
+in \p inout, i.e., inout[i] = in[i] op inout[i].  This is an MPI_User_function,
+so \p datatype points to the MPI_Datatype of the elements.
+*******************************************************************************/
+typedef void PI_OPFUNC( void *in, void *inout, int *len, void *datatype );
+
+/*!
+********************************************************************************
+Creates a user-defined operation for PI_Reduce.
+
+\param func Function that applies the operation.
+\param commute Non-zero if the operation is commutative, which gives MPI more
+freedom in the order it combines values.  It must be associative regardless.
+\return Operation code to pass to PI_Reduce, or -1 if an error occurred.
+
+\pre Call during configuration phase.
+*******************************************************************************/
+int PI_CreateOp_( PI_OPFUNC *func, int commute );
+#define PI_CreateOp( func, commute ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_CreateOp_( func, commute ))
+
+/*!
+********************************************************************************
+Combines values from every channel in a reducer bundle.
+
+Unlike PI_Gather, the hub only receives the result of combining the rim's
+values with \p op, and the values are combined on the way (in a tree), so the
+work is spread over the rim processes.  Every process of the bundle calls
+PI_Reduce with the same \p op and the same format: on the rim, the format and
+values are written as by PI_Write on the process's channel; at the hub, the
+results are read as by PI_Read.  Each item is reduced element by element, so
+"%5d" at the hub receives 5 sums of 5 ints from each rim process.
+
+\param b Reducer bundle.
+\param op One of enum PI_REDOP, or a code returned by PI_CreateOp.
+\param format Format string and values (rim) or pointers (hub).
+
+\pre Bundle must be a reducer bundle, and the op must apply to the types
+in the format.
+*******************************************************************************/
+void PI_Reduce_( PI_BUNDLE *b, int op, const char *format, ... );
+#define PI_Reduce( b, op, format, ... ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_Reduce_( b, op, format, __VA_ARGS__, PI_END1, PI_END2 ))
+
 /*!
 ********************************************************************************
 Starts an internal timer.  Creates a fixed point in time -- the time between
@@ -565,6 +1222,41 @@ Returns true if logging to a file is enabled.
 *******************************************************************************/
 int PI_IsLogging(void);
 
+/*!
+********************************************************************************
+Counts kept by -pisvc=s for one end of a channel, or one bundle.
+\see PI_GetStats
+*******************************************************************************/
+typedef struct {
+    long calls;		/*!< Calls completed. */
+    long bytes;		/*!< Bytes of user data they read or wrote. */
+    double wait;	/*!< Total seconds blocked in them. */
+    double p50;		/*!< Median seconds blocked in one blocking call. */
+    double p99;		/*!< 99th percentile of the same. */
+    double p999;	/*!< 99.9th percentile of the same. */
+} PI_STATS;
+
+/*!
+********************************************************************************
+Gets the counts made by this process, with -pisvc=s, of its calls on a
+channel or bundle.
+
+For a channel, these are the process's writes or reads on it, whichever end
+it is; for a bundle, its selects or collective operations as the hub.  The
+percentiles are taken from a histogram of the time each blocking call took
+(see PI_HIST_BITS for its precision), not counting non-blocking calls.  All
+are 0 if -pisvc=s is off, or for an object this process doesn't use.  Can be
+called at any time while running; the totals for all processes are reported
+at PI_StopMain.
+
+\param object Channel or bundle.
+\param stats Where to put the counts.
+*******************************************************************************/
+void PI_GetStats_( const void *object, PI_STATS *stats );
+#define PI_GetStats( object, stats ) \
+	(PI_CallerFile = __FILE__, PI_CallerLine = __LINE__ , \
+	PI_GetStats_( object, stats ))
+
 /*!
 ********************************************************************************
 Aborts execution of Pilot application.
@@ -108,6 +108,23 @@ not, it means that P and Q are deadlocked due to using different channels.
 static int *chanproc;   /*!< -1 = channel not in use. */
 
 
+/*!
+********************************************************************************
+Channel credit array, indexed by channel ID (up to allocated_channels).
+
+A non-blocking read or write is only logged when it completes, so it never
+blocks the process in the dependency matrix.  If the process at the other end
+is not already blocked on the matching operation, the completion is banked
+here for that process's next operation on the channel to use:
+  - >0	number of completed non-blocking writes not yet matched by reads
+  - <0	number of completed non-blocking reads not yet matched by writes
+
+A write on a buffered channel completes without its read while fewer than the
+channel's capacity of writes are banked, so it is banked the same way.
+*******************************************************************************/
+static int *credits;
+
+
 /*!
 ********************************************************************************
 Recognized event codes, made up of event type (1st byte) + 3-byte event,
@@ -115,7 +132,8 @@ stored in a single string.  Order of codes matches switch cases in handle().
 *******************************************************************************/
 static char eventCodes[] = {
 	// CALLS events
-	"CWri" "CRea" "CSel" "CHas" "CTry" "CBro" "CGat"
+	"CWri" "CRea" "CSel" "CHas" "CTry" "CBro" "CGat" "CAwr" "CArd" "CRed"
+	"CSca"
 	// PILOT events
 	"PFIN" };
 
@@ -457,6 +475,77 @@ printf( "select complete!\n" );
     return 0;		// make compiler not warn
 }
 
+/*!
+********************************************************************************
+Unblock process q, which was blocked on the matching read/write with process p
+via channel c.
+*******************************************************************************/
+static void release( int q, int p, int c )
+{
+    DEPENDS(q,p) = 0;
+    chanproc[c] = -1;
+    if ( --(process[q].state) == RUN )	// if now running...
+	free( (char*)process[q].lastEvent );
+}
+
+/*!
+********************************************************************************
+Use up the earliest banked write on channel c for a read by process p.  If
+c is buffered, this makes room for a write its producer q was blocked on,
+which is then banked in turn.
+*******************************************************************************/
+static void takeCredit( int p, int q, int c )
+{
+    credits[c]--;
+    if ( olpe->channels[c-1]->capacity && chanproc[c] == q && DEPENDS(q,p) == +1 ) {
+	release( q, p, c );
+	credits[c]++;
+    }
+}
+
+/*!
+********************************************************************************
+Record completion of a non-blocking operation by process p on channel c, with
+process q at the other end.  dep is +1 for a write, -1 for a read.
+
+Messages on a channel are matched in order, so if completions of q's own
+non-blocking operations on c are already banked in credits[c], this one
+matches the earliest of them.  Otherwise, if q is blocked on the matching
+operation, or on a select that c can satisfy, q is unblocked.  Failing that,
+the completion is banked in credits[c].  A select is not satisfied by the
+write itself: q's read afterwards uses the credit.
+*******************************************************************************/
+static void asyncDone( int p, int q, int c, signed char dep )
+{
+    int ch;
+
+printf( "$DL$ +++ asyncDone %d->%d @C%d %d\n", p, q, c, dep );
+
+    // matches a banked completion by q
+    if ( credits[c] * dep < 0 ) {
+	if ( dep < 0 ) takeCredit( p, q, c );
+	else credits[c]++;
+	return;
+    }
+
+    // q blocked on the matching read/write via this channel
+    if ( chanproc[c] == q && DEPENDS(q,p) == -dep ) {
+	release( q, p, c );
+	return;
+    }
+
+    // q selecting on a bundle containing this channel
+    if ( dep == +1 && chanproc[c] == q && DEPENDS(q,p) == -2 ) {
+	memset( &DEPENDS(q,0), 0, olpe->allocated_processes );
+	for ( ch=1; ch<=olpe->allocated_channels; ch++ )
+	    if ( chanproc[ch] == q ) chanproc[ch] = -1;
+	process[q].state = RUN;
+	free( (char*)process[q].lastEvent );
+    }
+
+    credits[c] += dep;
+}
+
 /*!
 ********************************************************************************
 Remove all dependencies for an exited process
@@ -531,12 +620,24 @@ printf( "$DL$ * handling %d '%4s'\n", ev->proc, ev->ecode );
 	PI_CHANNEL **bundchan;
 
 	case 0:	// PI_Write; make write dependency ev->q via channel
+	    if ( credits[object] < 0 ) {	// matches completed async read
+		credits[object]++;
+		break;
+	    }
 	    q = olpe->channels[object-1]->consumer;
+	    if ( credits[object] < olpe->channels[object-1]->capacity ) {
+		asyncDone( ev->proc, q, object, +1 );	// room in buffer
+		break;
+	    }
 	    makeDepend( ev, q, olpe->channels[object-1]->chan_id, +1 );
 	    break;
 
 	case 1: // PI_Read; make read dependency ev->q via channel
 	    q = olpe->channels[object-1]->producer;
+	    if ( credits[object] > 0 ) {	// matches completed async write
+		takeCredit( ev->proc, q, object );
+		break;
+	    }
 	    makeDepend( ev, q, olpe->channels[object-1]->chan_id, -1 );
 	    break;
 
@@ -544,6 +645,11 @@ printf( "$DL$ * handling %d '%4s'\n", ev->proc, ev->ecode );
 	    bundsize = olpe->bundles[object-1]->size;
 	    bundchan = olpe->bundles[object-1]->channels;
 
+	    // satisfied by a completed async write (the read will use it)
+	    for ( i = 0; i<bundsize; i++ )
+		if ( credits[bundchan[i]->chan_id] > 0 ) break;
+	    if ( i < bundsize ) break;
+
 	    /* Make selection dependencies p->{producers of Selector bundle}:
 	       Count the successful insertions (makeDepend() returns 1).  A -1
 	       returns means we can stop, because the select hit a corresponding
@@ -592,7 +698,35 @@ printf( "$DL$ * handling %d '%4s'\n", ev->proc, ev->ecode );
 		makeDepend( ev, bundchan[i]->producer, bundchan[i]->chan_id, -1 );
 	    break;
 
-	case 7: // process exited
+	case 7: // PI_WriteAsync completed
+	    q = olpe->channels[object-1]->consumer;
+	    asyncDone( ev->proc, q, object, +1 );
+	    break;
+
+	case 8: // PI_ReadAsync completed
+	    q = olpe->channels[object-1]->producer;
+	    asyncDone( ev->proc, q, object, -1 );
+	    break;
+
+	case 9: // PI_Reduce at the hub (the rim logs its part as a PI_Write)
+	    bundsize = olpe->bundles[object-1]->size;
+	    bundchan = olpe->bundles[object-1]->channels;
+
+	    // make read dependencies p->{producers of Reducer bundle}
+	    for ( i = 0; i<bundsize; i++ )
+		makeDepend( ev, bundchan[i]->producer, bundchan[i]->chan_id, -1 );
+	    break;
+
+	case 10: // PI_Scatter (the rim reads its slice with PI_Read)
+	    bundsize = olpe->bundles[object-1]->size;
+	    bundchan = olpe->bundles[object-1]->channels;
+
+	    // make write dependencies p->{consumers of Scatterer bundle}
+	    for ( i = 0; i<bundsize; i++ )
+		makeDepend( ev, bundchan[i]->consumer, bundchan[i]->chan_id, +1 );
+	    break;
+
+	case 11: // process exited
 	    removeDepends( ev->proc );
 	    break;
 
@@ -643,6 +777,10 @@ void PI_DetectDL_start_( const PI_PROCENVT *e )
     for ( i=1; i <= e->allocated_channels; i++ )
 	chanproc[i] = -1;
 
+    /* allocate channel credit array, initially no credits */
+    credits = calloc( 1+e->allocated_channels, sizeof(*credits) );
+    PI_OLP_ASSERT( credits, PI_SYSTEM_ERROR )
+
     olpe = e;			// needed by event_ func
 }
 
@@ -702,5 +840,6 @@ void PI_DetectDL_end_()
     free( depends );
     free( process );
     free( chanproc );
+    free( credits );
 printf( "$DL$ signing off\n" );
 }
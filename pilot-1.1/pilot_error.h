@@ -53,14 +53,24 @@ PI_THREAD_SUPPORT,
 PI_START_THREAD,
 PI_DEADLOCK,
 
-PI_INVALID_OBJ		// 25
+PI_INVALID_OBJ,		// 25
+PI_NULL_REQUEST,
+PI_REQUEST_STATE,
+PI_SELECT_POLICY,
+PI_REDUCE_OP,
+
+PI_BUNDLE_RANKS,		// 30
+PI_RMA_SIZE,
+PI_CHANNEL_CAPACITY,
+PI_NULL_STATS,
+PI_REQUEST_COUNT
 };
 
 /*! First defined error code. */
 #define PI_MIN_ERROR 1
 
 /*! Last defined error code. */
-#define PI_MAX_ERROR PI_INVALID_OBJ
+#define PI_MAX_ERROR PI_REQUEST_COUNT
 
 /*!
 ********************************************************************************
@@ -100,7 +110,17 @@ static char *ErrorText[] = {
     "Cannot start online thread",
     "Program is deadlocked",
 
-    "Object is not a valid process, channel, or bundle"
+    "Object is not a valid process, channel, or bundle",
+    "Request pointer is NULL",
+    "Request is not in the right state for this operation",
+    "Invalid selection policy or weights",
+    "Invalid reduction operation",
+
+    "Bundle has processes sharing an MPI process (see -pithreads)",
+    "Invalid RMA slot size",
+    "Buffered channel capacity must be at least 1",
+    "PI_STATS pointer is NULL",
+    "Number of requests is negative"
 };
 #endif
 
@@ -41,10 +41,90 @@ Used for Read/Write calls.
 
 /*!
 ********************************************************************************
-\def PI_MAX_BUNDLES
-\brief Maximum number of bundles that may exist.
+\def PI_MAX_THREADS
+\brief Most Pilot processes that may share one MPI process.
+
+Largest n accepted for the -pithreads=n and -picoro=n options of PI_Configure.
+*******************************************************************************/
+#define PI_MAX_THREADS 65536
+
+/*!
+********************************************************************************
+\def PI_CORO_STACK
+\brief Bytes of stack given to each Pilot process run as a coroutine.
+
+Used for the -picoro=n option of PI_Configure.  Stacks are reserved all at
+once but only take memory as they are used, so this can be generous.  There
+is no guard page between them, so a work function must not overflow it.
+*******************************************************************************/
+#define PI_CORO_STACK (256 * 1024)
+
+/*!
+********************************************************************************
+\def PI_RMA_MIN
+\brief Smallest message, in bytes, that is put in a channel's RMA slot.
+
+Used for channels given a slot by PI_SetRMA.  Smaller messages are sent as
+usual, since MPI sends them eagerly in one step anyway, and the slot would
+cost them two extra messages.
+*******************************************************************************/
+#define PI_RMA_MIN 65536
+
+/*!
+********************************************************************************
+\def PI_LOG_BATCH
+\brief Bytes of log records each MPI process gathers before sending them.
+
+Used when logging (-pisvc=...).  The records of calls and events are put in a
+batch, which goes to the online process in one message when it is full, when
+PI_LOG_INTERVAL has passed, or at PI_StopMain.  A user event (PI_Log) longer
+than a batch is cut short.
+*******************************************************************************/
+#define PI_LOG_BATCH 65536
+
+/*!
+********************************************************************************
+\def PI_LOG_INTERVAL
+\brief Seconds after which a batch of log records is sent even if not full.
+
+Checked as records are added, so a process that logs nothing more keeps its
+last batch till PI_StopMain.
+*******************************************************************************/
+#define PI_LOG_INTERVAL 1.0
+
+/*!
+********************************************************************************
+\def PI_CLOCK_SAMPLES
+\brief Round trips each MPI process makes to compare its clock with the
+online process's.
+
+Used when logging, at PI_StartAll and again at PI_StopMain, so that log
+entries from all processes are timed by one clock.  The quickest round trip
+gives the offset, so more samples find a closer one.
+*******************************************************************************/
+#define PI_CLOCK_SAMPLES 10
+
+/*!
+********************************************************************************
+\def PI_HIST_BITS
+\brief Each doubling of time is split into 2^PI_HIST_BITS buckets in the
+histograms of blocked time kept for -pisvc=s.
+
+Times are counted in nanoseconds, exactly up to 2^PI_HIST_BITS, then to
+within 1 part in 2^PI_HIST_BITS (12.5% for 3).
 *******************************************************************************/
-#define PI_MAX_BUNDLES 20
+#define PI_HIST_BITS 3
+
+/*!
+********************************************************************************
+\def PI_HIST_RANGE
+\brief Times up to 2^PI_HIST_RANGE nanoseconds (about 18 minutes for 40) are
+told apart in the histograms; longer ones count in the last bucket.
+*******************************************************************************/
+#define PI_HIST_RANGE 40
+
+/*! Number of buckets in each histogram (see PI_HIST_BITS). */
+#define PI_HIST_BUCKETS ( (PI_HIST_RANGE - PI_HIST_BITS + 1) << PI_HIST_BITS )
 
 /* Sentinels for variable length argument lists */
 #define PI_END1 954855748
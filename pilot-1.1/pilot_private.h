@@ -24,6 +24,8 @@ Provides utility types, macros and prototypes for pilot.
 
 #include "pilot_limits.h"
 #include <mpi.h>
+#include <pthread.h>
+#include <ucontext.h>
 
 /*!
 ********************************************************************************
@@ -34,7 +36,7 @@ Functions to be assigned to processes must match this prototype.
 typedef int(*PI_WORK_FUNC)(int,void*);
 
 
-/*! Maximum length of each line in log messages (longer lines are wrapped). */
+/*! Size of buffers for the text of Pilot's own log events. */
 #define PI_MAX_LOGLEN 80
 
 /*! Character (in double quotes) used to separate fields on a log line. */
@@ -46,6 +48,8 @@ typedef int(*PI_WORK_FUNC)(int,void*);
 #define PI_PROC 899503453
 #define PI_CHAN 937927385
 #define PI_BUND 152536731
+#define PI_FMT 614589123
+#define PI_REQ 738410257
 
 /*** Pilot macros for error checking ***
  These are for use by API functions and those called by them, chiefly to
@@ -108,22 +112,156 @@ effects.
 /*! Macro for logging calls if enabled */
 #define LOGCALL( code, chanfunn, format ) \
     if ( thisproc.svc_flag[LOG_CALLS] ) { \
-        char buff[PI_MAX_LOGLEN]; \
-        sprintf( buff, "%s" PI_LOGSEP "%d" PI_LOGSEP "%s", \
-                (code), (chanfunn), (format) ); \
-        LogEvent( CALLS, buff ); \
+        LogRecord( CALLS, (code), (chanfunn), (format) ); \
     }
 
+/*! Macro for logging the end of a call logged by LOGCALL, if -pisvc=t is on.
+    \p seq is the number of the message the call wrote or read on channel
+    \p chanfunn, counting from 1 at each end, so a write and its read can be
+    linked; or 0 if there is none to link. */
+#define LOGEND( code, chanfunn, seq ) \
+    if ( thisproc.svc_flag[LOG_TRACE] ) { \
+        LogEnd( (code), (chanfunn), (seq) ); \
+    }
+
+/*! Macro for counting a call in \p counter if -pisvc=s is on; \p bytes is
+    only evaluated then.  \p t0 is STATS_CLOCK taken as the call began, or
+    negative if the call isn't timed. */
+#define COUNTCALL( counter, bytes, t0 ) \
+    if ( thisproc.svc_flag[LOG_STATS] ) { \
+        CountCall( &(counter), (bytes), (t0) ); \
+    }
+
+/*! Start time of a call for COUNTCALL, read only if -pisvc=s is on. */
+#define STATS_CLOCK ( thisproc.svc_flag[LOG_STATS] ? MPI_Wtime() : 0.0 )
+
 typedef struct PI_PROCESS PI_PROCESS;		// forward declarations
 typedef struct PI_CHANNEL PI_CHANNEL;
 typedef struct PI_BUNDLE PI_BUNDLE;
+typedef struct PI_FORMAT PI_FORMAT;
+typedef struct PI_REQUEST PI_REQUEST;
+typedef struct PI_TASK PI_TASK;
+
+/*! Bytes of data in each shared memory ring; must be a power of 2. */
+#define PI_SHM_RING 32768
+
+/*! Largest packed message that is put in a ring; larger ones go by MPI,
+    which moves them between co-located processes with a single copy. */
+#define PI_SHM_LARGE (PI_SHM_RING / 4)
+
+/*! Most channels coming into one process that are given a ring; the rest
+    use MPI as usual. */
+#define PI_SHM_CHANNELS 128
+
+/*! A process waiting on a ring calls MPI to keep its own transfers moving
+    once in this many turns; MPI calls are slow next to a look at the ring. */
+#define PI_SHM_PROGRESS 16
+
+/*! Assumed size of a cache line, so the two ends of a ring don't share one. */
+#define PI_CACHE_LINE 64
+
+/*!
+********************************************************************************
+\brief Single-producer/single-consumer ring for a channel between two
+processes on the same node.
+
+Lives in the consumer's segment of a shared MPI window (see ShareChannels in
+pilot.c).  Only the producer stores head and sent, and only the consumer
+stores tail and taken, so no locks are needed.  Positions and counts only
+ever increase; a position's offset in data is position % PI_SHM_RING.
+*******************************************************************************/
+typedef struct
+{
+    long head;	/*!< Bytes ever put in data by the producer. */
+    long sent;	/*!< Messages ever written, whether put in the ring or sent by MPI. */
+    char pad1[PI_CACHE_LINE - 2 * sizeof( long )];
+    long tail;	/*!< Bytes ever taken from data by the consumer. */
+    long taken;	/*!< Messages ever read, or whose MPI receive was started. */
+    char pad2[PI_CACHE_LINE - 2 * sizeof( long )];
+    char data[PI_SHM_RING];	/*!< PI_RECORDs, each followed by its packed items. */
+} PI_RING;
+
+/*!
+********************************************************************************
+\brief Header of one message in a PI_RING.
+
+A message is packed with MPI_Pack after its header, and the next header
+starts at the next multiple of 8 bytes.  A message that would not fit before
+the end of the ring is put at the start instead, after a header with len -1.
+*******************************************************************************/
+typedef struct
+{
+    int len;		/*!< Bytes of packed items, or -1 = skip to start of ring. */
+    unsigned seq;	/*!< Number of the message on its channel (low bits of PI_RING's sent). */
+} PI_RECORD;
+
+/*! Bytes taken in a ring by a message of \p len packed bytes. */
+#define PI_RECORD_SIZE( len ) ( sizeof( PI_RECORD ) + (((len) + 7) & ~7) )
+
+/*!
+********************************************************************************
+\brief Header of one record in a batch of log records.
+
+Each MPI process puts the records of its calls and events in a batch (see
+LogRecord in pilot.c), each header followed by its text with the '\0', and the
+next header at the next multiple of 8 bytes.  The online process decodes them
+into the text lines it always had.  All MPI processes must share the same
+binary layout.
+*******************************************************************************/
+typedef struct
+{
+    double time;	/*!< Seconds from PI_StartAll by the logging process's clock. */
+    int proc;		/*!< Number of the Pilot process that logged it. */
+    int id;		/*!< Channel or bundle ID of a CALLS event. */
+    int len;		/*!< Bytes of text after the header, with the '\0'. */
+    char type;		/*!< Event type, a LOGEVENT in pilot.c. */
+    char code[3];	/*!< Call code of a CALLS event, e.g. "Wri"; not '\0'-ended. */
+} PI_LOGREC;
+
+/*! Bytes taken in a batch by a log record with \p len bytes of text. */
+#define PI_LOGREC_SIZE( len ) ( sizeof( PI_LOGREC ) + (((len) + 7) & ~7) )
+
+/*!
+********************************************************************************
+\brief Send buffer for one message written ahead on a buffered channel.
+
+The producer packs the message here and sends it with MPI_Isend, so the write
+can return before the message is received.  The buffer only grows, and is
+reused once the send has completed.
+*******************************************************************************/
+typedef struct
+{
+    void *buf;		/*!< Packed message, or NULL till first used. */
+    int size;		/*!< Bytes allocated in buf. */
+    MPI_Request req;	/*!< Send from buf, or MPI_REQUEST_NULL. */
+} PI_SLOT;
+
+/*!
+********************************************************************************
+\brief Running totals of one kind of call, kept for -pisvc=s.
+
+Each is only updated by the one process that makes those calls, so needs no
+locking.  Its histogram is only allocated for a counter that is used.  At PI_StopMain they are sent to the online process, which adds up
+those of all the MPI processes and reports them.
+*******************************************************************************/
+typedef struct
+{
+    long calls;		/*!< Calls completed. */
+    long bytes;		/*!< Bytes of user data they read or wrote. */
+    double wait;	/*!< Seconds spent in them, for blocking calls. */
+    long *hist;		/*!< PI_HIST_BUCKETS counts of blocking calls by their time
+			     (see HistBucket in pilot.c), or NULL till one is counted. */
+} PI_COUNTER;
+
+/*! Index of the producer's and consumer's counters in PI_CHANNEL's stats. */
+enum { STAT_WRITES=0, STAT_READS };
 
 /*!
 ********************************************************************************
 \brief Type used for Pilot channels.
 
 Contains everything associated with a channel.  There is no "channel table"
-as such.  PI_CHANNEL* pointers are stored in PI_PROCENVT's 3D channels array.
+as such.  PI_CHANNEL* pointers are stored in PI_PROCENVT's channels table.
 *******************************************************************************/
 struct PI_CHANNEL
 {
@@ -132,11 +270,32 @@ struct PI_CHANNEL
 
     int producer;	/*!< Rank of the write-end of channel. */
     int consumer;	/*!< Rank of the read-end of channel. */
+    int prod_thread;	/*!< Thread of the write-end within its rank (see PI_PROCESS). */
+    int cons_thread;	/*!< Thread of the read-end within its rank. */
 
-    int chan_tag;	/*!< MPI tag of the channel, starts as chan_id, may be changed if part of Selector bundle */
+    int chan_tag;	/*!< MPI tag of the channel, unique among those with the same consumer and chan_comm, shared by a Selector bundle */
+    MPI_Comm chan_comm;	/*!< MPI communicator of the channel; both are assigned by PI_StartAll (see AssignChannelComms in pilot.c) */
     PI_BUNDLE *bundle;	/*!< Associated collective bundle, or NULL */
 
+    PI_RING *ring;	/*!< Shared memory ring if both ends are on one node, or private ring if both are on one rank, or NULL (set by PI_StartAll) */
+    PI_REQUEST *queue;	/*!< Non-blocking reads waiting for a message on the ring, or requests waiting their turn on an RMA or buffered channel, oldest first */
+    PI_REQUEST *queue_end;	/*!< Newest request in queue */
+    PI_TASK *waiter;	/*!< Coroutine parked till an end of the ring moves, or NULL (-picoro=n) */
+
+    int rma_size;	/*!< Bytes in the channel's slot in the consumer's RMA window, or 0 if it has none (see PI_SetRMA) */
+    MPI_Aint rma_disp;	/*!< Offset of the slot in the consumer's segment of rma_win (set by PI_StartAll) */
+    int rma_free;	/*!< Producer only: non-0 if the slot is known to be free */
+
+    int capacity;	/*!< Most messages the producer may write ahead of the reader, or 0 if unbuffered (see PI_CreateBufferedChannel) */
+    int credits;	/*!< Producer only: messages it may still write before hearing of more reads */
+    PI_SLOT *slots;	/*!< Producer only: capacity send buffers, used in turn, or NULL */
+    int next_slot;	/*!< Producer only: index in slots of the next one to use */
+
+    int flow_tag;	/*!< MPI tag on flow_comm of the consumer's notices that a slot is free or a message was read */
+    MPI_Request flow_req;	/*!< Producer only: receive of the next such notice, or MPI_REQUEST_NULL */
+
     int write_count;  	/*!< Number of writes on this channel. */
+    PI_COUNTER stats[2];	/*!< Writes counted by the producer, and reads by the consumer (-pisvc=s) */
 
     int magic;		/*!< Fill in with PI_CHAN */
 };
@@ -151,6 +310,7 @@ PI_PROCENVT's process table.
 struct PI_PROCESS
 {
     int rank;	/*!< Rank of the MPI process assigned to this Pilot process, starts from 0. */
+    int thread;	/*!< 0 for the process that owns the rank, else no. of its thread (-pithreads=n). */
     char name[PI_MAX_NAMELEN];	/*!< Friendly name for this process. */
 
     PI_WORK_FUNC run;	/*!< Pointer to the function associated with this process. */
@@ -178,6 +338,21 @@ struct PI_BUNDLE
     PI_CHANNEL **channels;	/*!< Array of channels. */
     MPI_Comm comm;   	/*!< Communicator associated with this bundle */
 
+    int *lookup;	/*!< Table mapping rank of rim process => index in channels (see RimIndex in pilot.c) */
+    int lookupmask;	/*!< 0 if lookup is dense (indexed by rank), else no. of hash slots - 1 */
+
+    int policy;		/*!< Selection policy (see enum PI_SELPOLICY). */
+    int *weights;	/*!< Weight of each channel for PI_SELECT_PRIORITY, else NULL. */
+    int *current;	/*!< Running totals of weights for PI_SELECT_PRIORITY, else NULL. */
+    int cursor;		/*!< Index after channel last chosen, for PI_SELECT_ROUND_ROBIN. */
+
+    MPI_Request *streamreq;	/*!< Receives pre-posted by PI_GatherNext, one per channel, else NULL. */
+    char *streambuf;	/*!< Buffer for streamreq, streamsize bytes per channel. */
+    int streamsize;	/*!< Bytes per channel in streambuf; 0 if receives not posted. */
+    int streamleft;	/*!< Contributions of current PI_GatherStream not yet returned. */
+
+    PI_COUNTER stats;	/*!< The hub's collective calls, or selects (-pisvc=s). */
+
     int magic;		/*!< Fill in with PI_BUND */
 };
 
@@ -189,9 +364,10 @@ struct PI_BUNDLE
 The environment contains all pointers, and bookkeeping data for every process.
 Each process maintains its own environment, stored as a static variable.
 *******************************************************************************/
-enum {LOGGING=0, LOG_TABLES, LOG_CALLS, LOG_STATS,
-	OLP_LOGFILE, OLP_DEADLOCK, OLP_RANK,
+enum {LOGGING=0, LOG_TABLES, LOG_CALLS, LOG_STATS, LOG_TRACE,
+	OLP_LOGFILE, OLP_DEADLOCK, OLP_RANK, SHM_MODE, COROUTINES,
 	SVC_END}; /*!< Flag indexes */
+enum {SHM_OFF=0, SHM_BUFFERED, SHM_SYNC}; /*!< Values of svc_flag[SHM_MODE] (-pishm=n) */
 typedef struct
 {
     enum {PREINIT, CONFIG, RUNNING, POSTRUN} phase; /*!< Phase of application life cycle. */
@@ -204,18 +380,59 @@ typedef struct
          OLP_RANK has the actual MPI rank no. of the process. */
     unsigned char svc_flag[SVC_END];
 
+    int threads;		/*!< Most Pilot processes on one MPI process (-pithreads=n
+				     or -picoro=n; svc_flag[COROUTINES] tells which). */
     int allocated_processes;	/*!< Number of processes that have been created. */
     PI_PROCESS *processes;	/*!< Table of PI_PROCESS structs, with fixed no.
-				     of rows = worldsize; indexed by rank. */
+				     of rows = worldsize for threads=1; indexed by
+				     ID, which is the rank for thread 0 (see
+				     ProcessAt in pilot.c). */
+    pthread_t *workers;		/*!< Threads running this rank's other processes. */
+    int allocated_workers;	/*!< Number of threads in workers. */
+    PI_TASK *tasks;		/*!< Coroutines running this rank's processes, the
+				     first being the one that owns the rank. */
+    int allocated_tasks;	/*!< Number of coroutines in tasks. */
+    char *task_stacks;		/*!< PI_CORO_STACK bytes for each of tasks but the first. */
 
     int allocated_channels;	/*!< Number of channels that have been created. */
-    PI_CHANNEL **channels;	/*!< Table of PI_CHANNEL* pointers, indexed by ID-1. */
+    int channel_rows;		/*!< Number of rows allocated in channels table. */
+    int allocated_comms;	/*!< Number of communicators made for channels. */
+    MPI_Comm *comms;		/*!< Table of communicators made for channels. */
+    int queue_width;		/*!< Most channels read by this process on one communicator. */
+    long recvs;			/*!< Plain channel reads (counted only for -pisvc=s). */
+    long recvs_waiting;		/*!< Reads whose message had already arrived (ditto). */
+    MPI_Comm node_comm;		/*!< Processes sharing memory with this one, or MPI_COMM_NULL. */
+    MPI_Win ring_win;		/*!< Shared window holding the rings of channels read here. */
+    int rings;			/*!< Number of rings in this process's segment of ring_win. */
+    PI_RING *local_rings;	/*!< Private rings of channels between threads of this rank. */
+    MPI_Comm flow_comm;		/*!< Duplicate of MPI_COMM_WORLD for notices back to the producers
+				     of RMA and buffered channels, or MPI_COMM_NULL. */
+    MPI_Win rma_win;		/*!< Window holding the RMA slots of channels read here (see PI_SetRMA). */
+    PI_CHANNEL **channels;	/*!< Table of PI_CHANNEL* pointers, grown by doubling;
+				    indexed by ID-1.  The structs themselves are
+				    allocated in slabs of PI_CHANNEL_SLAB. */
 
     int allocated_bundles;   	/*!< Number of bundles that have been created. */
-    PI_BUNDLE **bundles;  	/*!< Table of PI_BUNDLE* pointers, with fixed no.
-				    of rows = PI_MAX_BUNDLES; indexed by ID-1. */
+    int bundle_rows;		/*!< Number of rows allocated in bundles table. */
+    PI_BUNDLE **bundles;  	/*!< Table of PI_BUNDLE* pointers, grown by doubling;
+				    indexed by ID-1. */
+
+    PI_FORMAT *formats;	/*!< List of formats compiled by PI_CompileFormat. */
+    PI_REQUEST *persistent;	/*!< List of requests made by PI_CreatePersistentRead/Write. */
+
+    int allocated_ops;		/*!< Number of operations made by PI_CreateOp. */
+    MPI_Op *ops;		/*!< Table of MPI_Op's made by PI_CreateOp, indexed by code-PI_BUILTIN_OPS. */
 
     double start_time;		/*!< For use by PI_Start/EndTime */
+
+    char *log_batch[2];		/*!< Batches of PI_LOGRECs: the one being filled,
+				     and the one last sent (NULL if not logging). */
+    int log_used;		/*!< Bytes filled in log_batch[0]. */
+    MPI_Request log_req;	/*!< Send of log_batch[1], or MPI_REQUEST_NULL. */
+    MPI_Comm log_comm;		/*!< Duplicate of MPI_COMM_WORLD for batches and clock
+				     pings to the online process, or MPI_COMM_NULL. */
+    double log_start;		/*!< MPI_Wtime() at PI_StartAll, from which records are timed. */
+    double log_sent;		/*!< When the last batch was sent, from log_start. */
 } PI_PROCENVT;
 
 /*!
@@ -263,4 +480,133 @@ typedef enum {
     IO_DIRECTION_WRITE,
 } IO_DIRECTION;
 
+/*!
+********************************************************************************
+\brief One conversion specification from a compiled format string.
+*******************************************************************************/
+typedef struct {
+    int cType;		/*!< C datatype code (CTYPE in pilot.c). */
+    MPI_Datatype type;	/*!< MPI datatype, or MPI_DATATYPE_NULL for %m. */
+    int count;		/*!< -1 = scalar, 0 = "*" (size from arg list), else array size. */
+} PI_FORMAT_SPEC;
+
+/*!
+********************************************************************************
+\brief A read/write format string parsed into PI_FORMAT_SPECs.
+
+Created by PI_CompileFormat for the user, or internally by the format cache
+used by PI_Write, PI_Read, etc.  Binding a compiled format to the arguments
+of a call fills in an array of PI_MPI_RTTI's without reparsing the string.
+*******************************************************************************/
+struct PI_FORMAT
+{
+    const char *key;	/*!< Format pointer this was compiled from (cache key). */
+    char *text;		/*!< Copy of the format string, for logging and cache checks. */
+    IO_DIRECTION direction;	/*!< Whether this format is used to read or write. */
+    int size;		/*!< Number of conversion specs in the format. */
+    PI_FORMAT_SPEC spec[PI_MAX_FORMATLEN];	/*!< Parsed conversion specs. */
+    PI_FORMAT *next;	/*!< Next format in PI_PROCENVT's list of user formats. */
+
+    int magic;		/*!< Fill in with PI_FMT */
+};
+
+/*!
+********************************************************************************
+\brief A non-blocking read or write in progress.
+
+Created by PI_WriteAsync/PI_ReadAsync and freed when it is completed by
+PI_Wait, etc.  It owns the parsed items (scalars being written are copied
+into args) and whatever pack buffer or struct datatype carries them.
+
+A persistent request, made by PI_CreatePersistentRead/Write, binds its
+variables by reference and is reused by PI_Start/PI_Complete until
+PI_StopMain frees it.
+*******************************************************************************/
+struct PI_REQUEST
+{
+    PI_CHANNEL *channel;	/*!< Channel being read or written. */
+    IO_DIRECTION direction;	/*!< Whether this is a read or a write. */
+    char *format;	/*!< Copy of the format string, for logging. */
+
+    int count;		/*!< Number of parsed items in args. */
+    PI_MPI_RTTI args[PI_MAX_FORMATLEN];	/*!< Parsed items. */
+
+    void *packbuf;	/*!< Buffer for several packed items, or NULL. */
+    int packsize;	/*!< Size of packbuf in bytes. */
+    MPI_Datatype type;	/*!< Struct datatype for several large items, or MPI_DATATYPE_NULL. */
+    MPI_Request req;	/*!< The MPI request. */
+
+    enum { RING_NONE=0, RING_QUEUED, RING_MPI, RING_DONE } ring;	/*!< Progress on a ring channel:
+				     not one, waiting in the channel's queue (reads only),
+				     moved by MPI with req, or moved through the ring */
+    long seq;		/*!< Number of the message on a ring channel. */
+    PI_REQUEST *ring_next;	/*!< Next request in the channel's queue. */
+    enum { RMA_NONE=0, RMA_QUEUED, RMA_MPI, RMA_DONE } rma;	/*!< Progress on an RMA channel:
+				     not one, waiting in the channel's queue (a write till
+				     earlier ones and the slot allow, a read with req
+				     receiving the notice of its data), sent or received by
+				     MPI with req, or read out of the slot */
+    enum { BUF_NONE=0, BUF_QUEUED, BUF_DONE } buffered;	/*!< Progress of a write on a
+				     buffered channel: not one, waiting in the channel's queue
+				     for earlier writes and a credit, or copied to a slot */
+
+    int persistent;	/*!< Non-0 if made by PI_CreatePersistentRead/Write. */
+    int active;		/*!< Non-0 if persistent request has been started. */
+    int msgno;	/*!< Number of its message on the channel (see LOGEND). */
+    PI_REQUEST *next;	/*!< Next request in PI_PROCENVT's list of persistent requests. */
+
+    int magic;		/*!< Fill in with PI_REQ */
+};
+
+/*!
+********************************************************************************
+\brief A Pilot process run as a coroutine of its MPI process (-picoro=n).
+
+The coroutines of a rank take turns on its one thread, each switching to the
+next ready one when it has to wait (see the scheduler in pilot.c).  Only the
+first, the process that owns the rank, runs on the thread's own stack.
+*******************************************************************************/
+struct PI_TASK
+{
+    ucontext_t context;	/*!< Where the coroutine resumes, while it isn't running. */
+    PI_PROCESS *process;	/*!< Pilot process it runs. */
+    enum { TASK_READY, TASK_RUNNING, TASK_PARKED, TASK_DONE } state;
+			/*!< PARKED = waiting for a ring (see PI_CHANNEL's waiter) or,
+			     for the first, for the others to finish. */
+    PI_TASK *next;	/*!< Next in the ready queue. */
+};
+
+/*! Largest multi-item message, in packed bytes, that is packed into a stack
+    buffer to send as one MPI message.  Larger ones use a struct datatype. */
+#define PI_PACK_MAX 4096
+
+/*! Largest world size for which a bundle's rank => index lookup is a dense
+    array indexed by rank.  Beyond this, a hash table sized by the bundle is
+    used unless the bundle covers at least a quarter of the world. */
+#define PI_DENSE_LOOKUP_MAX 4096
+
+/*! Initial number of rows in the bundle table, which doubles as needed. */
+#define PI_BUNDLE_ROWS 16
+
+/*! Number of PI_CHANNEL structs allocated together.  The channels table also
+    starts with this many rows, and doubles as needed. */
+#define PI_CHANNEL_SLAB 64
+
+/*! Most channels coming into one process that share a communicator, so that
+    MPI's matching queues stay short (see AssignChannelComms in pilot.c). */
+#define PI_QUEUE_CHANNELS 64
+
+/*! Most communicators made for channels before PI_QUEUE_CHANNELS is raised,
+    so that a process with a great many incoming channels doesn't cost one
+    communicator per PI_QUEUE_CHANNELS of them. */
+#define PI_CHANNEL_COMMS 256
+
+/*! Number of built-in reduction operations (enum PI_REDOP).  Codes from
+    PI_CreateOp start here. */
+#define PI_BUILTIN_OPS 6
+
+/*! Number of entries in the cache of formats compiled on behalf of PI_Write,
+    PI_Read, etc.  Each entry is keyed on the format pointer and direction. */
+#define PI_FORMAT_CACHE 64
+
 #endif
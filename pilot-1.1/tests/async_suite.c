@@ -0,0 +1,207 @@
+/*
+Tests for PI_WriteAsync, PI_ReadAsync, and the functions that complete them.
+
+Tests that:
+ - non-blocking reads and writes of several items match blocking ones.
+ - a large array can be read with PI_Test polling.
+ - two processes can exchange data by writing before either reads.
+ - PI_WaitAny returns each completed request once, then -1.
+ - non-blocking calls are refused on collective bundles.
+*/
+#include "unittests.h"
+
+PI_PROCESS *async_echo, *async_left, *async_right;
+PI_CHANNEL *to_async_echo, *from_async_echo;
+PI_CHANNEL *left_to_right, *right_to_left;
+PI_CHANNEL *from_left, *from_right;
+PI_CHANNEL *async_bcast_chan[1];
+PI_BUNDLE *async_bcast_bundle;
+
+#define BIGLEN 2000
+
+int async_echo_func(int q, void *p)
+{
+    int n, big[BIGLEN];
+    char c;
+    double d[3];
+    PI_REQUEST *r;
+
+    /* small packed message, both ends non-blocking */
+    r = PI_ReadAsync(to_async_echo, "%d %c %3lf", &n, &c, d);
+    PI_Wait(&r);
+    r = PI_WriteAsync(from_async_echo, "%d %c %3lf", n, c, d);
+    PI_Wait(&r);
+
+    /* large message, blocking writer, polling reader */
+    r = PI_ReadAsync(to_async_echo, "%d %*d", &n, BIGLEN, big);
+    while (!PI_Test(&r))
+        ;
+    PI_Write(from_async_echo, "%d %*d", n, BIGLEN, big);
+    return 0;
+}
+
+/* left and right swap their index, writing before reading as in a stencil */
+int async_neighbour_func(int q, void *p)
+{
+    PI_CHANNEL *out = q == 0 ? left_to_right : right_to_left;
+    PI_CHANNEL *in = q == 0 ? right_to_left : left_to_right;
+    PI_CHANNEL *report = q == 0 ? from_left : from_right;
+    PI_REQUEST *reqs[2];
+    int mine = q + 10, theirs = -1;
+
+    reqs[0] = PI_WriteAsync(out, "%d", mine);
+    reqs[1] = PI_ReadAsync(in, "%d", &theirs);
+    PI_WaitAll(reqs, 2);
+
+    PI_Write(report, "%d %d", reqs[0] == NULL && reqs[1] == NULL, theirs);
+    return 0;
+}
+
+void test_async_echo(void)
+{
+    int n = 0;
+    char c = 0;
+    double d[3] = { 1.5, 2.5, 3.5 }, e[3] = { 0 };
+    PI_REQUEST *r;
+
+    r = PI_WriteAsync(to_async_echo, "%d %c %3lf", 42, 'z', d);
+    CU_ASSERT_PTR_NOT_NULL(r);
+    PI_Wait(&r);
+    CU_ASSERT_PTR_NULL(r);
+
+    PI_Read(from_async_echo, "%d %c %3lf", &n, &c, e);
+    CU_ASSERT_EQUAL(n, 42);
+    CU_ASSERT_EQUAL(c, 'z');
+    CU_ASSERT_DOUBLE_EQUAL(e[0], 1.5, 0.00001);
+    CU_ASSERT_DOUBLE_EQUAL(e[2], 3.5, 0.00001);
+}
+
+void test_async_large(void)
+{
+    int i, n = 0;
+    int *big = malloc(sizeof(int) * BIGLEN);
+    int *back = malloc(sizeof(int) * BIGLEN);
+    PI_REQUEST *r;
+
+    if (big == NULL || back == NULL) {
+        CU_FAIL_FATAL("Unable to allocate memory for test_async_large");
+    }
+    for (i = 0; i < BIGLEN; i++)
+        big[i] = i * 7;
+
+    PI_Write(to_async_echo, "%d %*d", BIGLEN, BIGLEN, big);
+    r = PI_ReadAsync(from_async_echo, "%d %*d", &n, BIGLEN, back);
+    while (!PI_Test(&r))
+        ;
+    CU_ASSERT_PTR_NULL(r);
+    CU_ASSERT_EQUAL(PI_Test(&r), 1);	// completed request stays complete
+
+    CU_ASSERT_EQUAL(n, BIGLEN);
+    for (i = 0; i < BIGLEN; i++)
+        CU_ASSERT_EQUAL(back[i], i * 7);
+    free(big);
+    free(back);
+}
+
+void test_async_exchange(void)
+{
+    PI_REQUEST *reqs[2];
+    int ok[2], got[2], seen[2] = { 0, 0 };
+    int i, index;
+
+    reqs[0] = PI_ReadAsync(from_left, "%d %d", &ok[0], &got[0]);
+    reqs[1] = PI_ReadAsync(from_right, "%d %d", &ok[1], &got[1]);
+
+    for (i = 0; i < 2; i++) {
+        index = PI_WaitAny(reqs, 2);
+        CU_ASSERT(index == 0 || index == 1);
+        if (index == 0 || index == 1) {
+            CU_ASSERT_PTR_NULL(reqs[index]);
+            seen[index]++;
+        }
+    }
+    CU_ASSERT_EQUAL(PI_WaitAny(reqs, 2), -1);	// nothing left
+
+    CU_ASSERT_EQUAL(seen[0], 1);
+    CU_ASSERT_EQUAL(seen[1], 1);
+    CU_ASSERT(ok[0]);
+    CU_ASSERT(ok[1]);
+    CU_ASSERT_EQUAL(got[0], 11);	// left got right's value
+    CU_ASSERT_EQUAL(got[1], 10);
+}
+
+void test_async_errors(void)
+{
+    PI_REQUEST *r = NULL;
+
+    PI_Errno = 0;
+    PI_Wait(&r);			// NULL request is already complete
+    CU_ASSERT_EQUAL(PI_Errno, 0);
+
+    PI_Wait(NULL);
+    CU_ASSERT_EQUAL(PI_Errno, PI_NULL_REQUEST);
+
+    PI_Errno = 0;
+    CU_ASSERT_EQUAL(PI_WaitAny(&r, 0), -1);	// nothing to wait for
+    CU_ASSERT_EQUAL(PI_Errno, 0);
+    PI_WaitAll(&r, -1);
+    CU_ASSERT_EQUAL(PI_Errno, PI_REQUEST_COUNT);
+    PI_Errno = 0;
+    CU_ASSERT_EQUAL(PI_WaitAny(&r, -1), -1);
+    CU_ASSERT_EQUAL(PI_Errno, PI_REQUEST_COUNT);
+
+    PI_Errno = 0;
+    r = PI_WriteAsync(async_bcast_chan[0], "%d", 1);
+    CU_ASSERT_PTR_NULL(r);
+    CU_ASSERT_EQUAL(PI_Errno, PI_BUNDLE_USAGE);
+    PI_Errno = 0;
+}
+
+static int init(void)
+{
+    int argc = default_argc;
+    char** argv = default_argv;
+    PI_QuietMode = 1;
+    PI_OnErrorReturn = 1;
+
+    PI_Configure(&argc, &argv);
+
+    async_echo = CreateAliasedProcess(async_echo_func, "async_echo", 0, NULL);
+    to_async_echo = PI_CreateChannel(PI_MAIN, async_echo);
+    from_async_echo = PI_CreateChannel(async_echo, PI_MAIN);
+
+    async_left = CreateAliasedProcess(async_neighbour_func, "async_left", 0, NULL);
+    async_right = CreateAliasedProcess(async_neighbour_func, "async_right", 1, NULL);
+    left_to_right = PI_CreateChannel(async_left, async_right);
+    right_to_left = PI_CreateChannel(async_right, async_left);
+    from_left = PI_CreateChannel(async_left, PI_MAIN);
+    from_right = PI_CreateChannel(async_right, PI_MAIN);
+
+    /* never used, except to show that it's refused */
+    async_bcast_chan[0] = PI_CreateChannel(PI_MAIN, async_echo);
+    async_bcast_bundle = PI_CreateBundle(PI_BROADCAST, async_bcast_chan, 1);
+
+    PI_StartAll();
+    return 0;
+}
+
+static int cleanup(void)
+{
+    if (PI_GetMyRank() == 0)
+        PI_StopMain(0);
+    return 0;
+}
+
+CU_ErrorCode AddAsyncSuite(void)
+{
+    CU_pSuite suite = CU_add_suite("Non-blocking Read/Write Tests", init, cleanup);
+    if (suite == NULL)
+        return CU_get_error();
+
+    AddTest(suite, "non-blocking echo of several items", test_async_echo);
+    AddTest(suite, "non-blocking read of large array with PI_Test", test_async_large);
+    AddTest(suite, "exchange by writing before reading, PI_WaitAny", test_async_exchange);
+    AddTest(suite, "non-blocking errors", test_async_errors);
+
+    return CUE_SUCCESS;
+}
@@ -0,0 +1,100 @@
+/*!
+********************************************************************************
+\file config_channels.c
+\brief Cost of the configuration phase as the number of channels grows.
+
+Scenario:
+	P0..Pn-1, with channels between every ordered pair of processes, repeated
+	until there are max channels in all
+Channels are created with PI_CreateChannelArray in batches that double the
+total each time, and the elapsed time since the first batch began is reported
+after each batch.  Finally, every process gets a selector bundle of one
+channel from each of the others, as a neighbour exchange would, and that time
+is reported too.  Nothing runs after PI_StartAll; only configuration is timed.
+
+Result:
+Total configuration time and time per channel at each channel count.  Every
+step of configuration is linear, so the time per channel should stay flat as
+the count grows (until memory runs short).
+
+Usage: mpirun -np N bench/config_channels [max]
+*******************************************************************************/
+
+#include <mpi.h>
+#include <pilot.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int idle(int idx, void *p)
+{
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int i, k, n, max = 1 << 20, made, batch, rank;
+    PI_PROCESS **procs, **workers, **from, **to;
+    PI_CHANNEL **chans;
+    double start;
+
+    n = PI_Configure(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);	/* every rank configures; one reports */
+    if (argc > 1) max = atoi(argv[1]);
+    if (n < 2) {
+        fprintf(stderr, "config_channels: need at least 2 MPI processes\n");
+        PI_StopMain(1);
+        return 1;
+    }
+
+    /* procs[0] is PI_MAIN, the rest are workers that return at once */
+    procs = malloc(sizeof(PI_PROCESS *) * n);
+    procs[0] = PI_MAIN;
+    workers = PI_CreateProcessArray(idle, n - 1, NULL);
+    for (i = 1; i < n; i++)
+        procs[i] = workers[i - 1];
+    free(workers);
+
+    /* channel k goes from process k%n to the process d after it, where d
+       cycles through 1..n-1, so every ordered pair is used in turn */
+    from = malloc(sizeof(PI_PROCESS *) * (max > n ? max : n));
+    to = malloc(sizeof(PI_PROCESS *) * (max > n ? max : n));
+    for (k = 0; k < max; k++) {
+        int f = k % n, d = 1 + (k / n) % (n - 1);
+        from[k] = procs[f];
+        to[k] = procs[(f + d) % n];
+    }
+    start = MPI_Wtime();	/* time Pilot calls, not filling in the arrays */
+
+    if (rank == 0) printf("%10s %12s %12s\n", "channels", "total ms", "us/channel");
+    for (made = 0, batch = 1024; made < max; made += batch, batch = made) {
+        if (batch > max - made) batch = max - made;
+        chans = PI_CreateChannelArray(from + made, to + made, batch);
+        free(chans);
+        if (rank == 0)
+            printf("%10d %12.2f %12.3f\n", made + batch,
+                   (MPI_Wtime() - start) * 1e3,
+                   (MPI_Wtime() - start) * 1e6 / (made + batch));
+    }
+
+    /* selector for process p: channels from p+1, p+2, ... p+n-1 (mod n) */
+    for (i = 0; i < n; i++) {
+        for (k = 0; k < n - 1; k++) {
+            from[k] = procs[(i + k + 1) % n];
+            to[k] = procs[i];
+        }
+        chans = PI_CreateChannelArray(from, to, n - 1);
+        PI_CreateBundle(PI_SELECT, chans, n - 1);
+        free(chans);
+    }
+    if (rank == 0)
+        printf("%d selectors of width %d: %.2f ms total\n", n, n - 1,
+               (MPI_Wtime() - start) * 1e3);
+
+    free(from);
+    free(to);
+    free(procs);
+
+    PI_StartAll();
+    PI_StopMain(0);
+    return 0;
+}
@@ -0,0 +1,94 @@
+/*!
+********************************************************************************
+\file select_width.c
+\brief Cost of PI_Select as the selector bundle gets wider.
+
+Scenario:
+	W1..Wn -results-> main (selector bundle of width n)
+Every worker process writes reps results, then reports that it is done on a
+separate channel.  Once all are done, main times selecting and reading each
+result, so the time measured is not spent waiting for the workers.
+The run is repeated for bundle widths n = 1, 2, 4, ... up to all the workers.
+
+Result:
+Average time per PI_Select+PI_Read for each width.  Finding the selected
+channel is a table lookup, so the time should not grow with the width (beyond
+the MPI cost of matching a message from any source).
+
+Usage: mpirun -np N bench/select_width [reps]
+*******************************************************************************/
+
+#include <mpi.h>
+#include <pilot.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+PI_CHANNEL **results, **done;
+PI_CHANNEL **copies[32];	/* channels of each run's selector */
+int reps = 2000;
+
+/* worker i takes part in every run whose width is more than i */
+int worker(int idx, void *p)
+{
+    int width, run, workers = *(int *)p, r;
+
+    for (width = 1, run = 0; width <= workers; width *= 2, run++) {
+        if (idx >= width) continue;
+        for (r = 0; r < reps; r++)
+            PI_Write(copies[run][idx], "%d", r);
+        PI_Write(done[idx], "%d", run);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int i, n, width, workers, value;
+    PI_BUNDLE **selectors;
+    double start;
+
+    n = PI_Configure(&argc, &argv);
+    if (argc > 1) reps = atoi(argv[1]);
+    workers = n - 1;
+    if (workers < 1) {
+        fprintf(stderr, "select_width: need at least 2 MPI processes\n");
+        PI_StopMain(1);
+        return 1;
+    }
+
+    results = malloc(sizeof(PI_CHANNEL *) * workers);
+    selectors = malloc(sizeof(PI_BUNDLE *) * workers);
+    for (i = 0; i < workers; i++)
+        results[i] = PI_CreateChannel(PI_CreateProcess(worker, i, &workers), PI_MAIN);
+    done = PI_CopyChannels(PI_SAME, results, workers);
+
+    /* one selector per width, each with its own copies of the channels */
+    for (width = 1, i = 0; width <= workers; width *= 2, i++) {
+        copies[i] = PI_CopyChannels(PI_SAME, results, width);
+        selectors[i] = PI_CreateBundle(PI_SELECT, copies[i], width);
+    }
+
+    PI_StartAll();
+
+    for (width = 1, i = 0; width <= workers; width *= 2, i++) {
+        int total = width * reps, got, k;
+        for (k = 0; k < width; k++)
+            PI_Read(done[k], "%d", &value);
+
+        start = MPI_Wtime();
+        for (got = 0; got < total; got++) {
+            k = PI_Select(selectors[i]);
+            PI_Read(PI_GetBundleChannel(selectors[i], k), "%d", &value);
+        }
+        printf("width %5d: %8.2f us per select\n", width,
+               (MPI_Wtime() - start) * 1e6 / total);
+    }
+
+    PI_StopMain(0);
+    for (width = 1, i = 0; width <= workers; width *= 2, i++)
+        free(copies[i]);
+    free(results);
+    free(done);
+    free(selectors);
+    return 0;
+}
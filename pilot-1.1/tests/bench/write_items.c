@@ -0,0 +1,104 @@
+/*!
+********************************************************************************
+\file write_items.c
+\brief Per-call latency of PI_Write/PI_Read as the number of items grows.
+
+Scenario:
+	main -to-> echo -back-> main
+main writes N ints in one call (N = 1, 2, 4, 8, 16), echo reads and writes
+them back, repeated many times.
+
+Result:
+Average round trip per call for each N.  Since each call is sent as one
+MPI message, the time should stay roughly flat as N grows.
+
+Usage: mpirun -np 2 bench/write_items [reps]
+*******************************************************************************/
+
+#include <mpi.h>
+#include <pilot.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAXITEMS 16
+
+PI_CHANNEL *to_echo, *from_echo;
+int reps = 10000;
+
+/* PI_Write/PI_Read of n separate %d items */
+static void xfer(int write, PI_CHANNEL *c, int n, int *v)
+{
+    switch (n) {
+    case 1:
+        if (write) PI_Write(c, "%d", v[0]);
+        else PI_Read(c, "%d", &v[0]);
+        break;
+    case 2:
+        if (write) PI_Write(c, "%d %d", v[0], v[1]);
+        else PI_Read(c, "%d %d", &v[0], &v[1]);
+        break;
+    case 4:
+        if (write) PI_Write(c, "%d %d %d %d", v[0], v[1], v[2], v[3]);
+        else PI_Read(c, "%d %d %d %d", &v[0], &v[1], &v[2], &v[3]);
+        break;
+    case 8:
+        if (write) PI_Write(c, "%d %d %d %d %d %d %d %d",
+                            v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]);
+        else PI_Read(c, "%d %d %d %d %d %d %d %d",
+                     &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+        break;
+    case 16:
+        if (write) PI_Write(c, "%d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d",
+                            v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7],
+                            v[8], v[9], v[10], v[11], v[12], v[13], v[14], v[15]);
+        else PI_Read(c, "%d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d",
+                     &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7],
+                     &v[8], &v[9], &v[10], &v[11], &v[12], &v[13], &v[14], &v[15]);
+        break;
+    }
+}
+
+int echo(int idx, void *p)
+{
+    int n, r, v[MAXITEMS];
+
+    for (n = 1; n <= MAXITEMS; n *= 2) {
+        for (r = 0; r < reps; r++) {
+            xfer(0, to_echo, n, v);
+            xfer(1, from_echo, n, v);
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    PI_PROCESS *e;
+    int n, r, v[MAXITEMS];
+    double start;
+
+    PI_Configure(&argc, &argv);
+    if (argc > 1) reps = atoi(argv[1]);
+
+    e = PI_CreateProcess(echo, 0, NULL);
+    to_echo = PI_CreateChannel(PI_MAIN, e);
+    from_echo = PI_CreateChannel(e, PI_MAIN);
+
+    PI_StartAll();
+
+    for (n = 0; n < MAXITEMS; n++)
+        v[n] = n;
+
+    for (n = 1; n <= MAXITEMS; n *= 2) {
+        start = MPI_Wtime();
+        for (r = 0; r < reps; r++) {
+            xfer(1, to_echo, n, v);
+            xfer(0, from_echo, n, v);
+        }
+        printf("%2d items: %8.2f us per round trip\n", n,
+               (MPI_Wtime() - start) * 1e6 / reps);
+    }
+
+    PI_StopMain(0);
+    return 0;
+}
@@ -1,6 +1,6 @@
 /*
 Tests for PI_Broadcast. Ensures that PI_Broadcast can broadcast to at least 4
-worker processes.
+worker processes, and that several items broadcast by one call arrive intact.
 */
 #include "unittests.h"
 
@@ -15,6 +15,14 @@ int broadcast_read(int q, void *p) {
 
     PI_Read(from_test6[q],"%*f", 1, r);
     PI_Write(to_test6[q],"%*f", 1, r);
+
+    /* several items, small and then large enough not to fit PI_PACK_MAX */
+    int n, big[2000];
+    char c;
+    PI_Read(from_test6[q],"%d %c %f", &n, &c, r);
+    PI_Write(to_test6[q],"%d %c %f", n, c, r[0]);
+    PI_Read(from_test6[q],"%d %2000d", &n, big);
+    PI_Write(to_test6[q],"%d %d", n, big[n]);
     return 0;
 }
 
@@ -74,6 +82,31 @@ static int cleanup(void)
     return 0;
 }
 
+void test6b(void) {
+
+    int n, i, big[2000];
+    char c;
+    float f;
+
+    PI_Broadcast(test6_bundle,"%d %c %f", 42, 'x', 2.5);
+    for (i = 0; i < 4; i++) {
+        PI_Read(to_test6[i],"%d %c %f", &n, &c, &f);
+        CU_ASSERT_EQUAL(n, 42);
+        CU_ASSERT_EQUAL(c, 'x');
+        CU_ASSERT_DOUBLE_EQUAL(f, 2.5, 0.00001);
+    }
+
+    for (i = 0; i < 2000; i++)
+        big[i] = 3 * i;
+    PI_Broadcast(test6_bundle,"%d %2000d", 1999, big);
+    for (i = 0; i < 4; i++) {
+        int last;
+        PI_Read(to_test6[i],"%d %d", &n, &last);
+        CU_ASSERT_EQUAL(n, 1999);
+        CU_ASSERT_EQUAL(last, 3 * 1999);
+    }
+}
+
 CU_ErrorCode AddBroadcasterSuite(void)
 {
     CU_pSuite suite = CU_add_suite("Broadcaster Tests", init, cleanup);
@@ -81,6 +114,7 @@ CU_ErrorCode AddBroadcasterSuite(void)
         return CU_get_error();
 
     AddTest(suite, "broadcaster tests", test6);
+    AddTest(suite, "broadcaster multiple items", test6b);
 
     return CUE_SUCCESS;
 }
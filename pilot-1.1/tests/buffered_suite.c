@@ -0,0 +1,244 @@
+/*
+Tests for channels made by PI_CreateBufferedChannel, on which the writer may
+run ahead of the reader by up to the channel's capacity.
+
+Tests that:
+ - PI_CreateBufferedChannel rejects a capacity under 1.
+ - a writer can write capacity large messages, too large to be sent eagerly,
+   and go on to something else before any of them is read.
+ - a non-blocking write beyond the capacity waits till a message is read.
+ - non-blocking and persistent writes and reads keep their order.
+ - several items, small and large, go through together.
+ - PI_Select and PI_ChannelHasData see messages written ahead.
+*/
+#include "unittests.h"
+
+#define CAP 4
+#define BIG (1 << 17)		/* doubles: 1 MB, well past any eager limit */
+#define ROUNDS 10
+#define NSEL 3
+
+static int err_zero;
+static PI_CHANNEL *to_main, *from_main, *side, *sel_chan[NSEL];
+static PI_BUNDLE *buf_sel;
+
+int buf_worker(int q, void *p)
+{
+    int i, k, n, test;
+    double *buf = malloc(sizeof(double) * BIG * CAP);
+    int *ibuf = malloc(sizeof(int) * BIG);
+    PI_REQUEST *reqs[CAP], *r;
+
+    if (buf == NULL || ibuf == NULL)
+        return -1;
+
+    /* test18b: write all CAP large messages before main reads any */
+    for (i = 0; i < CAP; i++) {
+        for (k = 0; k < BIG; k++)
+            buf[k] = i * 1000.0 + k;
+        PI_Write(to_main, "%*lf", BIG, buf);
+    }
+    PI_Write(side, "%d", CAP);
+
+    /* test18c: the channel is full, so one more has to wait */
+    PI_Read(from_main, "%d", &n);
+    for (i = 0; i < CAP; i++)
+        PI_Write(to_main, "%d", n + i);
+    r = PI_WriteAsync(to_main, "%d", n + CAP);
+    test = PI_Test(&r);
+    PI_Write(side, "%d", test);
+    PI_Wait(&r);
+
+    /* test18d: queued async writes, then persistent writes */
+    for (i = 0; i < CAP; i++)
+        reqs[i] = PI_WriteAsync(to_main, "%d", i);
+    PI_WaitAll(reqs, CAP);
+    r = PI_CreatePersistentWrite(to_main, "%d", &n);
+    for (i = 0; i < ROUNDS; i++) {
+        n = -i;
+        PI_Start(r);
+        PI_Complete(r);
+    }
+
+    /* test18e: several items in one message */
+    PI_Read(from_main, "%d %*d %*lf", &n, BIG, ibuf, BIG / 2, buf);
+    for (k = 0; k < BIG; k++)
+        ibuf[k] += n;
+    PI_Write(to_main, "%*d %*lf %d", BIG, ibuf, BIG / 2, buf, -n);
+
+    free(buf);
+    free(ibuf);
+    return 0;
+}
+
+int buf_sel_worker(int q, void *p)
+{
+    int i;
+
+    /* test18f: ROUNDS messages each, all written ahead of the selects */
+    for (i = 0; i < ROUNDS; i++)
+        PI_Write(sel_chan[q], "%d %d", q, i);
+    return 0;
+}
+
+void test18a(void)
+{
+    CU_ASSERT_EQUAL(err_zero, PI_CHANNEL_CAPACITY);
+}
+
+void test18b(void)
+{
+    int i, k, n, ok = 1;
+    double *buf = malloc(sizeof(double) * BIG);
+
+    if (buf == NULL) {
+        CU_FAIL_FATAL("Unable to allocate memory for test18b");
+    }
+
+    /* the worker only gets here once all its writes have returned */
+    PI_Read(side, "%d", &n);
+    CU_ASSERT_EQUAL(n, CAP);
+
+    for (i = 0; i < CAP; i++) {
+        PI_Read(to_main, "%*lf", BIG, buf);
+        for (k = 0; k < BIG; k++)
+            if (buf[k] != i * 1000.0 + k) ok = 0;
+    }
+    CU_ASSERT(ok);
+    free(buf);
+}
+
+void test18c(void)
+{
+    int i, n, test;
+
+    PI_Write(from_main, "%d", 50);
+    PI_Read(side, "%d", &test);
+    CU_ASSERT_EQUAL(test, 0);
+
+    for (i = 0; i <= CAP; i++) {
+        PI_Read(to_main, "%d", &n);
+        CU_ASSERT_EQUAL(n, 50 + i);
+    }
+}
+
+void test18d(void)
+{
+    int i, n[CAP], m, ok = 1;
+    PI_REQUEST *reqs[CAP], *r;
+
+    for (i = 0; i < CAP; i++)
+        reqs[i] = PI_ReadAsync(to_main, "%d", &n[i]);
+    PI_WaitAll(reqs, CAP);
+    for (i = 0; i < CAP; i++)
+        CU_ASSERT_EQUAL(n[i], i);
+
+    r = PI_CreatePersistentRead(to_main, "%d", &m);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(r);
+    for (i = 0; i < ROUNDS; i++) {
+        PI_Start(r);
+        PI_Complete(r);
+        if (m != -i) ok = 0;
+    }
+    CU_ASSERT(ok);
+}
+
+void test18e(void)
+{
+    int k, n, ok;
+    double *buf = malloc(sizeof(double) * BIG / 2);
+    int *ibuf = malloc(sizeof(int) * BIG);
+
+    if (buf == NULL || ibuf == NULL) {
+        CU_FAIL_FATAL("Unable to allocate memory for test18e");
+    }
+
+    for (k = 0; k < BIG; k++)
+        ibuf[k] = k;
+    for (k = 0; k < BIG / 2; k++)
+        buf[k] = k / 4.0;
+    PI_Write(from_main, "%d %*d %*lf", 5, BIG, ibuf, BIG / 2, buf);
+
+    for (k = 0; k < BIG; k++)
+        ibuf[k] = buf[k / 2] = 0;
+    PI_Read(to_main, "%*d %*lf %d", BIG, ibuf, BIG / 2, buf, &n);
+    CU_ASSERT_EQUAL(n, -5);
+    for (ok = 1, k = 0; k < BIG; k++)
+        if (ibuf[k] != k + 5) ok = 0;
+    for (k = 0; k < BIG / 2; k++)
+        if (buf[k] != k / 4.0) ok = 0;
+    CU_ASSERT(ok);
+    free(buf);
+    free(ibuf);
+}
+
+void test18f(void)
+{
+    int i, n, q, k, ok = 1, next[NSEL] = { 0 };
+
+    while (!PI_ChannelHasData(sel_chan[0]))
+        ;
+    for (i = 0; i < NSEL * ROUNDS; i++) {
+        n = PI_Select(buf_sel);
+        CU_ASSERT(n >= 0 && n < NSEL);
+        if (n < 0 || n >= NSEL) break;
+        PI_Read(PI_GetBundleChannel(buf_sel, n), "%d %d", &q, &k);
+        if (q != n || k != next[n]++) ok = 0;
+    }
+    CU_ASSERT(ok);
+    for (i = 0; i < NSEL; i++)
+        CU_ASSERT_EQUAL(next[i], ROUNDS);
+}
+
+static int init(void)
+{
+    int argc = default_argc;
+    char **argv = default_argv;
+    int i;
+    PI_PROCESS *w, *s;
+    PI_QuietMode = 1;
+    PI_OnErrorReturn = 1;
+
+    PI_Configure(&argc, &argv);
+
+    w = PI_CreateProcess(buf_worker, 0, NULL);
+    to_main = PI_CreateBufferedChannel(w, PI_MAIN, CAP);
+    from_main = PI_CreateBufferedChannel(PI_MAIN, w, 1);
+    side = PI_CreateChannel(w, PI_MAIN);
+    for (i = 0; i < NSEL; i++) {
+        s = PI_CreateProcess(buf_sel_worker, i, NULL);
+        sel_chan[i] = PI_CreateBufferedChannel(s, PI_MAIN, ROUNDS);
+    }
+    buf_sel = PI_CreateBundle(PI_SELECT, sel_chan, NSEL);
+
+    PI_Errno = 0;
+    PI_CreateBufferedChannel(w, PI_MAIN, 0);
+    err_zero = PI_Errno;
+    PI_Errno = 0;
+
+    PI_StartAll();
+    return 0;
+}
+
+static int cleanup(void)
+{
+    if (PI_GetMyRank() == 0)
+        PI_StopMain(0);
+    return 0;
+}
+
+CU_ErrorCode AddBufferedSuite(void)
+{
+    CU_pSuite suite = CU_add_suite("Buffered Channel Tests", init, cleanup);
+    if (suite == NULL)
+        return CU_get_error();
+
+    AddTest(suite, "capacity errors", test18a);
+    AddTest(suite, "large writes run ahead", test18b);
+    AddTest(suite, "write waits when full", test18c);
+    AddTest(suite, "async and persistent", test18d);
+    AddTest(suite, "several items", test18e);
+    AddTest(suite, "select and has data", test18f);
+
+    return CUE_SUCCESS;
+}
@@ -0,0 +1,255 @@
+/*
+Tests for running many Pilot processes on each MPI process as coroutines
+(-picoro=16).  With N MPI processes, the workers are P1..P16N-1, of which
+PN, P2N, ... are coroutines on rank 0 with main, PN+1, P2N+1, ... on rank 1,
+and so on.
+
+Tests that:
+ - PI_Configure counts 16 processes per MPI process, and no more can be made.
+ - a stream of tokens passes along a chain of all the workers, taken rank by
+   rank so that most links are between coroutines of one MPI process.
+ - small and large messages go both ways between main and PN, which is a
+   coroutine on main's MPI process, and PI_GetName(NULL) names PN there.
+ - main polling PI_ChannelHasData lets the coroutine it is waiting for run.
+ - main can select from coroutines on the other MPI processes.
+ - main polling PI_TrySelect on a round-robin selector lets it run too.
+*/
+#include "unittests.h"
+#include <stdio.h>
+#include <string.h>
+
+#define CORO 16
+#define CORO_ARG "-picoro=16"
+#define NTOKENS 20
+#define BIGLEN 5000	/* 20000 bytes, more than PI_SHM_LARGE */
+#define MAXPOLLS 1000000
+
+static int numPilotProcs, worldsize, nworkers, err_capacity;
+static PI_CHANNEL **chain;	/* chain[k] goes into the k'th worker in order, chain[nworkers] to main */
+static int *order;		/* order[k] = index of the k'th worker in the chain */
+static int *place;		/* place[q] = k such that order[k] = q */
+static PI_CHANNEL *to_echo, *from_echo, *from_poll, *to_rr;
+static PI_CHANNEL **to_sel;	/* a worker's channel in the selector, or NULL */
+static PI_BUNDLE *selector, *rr_poll;	/* rr_poll: round-robin over P3N */
+static int nselect, sel_sum;
+
+int coro_worker(int q, void *p)
+{
+    int i, v, n, k, ok;
+    int *buf;
+    char name[PI_MAX_NAMELEN];
+
+    /* test16a: pass each token on, adding our process no. */
+    for (i = 0; i < NTOKENS; i++) {
+        PI_Read(chain[place[q]], "%d", &v);
+        PI_Write(chain[place[q] + 1], "%d", v + q + 1);
+    }
+
+    /* test16b: PN echoes */
+    if (q == worldsize - 1) {
+        buf = malloc(sizeof(int) * BIGLEN);
+        if (buf == NULL) return -1;
+        PI_Read(to_echo, "%d", &n);
+        PI_Write(from_echo, "%d", -n);
+        PI_Read(to_echo, "%d %*d", &n, BIGLEN, buf);
+        for (k = 0; k < BIGLEN; k++)
+            buf[k] += n;
+        PI_Write(from_echo, "%*d", BIGLEN, buf);
+        sprintf(name, "P%d", worldsize);
+        ok = strcmp(PI_GetName(NULL), name) == 0;
+        PI_Write(from_echo, "%d", ok);
+        free(buf);
+    }
+
+    /* test16c: P2N is what main polls for */
+    if (q == 2 * worldsize - 1)
+        PI_Write(from_poll, "%d", q + 1);
+
+    /* test16d: report our process no. to the selector */
+    if (to_sel[q])
+        PI_Write(to_sel[q], "%d", q + 1);
+
+    /* test16e: P3N is what main polls for with PI_TrySelect, once told */
+    if (q == 3 * worldsize - 1) {
+        PI_Read(to_rr, "%d", &v);
+        PI_Write(PI_GetBundleChannel(rr_poll, 0), "%d", v + q + 1);
+    }
+    return 0;
+}
+
+void test16a(void)
+{
+    int i, v, ok;
+
+    CU_ASSERT_EQUAL(numPilotProcs, CORO * worldsize);
+    CU_ASSERT_EQUAL(err_capacity, PI_INSUFFICIENT_MPIPROCS);
+
+    for (i = 0; i < NTOKENS; i++)
+        PI_Write(chain[0], "%d", i);
+    for (ok = 1, i = 0; i < NTOKENS; i++) {
+        PI_Read(chain[nworkers], "%d", &v);
+        if (v != i + nworkers * (nworkers + 1) / 2) ok = 0;
+    }
+    CU_ASSERT(ok);
+}
+
+void test16b(void)
+{
+    int n, k, ok;
+    int *buf = malloc(sizeof(int) * BIGLEN);
+
+    if (buf == NULL) {
+        CU_FAIL_FATAL("Unable to allocate memory for test16b");
+    }
+
+    PI_Write(to_echo, "%d", 42);
+    PI_Read(from_echo, "%d", &n);
+    CU_ASSERT_EQUAL(n, -42);
+
+    for (k = 0; k < BIGLEN; k++)
+        buf[k] = k;
+    PI_Write(to_echo, "%d %*d", 7, BIGLEN, buf);
+    PI_Read(from_echo, "%*d", BIGLEN, buf);
+    for (ok = 1, k = 0; k < BIGLEN; k++)
+        if (buf[k] != k + 7) ok = 0;
+    CU_ASSERT(ok);
+
+    PI_Read(from_echo, "%d", &ok);
+    CU_ASSERT(ok);
+    free(buf);
+}
+
+void test16c(void)
+{
+    int n, polls;
+
+    /* no sleeping: only the poll itself can let P2N run */
+    for (polls = 0; !PI_ChannelHasData(from_poll) && polls < MAXPOLLS; polls++)
+        ;
+    CU_ASSERT(polls < MAXPOLLS);
+    PI_Read(from_poll, "%d", &n);
+    CU_ASSERT_EQUAL(n, 2 * worldsize);
+}
+
+void test16d(void)
+{
+    int i, n, sum = 0;
+
+    CU_ASSERT_PTR_NOT_NULL_FATAL(selector);
+    for (i = 0; i < nselect; i++) {
+        n = PI_Select(selector);
+        CU_ASSERT(n >= 0 && n < nselect);
+        if (n < 0 || n >= nselect) break;
+        PI_Read(PI_GetBundleChannel(selector, n), "%d", &n);
+        sum += n;
+    }
+    CU_ASSERT_EQUAL(sum, sel_sum);
+}
+
+void test16e(void)
+{
+    int n, polls;
+
+    /* as test16c, but a fair selector must yield too */
+    CU_ASSERT_PTR_NOT_NULL_FATAL(rr_poll);
+    PI_Write(to_rr, "%d", 100);
+    for (polls = 0; PI_TrySelect(rr_poll) < 0 && polls < MAXPOLLS; polls++)
+        ;
+    CU_ASSERT(polls < MAXPOLLS);
+    PI_Read(PI_GetBundleChannel(rr_poll, 0), "%d", &n);
+    CU_ASSERT_EQUAL(n, 100 + 3 * worldsize);
+}
+
+static int init(void)
+{
+    char *args[] = { default_argv[0], CORO_ARG };
+    int argc = 2;
+    char **argv = args;
+    int k, q, r, t;
+    PI_PROCESS **workers;
+    PI_CHANNEL **sel;
+    PI_QuietMode = 1;
+    PI_OnErrorReturn = 1;
+
+    numPilotProcs = PI_Configure(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &worldsize);
+
+    nworkers = numPilotProcs - 1;
+    workers = PI_CreateProcessArray(coro_worker, nworkers, NULL);
+    chain = malloc(sizeof(PI_CHANNEL *) * (nworkers + 1));
+    order = malloc(sizeof(int) * nworkers);
+    place = malloc(sizeof(int) * nworkers);
+    to_sel = calloc(nworkers, sizeof(PI_CHANNEL *));
+    sel = malloc(sizeof(PI_CHANNEL *) * worldsize);
+    if (workers == NULL || chain == NULL || order == NULL || place == NULL ||
+        to_sel == NULL || sel == NULL)
+        return -1;
+
+    PI_Errno = 0;
+    PI_CreateProcess(coro_worker, 0, NULL);
+    err_capacity = PI_Errno;
+    PI_Errno = 0;
+
+    /* rank r has Pr (unless r is 0) and then P(tN+r) for t = 1..CORO-1 */
+    for (k = 0, r = 0; r < worldsize; r++) {
+        if (r > 0) order[k++] = r - 1;
+        for (t = 1; t < CORO; t++)
+            order[k++] = t * worldsize + r - 1;
+    }
+    for (k = 0; k < nworkers; k++)
+        place[order[k]] = k;
+
+    chain[0] = PI_CreateChannel(PI_MAIN, workers[order[0]]);
+    for (k = 1; k < nworkers; k++)
+        chain[k] = PI_CreateChannel(workers[order[k - 1]], workers[order[k]]);
+    chain[nworkers] = PI_CreateChannel(workers[order[nworkers - 1]], PI_MAIN);
+
+    to_echo = PI_CreateChannel(PI_MAIN, workers[worldsize - 1]);
+    from_echo = PI_CreateChannel(workers[worldsize - 1], PI_MAIN);
+    from_poll = PI_CreateChannel(workers[2 * worldsize - 1], PI_MAIN);
+
+    /* selector over PN+1..P2N-1, one on each of ranks 1..N-1 */
+    nselect = sel_sum = 0;
+    for (q = worldsize; q < 2 * worldsize - 1; q++) {
+        to_sel[q] = sel[nselect++] = PI_CreateChannel(workers[q], PI_MAIN);
+        sel_sum += q + 1;
+    }
+    selector = PI_CreateBundle(PI_SELECT, sel, nselect);
+
+    /* P3N is another coroutine on main's MPI process */
+    to_rr = PI_CreateChannel(PI_MAIN, workers[3 * worldsize - 1]);
+    sel[0] = PI_CreateChannel(workers[3 * worldsize - 1], PI_MAIN);
+    rr_poll = PI_CreateBundle(PI_SELECT, sel, 1);
+    PI_SetSelectPolicy(rr_poll, PI_SELECT_ROUND_ROBIN, NULL);
+
+    free(workers);
+    free(sel);
+    PI_StartAll();
+    return 0;
+}
+
+static int cleanup(void)
+{
+    if (PI_GetMyRank() == 0)
+        PI_StopMain(0);
+    free(chain);
+    free(order);
+    free(place);
+    free(to_sel);
+    return 0;
+}
+
+CU_ErrorCode AddCoroSuite(void)
+{
+    CU_pSuite suite = CU_add_suite("Coroutine Process Tests", init, cleanup);
+    if (suite == NULL)
+        return CU_get_error();
+
+    AddTest(suite, "token stream through chain", test16a);
+    AddTest(suite, "echo within MPI process", test16b);
+    AddTest(suite, "poll a coroutine", test16c);
+    AddTest(suite, "select from coroutines", test16d);
+    AddTest(suite, "poll a round-robin selector", test16e);
+
+    return CUE_SUCCESS;
+}
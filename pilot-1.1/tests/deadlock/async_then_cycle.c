@@ -0,0 +1,69 @@
+/*!
+********************************************************************************
+\file async_then_cycle.c
+\brief Legal non-blocking exchange followed by circular wait.
+
+Scenario:
+	M <-main_q/q_main-> Q -q_r-> R -r_main-> M
+M and Q each PI_WriteAsync to the other, then PI_ReadAsync, then PI_WaitAll
+(would be a deadly embrace if these calls blocked)
+M reads r_main
+Q reads main_q
+R reads q_r
+
+Result:
+1) any order: "Operation creates circular wait with above processes"
+*******************************************************************************/
+
+#include <pilot.h>
+#include <stddef.h>
+
+PI_CHANNEL *main_q, *q_main, *q_r, *r_main;
+
+int q_worker(int idx, void *p)
+{
+    int x;
+    PI_REQUEST *reqs[2];
+
+    reqs[0] = PI_WriteAsync(q_main, "%d", 1);
+    reqs[1] = PI_ReadAsync(main_q, "%d", &x);
+    PI_WaitAll(reqs, 2);
+
+    PI_Read(main_q, "%d", &x);
+    return 0;
+}
+
+int r_worker(int idx, void *p)
+{
+    int x;
+    PI_Read(q_r, "%d", &x);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    PI_PROCESS *q, *r;
+    PI_REQUEST *reqs[2];
+    int x;
+
+    PI_Configure(&argc, &argv);
+
+    q = PI_CreateProcess(q_worker, 0, NULL);
+    r = PI_CreateProcess(r_worker, 0, NULL);
+
+    main_q = PI_CreateChannel(PI_MAIN, q);
+    q_main = PI_CreateChannel(q, PI_MAIN);
+    q_r = PI_CreateChannel(q, r);
+    r_main = PI_CreateChannel(r, PI_MAIN);
+
+    PI_StartAll();
+
+    reqs[0] = PI_WriteAsync(main_q, "%d", 1);
+    reqs[1] = PI_ReadAsync(q_main, "%d", &x);
+    PI_WaitAll(reqs, 2);
+
+    PI_Read(r_main, "%d", &x);
+
+    PI_StopMain(0);
+    return 0;
+}
@@ -0,0 +1,58 @@
+/*!
+********************************************************************************
+\file buffered_then_embrace.c
+\brief Legal writes ahead on buffered channels, followed by deadly embrace.
+
+Scenario:
+	M <-main_q/q_main-> Q, both buffered with capacity CAP
+M and Q each PI_Write CAP values to the other, then PI_Read them
+(would be a deadly embrace if the channels were not buffered)
+M and Q each PI_Write CAP+1 values to the other
+
+Result:
+1) any order: "Conflicting channels create deadly embrace"
+*******************************************************************************/
+
+#include <pilot.h>
+#include <stddef.h>
+
+#define CAP 3
+
+PI_CHANNEL *main_q, *q_main;
+
+static void exchange(PI_CHANNEL *out, PI_CHANNEL *in, int n)
+{
+    int i, x;
+
+    for (i = 0; i < n; i++)
+        PI_Write(out, "%d", i);
+    for (i = 0; i < n; i++)
+        PI_Read(in, "%d", &x);
+}
+
+int q_worker(int idx, void *p)
+{
+    exchange(q_main, main_q, CAP);
+    exchange(q_main, main_q, CAP + 1);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    PI_PROCESS *q;
+
+    PI_Configure(&argc, &argv);
+
+    q = PI_CreateProcess(q_worker, 0, NULL);
+
+    main_q = PI_CreateBufferedChannel(PI_MAIN, q, CAP);
+    q_main = PI_CreateBufferedChannel(q, PI_MAIN, CAP);
+
+    PI_StartAll();
+
+    exchange(main_q, q_main, CAP);
+    exchange(main_q, q_main, CAP + 1);
+
+    PI_StopMain(0);
+    return 0;
+}
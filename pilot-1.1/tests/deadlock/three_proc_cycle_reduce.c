@@ -0,0 +1,63 @@
+/*!
+********************************************************************************
+\file three_proc_cycle_reduce.c
+\brief Circular wait with two processes reading and one reduce.
+
+Scenario:
+	M -main_q-> Q -q_r-> R
+	  <-----reducer-------
+M reduces
+Q reads
+R reads
+
+Result:
+1) any order: "Operation creates circular wait with above processes"
+*******************************************************************************/
+
+#include <pilot.h>
+#include <stddef.h>
+#include <stdio.h>
+
+PI_CHANNEL* main_q;
+PI_CHANNEL* q_r;
+
+int Q(int idx, void* ctx)
+{
+    int recv;
+    PI_Read(main_q, "%d", &recv);
+    return 0;
+}
+
+int R(int idx, void* ctx)
+{
+    int recv;
+    PI_Read(q_r, "%d", &recv);
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    PI_PROCESS* q;
+    PI_PROCESS* r;
+    PI_CHANNEL* chans[1];
+    PI_BUNDLE* reducer;
+
+    PI_Configure(&argc, &argv);
+
+    q = PI_CreateProcess(Q, 0, NULL);
+    r = PI_CreateProcess(R, 0, NULL);
+    main_q = PI_CreateChannel(PI_MAIN, q);
+    q_r = PI_CreateChannel(q, r);
+    chans[0] = PI_CreateChannel(r, PI_MAIN);
+    reducer = PI_CreateBundle(PI_REDUCE, chans, 1);
+
+    PI_StartAll();
+
+    {
+        int sum;
+        PI_Reduce(reducer, PI_SUM, "%d", &sum);
+    }
+
+    PI_StopMain(0);
+    return 0;
+}
@@ -0,0 +1,64 @@
+/*!
+********************************************************************************
+\file three_proc_cycle_scatter.c
+\brief Circular wait with two processes reading and one scatter.
+
+Scenario:
+	M -----scatterer----> Q
+	  <-main_r- R <-r_q-
+M scatters
+Q reads
+R reads
+
+Result:
+1) any order: "Operation creates circular wait with above processes"
+*******************************************************************************/
+
+#include <pilot.h>
+#include <stddef.h>
+#include <stdio.h>
+
+PI_CHANNEL* r_q;
+PI_CHANNEL* main_r;
+
+int Q(int idx, void* ctx)
+{
+    int recv;
+    PI_Read(r_q, "%d", &recv);
+    return 0;
+}
+
+int R(int idx, void* ctx)
+{
+    int recv;
+    PI_Read(main_r, "%d", &recv);
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    PI_PROCESS* q;
+    PI_PROCESS* r;
+    PI_CHANNEL* chans[1];
+    PI_BUNDLE* scatterer;
+
+    PI_Configure(&argc, &argv);
+
+    q = PI_CreateProcess(Q, 0, NULL);
+    r = PI_CreateProcess(R, 0, NULL);
+    r_q = PI_CreateChannel(r, q);
+    main_r = PI_CreateChannel(PI_MAIN, r);
+    chans[0] = PI_CreateChannel(PI_MAIN, q);
+    scatterer = PI_CreateBundle(PI_SCATTER, chans, 1);
+
+    PI_StartAll();
+
+    {
+        int slices[1]; // One int for one channel.
+        slices[0] = 1;
+        PI_Scatter(scatterer, "%d", slices);
+    }
+
+    PI_StopMain(0);
+    return 0;
+}
@@ -2,6 +2,7 @@
 # This is the test runner for the deadlock unit tests. Since the
 # deadlock detector kills the program when a deadlock is detected,
 # there's no benefit to using CUnit as the test harness.
+# Set NOMPI=1 to run tests built against 'make nompi', without mpirun.
 
 NPROCS=5	# no. of MPI/Pilot processes needed (becomes NSLOTS)
 
@@ -28,7 +29,11 @@ run_test() {
     # $2 - expected error code
     # $3 - optional alternate error code
     printf "  $1... "
-    tmp=$(mpirun -np $NPROCS "deadlock/$1.case" -pisvc=d 2>&1 > /dev/null)
+    if [[ "$NOMPI" ]]; then
+        tmp=$("deadlock/$1.case" -np $NPROCS -pisvc=d 2>&1 > /dev/null)
+    else
+        tmp=$(mpirun -np $NPROCS "deadlock/$1.case" -pisvc=d 2>&1 > /dev/null)
+    fi
     if find_text "$tmp" "$2" "$3"; then
         echo "success"
     else
@@ -51,8 +56,12 @@ run_test "three_proc_cycle_read"	"$REASON_CW"
 run_test "three_proc_cycle_write"	"$REASON_CW"
 run_test "three_proc_cycle_select"	"$REASON_CW" "$REASON_SN"
 run_test "three_proc_cycle_gather"	"$REASON_CW"
+run_test "three_proc_cycle_reduce"	"$REASON_CW"
+run_test "three_proc_cycle_scatter"	"$REASON_CW"
 run_test "four_proc_cycle_read"		"$REASON_CW"
 run_test "test_unsatisfiable_select"	"$REASON_SN" "$REASON_ES"
+run_test "async_then_cycle"		"$REASON_CW"
+run_test "buffered_then_embrace"	"$REASON_DE"
 
 endtime=`date`
 echo "Run ended on $endtime"
@@ -90,8 +90,11 @@ start_test "three_proc_cycle_read"
 start_test "three_proc_cycle_write"
 start_test "three_proc_cycle_select"
 start_test "three_proc_cycle_gather"
+start_test "three_proc_cycle_reduce"
+start_test "three_proc_cycle_scatter"
 start_test "four_proc_cycle_read"
 start_test "test_unsatisfiable_select"
+start_test "async_then_cycle"
 
 echo "Checking output, may pause until job completes..."
 
@@ -105,8 +108,11 @@ check_test "three_proc_cycle_read"	"$REASON_CW"
 check_test "three_proc_cycle_write"	"$REASON_CW"
 check_test "three_proc_cycle_select"	"$REASON_CW" "$REASON_SN"
 check_test "three_proc_cycle_gather"	"$REASON_CW"
+check_test "three_proc_cycle_reduce"	"$REASON_CW"
+check_test "three_proc_cycle_scatter"	"$REASON_CW"
 check_test "four_proc_cycle_read"	"$REASON_CW"
 check_test "test_unsatisfiable_select"	"$REASON_SN" "$REASON_ES"
+check_test "async_then_cycle"		"$REASON_CW"
 
 endtime=`date`
 echo "Run ended on $endtime"
@@ -1,6 +1,7 @@
 /*
 Unit tests for the format parser. This suite indirectly tests ParseFormatString
-through PI_Read and PI_Write.
+through PI_Read and PI_Write, and tests compiled formats from PI_CompileFormat
+with PI_WriteF and PI_ReadF.
 
 NOTE: you should *not* run this suite with the deadlock detector on.
 */
@@ -12,6 +13,9 @@ PI_PROCESS* dummy_proc;
 PI_CHANNEL* all_types_chan;
 PI_PROCESS* all_types_proc;
 
+PI_CHANNEL *to_compiled, *from_compiled;
+PI_PROCESS* compiled_proc;
+
 int dummy_process_func( int arg1, void* arg2 )
 {
     return 0;
@@ -45,6 +49,21 @@ int all_types_func( int arg1, void* arg2 )
     return 0;
 }
 
+int compiled_echo_func( int arg1, void* arg2 )
+{
+    PI_FORMAT* rfmt = PI_CompileFormat( PI_READ, "%d %*lf" );
+    PI_FORMAT* wfmt = PI_CompileFormat( PI_WRITE, "%d %*lf" );
+    double vals[3];
+    int i, n;
+
+    // echo the same message several times to exercise handle reuse
+    for ( i = 0; i < 3; i++ ) {
+        PI_ReadF( to_compiled, rfmt, &n, 3, vals );
+        PI_WriteF( from_compiled, wfmt, n + 1, 3, vals );
+    }
+    return 0;
+}
+
 void ShouldFailOnWhitespaceOnly( void )
 {
     PI_Errno = 0;
@@ -132,6 +151,48 @@ void ShouldNotCrashWithLongFormat( void )
     CU_ASSERT_EQUAL( PI_Errno, PI_FORMAT_ARGS );
 }
 
+void CompileShouldRejectBadFormats( void )
+{
+    const char* fmts[] = { "", "  ", "%1d", "%3*d", "%lol", " %", NULL };
+    int i;
+
+    for ( i = 0; fmts[i] != NULL; i++ ) {
+        PI_Errno = 0;
+        CU_ASSERT( PI_CompileFormat( PI_WRITE, fmts[i] ) == NULL );
+        CU_ASSERT_EQUAL( PI_Errno, PI_FORMAT_ARGS );
+    }
+
+    PI_Errno = 0;
+    CU_ASSERT( PI_CompileFormat( PI_READ, NULL ) == NULL );
+    CU_ASSERT_EQUAL( PI_Errno, PI_NULL_FORMAT );
+}
+
+void CompiledShouldRejectWrongDirection( void )
+{
+    PI_FORMAT* rfmt = PI_CompileFormat( PI_READ, "%d" );
+    CU_ASSERT( rfmt != NULL );
+
+    PI_Errno = 0;
+    PI_WriteF( dummy_chan, rfmt, 1 );
+    CU_ASSERT_EQUAL( PI_Errno, PI_FORMAT_ARGS );
+}
+
+void CompiledShouldEcho( void )
+{
+    PI_FORMAT* wfmt = PI_CompileFormat( PI_WRITE, "%d %*lf" );
+    PI_FORMAT* rfmt = PI_CompileFormat( PI_READ, "%d %*lf" );
+    double vals[3] = { 1.5, 2.5, 3.5 }, back[3];
+    int i, n;
+
+    for ( i = 0; i < 3; i++ ) {
+        PI_WriteF( to_compiled, wfmt, i, 3, vals );
+        PI_ReadF( from_compiled, rfmt, &n, 3, back );
+        CU_ASSERT_EQUAL( n, i + 1 );
+        CU_ASSERT_DOUBLE_EQUAL( back[0], 1.5, 0.00001 );
+        CU_ASSERT_DOUBLE_EQUAL( back[2], 3.5, 0.00001 );
+    }
+}
+
 static int init(void)
 {
     int argc = default_argc;
@@ -147,6 +208,10 @@ static int init(void)
     all_types_proc = PI_CreateProcess( all_types_func, 0, NULL );
     all_types_chan = PI_CreateChannel( PI_MAIN, all_types_proc );
 
+    compiled_proc = PI_CreateProcess( compiled_echo_func, 0, NULL );
+    to_compiled = PI_CreateChannel( PI_MAIN, compiled_proc );
+    from_compiled = PI_CreateChannel( compiled_proc, PI_MAIN );
+
     PI_StartAll();
     return 0;
 }
@@ -171,6 +236,9 @@ CU_ErrorCode AddFormatSuite(void)
     AddTest( suite, "Should fail on NULL format string", ShouldFailOnNullFormatString );
     AddTest( suite, "Try all format codes", ShouldAcceptBasicFormats );
     AddTest( suite, "Should not crash with too long format string", ShouldNotCrashWithLongFormat );
+    AddTest( suite, "PI_CompileFormat should reject bad formats", CompileShouldRejectBadFormats );
+    AddTest( suite, "Compiled format should check direction", CompiledShouldRejectWrongDirection );
+    AddTest( suite, "Compiled formats should echo values", CompiledShouldEcho );
 
     return CUE_SUCCESS;
 }
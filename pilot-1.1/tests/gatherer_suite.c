@@ -5,6 +5,9 @@ Tests that:
  - gathering is possible from 3 processes.
  - gathering a large array (> 10000 ints) does not cause problems.
  - it is possible to gather on a process other than PI_MAIN.
+ - gathering several items in one call puts each in the right array.
+ - PI_Gatherv collects different lengths from each process, into allocated
+   or provided buffers, for one or several items.
 */
 #include "unittests.h"
 #include <stdio.h>
@@ -13,6 +16,9 @@ PI_PROCESS *test7_1, *test7_2, *test7_3;
 PI_CHANNEL *to_test7[3];
 PI_BUNDLE *test7_bundle;
 
+PI_CHANNEL **to_test7v;		/* copies of to_test7 for PI_Gatherv */
+PI_BUNDLE *test7v_bundle;
+
 PI_PROCESS *test7_4;
 PI_CHANNEL *test7_large_array_channels[1];
 PI_BUNDLE *test7_large_array_bundle;
@@ -24,6 +30,28 @@ int gather_write(int q, void *p) {
     c[0] = 65 + q;
 
     PI_Write(to_test7[q],"%*c", 1, c);
+
+    /* several items, small and then large enough not to fit PI_PACK_MAX */
+    int big[2000];
+    double d[2] = { 0.5 * q, 1.5 * q };
+    int i;
+    for (i = 0; i < 2000; i++)
+        big[i] = q * 10000 + i;
+    PI_Write(to_test7[q],"%c %d %2lf", c[0], q * 3, d);
+    PI_Write(to_test7[q],"%d %2000d", q, big);
+
+    /* variable lengths: q+1 ints, then 1000(q+1) ints, a char and q+1 doubles */
+    for (i = 0; i < q + 1; i++)
+        big[i] = q * 10000 + i;
+    PI_Write(to_test7v[q],"%*d", q + 1, big);
+    {
+        int *many = malloc(sizeof(int) * 1000 * (q + 1));
+        double dv[3] = { q, q + 0.25, q + 0.5 };
+        for (i = 0; i < 1000 * (q + 1); i++)
+            many[i] = q * 10000 + i;
+        PI_Write(to_test7v[q],"%*d %c %*lf", 1000 * (q + 1), many, 65 + q, q + 1, dv);
+        free(many);
+    }
     return 0;
 }
 
@@ -37,6 +65,88 @@ void test7a(void) {
     CU_ASSERT_EQUAL(cc[2],67);
 }
 
+void test7d(void) {
+    char cc[3];
+    int ii[3];
+    double dd[6];
+    int *big = malloc(sizeof(int) * 3 * 2000);
+    int i, q;
+    if (big == NULL) {
+        CU_FAIL_FATAL("Unable to allocate memory for test7d");
+    }
+
+    PI_Gather(test7_bundle,"%c %d %2lf", cc, ii, dd);
+    for (q = 0; q < 3; q++) {
+        CU_ASSERT_EQUAL(cc[q], 65 + q);
+        CU_ASSERT_EQUAL(ii[q], q * 3);
+        CU_ASSERT_DOUBLE_EQUAL(dd[2*q], 0.5 * q, 0.00001);
+        CU_ASSERT_DOUBLE_EQUAL(dd[2*q+1], 1.5 * q, 0.00001);
+    }
+
+    PI_Gather(test7_bundle,"%d %2000d", ii, big);
+    for (q = 0; q < 3; q++) {
+        CU_ASSERT_EQUAL(ii[q], q);
+        for (i = 0; i < 2000; i++)
+            CU_ASSERT_EQUAL(big[q * 2000 + i], q * 10000 + i);
+    }
+    free(big);
+}
+
+void test7e(void) {
+    int *ints = NULL;
+    int counts[3], offsets[3];
+    int q, j;
+
+    PI_Gatherv(test7v_bundle, counts, offsets, "%d", &ints);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(ints);
+    for (q = 0; q < 3; q++) {
+        CU_ASSERT_EQUAL(counts[q], q + 1);
+        CU_ASSERT_EQUAL(offsets[q], q * (q + 1) / 2);
+        for (j = 0; j < q + 1; j++)
+            CU_ASSERT_EQUAL(ints[offsets[q] + j], q * 10000 + j);
+    }
+    free(ints);
+}
+
+void test7f(void) {
+    int *ints = malloc(sizeof(int) * 6000);	/* provided buffer */
+    char cc[3], *pc = cc;
+    double *dd = NULL;
+    int counts[3*3], offsets[3*3];
+    int q, j, ok;
+
+    if (ints == NULL) {
+        CU_FAIL_FATAL("Unable to allocate memory for test7f");
+    }
+
+    PI_Gatherv(test7v_bundle, counts, offsets, "%d %c %lf", &ints, &pc, &dd);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(dd);
+    for (q = 0; q < 3; q++) {
+        /* item 0: ints */
+        CU_ASSERT_EQUAL(counts[q], 1000 * (q + 1));
+        for (ok = 1, j = 0; j < 1000 * (q + 1); j++)
+            if (ints[offsets[q] + j] != q * 10000 + j) ok = 0;
+        CU_ASSERT(ok);
+
+        /* item 1: one char each */
+        CU_ASSERT_EQUAL(counts[3 + q], 1);
+        CU_ASSERT_EQUAL(cc[q], 65 + q);
+
+        /* item 2: doubles */
+        CU_ASSERT_EQUAL(counts[6 + q], q + 1);
+        for (j = 0; j < q + 1; j++)
+            CU_ASSERT_DOUBLE_EQUAL(dd[offsets[6 + q] + j], q + 0.25 * j, 0.00001);
+    }
+    free(ints);
+    free(dd);
+
+    /* PI_Gather does not apply to a PI_GATHERV bundle */
+    PI_Errno = 0;
+    PI_Gather(test7v_bundle, "%d", ints);
+    CU_ASSERT_EQUAL(PI_Errno, PI_BUNDLE_USAGE);
+    PI_Errno = 0;
+}
+
 int gather_array_write(int idx, void* arg2)
 {
     int i;
@@ -125,6 +235,9 @@ static int init(void)
     test7_bundle = PI_CreateBundle(PI_GATHER, to_test7,3);
     PI_SetName(test7_bundle, "test7 gatherer");
 
+    to_test7v = PI_CopyChannels(PI_SAME, to_test7, 3);
+    test7v_bundle = PI_CreateBundle(PI_GATHERV, to_test7v, 3);
+
     test7_4 = CreateAliasedProcess(gather_array_write, "test7_4", 0, NULL);
     test7_large_array_channels[0] = PI_CreateChannel(test7_4, PI_MAIN);
     test7_large_array_bundle = PI_CreateBundle(PI_GATHER, test7_large_array_channels, 1);
@@ -155,6 +268,9 @@ CU_ErrorCode AddGathererSuite(void)
         return CU_get_error();
 
     AddTest(suite, "gatherer tests", test7a);
+    AddTest(suite, "gatherer multiple items", test7d);
+    AddTest(suite, "gatherv single item", test7e);
+    AddTest(suite, "gatherv multiple items", test7f);
     AddTest(suite, "gatherer large array", test7b);
     AddTest(suite, "non-main gatherer", test7c);
 
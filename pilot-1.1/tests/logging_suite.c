@@ -0,0 +1,136 @@
+/*
+Tests for the log made by -pisvc=c, whose entries each MPI process sends to
+the online process in batches of binary records.
+
+Tests that:
+ - calls on channels are logged by each process with their call code and
+   format, once per call.
+ - a user event longer than the old fixed log line comes through whole.
+ - every process that ran logs its FIN.
+ - each process's entries are in time order.
+ - entries from different processes are timed by one clock: an event logged
+   after a read comes after one logged before the matching write.
+*/
+#include "unittests.h"
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#define ROUNDS 50
+#define LONGLEN 300		/* well past the old 80-char log line */
+#define LOGFILE "logging_suite.log"
+#define DELAY 0.01		/* seconds between main's event and its write */
+
+static PI_CHANNEL *to_main, *from_main;
+static char long_text[LONGLEN + 1];
+static int running;
+
+int log_worker(int q, void *p)
+{
+    int i, n;
+
+    for (i = 0; i < ROUNDS; i++)
+        PI_Write(to_main, "%d", i);
+    PI_Log(long_text);
+    PI_Read(from_main, "%d", &n);
+    PI_Log("after read");
+    return 0;
+}
+
+void test19a(void)
+{
+    int i, n, worldsize;
+    int reads = 0, writes = 0, longs = 0, fins = 0, ordered = 1;
+    long t, last[NUM_REQUIRED_PROCS], before = LONG_MIN, after = LONG_MIN;
+    double start;
+    char line[2 * LONGLEN], *tab;
+    FILE *log;
+
+    for (i = 0; i < NUM_REQUIRED_PROCS; i++)
+        last[i] = LONG_MIN;	/* corrected times may start below 0 */
+    for (i = 0; i < ROUNDS; i++)
+        PI_Read(to_main, "%d", &n);
+    PI_Log("before write");
+    start = MPI_Wtime();
+    while (MPI_Wtime() - start < DELAY)
+        ;
+    PI_Log(long_text);
+    PI_Write(from_main, "%d", 1);
+
+    /* the log is only complete once everyone has finished */
+    PI_StopMain(0);
+    running = 0;
+
+    log = fopen(LOGFILE, "r");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(log);
+    while (fgets(line, sizeof(line), log)) {
+        line[strcspn(line, "\n")] = '\0';
+        t = strtol(line, &tab, 10);
+
+        /* time, type, process no., then the rest */
+        if (sscanf(tab, "\t%*c\t%d", &n) == 1 && n >= 0 &&
+            n < NUM_REQUIRED_PROCS) {
+            if (t < last[n]) ordered = 0;
+            last[n] = t;
+        }
+        if (strstr(line, "\tC\t0\tRea\t") && strstr(line, "\t%d")) reads++;
+        if (strstr(line, "\tC\t2\tWri\t") && strstr(line, "\t%d")) writes++;
+        if (strstr(line, "\tU\t") && strstr(line, long_text)) longs++;
+        if (strstr(line, "\tP\t") && strstr(line, "\tFIN\t")) fins++;
+        if (strstr(line, "\tU\t0\tbefore write")) before = t;
+        if (strstr(line, "\tU\t2\tafter read")) after = t;
+    }
+    fclose(log);
+    remove(LOGFILE);
+
+    MPI_Comm_size(MPI_COMM_WORLD, &worldsize);
+    CU_ASSERT_EQUAL(reads, ROUNDS);
+    CU_ASSERT_EQUAL(writes, ROUNDS);
+    CU_ASSERT_EQUAL(longs, 2);
+    CU_ASSERT_EQUAL(fins, worldsize - 1);	// all but the online process
+    CU_ASSERT(ordered);
+    CU_ASSERT(before != LONG_MIN && after > before);
+}
+
+static int init(void)
+{
+    char *args[] = { "unittests", "-pisvc=c", "-pilog=" LOGFILE };
+    int argc = 3;
+    char **argv = args;
+    int i;
+    PI_PROCESS *w;
+    PI_QuietMode = 1;
+    PI_OnErrorReturn = 1;
+
+    for (i = 0; i < LONGLEN; i++)
+        long_text[i] = 'a' + i % 26;
+    long_text[LONGLEN] = '\0';
+
+    PI_Configure(&argc, &argv);
+
+    w = PI_CreateProcess(log_worker, 0, NULL);
+    to_main = PI_CreateChannel(w, PI_MAIN);
+    from_main = PI_CreateChannel(PI_MAIN, w);
+
+    PI_StartAll();
+    running = 1;
+    return 0;
+}
+
+static int cleanup(void)
+{
+    if (PI_GetMyRank() == 0 && running)
+        PI_StopMain(0);
+    return 0;
+}
+
+CU_ErrorCode AddLoggingSuite(void)
+{
+    CU_pSuite suite = CU_add_suite("Logging Tests", init, cleanup);
+    if (suite == NULL)
+        return CU_get_error();
+
+    AddTest(suite, "log of calls and events", test19a);
+
+    return CUE_SUCCESS;
+}
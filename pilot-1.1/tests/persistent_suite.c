@@ -0,0 +1,150 @@
+/*
+Tests for PI_CreatePersistentWrite, PI_CreatePersistentRead, PI_Start and
+PI_Complete.
+
+Tests that:
+ - a large row can be exchanged repeatedly, picking up new values each time.
+ - a persistent write of several small items matches a blocking read.
+ - requests in the wrong state are refused.
+*/
+#include "unittests.h"
+
+PI_PROCESS *persist_worker;
+PI_CHANNEL *to_persist, *from_persist;
+
+#define ROWLEN 4096
+#define ITERS 10
+
+int persist_worker_func(int q, void *p)
+{
+    int i, iter, a, b;
+    double *row = malloc(sizeof(double) * ROWLEN);
+    PI_REQUEST *rd, *wr;
+
+    if (row == NULL)
+        return -1;
+
+    /* halo-style echo: add 1 to iteration no. and first element */
+    rd = PI_CreatePersistentRead(to_persist, "%d %*lf", &iter, ROWLEN, row);
+    wr = PI_CreatePersistentWrite(from_persist, "%d %*lf", &iter, ROWLEN, row);
+    for (i = 0; i < ITERS; i++) {
+        PI_Start(rd);
+        PI_Complete(rd);
+        iter++;
+        row[0] += 1.0;
+        PI_Start(wr);
+        PI_Complete(wr);
+    }
+
+    /* blocking end against persistent requests in main */
+    PI_Read(to_persist, "%d %d", &a, &b);
+    PI_Write(from_persist, "%d", a + b);
+
+    free(row);
+    return 0;
+}
+
+void test_persistent_row(void)
+{
+    int i, j, iter, back, ok;
+    double *row = malloc(sizeof(double) * ROWLEN);
+    double *echo = malloc(sizeof(double) * ROWLEN);
+    PI_REQUEST *wr, *rd;
+
+    if (row == NULL || echo == NULL) {
+        CU_FAIL_FATAL("Unable to allocate memory for test_persistent_row");
+    }
+
+    wr = PI_CreatePersistentWrite(to_persist, "%d %*lf", &iter, ROWLEN, row);
+    rd = PI_CreatePersistentRead(from_persist, "%d %*lf", &back, ROWLEN, echo);
+    CU_ASSERT_PTR_NOT_NULL(wr);
+    CU_ASSERT_PTR_NOT_NULL(rd);
+
+    for (i = 0; i < ITERS; i++) {
+        iter = i;
+        for (j = 0; j < ROWLEN; j++)
+            row[j] = i + j;
+
+        PI_Start(rd);		// post the read before the write
+        PI_Start(wr);
+        PI_Complete(wr);
+        PI_Complete(rd);
+
+        CU_ASSERT_EQUAL(back, i + 1);
+        CU_ASSERT_DOUBLE_EQUAL(echo[0], i + 1.0, 0.00001);
+        for (ok = 1, j = 1; j < ROWLEN; j++)
+            if (echo[j] != i + j) ok = 0;
+        CU_ASSERT(ok);
+    }
+    free(row);
+    free(echo);
+}
+
+PI_REQUEST *small_wr, *small_rd;
+
+void test_persistent_small(void)
+{
+    int a = 30, b = 12, sum = 0;
+
+    small_wr = PI_CreatePersistentWrite(to_persist, "%d %d", &a, &b);
+    small_rd = PI_CreatePersistentRead(from_persist, "%d", &sum);
+    PI_Start(small_wr);
+    PI_Start(small_rd);
+    PI_Complete(small_wr);
+    PI_Complete(small_rd);
+    CU_ASSERT_EQUAL(sum, 42);
+}
+
+void test_persistent_errors(void)
+{
+    PI_Errno = 0;
+    PI_Complete(small_wr);		// not started
+    CU_ASSERT_EQUAL(PI_Errno, PI_REQUEST_STATE);
+
+    PI_Errno = 0;
+    PI_Wait(&small_rd);			// would free it
+    CU_ASSERT_EQUAL(PI_Errno, PI_REQUEST_STATE);
+    CU_ASSERT_PTR_NOT_NULL(small_rd);
+
+    PI_Errno = 0;
+    PI_Start(NULL);
+    CU_ASSERT_EQUAL(PI_Errno, PI_NULL_REQUEST);
+    PI_Errno = 0;
+}
+
+static int init(void)
+{
+    int argc = default_argc;
+    char** argv = default_argv;
+    PI_QuietMode = 1;
+    PI_OnErrorReturn = 1;
+
+    PI_Configure(&argc, &argv);
+
+    persist_worker = CreateAliasedProcess(persist_worker_func, "persist_worker", 0, NULL);
+    to_persist = PI_CreateChannel(PI_MAIN, persist_worker);
+    from_persist = PI_CreateChannel(persist_worker, PI_MAIN);
+
+    PI_StartAll();
+    return 0;
+}
+
+static int cleanup(void)
+{
+    if (PI_GetMyRank() == 0)
+        PI_StopMain(0);
+    return 0;
+}
+
+CU_ErrorCode AddPersistentSuite(void)
+{
+    CU_pSuite suite = CU_add_suite("Persistent Read/Write Tests", init, cleanup);
+    if (suite == NULL)
+        return CU_get_error();
+
+    AddTest(suite, "persistent exchange of a large row", test_persistent_row);
+    AddTest(suite, "persistent write of small items", test_persistent_small);
+    AddTest(suite, "persistent request errors", test_persistent_errors);
+
+    return CUE_SUCCESS;
+}
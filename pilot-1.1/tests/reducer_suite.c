@@ -0,0 +1,180 @@
+/*
+Tests for PI_Reduce and PI_CreateOp.
+
+Tests that:
+ - the built-in operations combine single values from 4 processes.
+ - arrays are combined element by element, including a large one.
+ - a user-defined operation can be used.
+ - PI_Write on a reducer channel, and PI_Reduce with a bad operation, fail.
+*/
+#include "unittests.h"
+#include <stdlib.h>
+
+#define NREDUCERS 4
+#define BIGLEN 5000
+
+PI_PROCESS *reduce_procs[NREDUCERS];
+PI_CHANNEL *to_reduce[NREDUCERS];
+PI_BUNDLE *reduce_bundle;
+int absmax_op;
+
+/* keeps the element of larger magnitude */
+static void absmax(void *in, void *inout, int *len, void *datatype)
+{
+    int *a = in, *b = inout;
+    int i;
+
+    for (i = 0; i < *len; i++)
+        if (abs(a[i]) > abs(b[i])) b[i] = a[i];
+}
+
+int reduce_worker(int q, void *p)
+{
+    int i, err;
+    int v[3] = { q, 1 << q, 10 * q };
+    double *big = malloc(sizeof(double) * BIGLEN);
+
+    if (big == NULL)
+        return -1;
+
+    /* test12a */
+    PI_Reduce(reduce_bundle, PI_SUM, "%d %lf", q + 1, 0.5 * q);
+    PI_Reduce(reduce_bundle, PI_PROD, "%d", q + 1);
+    PI_Reduce(reduce_bundle, PI_MIN, "%d", q + 1);
+    PI_Reduce(reduce_bundle, PI_MAX, "%lf", 0.5 * q);
+
+    /* test12b */
+    for (i = 0; i < BIGLEN; i++)
+        big[i] = i + q;
+    PI_Reduce(reduce_bundle, PI_SUM, "%3d %*lf", v, BIGLEN, big);
+    PI_Reduce(reduce_bundle, PI_BOR, "%d", 1 << q);
+    PI_Reduce(reduce_bundle, PI_BAND, "%d", 0xF0 | (1 << q));
+
+    /* test12c */
+    PI_Reduce(reduce_bundle, absmax_op, "%d", (q % 2 ? -5 : 5) * q);
+
+    /* test12d: report the error code from writing on our channel */
+    PI_Errno = 0;
+    PI_Write(to_reduce[q], "%d", q);
+    err = PI_Errno;
+    PI_Errno = 0;
+    PI_Reduce(reduce_bundle, PI_MIN, "%d", err);
+
+    free(big);
+    return 0;
+}
+
+void test12a(void)
+{
+    int isum = 0, prod = 0, min = 0;
+    double dsum = 0.0, max = 0.0;
+
+    PI_Reduce(reduce_bundle, PI_SUM, "%d %lf", &isum, &dsum);
+    CU_ASSERT_EQUAL(isum, 10);
+    CU_ASSERT_DOUBLE_EQUAL(dsum, 3.0, 0.00001);
+
+    PI_Reduce(reduce_bundle, PI_PROD, "%d", &prod);
+    CU_ASSERT_EQUAL(prod, 24);
+
+    PI_Reduce(reduce_bundle, PI_MIN, "%d", &min);
+    CU_ASSERT_EQUAL(min, 1);
+
+    PI_Reduce(reduce_bundle, PI_MAX, "%lf", &max);
+    CU_ASSERT_DOUBLE_EQUAL(max, 1.5, 0.00001);
+}
+
+void test12b(void)
+{
+    int v[3], bor = 0, band = 0;
+    int i, ok;
+    double *big = malloc(sizeof(double) * BIGLEN);
+
+    if (big == NULL) {
+        CU_FAIL_FATAL("Unable to allocate memory for test12b");
+    }
+
+    PI_Reduce(reduce_bundle, PI_SUM, "%3d %*lf", v, BIGLEN, big);
+    CU_ASSERT_EQUAL(v[0], 6);
+    CU_ASSERT_EQUAL(v[1], 15);
+    CU_ASSERT_EQUAL(v[2], 60);
+    for (ok = 1, i = 0; i < BIGLEN; i++)
+        if (big[i] != 4.0 * i + 6.0) ok = 0;
+    CU_ASSERT(ok);
+
+    PI_Reduce(reduce_bundle, PI_BOR, "%d", &bor);
+    CU_ASSERT_EQUAL(bor, 0xF);
+
+    PI_Reduce(reduce_bundle, PI_BAND, "%d", &band);
+    CU_ASSERT_EQUAL(band, 0xF0);
+
+    free(big);
+}
+
+void test12c(void)
+{
+    int result = 0;
+
+    CU_ASSERT(absmax_op >= 0);
+    PI_Reduce(reduce_bundle, absmax_op, "%d", &result);
+    CU_ASSERT_EQUAL(result, -15);
+}
+
+void test12d(void)
+{
+    int err = 0;
+    char cc[NREDUCERS];
+
+    PI_Reduce(reduce_bundle, PI_MIN, "%d", &err);
+    CU_ASSERT_EQUAL(err, PI_BUNDLE_USAGE);
+
+    PI_Errno = 0;
+    PI_Reduce(reduce_bundle, absmax_op + 1, "%d", &err);
+    CU_ASSERT_EQUAL(PI_Errno, PI_REDUCE_OP);
+
+    PI_Errno = 0;
+    PI_Gather(reduce_bundle, "%c", cc);
+    CU_ASSERT_EQUAL(PI_Errno, PI_BUNDLE_USAGE);
+    PI_Errno = 0;
+}
+
+static int init(void)
+{
+    int argc = default_argc;
+    char** argv = default_argv;
+    int i;
+    PI_QuietMode = 1;
+    PI_OnErrorReturn = 1;
+
+    PI_Configure(&argc, &argv);
+
+    for (i = 0; i < NREDUCERS; i++) {
+        reduce_procs[i] = CreateAliasedProcess(reduce_worker, "reducer", i, NULL);
+        to_reduce[i] = PI_CreateChannel(reduce_procs[i], PI_MAIN);
+    }
+    reduce_bundle = PI_CreateBundle(PI_REDUCE, to_reduce, NREDUCERS);
+    absmax_op = PI_CreateOp(absmax, 1);
+
+    PI_StartAll();
+    return 0;
+}
+
+static int cleanup(void)
+{
+    if (PI_GetMyRank() == 0)
+        PI_StopMain(0);
+    return 0;
+}
+
+CU_ErrorCode AddReducerSuite(void)
+{
+    CU_pSuite suite = CU_add_suite("Reducer Tests", init, cleanup);
+    if (suite == NULL)
+        return CU_get_error();
+
+    AddTest(suite, "reduce single values", test12a);
+    AddTest(suite, "reduce arrays", test12b);
+    AddTest(suite, "reduce with user op", test12c);
+    AddTest(suite, "reducer errors", test12d);
+
+    return CUE_SUCCESS;
+}
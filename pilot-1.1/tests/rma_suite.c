@@ -0,0 +1,339 @@
+/*
+Tests for channels given an RMA slot by PI_SetRMA, whose large messages are
+put straight into a window on the reader.
+
+Tests that:
+ - PI_SetRMA rejects a slot too small ever to be used, and a NULL channel.
+ - large messages go back and forth through slots many times, in order with
+   small messages on the same channels, which are sent as usual.
+ - several items, mixing an int with large int and double arrays, go
+   through a slot together.
+ - non-blocking writes and reads queue for the slot, and complete in order.
+ - persistent writes and reads reuse the slot, picking up new values.
+ - PI_ChannelHasData and PI_Select see messages that wait in a slot.
+ - PI_GatherNext takes messages out of the slots, and small ones as usual.
+*/
+#include "unittests.h"
+
+#define BIG 20000		/* doubles: 160000 bytes, over PI_RMA_MIN */
+#define SLOT (BIG * 12 + 64)	/* room for BIG doubles and BIG ints */
+#define ROUNDS 10
+#define NQUEUE 3
+#define NSEL 3
+
+static int err_small, err_null;
+static PI_CHANNEL *to_rma, *from_rma, *sel_chan[NSEL];
+static PI_BUNDLE *rma_sel;
+
+static void fill(double *buf, double base)
+{
+    int k;
+    for (k = 0; k < BIG; k++)
+        buf[k] = base + k;
+}
+
+static int check(const double *buf, double base)
+{
+    int k;
+    for (k = 0; k < BIG; k++)
+        if (buf[k] != base + k) return 0;
+    return 1;
+}
+
+int rma_echo(int q, void *p)
+{
+    int i, k, n, ok;
+    double *buf = malloc(sizeof(double) * BIG * NQUEUE);
+    int *ibuf = malloc(sizeof(int) * BIG);
+    PI_REQUEST *reqs[NQUEUE], *r;
+
+    if (buf == NULL || ibuf == NULL)
+        return -1;
+
+    /* test17b: echo large arrays plus one, and small ints plus one */
+    for (i = 0; i < ROUNDS; i++) {
+        PI_Read(to_rma, "%*lf", BIG, buf);
+        for (k = 0; k < BIG; k++)
+            buf[k] += 1;
+        PI_Write(from_rma, "%*lf", BIG, buf);
+        PI_Read(to_rma, "%d", &n);
+        PI_Write(from_rma, "%d", n + 1);
+    }
+
+    /* test17c: several items in one message */
+    PI_Read(to_rma, "%d %*d %*lf", &n, BIG, ibuf, BIG / 2, buf);
+    for (k = 0; k < BIG; k++)
+        ibuf[k] += n;
+    PI_Write(from_rma, "%*d %*lf %d", BIG, ibuf, BIG / 2, buf, -n);
+
+    /* test17d: queued non-blocking reads */
+    for (i = 0; i < NQUEUE; i++)
+        reqs[i] = PI_ReadAsync(to_rma, "%*lf", BIG, buf + i * BIG);
+    PI_WaitAll(reqs, NQUEUE);
+    for (ok = 1, i = 0; i < NQUEUE; i++)
+        ok = ok && check(buf + i * BIG, i * 1000.0);
+    PI_Write(from_rma, "%d", ok);
+
+    /* test17e: persistent reads */
+    r = PI_CreatePersistentRead(to_rma, "%*lf", BIG, buf);
+    for (ok = 1, i = 0; i < ROUNDS; i++) {
+        PI_Start(r);
+        PI_Complete(r);
+        ok = ok && check(buf, -i);
+    }
+    PI_Write(from_rma, "%d", ok);
+
+    /* test17f: a message for main to poll for */
+    fill(buf, 0.5);
+    PI_Write(from_rma, "%*lf", BIG, buf);
+
+    free(buf);
+    free(ibuf);
+    return 0;
+}
+
+int rma_sel_worker(int q, void *p)
+{
+    double *buf = malloc(sizeof(double) * BIG);
+
+    if (buf == NULL)
+        return -1;
+
+    /* test17g */
+    fill(buf, q * 100.0);
+    PI_Write(sel_chan[q], "%d %*lf", q, BIG, buf);
+
+    /* test17h: a stream of large messages, then one of small */
+    fill(buf, q * 100.0 + 1);
+    PI_Write(sel_chan[q], "%d %*lf", q, BIG, buf);
+    PI_Write(sel_chan[q], "%d", q);
+    free(buf);
+    return 0;
+}
+
+void test17a(void)
+{
+    CU_ASSERT_EQUAL(err_small, PI_RMA_SIZE);
+    CU_ASSERT_EQUAL(err_null, PI_NULL_CHANNEL);
+}
+
+void test17b(void)
+{
+    int i, n, ok = 1;
+    double *buf = malloc(sizeof(double) * BIG);
+
+    if (buf == NULL) {
+        CU_FAIL_FATAL("Unable to allocate memory for test17b");
+    }
+
+    for (i = 0; i < ROUNDS; i++) {
+        fill(buf, i * 10.0);
+        PI_Write(to_rma, "%*lf", BIG, buf);
+        PI_Write(to_rma, "%d", i);
+        PI_Read(from_rma, "%*lf", BIG, buf);
+        PI_Read(from_rma, "%d", &n);
+        ok = ok && check(buf, i * 10.0 + 1) && n == i + 1;
+    }
+    CU_ASSERT(ok);
+    free(buf);
+}
+
+void test17c(void)
+{
+    int k, n, ok;
+    double *buf = malloc(sizeof(double) * BIG / 2);
+    int *ibuf = malloc(sizeof(int) * BIG);
+
+    if (buf == NULL || ibuf == NULL) {
+        CU_FAIL_FATAL("Unable to allocate memory for test17c");
+    }
+
+    for (k = 0; k < BIG; k++)
+        ibuf[k] = k;
+    for (k = 0; k < BIG / 2; k++)
+        buf[k] = k / 4.0;
+    PI_Write(to_rma, "%d %*d %*lf", 5, BIG, ibuf, BIG / 2, buf);
+
+    for (k = 0; k < BIG; k++)
+        ibuf[k] = buf[k / 2] = 0;
+    PI_Read(from_rma, "%*d %*lf %d", BIG, ibuf, BIG / 2, buf, &n);
+    CU_ASSERT_EQUAL(n, -5);
+    for (ok = 1, k = 0; k < BIG; k++)
+        if (ibuf[k] != k + 5) ok = 0;
+    for (k = 0; k < BIG / 2; k++)
+        if (buf[k] != k / 4.0) ok = 0;
+    CU_ASSERT(ok);
+    free(buf);
+    free(ibuf);
+}
+
+void test17d(void)
+{
+    int i, ok;
+    double *buf = malloc(sizeof(double) * BIG * NQUEUE);
+    PI_REQUEST *reqs[NQUEUE];
+
+    if (buf == NULL) {
+        CU_FAIL_FATAL("Unable to allocate memory for test17d");
+    }
+
+    /* only the first can go at once; the rest wait for the slot */
+    for (i = 0; i < NQUEUE; i++) {
+        fill(buf + i * BIG, i * 1000.0);
+        reqs[i] = PI_WriteAsync(to_rma, "%*lf", BIG, buf + i * BIG);
+        CU_ASSERT_PTR_NOT_NULL(reqs[i]);
+    }
+    PI_WaitAll(reqs, NQUEUE);
+    for (i = 0; i < NQUEUE; i++)
+        CU_ASSERT_PTR_NULL(reqs[i]);
+
+    PI_Read(from_rma, "%d", &ok);
+    CU_ASSERT(ok);
+    free(buf);
+}
+
+void test17e(void)
+{
+    int i, ok;
+    double *buf = malloc(sizeof(double) * BIG);
+    PI_REQUEST *r;
+
+    if (buf == NULL) {
+        CU_FAIL_FATAL("Unable to allocate memory for test17e");
+    }
+
+    r = PI_CreatePersistentWrite(to_rma, "%*lf", BIG, buf);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(r);
+    for (i = 0; i < ROUNDS; i++) {
+        fill(buf, -i);
+        PI_Start(r);
+        PI_Complete(r);
+    }
+    PI_Read(from_rma, "%d", &ok);
+    CU_ASSERT(ok);
+    free(buf);
+}
+
+void test17f(void)
+{
+    double *buf = malloc(sizeof(double) * BIG);
+
+    if (buf == NULL) {
+        CU_FAIL_FATAL("Unable to allocate memory for test17f");
+    }
+
+    while (!PI_ChannelHasData(from_rma))
+        ;
+    PI_Read(from_rma, "%*lf", BIG, buf);
+    CU_ASSERT(check(buf, 0.5));
+    free(buf);
+}
+
+void test17g(void)
+{
+    int i, n, q, seen = 0;
+    double *buf = malloc(sizeof(double) * BIG);
+
+    if (buf == NULL) {
+        CU_FAIL_FATAL("Unable to allocate memory for test17g");
+    }
+
+    for (i = 0; i < NSEL; i++) {
+        n = PI_Select(rma_sel);
+        CU_ASSERT(n >= 0 && n < NSEL);
+        if (n < 0 || n >= NSEL) break;
+        PI_Read(PI_GetBundleChannel(rma_sel, n), "%d %*lf", &q, BIG, buf);
+        CU_ASSERT_EQUAL(q, n);
+        CU_ASSERT(check(buf, n * 100.0));
+        seen |= 1 << n;
+    }
+    CU_ASSERT_EQUAL(seen, (1 << NSEL) - 1);
+    free(buf);
+}
+
+void test17h(void)
+{
+    int i, n, q, seen = 0;
+    double *buf = malloc(sizeof(double) * BIG);
+
+    if (buf == NULL) {
+        CU_FAIL_FATAL("Unable to allocate memory for test17h");
+    }
+
+    PI_GatherStream(rma_sel);
+    for (i = 0; i < NSEL; i++) {
+        PI_GatherNext(rma_sel, &n, "%d %*lf", &q, BIG, buf);
+        CU_ASSERT_EQUAL(q, n);
+        CU_ASSERT(check(buf, n * 100.0 + 1));
+        seen |= 1 << n;
+    }
+    CU_ASSERT_EQUAL(seen, (1 << NSEL) - 1);
+
+    PI_GatherStream(rma_sel);
+    for (i = 0; i < NSEL; i++) {
+        PI_GatherNext(rma_sel, &n, "%d", &q);
+        CU_ASSERT_EQUAL(q, n);
+    }
+    free(buf);
+}
+
+static int init(void)
+{
+    int argc = default_argc;
+    char **argv = default_argv;
+    int i;
+    PI_PROCESS *echo, *w;
+    PI_QuietMode = 1;
+    PI_OnErrorReturn = 1;
+
+    PI_Configure(&argc, &argv);
+
+    echo = PI_CreateProcess(rma_echo, 0, NULL);
+    to_rma = PI_CreateChannel(PI_MAIN, echo);
+    from_rma = PI_CreateChannel(echo, PI_MAIN);
+    for (i = 0; i < NSEL; i++) {
+        w = PI_CreateProcess(rma_sel_worker, i, NULL);
+        sel_chan[i] = PI_CreateChannel(w, PI_MAIN);
+        PI_SetRMA(sel_chan[i], SLOT);
+    }
+    rma_sel = PI_CreateBundle(PI_SELECT, sel_chan, NSEL);
+
+    PI_Errno = 0;
+    PI_SetRMA(to_rma, PI_RMA_MIN - 1);
+    err_small = PI_Errno;
+    PI_Errno = 0;
+    PI_SetRMA(NULL, SLOT);
+    err_null = PI_Errno;
+    PI_Errno = 0;
+
+    PI_SetRMA(to_rma, SLOT);
+    PI_SetRMA(from_rma, SLOT);
+
+    PI_StartAll();
+    return 0;
+}
+
+static int cleanup(void)
+{
+    if (PI_GetMyRank() == 0)
+        PI_StopMain(0);
+    return 0;
+}
+
+CU_ErrorCode AddRmaSuite(void)
+{
+    CU_pSuite suite = CU_add_suite("RMA Channel Tests", init, cleanup);
+    if (suite == NULL)
+        return CU_get_error();
+
+    AddTest(suite, "slot size errors", test17a);
+    AddTest(suite, "large and small echoes", test17b);
+    AddTest(suite, "several items through slot", test17c);
+    AddTest(suite, "queued async writes and reads", test17d);
+    AddTest(suite, "persistent writes and reads", test17e);
+    AddTest(suite, "has data waiting in slot", test17f);
+    AddTest(suite, "select from slotted channels", test17g);
+    AddTest(suite, "streaming gather from slotted channels", test17h);
+
+    return CUE_SUCCESS;
+}
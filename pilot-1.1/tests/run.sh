@@ -1,2 +1,7 @@
 #!/bin/bash
-mpirun -np 8 ./test_suite
+# Set NOMPI=1 to run a test_suite built against 'make nompi', without mpirun.
+if [[ "$NOMPI" ]]; then
+    ./test_suite -np 8
+else
+    mpirun -np 8 ./test_suite
+fi
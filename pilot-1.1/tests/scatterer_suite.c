@@ -0,0 +1,155 @@
+/*
+Tests for PI_Scatter.
+
+Tests that:
+ - each of 4 processes receives its own slice of an array.
+ - scattering several items in one call gives each process its slice of each.
+ - PI_Scatter and PI_Broadcast refuse each other's bundles.
+*/
+#include "unittests.h"
+
+#define NSCATTER 4
+#define BIGLEN 2000
+
+PI_PROCESS *test13_procs[NSCATTER];
+PI_CHANNEL *to_test13[NSCATTER];
+PI_CHANNEL *from_test13[NSCATTER];
+PI_BUNDLE *test13_bundle;
+PI_BUNDLE *test13_broadcaster;
+
+int scatter_read(int q, void *p)
+{
+    int v[3], n, i, ok;
+    char c;
+    double d[2];
+    int big[BIGLEN];
+
+    /* test13a: echo back the sum of our slice */
+    PI_Read(to_test13[q], "%3d", v);
+    PI_Write(from_test13[q], "%d", v[0] + v[1] + v[2]);
+
+    /* test13b: small items, then large enough not to fit PI_PACK_MAX */
+    PI_Read(to_test13[q], "%c %d %2lf", &c, &n, d);
+    PI_Write(from_test13[q], "%c %d %lf", c, n, d[0] + d[1]);
+    PI_Read(to_test13[q], "%d %*d", &n, BIGLEN, big);
+    for (ok = 1, i = 0; i < BIGLEN; i++)
+        if (big[i] != q * 10000 + i) ok = 0;
+    PI_Write(from_test13[q], "%d %d", n, ok);
+    return 0;
+}
+
+void test13a(void)
+{
+    int v[3 * NSCATTER];
+    int i, sum;
+
+    for (i = 0; i < 3 * NSCATTER; i++)
+        v[i] = i;
+    PI_Scatter(test13_bundle, "%3d", v);
+
+    /* process q gets 3q, 3q+1, 3q+2 */
+    for (i = 0; i < NSCATTER; i++) {
+        PI_Read(from_test13[i], "%d", &sum);
+        CU_ASSERT_EQUAL(sum, 9 * i + 3);
+    }
+}
+
+void test13b(void)
+{
+    char cc[NSCATTER];
+    int ii[NSCATTER];
+    double dd[2 * NSCATTER];
+    int *big = malloc(sizeof(int) * NSCATTER * BIGLEN);
+    int i, q, n, ok;
+    char c;
+    double d;
+
+    if (big == NULL) {
+        CU_FAIL_FATAL("Unable to allocate memory for test13b");
+    }
+
+    for (q = 0; q < NSCATTER; q++) {
+        cc[q] = 'A' + q;
+        ii[q] = q * 3;
+        dd[2*q] = 0.5 * q;
+        dd[2*q+1] = 1.5 * q;
+        for (i = 0; i < BIGLEN; i++)
+            big[q * BIGLEN + i] = q * 10000 + i;
+    }
+
+    PI_Scatter(test13_bundle, "%c %d %2lf", cc, ii, dd);
+    for (q = 0; q < NSCATTER; q++) {
+        PI_Read(from_test13[q], "%c %d %lf", &c, &n, &d);
+        CU_ASSERT_EQUAL(c, 'A' + q);
+        CU_ASSERT_EQUAL(n, q * 3);
+        CU_ASSERT_DOUBLE_EQUAL(d, 2.0 * q, 0.00001);
+    }
+
+    PI_Scatter(test13_bundle, "%d %*d", ii, BIGLEN, big);
+    for (q = 0; q < NSCATTER; q++) {
+        PI_Read(from_test13[q], "%d %d", &n, &ok);
+        CU_ASSERT_EQUAL(n, q * 3);
+        CU_ASSERT(ok);
+    }
+    free(big);
+}
+
+void test13c(void)
+{
+    int v[NSCATTER];
+
+    PI_Errno = 0;
+    PI_Scatter(test13_broadcaster, "%d", v);
+    CU_ASSERT_EQUAL(PI_Errno, PI_BUNDLE_USAGE);
+
+    PI_Errno = 0;
+    PI_Broadcast(test13_bundle, "%d", v[0]);
+    CU_ASSERT_EQUAL(PI_Errno, PI_BUNDLE_USAGE);
+    PI_Errno = 0;
+}
+
+static int init(void)
+{
+    int argc = default_argc;
+    char** argv = default_argv;
+    int i;
+    PI_CHANNEL **copies;
+    PI_QuietMode = 1;
+    PI_OnErrorReturn = 1;
+
+    PI_Configure(&argc, &argv);
+
+    for (i = 0; i < NSCATTER; i++) {
+        test13_procs[i] = CreateAliasedProcess(scatter_read, "test13", i, NULL);
+        to_test13[i] = PI_CreateChannel(PI_MAIN, test13_procs[i]);
+        from_test13[i] = PI_CreateChannel(test13_procs[i], PI_MAIN);
+    }
+    test13_bundle = PI_CreateBundle(PI_SCATTER, to_test13, NSCATTER);
+
+    copies = PI_CopyChannels(PI_SAME, to_test13, NSCATTER);
+    test13_broadcaster = PI_CreateBundle(PI_BROADCAST, copies, NSCATTER);
+    free(copies);
+
+    PI_StartAll();
+    return 0;
+}
+
+static int cleanup(void)
+{
+    if (PI_GetMyRank() == 0)
+        PI_StopMain(0);
+    return 0;
+}
+
+CU_ErrorCode AddScattererSuite(void)
+{
+    CU_pSuite suite = CU_add_suite("Scatterer Tests", init, cleanup);
+    if (suite == NULL)
+        return CU_get_error();
+
+    AddTest(suite, "scatter slices", test13a);
+    AddTest(suite, "scatter several items", test13b);
+    AddTest(suite, "scatterer errors", test13c);
+
+    return CUE_SUCCESS;
+}
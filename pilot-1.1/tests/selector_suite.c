@@ -2,18 +2,77 @@
 Unit tests for PI_Select. Tests that PI_Select works with at least 3 processes.
 */
 #include "unittests.h"
+#include <stdio.h>
+#include <string.h>
 
 PI_PROCESS *test5_1, *test5_2, *test5_3;
 PI_CHANNEL *from_test5[3];
 PI_BUNDLE *test5_selector;
 
+/* copies of from_test5 for the fairness policies */
+PI_CHANNEL **test5_rr, **test5_prio, **test5_done;
+PI_CHANNEL **test5_stream;	/* copies for PI_GatherStream */
+PI_BUNDLE *test5_stream_selector;
+
+/* buffered channels of capacity 1, streamed more times than that */
+#define BUF_ROUNDS 3
+PI_CHANNEL *test5_buf[3];
+PI_BUNDLE *test5_buf_selector;
+
+#define MANY_BUNDLES 40		/* more than the bundle table starts with */
+PI_BUNDLE *test5_many[MANY_BUNDLES];
+PI_BUNDLE *test5_rr_selector, *test5_prio_selector;
+int test5_zero_errno, test5_null_errno, test5_config_size;
+
+/* made with PI_CreateProcessArray/PI_CreateChannelArray */
+#define BULK_PROCS 2
+PI_PROCESS **test5_bulk_procs;
+PI_CHANNEL **test5_bulk;
+PI_BUNDLE *test5_bulk_selector;
+int test5_dup_errno, test5_ends_errno, test5_procs_errno;
+PI_CHANNEL *test5_before, *test5_after;
+
+/* enough channels in between that later ones use another communicator */
+#define SPAN_CHANNELS 1100
+PI_CHANNEL *test5_near[3], **test5_far, **test5_span;
+PI_BUNDLE *test5_span_selector;
+
+#define POLICY_MSGS 4
+
 int select_write(int q, void *p) {
 
-    int a;
+    int a, i;
 
     a = 78;
 
     PI_Write(from_test5[q],"%d",a);
+
+    for (i = 0; i < POLICY_MSGS; i++)
+        PI_Write(test5_rr[q],"%d",q);
+    for (i = 0; i < POLICY_MSGS; i++)
+        PI_Write(test5_prio[q],"%d",q);
+    PI_Write(test5_done[q],"%d",a);
+
+    /* two streams: small items, then a large array */
+    {
+        int big[3000];
+        for (i = 0; i < 3000; i++)
+            big[i] = q * 10000 + i;
+        PI_Write(test5_stream[q],"%d %lf",q,0.5*q);
+        PI_Write(test5_stream[q],"%d %3000d",q,big);
+    }
+    for (i = 0; i < BUF_ROUNDS; i++)
+        PI_Write(test5_buf[q],"%d",10*i+q);
+
+    /* channels far apart, on their own and in a selector */
+    PI_Write(test5_far[q],"%d",q);
+    PI_Write(test5_span[q],"%d",q);
+    return 0;
+}
+
+int bulk_write(int q, void *p) {
+
+    PI_Write(test5_bulk[q],"%d",10*q);
     return 0;
 }
 
@@ -32,10 +91,194 @@ void test5(void) {
     }
 }
 
+/* wait till every writer has sent everything, so all channels have data */
+static void test5_wait_done(void) {
+
+    static int done = 0;
+    int i, r;
+
+    if (done) return;
+    for (i = 0; i < 3; i++)
+        PI_Read(test5_done[i],"%d",&r);
+    done = 1;
+}
+
+void test5b(void) {
+
+    int i, s, r;
+
+    test5_wait_done();
+
+    /* every channel has data, so round-robin visits them in turn */
+    for (i = 0; i < 3*POLICY_MSGS; i++) {
+        s = PI_Select(test5_rr_selector);
+        CU_ASSERT_EQUAL(s, i%3);
+        PI_Read(PI_GetBundleChannel(test5_rr_selector,s),"%d",&r);
+        CU_ASSERT_EQUAL(r, s);
+    }
+    CU_ASSERT_EQUAL(PI_TrySelect(test5_rr_selector), -1);
+}
+
+void test5c(void) {
+
+    int i, s, r;
+    int picks[3] = {0, 0, 0};
+
+    test5_wait_done();
+
+    /* weights {2,1,0}: the first picks favour channel 0, and channel 2 is
+       only chosen once channels 0 and 1 are empty */
+    for (i = 0; i < 3*POLICY_MSGS; i++) {
+        s = PI_Select(test5_prio_selector);
+        PI_Read(PI_GetBundleChannel(test5_prio_selector,s),"%d",&r);
+        CU_ASSERT_EQUAL(r, s);
+        picks[s]++;
+        if (i == 2) {
+            CU_ASSERT_EQUAL(picks[0], 2);
+            CU_ASSERT_EQUAL(picks[1], 1);
+        }
+        if (s == 2) {
+            CU_ASSERT_EQUAL(picks[0], POLICY_MSGS);
+            CU_ASSERT_EQUAL(picks[1], POLICY_MSGS);
+        }
+    }
+    CU_ASSERT_EQUAL(PI_TrySelect(test5_prio_selector), -1);
+}
+
+void test5d(void) {
+
+    int weights[3] = {1, 1, 1};
+
+    /* bad weights were rejected during configuration */
+    CU_ASSERT_EQUAL(test5_zero_errno, PI_SELECT_POLICY);
+    CU_ASSERT_EQUAL(test5_null_errno, PI_SELECT_POLICY);
+
+    /* the size, for one weight per channel, was known while configuring */
+    CU_ASSERT_EQUAL(test5_config_size, 3);
+
+    /* policy can only be set while configuring */
+    PI_Errno = 0;
+    PI_SetSelectPolicy(test5_selector, PI_SELECT_PRIORITY, weights);
+    CU_ASSERT_EQUAL(PI_Errno, PI_WRONG_PHASE);
+    PI_Errno = 0;
+}
+
+void test5e(void) {
+
+    int i, k, q, left, index, ok;
+    int seen[3] = {0, 0, 0};
+    double d;
+    int *big = malloc(sizeof(int) * 3000);
+
+    if (big == NULL) {
+        CU_FAIL_FATAL("Unable to allocate memory for test5e");
+    }
+
+    /* each channel's contribution comes back exactly once */
+    PI_GatherStream(test5_stream_selector);
+    for (i = 0; i < 3; i++) {
+        left = PI_GatherNext(test5_stream_selector, &index, "%d %lf", &q, &d);
+        CU_ASSERT_EQUAL(left, 2 - i);
+        CU_ASSERT_EQUAL(q, index);
+        CU_ASSERT_DOUBLE_EQUAL(d, 0.5 * index, 0.00001);
+        seen[index]++;
+    }
+    CU_ASSERT(seen[0] == 1 && seen[1] == 1 && seen[2] == 1);
+
+    /* the stream is finished */
+    PI_Errno = 0;
+    PI_GatherNext(test5_stream_selector, &index, "%d %lf", &q, &d);
+    CU_ASSERT_EQUAL(PI_Errno, PI_REQUEST_STATE);
+    PI_Errno = 0;
+
+    /* a second stream, of messages larger than PI_PACK_MAX */
+    PI_GatherStream(test5_stream_selector);
+    for (i = 0; i < 3; i++) {
+        PI_GatherNext(test5_stream_selector, &index, "%d %3000d", &q, big);
+        CU_ASSERT_EQUAL(q, index);
+        for (ok = 1, left = 0; left < 3000; left++)
+            if (big[left] != index * 10000 + left) ok = 0;
+        CU_ASSERT(ok);
+    }
+    free(big);
+
+    /* each stream's reads return credits, so writers can go on */
+    for (k = 0; k < BUF_ROUNDS; k++) {
+        PI_GatherStream(test5_buf_selector);
+        for (i = 0; i < 3; i++) {
+            PI_GatherNext(test5_buf_selector, &index, "%d", &q);
+            CU_ASSERT_EQUAL(q, 10*k+index);
+        }
+    }
+}
+
+void test5f(void) {
+
+    int k, first;
+    char name[PI_MAX_NAMELEN];
+
+    /* bundles made after the table grew keep consecutive IDs */
+    CU_ASSERT_EQUAL(sscanf(PI_GetName(test5_many[0]), "B%d@P0", &first), 1);
+    for (k = 0; k < MANY_BUNDLES; k++) {
+        CU_ASSERT_EQUAL(PI_GetBundleSize(test5_many[k]), 3);
+        sprintf(name, "B%d@P0", first + k);
+        CU_ASSERT_STRING_EQUAL(PI_GetName(test5_many[k]), name);
+    }
+
+    /* earlier bundles are still intact */
+    CU_ASSERT_STRING_EQUAL(PI_GetName(test5_selector), "test5 selector");
+}
+
+void test5g(void) {
+
+    int i, k, r, before, after, seen = 0;
+
+    /* each process of the array got its own index */
+    CU_ASSERT_PTR_NOT_NULL_FATAL(test5_bulk_selector);
+    for (i = 0; i < BULK_PROCS; i++) {
+        k = PI_Select(test5_bulk_selector);
+        PI_Read(PI_GetBundleChannel(test5_bulk_selector,k),"%d",&r);
+        CU_ASSERT_EQUAL(r,10*k);
+        seen |= 1 << k;
+    }
+    CU_ASSERT_EQUAL(seen,(1 << BULK_PROCS) - 1);
+
+    /* a rim process repeated at index 0 is caught */
+    CU_ASSERT_EQUAL(test5_dup_errno,PI_BUNDLE_DUPLICATE);
+
+    /* failed calls created nothing, so channel IDs carry on */
+    CU_ASSERT_EQUAL(test5_ends_errno,PI_ENDPOINT_DUPLICATE);
+    CU_ASSERT_EQUAL(test5_procs_errno,PI_INSUFFICIENT_MPIPROCS);
+    CU_ASSERT_EQUAL(sscanf(PI_GetName(test5_before),"C%d",&before),1);
+    CU_ASSERT_EQUAL(sscanf(PI_GetName(test5_after),"C%d",&after),1);
+    CU_ASSERT_EQUAL(after,before+1);
+}
+
+void test5h(void) {
+
+    int i, k, r, seen = 0;
+
+    for (i = 0; i < 3; i++) {
+        PI_Read(test5_far[i],"%d",&r);
+        CU_ASSERT_EQUAL(r,i);
+    }
+
+    /* the selector's channels come from either side of the filler */
+    for (i = 0; i < 3; i++) {
+        k = PI_Select(test5_span_selector);
+        PI_Read(PI_GetBundleChannel(test5_span_selector,k),"%d",&r);
+        CU_ASSERT_EQUAL(r,k);
+        seen |= 1 << k;
+    }
+    CU_ASSERT_EQUAL(seen,7);
+    CU_ASSERT_EQUAL(PI_TrySelect(test5_span_selector),-1);
+}
+
 static int init(void)
 {
     int argc = default_argc;
     char** argv = default_argv;
+    int i;
     PI_QuietMode = 1;
     PI_OnErrorReturn = 1;
 
@@ -52,6 +295,85 @@ static int init(void)
     test5_selector = PI_CreateBundle(PI_SELECT, from_test5, 3);
     PI_SetName(test5_selector, "test5 selector");
 
+    test5_rr = PI_CopyChannels(PI_SAME, from_test5, 3);
+    test5_prio = PI_CopyChannels(PI_SAME, from_test5, 3);
+    test5_done = PI_CopyChannels(PI_SAME, from_test5, 3);
+
+    for (i = 0; i < MANY_BUNDLES; i++) {
+        PI_CHANNEL **copies = PI_CopyChannels(PI_SAME, from_test5, 3);
+        test5_many[i] = PI_CreateBundle(PI_SELECT, copies, 3);
+        free(copies);
+    }
+
+    test5_stream = PI_CopyChannels(PI_SAME, from_test5, 3);
+
+    test5_near[0] = PI_CreateChannel(test5_1,PI_MAIN);
+    {
+        PI_PROCESS *filler[SPAN_CHANNELS];
+        for (i = 0; i < SPAN_CHANNELS; i++)
+            filler[i] = test5_2;
+        free(PI_CreateChannelArray(filler, NULL, SPAN_CHANNELS));
+    }
+    test5_far = PI_CopyChannels(PI_SAME, from_test5, 3);
+    test5_span = PI_CopyChannels(PI_SAME, from_test5, 3);
+    test5_near[1] = test5_span[1];
+    test5_near[2] = test5_span[2];
+    free(test5_span);
+    test5_span = test5_near;
+    test5_span_selector = PI_CreateBundle(PI_SELECT, test5_span, 3);
+    test5_stream_selector = PI_CreateBundle(PI_SELECT, test5_stream, 3);
+
+    test5_buf[0] = PI_CreateBufferedChannel(test5_1,PI_MAIN,1);
+    test5_buf[1] = PI_CreateBufferedChannel(test5_2,PI_MAIN,1);
+    test5_buf[2] = PI_CreateBufferedChannel(test5_3,PI_MAIN,1);
+    test5_buf_selector = PI_CreateBundle(PI_SELECT, test5_buf, 3);
+
+    test5_rr_selector = PI_CreateBundle(PI_SELECT, test5_rr, 3);
+    PI_SetSelectPolicy(test5_rr_selector, PI_SELECT_ROUND_ROBIN, NULL);
+
+    test5_prio_selector = PI_CreateBundle(PI_SELECT, test5_prio, 3);
+    {
+        int zeros[3] = {0, 0, 0};
+        int weights[3] = {2, 1, 0};
+
+        PI_Errno = 0;
+        PI_SetSelectPolicy(test5_prio_selector, PI_SELECT_PRIORITY, zeros);
+        test5_zero_errno = PI_Errno;
+        PI_Errno = 0;
+        PI_SetSelectPolicy(test5_prio_selector, PI_SELECT_PRIORITY, NULL);
+        test5_null_errno = PI_Errno;
+        PI_Errno = 0;
+        PI_SetSelectPolicy(test5_prio_selector, PI_SELECT_PRIORITY, weights);
+        test5_config_size = PI_GetBundleSize(test5_prio_selector);
+    }
+
+    test5_bulk_procs = PI_CreateProcessArray(bulk_write, BULK_PROCS, NULL);
+    test5_bulk = PI_CreateChannelArray(test5_bulk_procs, NULL, BULK_PROCS);
+    test5_bulk_selector = PI_CreateBundle(PI_SELECT, test5_bulk, BULK_PROCS);
+    {
+        PI_PROCESS *rim[3] = {test5_1, test5_2, test5_1};
+        PI_PROCESS *last_bad[2] = {test5_2, PI_MAIN};	/* PI_MAIN>PI_MAIN */
+        PI_CHANNEL **dups = PI_CreateChannelArray(rim, NULL, 3);
+
+        PI_Errno = 0;
+        PI_CreateBundle(PI_SELECT, dups, 3);
+        test5_dup_errno = PI_Errno;
+        PI_Errno = 0;
+        free(dups);
+
+        test5_before = PI_CreateChannel(PI_MAIN, test5_1);
+
+        PI_Errno = 0;
+        PI_CreateChannelArray(last_bad, NULL, 2);
+        test5_ends_errno = PI_Errno;
+        PI_Errno = 0;
+        PI_CreateProcessArray(bulk_write, 1000, NULL);
+        test5_procs_errno = PI_Errno;
+        PI_Errno = 0;
+
+        test5_after = PI_CreateChannel(PI_MAIN, test5_1);
+    }
+
     PI_StartAll();
     return 0;
 }
@@ -70,6 +392,13 @@ CU_ErrorCode AddSelectorSuite(void)
         return CU_get_error();
 
     AddTest(suite, "selector tests", test5);
+    AddTest(suite, "round-robin selector", test5b);
+    AddTest(suite, "priority selector", test5c);
+    AddTest(suite, "select policy errors", test5d);
+    AddTest(suite, "streaming gather", test5e);
+    AddTest(suite, "many bundles", test5f);
+    AddTest(suite, "bulk creation and duplicates", test5g);
+    AddTest(suite, "channels on several communicators", test5h);
 
     return CUE_SUCCESS;
 }
@@ -0,0 +1,199 @@
+/*
+Tests for channels between processes on the same node, which go through
+shared memory rings (all the processes are on one node when the suite is run
+with mpirun on one machine).
+
+Tests that:
+ - a long stream of small and large messages arrives whole and in order,
+   though it overfills the ring and the large ones go by MPI.
+ - non-blocking reads queued on a ring, and PI_ChannelHasData, see the
+   messages in order.
+ - a small write returns at once with -pishm=1 (the default), but waits for
+   the reader with -pishm=2.
+The same tests are run once in each mode.
+*/
+#include "unittests.h"
+#include <unistd.h>
+
+#define NSTREAM 300
+#define SMALLLEN 100
+#define BIGLEN 5000	/* 20000 bytes, more than PI_SHM_LARGE */
+#define SHM_DELAY 0.3	/* seconds main waits before reading */
+
+PI_PROCESS *shm_proc;
+PI_CHANNEL *to_shm, *from_shm;
+int shm_sync;		/* non-0 when running with -pishm=2 */
+
+static int shm_len(int i)
+{
+    return i % 10 == 9 ? BIGLEN : SMALLLEN;
+}
+
+int shm_worker(int q, void *p)
+{
+    int i, k, go;
+    int *buf = malloc(sizeof(int) * BIGLEN);
+    double t;
+    PI_REQUEST *r;
+
+    if (buf == NULL)
+        return -1;
+
+    /* test14a: every tenth message is large */
+    for (i = 0; i < NSTREAM; i++) {
+        for (k = 0; k < shm_len(i); k++)
+            buf[k] = i * 7 + k;
+        PI_Write(from_shm, "%d %*d", i, shm_len(i), buf);
+    }
+
+    /* test14b: two for queued reads, one large, one for PI_ChannelHasData */
+    PI_Read(to_shm, "%d", &go);
+    PI_Write(from_shm, "%d", 1);
+    PI_Write(from_shm, "%d", 2);
+    for (k = 0; k < BIGLEN; k++)
+        buf[k] = -k;
+    r = PI_WriteAsync(from_shm, "%*d", BIGLEN, buf);
+    PI_Wait(&r);
+    PI_Write(from_shm, "%d", 3);
+
+    /* test14c: how long does a small write take if main is not reading? */
+    PI_Read(to_shm, "%d", &go);
+    t = MPI_Wtime();
+    PI_Write(from_shm, "%d", 4);
+    t = MPI_Wtime() - t;
+    PI_Write(from_shm, "%lf", t);
+
+    free(buf);
+    return 0;
+}
+
+void test14a(void)
+{
+    int i, k, n, ok;
+    int *buf = malloc(sizeof(int) * BIGLEN);
+
+    if (buf == NULL) {
+        CU_FAIL_FATAL("Unable to allocate memory for test14a");
+    }
+
+    /* let the worker fill the ring first */
+    usleep(100000);
+    for (ok = 1, i = 0; i < NSTREAM; i++) {
+        PI_Read(from_shm, "%d %*d", &n, shm_len(i), buf);
+        if (n != i) ok = 0;
+        for (k = 0; k < shm_len(i); k++)
+            if (buf[k] != i * 7 + k) ok = 0;
+    }
+    CU_ASSERT(ok);
+    free(buf);
+}
+
+void test14b(void)
+{
+    int a = 0, b = 0, c = 0, k, ok, tries;
+    int *big = malloc(sizeof(int) * BIGLEN);
+    PI_REQUEST *reqs[2];
+
+    if (big == NULL) {
+        CU_FAIL_FATAL("Unable to allocate memory for test14b");
+    }
+
+    /* the worker is waiting for us, so nothing can arrive yet */
+    CU_ASSERT_FALSE(PI_ChannelHasData(from_shm));
+    reqs[0] = PI_ReadAsync(from_shm, "%d", &a);
+    reqs[1] = PI_ReadAsync(from_shm, "%d", &b);
+    CU_ASSERT_FALSE(PI_Test(&reqs[0]));
+
+    PI_Write(to_shm, "%d", 1);
+    PI_WaitAll(reqs, 2);
+    CU_ASSERT_EQUAL(a, 1);
+    CU_ASSERT_EQUAL(b, 2);
+
+    PI_Read(from_shm, "%*d", BIGLEN, big);
+    for (ok = 1, k = 0; k < BIGLEN; k++)
+        if (big[k] != -k) ok = 0;
+    CU_ASSERT(ok);
+
+    for (tries = 0; !PI_ChannelHasData(from_shm) && tries < 5000; tries++)
+        usleep(1000);
+    CU_ASSERT(PI_ChannelHasData(from_shm));
+    PI_Read(from_shm, "%d", &c);
+    CU_ASSERT_EQUAL(c, 3);
+    free(big);
+}
+
+void test14c(void)
+{
+    int n;
+    double t;
+
+    PI_Write(to_shm, "%d", 1);
+    usleep(SHM_DELAY * 1e6);
+    PI_Read(from_shm, "%d", &n);
+    PI_Read(from_shm, "%lf", &t);
+    CU_ASSERT_EQUAL(n, 4);
+    if (shm_sync) {
+        CU_ASSERT(t >= SHM_DELAY * 0.8);
+    }
+    else {
+        CU_ASSERT(t < SHM_DELAY * 0.5);
+    }
+}
+
+static int init_mode(char *mode)
+{
+    char *args[] = { default_argv[0], mode };
+    int argc = 2;
+    char **argv = args;
+    PI_QuietMode = 1;
+    PI_OnErrorReturn = 1;
+
+    PI_Configure(&argc, &argv);
+
+    shm_proc = CreateAliasedProcess(shm_worker, "shm", 0, NULL);
+    to_shm = PI_CreateChannel(PI_MAIN, shm_proc);
+    from_shm = PI_CreateChannel(shm_proc, PI_MAIN);
+
+    PI_StartAll();
+    return 0;
+}
+
+static int init(void)
+{
+    shm_sync = 0;
+    return init_mode("-pishm=1");
+}
+
+static int init_sync(void)
+{
+    shm_sync = 1;
+    return init_mode("-pishm=2");
+}
+
+static int cleanup(void)
+{
+    if (PI_GetMyRank() == 0)
+        PI_StopMain(0);
+    return 0;
+}
+
+CU_ErrorCode AddShmSuite(void)
+{
+    CU_pSuite suite = CU_add_suite("Shared Memory Tests", init, cleanup);
+    if (suite == NULL)
+        return CU_get_error();
+
+    AddTest(suite, "stream through ring", test14a);
+    AddTest(suite, "non-blocking reads on ring", test14b);
+    AddTest(suite, "buffered write", test14c);
+
+    suite = CU_add_suite("Synchronous Shared Memory Tests", init_sync, cleanup);
+    if (suite == NULL)
+        return CU_get_error();
+
+    AddTest(suite, "stream through ring", test14a);
+    AddTest(suite, "non-blocking reads on ring", test14b);
+    AddTest(suite, "synchronous write", test14c);
+
+    return CUE_SUCCESS;
+}
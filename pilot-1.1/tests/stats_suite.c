@@ -0,0 +1,212 @@
+/*
+Tests for the statistics made by -pisvc=s, which each MPI process counts for
+itself and the online process adds up and reports at PI_StopMain.
+
+Tests that:
+ - PI_GetStats gives a process's own counts while running, and fails on a
+   NULL PI_STATS.
+ - the writes and reads of a channel are counted at their own ends, with the
+   bytes of user data they carried, including non-blocking calls, whose
+   time blocked in PI_WaitAll and PI_WaitAny is counted too.
+ - the selects on a bundle, and a broadcast, are counted at the hub.
+ - a read that has to wait for its message is timed, and stands out in the
+   percentiles of the channel's reads.
+*/
+#include "unittests.h"
+#include <stdio.h>
+#include <string.h>
+
+#define ROUNDS 20
+#define LEN 100
+#define REPORT "stats_suite.log.json"
+#define DELAY 0.05		/* seconds the worker waits before its last write */
+
+/* IDs given in order of creation by init */
+#define TO_MAIN 1
+#define ASIDE 3
+#define SEL 1
+#define BRO 2
+
+static PI_CHANNEL *to_main, *from_main, *aside;
+static PI_BUNDLE *sel, *bro;
+static int running;
+
+/* Keeps the caller busy for DELAY seconds. */
+static void Spin(void)
+{
+    double start = MPI_Wtime();
+    while (MPI_Wtime() - start < DELAY)
+        ;
+}
+
+int stats_worker(int q, void *p)
+{
+    int i, n;
+    double a[LEN];
+    PI_REQUEST *r;
+
+    PI_Read(from_main, "%d", &n);
+    for (i = 0; i < ROUNDS; i++)
+        PI_Write(to_main, "%d", i);
+    for (i = 0; i < LEN; i++)
+        a[i] = i;
+
+    /* main waits for each of these */
+    for (i = 0; i < 2; i++) {
+        Spin();
+        r = PI_WriteAsync(aside, "%*lf", LEN, a);
+        PI_Wait(&r);
+    }
+    Spin();
+    PI_Write(to_main, "%d", -1);
+    return 0;
+}
+
+/* Finds in report the object for channel or bundle "id": id, then the calls,
+   bytes, wait and p999 of its counter named key. */
+static int Find(const char *report, int id, const char *key, long *calls,
+                long *bytes, double *wait, double *p999)
+{
+    char pattern[40];
+    const char *at;
+
+    sprintf(pattern, "{\"id\": %d,", id);
+    if ((at = strstr(report, pattern)) == NULL) return 0;
+    sprintf(pattern, "\"%s\": ", key);
+    if ((at = strstr(at, pattern)) == NULL) return 0;
+    return sscanf(at + strlen(pattern), "{\"calls\": %ld, \"bytes\": %ld, "
+                  "\"wait\": %lf, \"p50\": %*f, \"p99\": %*f, \"p999\": %lf",
+                  calls, bytes, wait, p999) == 4;
+}
+
+void test20a(void)
+{
+    int i, n;
+    double a[LEN];
+    PI_STATS st;
+    PI_REQUEST *r;
+
+    PI_Broadcast(bro, "%d", 1);
+    for (i = 0; i < ROUNDS; i++) {
+        PI_Select(sel);
+        PI_Read(to_main, "%d", &n);
+    }
+    r = PI_ReadAsync(aside, "%*lf", LEN, a);
+    PI_WaitAll(&r, 1);
+    r = PI_ReadAsync(aside, "%*lf", LEN, a);
+    PI_WaitAny(&r, 1);
+    PI_Read(to_main, "%d", &n);		// waits DELAY for this
+
+    PI_GetStats(aside, &st);		// the waits of PI_WaitAll/Any count
+    CU_ASSERT_EQUAL(st.calls, 2);
+    CU_ASSERT(st.wait >= DELAY);
+
+    PI_GetStats(to_main, &st);
+    CU_ASSERT_EQUAL(st.calls, ROUNDS + 1);
+    CU_ASSERT_EQUAL(st.bytes, (ROUNDS + 1) * sizeof(int));
+    CU_ASSERT(st.wait >= DELAY / 2);	// main starts reading a little late
+    CU_ASSERT(st.p50 <= st.p99 && st.p99 <= st.p999);
+    CU_ASSERT(st.p999 >= DELAY / 2);	// the slowest is the one read late
+    CU_ASSERT(st.p50 < DELAY / 2);
+
+    PI_GetStats(sel, &st);
+    CU_ASSERT_EQUAL(st.calls, ROUNDS);
+    CU_ASSERT_EQUAL(st.bytes, 0);
+
+    PI_GetStats(from_main, &st);		// main's writes: only the broadcast
+    CU_ASSERT_EQUAL(st.calls, 0);
+
+    PI_Errno = 0;
+    PI_GetStats(to_main, NULL);
+    CU_ASSERT_EQUAL(PI_Errno, PI_NULL_STATS);
+}
+
+void test20b(void)
+{
+    long calls, bytes, size;
+    double wait, p999;
+    char report[16384];
+    FILE *f;
+
+    /* the report is only made once everyone has finished */
+    PI_StopMain(0);
+    running = 0;
+
+    f = fopen(REPORT, "r");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(f);
+    size = fread(report, 1, sizeof(report) - 1, f);
+    report[size] = '\0';
+    fclose(f);
+    remove(REPORT);
+    remove("stats_suite.log");
+
+    size = (ROUNDS + 1) * sizeof(int);
+    CU_ASSERT(Find(report, TO_MAIN, "writes", &calls, &bytes, &wait, &p999));
+    CU_ASSERT_EQUAL(calls, ROUNDS + 1);
+    CU_ASSERT_EQUAL(bytes, size);
+    CU_ASSERT(Find(report, TO_MAIN, "reads", &calls, &bytes, &wait, &p999));
+    CU_ASSERT_EQUAL(calls, ROUNDS + 1);
+    CU_ASSERT_EQUAL(bytes, size);
+    CU_ASSERT(wait >= DELAY / 2);
+    CU_ASSERT(p999 >= DELAY / 2);
+
+    size = 2 * LEN * sizeof(double);
+    CU_ASSERT(Find(report, ASIDE, "writes", &calls, &bytes, &wait, &p999));
+    CU_ASSERT_EQUAL(calls, 2);
+    CU_ASSERT_EQUAL(bytes, size);
+    CU_ASSERT(Find(report, ASIDE, "reads", &calls, &bytes, &wait, &p999));
+    CU_ASSERT_EQUAL(calls, 2);
+    CU_ASSERT_EQUAL(bytes, size);
+    CU_ASSERT(wait >= DELAY);
+
+    /* bundles are listed after the channels, so look from there */
+    char *bundles = strstr(report, "\"bundles\"");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(bundles);
+    CU_ASSERT(Find(bundles, SEL, "ops", &calls, &bytes, &wait, &p999));
+    CU_ASSERT_EQUAL(calls, ROUNDS);
+    CU_ASSERT(Find(bundles, BRO, "ops", &calls, &bytes, &wait, &p999));
+    CU_ASSERT_EQUAL(calls, 1);
+    CU_ASSERT_EQUAL(bytes, sizeof(int));
+}
+
+static int init(void)
+{
+    char *args[] = { "unittests", "-pisvc=s", "-pilog=stats_suite.log" };
+    int argc = 3;
+    char **argv = args;
+    PI_PROCESS *w;
+    PI_QuietMode = 1;
+    PI_OnErrorReturn = 1;
+
+    PI_Configure(&argc, &argv);
+
+    w = PI_CreateProcess(stats_worker, 0, NULL);
+    to_main = PI_CreateChannel(w, PI_MAIN);
+    from_main = PI_CreateChannel(PI_MAIN, w);
+    aside = PI_CreateChannel(w, PI_MAIN);
+    sel = PI_CreateBundle(PI_SELECT, &to_main, 1);
+    bro = PI_CreateBundle(PI_BROADCAST, &from_main, 1);
+
+    PI_StartAll();
+    running = 1;
+    return 0;
+}
+
+static int cleanup(void)
+{
+    if (PI_GetMyRank() == 0 && running)
+        PI_StopMain(0);
+    return 0;
+}
+
+CU_ErrorCode AddStatsSuite(void)
+{
+    CU_pSuite suite = CU_add_suite("Statistics Tests", init, cleanup);
+    if (suite == NULL)
+        return CU_get_error();
+
+    AddTest(suite, "PI_GetStats while running", test20a);
+    AddTest(suite, "report of calls, bytes and waits", test20b);
+
+    return CUE_SUCCESS;
+}
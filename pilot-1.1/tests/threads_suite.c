@@ -0,0 +1,236 @@
+/*
+Tests for running several Pilot processes on each MPI process as threads
+(-pithreads=3).  With N MPI processes, the workers are P1..PN+3, of which
+PN..PN+3 are threads on ranks 0..3, PN sharing rank 0 with main.
+
+Tests that:
+ - PI_Configure counts 3 processes per MPI process.
+ - a token passes along a chain of all the workers, both within and between
+   MPI processes.
+ - small and large messages go both ways between main and PN, which is a
+   thread on main's MPI process, and PI_GetName(NULL) names PN there; an
+   error PN makes sets its own PI_Errno, not main's.
+ - main can select from threads on different MPI processes.
+ - too many processes, and bundles with two processes on one MPI process,
+   are refused.
+*/
+#include "unittests.h"
+#include <stdio.h>
+#include <string.h>
+
+#define THREADS_ARG "-pithreads=3"
+#define BIGLEN 5000	/* 20000 bytes, more than PI_SHM_LARGE */
+#define TOKEN 1000
+
+static int numPilotProcs, worldsize, nworkers;
+static PI_CHANNEL **chain;	/* chain[q] goes into worker q, chain[nworkers] to main */
+static PI_CHANNEL **to_sel;	/* a worker's channel in the selector, or NULL */
+static PI_CHANNEL *to_echo, *from_echo;
+static PI_BUNDLE *selector;
+static int nselect, sel_sum;
+static int err_capacity, err_selranks, err_hubrank, err_selsame, err_self;
+
+int thread_worker(int q, void *p)
+{
+    int v, n, k, ok;
+    int *buf;
+    char name[PI_MAX_NAMELEN];
+
+    /* test15a: pass the token on, adding our index */
+    PI_Read(chain[q], "%d", &v);
+    PI_Write(chain[q + 1], "%d", v + q);
+
+    /* test15b: the worker on main's MPI process echoes */
+    if (q == worldsize - 1) {
+        buf = malloc(sizeof(int) * BIGLEN);
+        if (buf == NULL) return -1;
+        PI_Read(to_echo, "%d", &n);
+        PI_Write(from_echo, "%d", -n);
+        PI_Read(to_echo, "%d %*d", &n, BIGLEN, buf);
+        for (k = 0; k < BIGLEN; k++)
+            buf[k] += n;
+        PI_Write(from_echo, "%*d", BIGLEN, buf);
+        sprintf(name, "P%d", worldsize);
+        ok = strcmp(PI_GetName(NULL), name) == 0;
+        PI_Write(from_echo, "%d", ok);
+
+        /* an error here is only seen by this thread */
+        PI_Errno = 0;
+        PI_Write(NULL, "%d", 1);
+        PI_Write(from_echo, "%d", PI_Errno);
+        free(buf);
+    }
+
+    /* test15c: report our process no. to the selector */
+    if (to_sel[q])
+        PI_Write(to_sel[q], "%d", q + 1);
+    return 0;
+}
+
+void test15a(void)
+{
+    int v;
+
+    CU_ASSERT_EQUAL(numPilotProcs, 3 * worldsize);
+
+    PI_Write(chain[0], "%d", TOKEN);
+    PI_Read(chain[nworkers], "%d", &v);
+    CU_ASSERT_EQUAL(v, TOKEN + nworkers * (nworkers - 1) / 2);
+}
+
+void test15b(void)
+{
+    int n, k, ok;
+    int *buf = malloc(sizeof(int) * BIGLEN);
+
+    if (buf == NULL) {
+        CU_FAIL_FATAL("Unable to allocate memory for test15b");
+    }
+
+    PI_Write(to_echo, "%d", 42);
+    PI_Read(from_echo, "%d", &n);
+    CU_ASSERT_EQUAL(n, -42);
+
+    for (k = 0; k < BIGLEN; k++)
+        buf[k] = k;
+    PI_Write(to_echo, "%d %*d", 7, BIGLEN, buf);
+    PI_Read(from_echo, "%*d", BIGLEN, buf);
+    for (ok = 1, k = 0; k < BIGLEN; k++)
+        if (buf[k] != k + 7) ok = 0;
+    CU_ASSERT(ok);
+
+    PI_Read(from_echo, "%d", &ok);
+    CU_ASSERT(ok);
+
+    PI_Errno = 0;
+    PI_Read(from_echo, "%d", &n);
+    CU_ASSERT_EQUAL(n, PI_NULL_CHANNEL);
+    CU_ASSERT_EQUAL(PI_Errno, 0);	// main's own is untouched
+    free(buf);
+}
+
+void test15c(void)
+{
+    int i, n, sum = 0;
+
+    CU_ASSERT_PTR_NOT_NULL_FATAL(selector);
+    for (i = 0; i < nselect; i++) {
+        n = PI_Select(selector);
+        CU_ASSERT(n >= 0 && n < nselect);
+        if (n < 0 || n >= nselect) break;
+        PI_Read(PI_GetBundleChannel(selector, n), "%d", &n);
+        sum += n;
+    }
+    CU_ASSERT_EQUAL(sum, sel_sum);
+}
+
+void test15d(void)
+{
+    CU_ASSERT_EQUAL(err_capacity, PI_INSUFFICIENT_MPIPROCS);
+    CU_ASSERT_EQUAL(err_selranks, PI_BUNDLE_RANKS);
+    CU_ASSERT_EQUAL(err_hubrank, PI_BUNDLE_RANKS);
+    CU_ASSERT_EQUAL(err_selsame, PI_BUNDLE_DUPLICATE);
+    CU_ASSERT_EQUAL(err_self, PI_ENDPOINT_DUPLICATE);
+}
+
+static int init(void)
+{
+    char *args[] = { default_argv[0], THREADS_ARG };
+    int argc = 2;
+    char **argv = args;
+    int q, id;
+    PI_PROCESS **workers;
+    PI_CHANNEL *pair[2], **sel;
+    PI_QuietMode = 1;
+    PI_OnErrorReturn = 1;
+
+    numPilotProcs = PI_Configure(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &worldsize);
+
+    /* P1..PN-1 get ranks of their own, PN..PN+3 are threads on ranks 0..3 */
+    nworkers = worldsize + 3;
+    workers = PI_CreateProcessArray(thread_worker, nworkers, NULL);
+    chain = malloc(sizeof(PI_CHANNEL *) * (nworkers + 1));
+    to_sel = calloc(nworkers, sizeof(PI_CHANNEL *));
+    sel = malloc(sizeof(PI_CHANNEL *) * nworkers);
+    if (workers == NULL || chain == NULL || to_sel == NULL || sel == NULL)
+        return -1;
+
+    chain[0] = PI_CreateChannel(PI_MAIN, workers[0]);
+    for (q = 1; q < nworkers; q++)
+        chain[q] = PI_CreateChannel(workers[q - 1], workers[q]);
+    chain[nworkers] = PI_CreateChannel(workers[nworkers - 1], PI_MAIN);
+
+    to_echo = PI_CreateChannel(PI_MAIN, workers[worldsize - 1]);
+    from_echo = PI_CreateChannel(workers[worldsize - 1], PI_MAIN);
+
+    /* selector over P4..PN-1 and the threads PN+1..PN+3 on ranks 1..3 */
+    nselect = sel_sum = 0;
+    for (q = 0; q < nworkers; q++) {
+        id = q + 1;
+        if ((id >= 4 && id < worldsize) || id > worldsize) {
+            to_sel[q] = sel[nselect++] = PI_CreateChannel(workers[q], PI_MAIN);
+            sel_sum += id;
+        }
+    }
+    selector = PI_CreateBundle(PI_SELECT, sel, nselect);
+
+    /* one too many processes */
+    PI_Errno = 0;
+    PI_CreateProcessArray(thread_worker, numPilotProcs - nworkers, NULL);
+    err_capacity = PI_Errno;
+
+    /* P1 and PN+1 are both on rank 1 */
+    pair[0] = PI_CreateChannel(workers[0], PI_MAIN);
+    pair[1] = PI_CreateChannel(workers[worldsize], PI_MAIN);
+    PI_Errno = 0;
+    PI_CreateBundle(PI_SELECT, pair, 2);
+    err_selranks = PI_Errno;
+
+    /* main and PN are both on rank 0 */
+    pair[0] = PI_CreateChannel(PI_MAIN, workers[0]);
+    pair[1] = PI_CreateChannel(PI_MAIN, workers[worldsize - 1]);
+    PI_Errno = 0;
+    PI_CreateBundle(PI_BROADCAST, pair, 2);
+    err_hubrank = PI_Errno;
+
+    /* still a duplicate when it really is the same process */
+    pair[0] = PI_CreateChannel(workers[1], PI_MAIN);
+    pair[1] = PI_CreateChannel(workers[1], PI_MAIN);
+    PI_Errno = 0;
+    PI_CreateBundle(PI_SELECT, pair, 2);
+    err_selsame = PI_Errno;
+
+    PI_Errno = 0;
+    PI_CreateChannel(workers[worldsize], workers[worldsize]);
+    err_self = PI_Errno;
+    PI_Errno = 0;
+
+    free(workers);
+    free(sel);
+    PI_StartAll();
+    return 0;
+}
+
+static int cleanup(void)
+{
+    if (PI_GetMyRank() == 0)
+        PI_StopMain(0);
+    free(chain);
+    free(to_sel);
+    return 0;
+}
+
+CU_ErrorCode AddThreadsSuite(void)
+{
+    CU_pSuite suite = CU_add_suite("Threaded Process Tests", init, cleanup);
+    if (suite == NULL)
+        return CU_get_error();
+
+    AddTest(suite, "token chain", test15a);
+    AddTest(suite, "echo within MPI process", test15b);
+    AddTest(suite, "select from threads", test15c);
+    AddTest(suite, "threaded process errors", test15d);
+
+    return CUE_SUCCESS;
+}
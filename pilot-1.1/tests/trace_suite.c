@@ -0,0 +1,192 @@
+/*
+Tests for the timeline made by -pisvc=t, which the online process writes in
+Chrome's Trace Event format from the log once its times have been corrected.
+
+Tests that:
+ - each blocking write and read is a slice on its process's track, named by
+   the call and the channel, and lasts no less than a wait it was made to do.
+ - each write is joined to its read by an arrow with the same ID at both
+   ends, including non-blocking ones.
+ - the tracks are named after the processes, and PI_Log entries are instants.
+*/
+#include "unittests.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROUNDS 10
+#define TRACE "trace_suite.log.trace.json"
+#define DELAY 0.05		/* seconds the worker waits before its last write */
+
+/* IDs given in order of creation by init */
+#define PING 1
+#define PONG 2
+#define ASIDE 3
+
+static PI_CHANNEL *ping, *pong, *aside;
+static int running;
+
+int trace_worker(int q, void *p)
+{
+    int i, n;
+    double start;
+    PI_REQUEST *r;
+
+    for (i = 0; i < ROUNDS; i++) {
+        PI_Read(ping, "%d", &n);
+        PI_Write(pong, "%d", n);
+    }
+    r = PI_WriteAsync(aside, "%d", 1);
+    PI_Wait(&r);
+
+    start = MPI_Wtime();
+    while (MPI_Wtime() - start < DELAY)
+        ;
+    PI_Write(pong, "%d", -1);
+    return 0;
+}
+
+/* Counts the times pattern is found in s. */
+static int Count(const char *s, const char *pattern)
+{
+    int n = 0;
+
+    while ((s = strstr(s, pattern)) != NULL) {
+        n++;
+        s += strlen(pattern);
+    }
+    return n;
+}
+
+void test21a(void)
+{
+    int i, n;
+    PI_REQUEST *r;
+
+    PI_Log("pinging");
+    for (i = 0; i < ROUNDS; i++) {
+        PI_Write(ping, "%d", i);
+        PI_Read(pong, "%d", &n);
+        CU_ASSERT_EQUAL(n, i);
+    }
+    r = PI_ReadAsync(aside, "%d", &n);
+    PI_Wait(&r);
+    CU_ASSERT_EQUAL(n, 1);
+    PI_Read(pong, "%d", &n);		// waits DELAY for this
+    CU_ASSERT_EQUAL(n, -1);
+}
+
+void test21b(void)
+{
+    char *trace, pattern[80], *at;
+    long size, dur, longest = 0;
+    FILE *f;
+    int i;
+
+    /* the timeline is only made once everyone has finished */
+    PI_StopMain(0);
+    running = 0;
+
+    f = fopen(TRACE, "r");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(f);
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+    trace = malloc(size + 1);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(trace);
+    size = fread(trace, 1, size, f);
+    trace[size] = '\0';
+    fclose(f);
+    remove(TRACE);
+    remove("trace_suite.log");
+
+    CU_ASSERT(strncmp(trace, "{\"displayTimeUnit\"", 18) == 0);
+    CU_ASSERT(strcmp(trace + size - 4, "\n]}\n") == 0);
+
+    /* tracks for main and the worker, each on its own MPI process */
+    CU_ASSERT_EQUAL(Count(trace, "\"thread_name\""), 2);
+    CU_ASSERT_EQUAL(Count(trace, "\"args\": {\"name\": \"worker\"}"), 1);
+    CU_ASSERT_EQUAL(Count(trace, "\"name\": \"pinging\", \"ph\": \"i\""), 1);
+
+    /* a slice at each end of every message */
+    CU_ASSERT_EQUAL(Count(trace, "\"name\": \"Wri ping\", \"ph\": \"X\""), ROUNDS);
+    CU_ASSERT_EQUAL(Count(trace, "\"name\": \"Rea ping\", \"ph\": \"X\""), ROUNDS);
+    CU_ASSERT_EQUAL(Count(trace, "\"name\": \"Wri pong\", \"ph\": \"X\""), ROUNDS + 1);
+    CU_ASSERT_EQUAL(Count(trace, "\"name\": \"Rea pong\", \"ph\": \"X\""), ROUNDS + 1);
+    CU_ASSERT_EQUAL(Count(trace, "\"name\": \"Awr aside\", \"ph\": \"X\""), 1);
+    CU_ASSERT_EQUAL(Count(trace, "\"name\": \"Ard aside\", \"ph\": \"X\""), 1);
+
+    /* the longest read of pong is the one that waited */
+    at = trace;
+    while ((at = strstr(at, "\"name\": \"Rea pong\", \"ph\": \"X\"")) != NULL) {
+        at = strstr(at, "\"dur\": ");
+        CU_ASSERT_PTR_NOT_NULL_FATAL(at);
+        dur = atol(at + 7);
+        if (dur > longest) longest = dur;
+    }
+    CU_ASSERT(longest >= DELAY / 2 * 1000000);	// main starts reading a little late
+
+    /* an arrow from each write to its read */
+    CU_ASSERT_EQUAL(Count(trace, "\"ph\": \"s\""), 2 * ROUNDS + 2);
+    CU_ASSERT_EQUAL(Count(trace, "\"ph\": \"f\""), 2 * ROUNDS + 2);
+    for (i = 1; i <= ROUNDS; i++) {
+        sprintf(pattern, "\"ph\": \"s\", \"id\": \"%d.%d\"", PING, i);
+        CU_ASSERT_EQUAL(Count(trace, pattern), 1);
+        sprintf(pattern, "\"ph\": \"f\", \"bp\": \"e\", \"id\": \"%d.%d\"", PING, i);
+        CU_ASSERT_EQUAL(Count(trace, pattern), 1);
+    }
+    sprintf(pattern, "\"ph\": \"s\", \"id\": \"%d.%d\"", PONG, ROUNDS + 1);
+    CU_ASSERT_EQUAL(Count(trace, pattern), 1);
+    sprintf(pattern, "\"ph\": \"f\", \"bp\": \"e\", \"id\": \"%d.%d\"", PONG, ROUNDS + 1);
+    CU_ASSERT_EQUAL(Count(trace, pattern), 1);
+    sprintf(pattern, "\"ph\": \"s\", \"id\": \"%d.1\"", ASIDE);
+    CU_ASSERT_EQUAL(Count(trace, pattern), 1);
+    sprintf(pattern, "\"ph\": \"f\", \"bp\": \"e\", \"id\": \"%d.1\"", ASIDE);
+    CU_ASSERT_EQUAL(Count(trace, pattern), 1);
+
+    free(trace);
+}
+
+static int init(void)
+{
+    char *args[] = { "unittests", "-pisvc=t", "-pilog=trace_suite.log" };
+    int argc = 3;
+    char **argv = args;
+    PI_PROCESS *w;
+    PI_QuietMode = 1;
+    PI_OnErrorReturn = 1;
+
+    PI_Configure(&argc, &argv);
+
+    w = PI_CreateProcess(trace_worker, 0, NULL);
+    PI_SetName(w, "worker");
+    ping = PI_CreateChannel(PI_MAIN, w);
+    PI_SetName(ping, "ping");
+    pong = PI_CreateChannel(w, PI_MAIN);
+    PI_SetName(pong, "pong");
+    aside = PI_CreateChannel(w, PI_MAIN);
+    PI_SetName(aside, "aside");
+
+    PI_StartAll();
+    running = 1;
+    return 0;
+}
+
+static int cleanup(void)
+{
+    if (PI_GetMyRank() == 0 && running)
+        PI_StopMain(0);
+    return 0;
+}
+
+CU_ErrorCode AddTraceSuite(void)
+{
+    CU_pSuite suite = CU_add_suite("Trace Tests", init, cleanup);
+    if (suite == NULL)
+        return CU_get_error();
+
+    AddTest(suite, "calls and messages while running", test21a);
+    AddTest(suite, "timeline of slices and arrows", test21b);
+
+    return CUE_SUCCESS;
+}
@@ -44,5 +44,17 @@ CU_ErrorCode AddGathererSuite(void);
 CU_ErrorCode AddExtraReadWriteSuite(void);
 CU_ErrorCode AddFormatSuite(void);
 CU_ErrorCode AddInitSuite(void);
+CU_ErrorCode AddAsyncSuite(void);
+CU_ErrorCode AddPersistentSuite(void);
+CU_ErrorCode AddReducerSuite(void);
+CU_ErrorCode AddScattererSuite(void);
+CU_ErrorCode AddShmSuite(void);
+CU_ErrorCode AddThreadsSuite(void);
+CU_ErrorCode AddCoroSuite(void);
+CU_ErrorCode AddRmaSuite(void);
+CU_ErrorCode AddBufferedSuite(void);
+CU_ErrorCode AddLoggingSuite(void);
+CU_ErrorCode AddStatsSuite(void);
+CU_ErrorCode AddTraceSuite(void);
 
 #endif /* UNITTESTS_H */
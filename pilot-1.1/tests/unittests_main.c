@@ -23,18 +23,31 @@ static SuiteRegisterFunc suites[] = {
     AddGathererSuite,
     AddExtraReadWriteSuite,
     AddFormatSuite,
+    AddAsyncSuite,
+    AddPersistentSuite,
+    AddReducerSuite,
+    AddScattererSuite,
+    AddShmSuite,
+    AddThreadsSuite,
+    AddCoroSuite,
+    AddRmaSuite,
+    AddBufferedSuite,
+    AddLoggingSuite,
+    AddStatsSuite,
+    AddTraceSuite,
 
     NULL,
 };
 
 int main(int argc, char* argv[])
 {
-    int rank, numProcs;
+    int rank, numProcs, provided;
     int i;
     CU_ErrorCode err = CUE_SUCCESS;
 
-    // Calling MPI_Init will put Pilot into "Bench Mode".
-    MPI_Init(&argc, &argv);
+    // Calling MPI_Init will put Pilot into "Bench Mode".  Threads are needed
+    // by the suite that runs Pilot processes as threads.
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &numProcs);
 
@@ -90,6 +90,35 @@
 		free($1);
 }
 
+%typemap(in) (const int weights[]) {
+  if ($input == Py_None) {
+    $1 = NULL;
+  } else if (PyList_Check($input)) {
+    int size = PyList_Size($input);
+    int i = 0;
+    $1 = (int*) malloc((size+1)*sizeof(int));
+    for (i = 0; i < size; ++i) {
+      PyObject *o = PyList_GetItem($input,i);
+      if (PyInt_Check(o))
+        $1[i] = (int) PyInt_AsLong(o);
+      else {
+        PyErr_SetString(PyExc_TypeError, "list must contain integers");
+        free($1);
+        return NULL;
+      }
+    }
+    $1[i] = 0;
+  } else {
+    PyErr_SetString(PyExc_TypeError,"not a list");
+    return NULL;
+  }
+}
+
+%typemap(freearg) (const int weights[]) {
+	if($1)
+		free((int*)$1);
+}
+
 %rename(PI_Configure_) wrap_PI_Configure;
 %rename(PI_Write_) PI_WriteVarArgs;
 %rename(PI_Read_) PI_ReadItem;
@@ -105,6 +134,19 @@
 %ignore PI_Broadcast_;
 %ignore PI_Gather_;
 %ignore PI_CreateProcess_;
+%ignore PI_WriteF_;
+%ignore PI_ReadF_;
+%ignore PI_WriteAsync_;
+%ignore PI_ReadAsync_;
+%ignore PI_CreatePersistentWrite_;
+%ignore PI_CreatePersistentRead_;
+%ignore PI_Reduce_;
+%ignore PI_Scatter_;
+%ignore PI_Gatherv_;
+%ignore PI_GatherNext_;
+%ignore PI_CreateOp_;
+%ignore PI_CreateProcessArray_;
+%ignore PI_CreateChannelArray_;
 
 %{
 #include "pilot.h"
@@ -24,6 +24,9 @@ MAIN = None
 BROADCAST = _pylot.PI_BROADCAST
 GATHER = _pylot.PI_GATHER
 SELECT = _pylot.PI_SELECT
+SELECT_FIFO = _pylot.PI_SELECT_FIFO
+SELECT_ROUND_ROBIN = _pylot.PI_SELECT_ROUND_ROBIN
+SELECT_PRIORITY = _pylot.PI_SELECT_PRIORITY
 SAME = _pylot.PI_SAME
 REVERSE = _pylot.PI_REVERSE
 
@@ -46,8 +49,17 @@ def configure(argv=_sys.argv):
 
 createProcess = _StackTrace(_pylot.PI_CreateProcess_)
 createChannel = _StackTrace(_pylot.PI_CreateChannel_)
+createBufferedChannel = _StackTrace(_pylot.PI_CreateBufferedChannel_)
 createBundle = _StackTrace(_pylot.PI_CreateBundle_)
 copyChannels = _StackTrace(_pylot.PI_CopyChannels_)
+@_StackTrace
+def setSelectPolicy(bundle, policy, weights=None):
+	# the C side reads one weight per channel, so a short list would overrun
+	if weights is not None and len(weights) != _pylot.PI_GetBundleSize_(bundle):
+		raise ValueError("weights must have one entry per channel of the bundle")
+	_pylot.PI_SetSelectPolicy_(bundle, policy, weights)
+
+setRMA = _StackTrace(_pylot.PI_SetRMA_)
 getName = _StackTrace(_pylot.PI_GetName_)
 setName = _StackTrace(_pylot.PI_SetName_)
 startAll = _StackTrace(_pylot.PI_StartAll_)
@@ -65,6 +77,13 @@ startTime = _pylot.PI_StartTime
 endTime = _pylot.PI_EndTime
 log = _StackTrace(_pylot.PI_Log_)
 isLogging = _pylot.PI_IsLogging
+
+@_StackTrace
+def getStats(object):
+	stats = _pylot.PI_STATS()
+	_pylot.PI_GetStats_(object, stats)
+	return stats
+
 abort = _pylot.PI_Abort
 
 write = _StackTrace(_pylot.PI_Write_)